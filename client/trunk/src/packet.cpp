@@ -112,7 +112,7 @@ bool Packet::read(QTcpSocket *sock) {
 		return false;
 	}
 	
-	m_Size=(m_Buffer[0] | (m_Buffer[1] >> 8));
+	m_Size=(m_Buffer[0] | (m_Buffer[1] << 8));
 	if (m_Size<=0) {
 		qDebug() << "Corrupt packet size: " << m_Size;
 		return false;
@@ -129,7 +129,7 @@ bool Packet::read(QTcpSocket *sock) {
 
 bool Packet::write(QTcpSocket *sock) {
 	m_Buffer[0]=m_Size;
-	m_Buffer[1]=(m_Size << 8);
+	m_Buffer[1]=(m_Size >> 8);
 	
 	int n, bytes=0, remaining=m_Size+2;
 	while(bytes<remaining) {
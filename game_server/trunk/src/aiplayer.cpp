@@ -19,7 +19,273 @@
  ***************************************************************************/
 // aiplayer.cpp: implementation of the AIPlayer class.
 
+#include <vector>
+
 #include "aiplayer.h"
+#include "board.h"
+#include "utilities.h"
+
+AIPlayer::AIPlayer(const std::string &username): Player(username, ComputerPlayer) {
+	m_Search=NULL;
+}
+
+AIPlayer::~AIPlayer() {
+	if (m_Search) {
+		m_Search->cancel();
+		m_Search->release();
+	}
+}
+
+void AIPlayer::think(const Game &game, int seat, uint32_t seed) {
+	if (m_Search) {
+		m_Search->cancel();
+		m_Search->release();
+	}
+
+	m_Search=new Search(game, seat, seed);
+	listMoves(m_Search);
+
+	// with nothing to choose between, decide() leaves the default move to the room
+	if (m_Search->m_NumMoves<2)
+		return;
+
+	// queue the first batch of every move before the second of any, so that moves
+	// get an even share of the budget if it runs out
+	std::vector<TaskPool::Task*> tasks;
+	for (int i=0; i<AI_BATCHES; i++) {
+		for (int j=0; j<m_Search->m_NumMoves; j++)
+			tasks.push_back(new Rollout(m_Search, j, i));
+	}
+
+	TaskPool::instance()->submit(tasks);
+}
+
+bool AIPlayer::decide(Game::Action &action, int &arg, int &amount) {
+	if (!m_Search)
+		return false;
+
+	m_Search->cancel();
+
+	int best=m_Search->getBest();
+	if (best!=-1) {
+		const Move &move=m_Search->m_Moves[best];
+		action=move.action;
+		arg=move.arg;
+		amount=move.amount;
+	}
+
+	m_Search->release();
+	m_Search=NULL;
+
+	return (best!=-1);
+}
+
+void AIPlayer::listMoves(Search *search) {
+	const Game &game=search->m_Game;
+	int seat=search->m_Seat;
+	const Game::PlayerState &player=game.getPlayer(seat);
+
+	switch(game.getStage()) {
+		case Game::Rolling: {
+			// only a player in jail has a choice to make before rolling
+			if (!player.inJail)
+				break;
+
+			search->addMove(Game::Roll);
+			if (player.money>=Board::BailFee)
+				search->addMove(Game::PayBail);
+			if (player.jailCards)
+				search->addMove(Game::UseJailCard);
+		} break;
+
+		case Game::Buying: {
+			if (player.money>=Board::Spaces[game.getOffer()].price)
+				search->addMove(Game::Buy);
+			search->addMove(Game::Decline);
+		} break;
+
+		case Game::Auctioning: {
+			int price=Board::Spaces[game.getOffer()].price;
+			int raise=game.getHighBid()+10;
+
+			// drop out, raise a little, or go straight to the printed price
+			search->addMove(Game::Pass);
+			if (raise<=player.money)
+				search->addMove(Game::Bid, 0, raise);
+			if (price>raise && price<=player.money)
+				search->addMove(Game::Bid, 0, price);
+		} break;
+
+		case Game::Owing: {
+			// there is nothing to gain from raising more money than is owed
+			if (player.money>=game.getDebt()) {
+				search->addMove(Game::PayDebt);
+				break;
+			}
+
+			for (int i=0; i<BOARD_SPACES; i++) {
+				if (game.canMortgage(seat, i))
+					search->addMove(Game::Mortgage, i);
+				if (game.canSell(seat, i))
+					search->addMove(Game::Sell, i);
+			}
+
+			if (!search->m_NumMoves)
+				search->addMove(Game::DeclareBankrupt);
+		} break;
+
+		case Game::Ending: {
+			search->addMove(Game::EndTurn);
+
+			for (int i=0; i<BOARD_SPACES; i++) {
+				if (game.canBuild(seat, i))
+					search->addMove(Game::Build, i);
+				if (game.canUnmortgage(seat, i))
+					search->addMove(Game::Unmortgage, i);
+			}
+		} break;
+
+		// income tax is simple arithmetic, which the default move gets right
+		default: break;
+	}
+}
+
+double AIPlayer::score(const Game &game, int seat) {
+	if (game.getStage()==Game::Over)
+		return (game.getWinner()==seat ? 1.0 : 0.0);
+
+	if (game.getPlayer(seat).bankrupt)
+		return 0.0;
+
+	int total=0;
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		if (!game.getPlayer(i).bankrupt)
+			total+=game.getWorth(i);
+	}
+
+	return (total>0 ? (double) game.getWorth(seat)/total : 0.0);
+}
+
+AIPlayer::Search::Search(const Game &game, int seat, uint32_t seed): m_Game(game) {
+	m_Game.clearEvents();
+	m_Game.setQuiet(true);
+
+	m_Seat=seat;
+	m_Seed=seed;
+	m_NumMoves=0;
+	m_Deadline=Util::milliseconds()+AI_BUDGET;
+	m_Cancelled=false;
+	m_Refs=1;
+}
+
+void AIPlayer::Search::hold() {
+	lock();
+	m_Refs++;
+	unlock();
+}
+
+void AIPlayer::Search::release() {
+	lock();
+	bool last=(--m_Refs==0);
+	unlock();
+
+	if (last)
+		delete this;
+}
+
+void AIPlayer::Search::cancel() {
+	lock();
+	m_Cancelled=true;
+	unlock();
+}
+
+bool AIPlayer::Search::isLive() {
+	lock();
+	bool live=!m_Cancelled;
+	unlock();
+
+	return (live && Util::milliseconds()<m_Deadline);
+}
+
+void AIPlayer::Search::addMove(const Game::Action &action, int arg, int amount) {
+	if (m_NumMoves==AI_MAX_MOVES)
+		return;
+
+	Move &move=m_Moves[m_NumMoves];
+	move.action=action;
+	move.arg=arg;
+	move.amount=amount;
+
+	m_Scores[m_NumMoves]=0.0;
+	m_Runs[m_NumMoves]=0;
+	m_NumMoves++;
+}
+
+void AIPlayer::Search::record(int move, double score, int count) {
+	lock();
+	m_Scores[move]+=score;
+	m_Runs[move]+=count;
+	unlock();
+}
+
+int AIPlayer::Search::getBest() {
+	if (m_NumMoves<2)
+		return m_NumMoves-1;
+
+	lock();
+
+	int best=-1;
+	double bestMean=-1.0;
+	for (int i=0; i<m_NumMoves; i++) {
+		if (!m_Runs[i])
+			continue;
+
+		double mean=m_Scores[i]/m_Runs[i];
+		if (mean>bestMean) {
+			best=i;
+			bestMean=mean;
+		}
+	}
+
+	unlock();
+
+	return best;
+}
+
+AIPlayer::Rollout::Rollout(Search *search, int move, int batch) {
+	m_Search=search;
+	m_Move=move;
+	m_Batch=batch;
+
+	m_Search->hold();
+}
+
+AIPlayer::Rollout::~Rollout() {
+	m_Search->release();
+}
+
+void AIPlayer::Rollout::run() {
+	const Move &move=m_Search->m_Moves[m_Move];
+	int seat=m_Search->m_Seat;
+
+	double total=0.0;
+	int count=0;
+	for (int i=0; i<AI_BATCH_SIZE && m_Search->isLive(); i++) {
+		// the game copy is quiet already, and never shares dice with the real game
+		Game game(m_Search->m_Game);
+		game.seed(m_Search->m_Seed+m_Batch*AI_BATCH_SIZE+i);
+
+		if (!game.act(seat, move.action, move.arg, move.amount))
+			return;
+
+		int end=game.getRound()+AI_ROLLOUT_ROUNDS;
+		for (int j=0; j<AI_ROLLOUT_STEPS && game.getStage()!=Game::Over && game.getRound()<end; j++)
+			game.playDefault();
+
+		total+=score(game, seat);
+		count++;
+	}
 
-AIPlayer::AIPlayer(const std::string &username): Player(username) {
+	if (count)
+		m_Search->record(m_Move, total, count);
 }
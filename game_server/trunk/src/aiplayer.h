@@ -23,18 +23,216 @@
 #define AIPLAYER_H
 
 #include <iostream>
+#include <stdint.h>
 
+#include "game.h"
+#include "lockable.h"
 #include "player.h"
+#include "taskpool.h"
 
-// TODO: stub class for computer controlled players
+/// Milliseconds a computer player may spend weighing a decision.
+#define AI_BUDGET		50
+/// Most moves a computer player weighs against each other.
+#define AI_MAX_MOVES		64
+/// Batches of rollouts run for each move.
+#define AI_BATCHES		4
+/// Rollouts in each batch.
+#define AI_BATCH_SIZE		16
+/// Rounds each rollout plays ahead.
+#define AI_ROLLOUT_ROUNDS	3
+/// Most decisions a rollout makes, in case the game stalls.
+#define AI_ROLLOUT_STEPS	1000
+
+/**
+ * A computer controlled player.
+ * When the game waits on a computer player, it lists the moves open to it and weighs
+ * them with Monte-Carlo rollouts: each move is made on a private copy of the game,
+ * which is then played a few rounds ahead using the default strategy for everyone, and
+ * the outcome is scored by the player's share of the wealth at the table. Every move
+ * sees the same dice in its n-th rollout, so luck does not decide between them.
+ * The rollouts run on the TaskPool while the room waits out its delay for computer
+ * players, so the room's worker is never held up. Rollouts that have not run by the
+ * end of the time budget are dropped, and a busy server makes rougher decisions
+ * instead of slower ones.
+ */
 class AIPlayer: public Player {
 	public:
+		/**
+		 * Creates a computer player.
+		 *
+		 * @param username The name shown for the player.
+		 */
 		AIPlayer(const std::string &username);
 
+		/// Drops any decision still being weighed.
+		~AIPlayer();
+
 		/**
-		 * Returns the runtime type identifier for this object.
+		 * Starts weighing the moves open to this player, replacing any earlier search.
+		 *
+		 * @param game The game, which is waiting on this player.
+		 * @param seat The player's seat.
+		 * @param seed Seed for the rollouts' dice.
 		 */
-		virtual std::string rtti() const { return "AIPlayer"; }
+		void think(const Game &game, int seat, uint32_t seed);
+
+		/**
+		 * Ends the search started by think() and picks the best move found.
+		 *
+		 * @param action The action to take.
+		 * @param arg The space for property actions.
+		 * @param amount The amount for bids.
+		 * @return true if a move was picked, false if the default move should be made.
+		 */
+		bool decide(Game::Action &action, int &arg, int &amount);
+
+	private:
+		/// A move open to the player.
+		struct Move {
+			/// The action.
+			Game::Action action;
+
+			/// The space the action applies to.
+			int arg;
+
+			/// The amount bid.
+			int amount;
+		};
+
+		/// The moves for one decision, and how well they have done so far.
+		class Search: public Lockable {
+			public:
+				/**
+				 * Creates a search with no moves, held once by the caller.
+				 *
+				 * @param game The game to take a copy of.
+				 * @param seat The seat of the player deciding.
+				 * @param seed Seed for the first rollout of every move.
+				 */
+				Search(const Game &game, int seat, uint32_t seed);
+
+				/// Adds a reference to the search.
+				void hold();
+
+				/// Drops a reference to the search, deleting it once no references are left.
+				void release();
+
+				/// Stops any more rollouts from being run.
+				void cancel();
+
+				/**
+				 * Checks if rollouts should still be run.
+				 *
+				 * @return true if the search is neither cancelled nor out of time.
+				 */
+				bool isLive();
+
+				/**
+				 * Adds a move to be weighed, if there is room for it.
+				 *
+				 * @param action The action.
+				 * @param arg The space the action applies to.
+				 * @param amount The amount bid.
+				 */
+				void addMove(const Game::Action &action, int arg=0, int amount=0);
+
+				/**
+				 * Adds up the scores of some rollouts.
+				 *
+				 * @param move The move that was made.
+				 * @param score The sum of the scores.
+				 * @param count The number of rollouts.
+				 */
+				void record(int move, double score, int count);
+
+				/**
+				 * Picks the move with the best average score.
+				 *
+				 * @return The move's index, or -1 if there is nothing to choose from.
+				 */
+				int getBest();
+
+				/// The game as it was when the search began.
+				Game m_Game;
+
+				/// The seat of the player deciding.
+				int m_Seat;
+
+				/// Seed for the first rollout of every move.
+				uint32_t m_Seed;
+
+				/// The moves being weighed.
+				Move m_Moves[AI_MAX_MOVES];
+
+				/// The number of moves.
+				int m_NumMoves;
+
+			private:
+				/// Sum of the scores of each move's rollouts.
+				double m_Scores[AI_MAX_MOVES];
+
+				/// Number of rollouts run for each move.
+				int m_Runs[AI_MAX_MOVES];
+
+				/// When rollouts stop being run, in milliseconds.
+				uint64_t m_Deadline;
+
+				/// Whether the decision has been made.
+				bool m_Cancelled;
+
+				/// The number of references to the search.
+				int m_Refs;
+		};
+
+		/// A batch of rollouts for one move.
+		class Rollout: public TaskPool::Task {
+			public:
+				/**
+				 * Creates a batch, which holds on to the search.
+				 *
+				 * @param search The search.
+				 * @param move The move to make.
+				 * @param batch The batch's position, which picks the dice it sees.
+				 */
+				Rollout(Search *search, int move, int batch);
+
+				/// Lets go of the search.
+				~Rollout();
+
+				/// Plays the rollouts and records their scores.
+				void run();
+
+			private:
+				/// The search.
+				Search *m_Search;
+
+				/// The move to make.
+				int m_Move;
+
+				/// The batch's position.
+				int m_Batch;
+		};
+
+	private:
+		/**
+		 * Lists the moves worth weighing in the game's current state.
+		 *
+		 * @param search The search to add the moves to.
+		 */
+		static void listMoves(Search *search);
+
+		/**
+		 * Scores the outcome of a rollout for a player.
+		 *
+		 * @param game The game, after the rollout.
+		 * @param seat The player's seat.
+		 * @return 1 for a win, 0 for bankruptcy, otherwise the player's share of the
+		 * total worth of the players still in the game.
+		 */
+		static double score(const Game &game, int seat);
+
+		/// The decision being weighed, or NULL.
+		Search *m_Search;
 };
 
 #endif
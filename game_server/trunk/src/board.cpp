@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// board.cpp: definition of the board data.
+
+#include "board.h"
+
+using namespace Board;
+
+const Space Board::Spaces[BOARD_SPACES]={
+	{ Go, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Go
+	{ Street, 0, 60, 50, { 2, 10, 30, 90, 160, 250 } },	// Mediterranean Avenue
+	{ Chest, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Community Chest
+	{ Street, 0, 60, 50, { 4, 20, 60, 180, 320, 450 } },	// Baltic Avenue
+	{ IncomeTax, NoGroup, 200, 0, { 0, 0, 0, 0, 0, 0 } },	// Income Tax
+	{ Railroad, RailroadGroup, 200, 0, { 25, 50, 100, 200, 0, 0 } },	// Reading Railroad
+	{ Street, 1, 100, 50, { 6, 30, 90, 270, 400, 550 } },	// Oriental Avenue
+	{ Chance, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Chance
+	{ Street, 1, 100, 50, { 6, 30, 90, 270, 400, 550 } },	// Vermont Avenue
+	{ Street, 1, 120, 50, { 8, 40, 100, 300, 450, 600 } },	// Connecticut Avenue
+	{ Jail, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Jail
+	{ Street, 2, 140, 100, { 10, 50, 150, 450, 625, 750 } },	// St. Charles Place
+	{ Utility, UtilityGroup, 150, 0, { 4, 10, 0, 0, 0, 0 } },	// Electric Company
+	{ Street, 2, 140, 100, { 10, 50, 150, 450, 625, 750 } },	// States Avenue
+	{ Street, 2, 160, 100, { 12, 60, 180, 500, 700, 900 } },	// Virginia Avenue
+	{ Railroad, RailroadGroup, 200, 0, { 25, 50, 100, 200, 0, 0 } },	// Pennsylvania Railroad
+	{ Street, 3, 180, 100, { 14, 70, 200, 550, 750, 950 } },	// St. James Place
+	{ Chest, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Community Chest
+	{ Street, 3, 180, 100, { 14, 70, 200, 550, 750, 950 } },	// Tennessee Avenue
+	{ Street, 3, 200, 100, { 16, 80, 220, 600, 800, 1000 } },	// New York Avenue
+	{ FreeParking, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Free Parking
+	{ Street, 4, 220, 150, { 18, 90, 250, 700, 875, 1050 } },	// Kentucky Avenue
+	{ Chance, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Chance
+	{ Street, 4, 220, 150, { 18, 90, 250, 700, 875, 1050 } },	// Indiana Avenue
+	{ Street, 4, 240, 150, { 20, 100, 300, 750, 925, 1100 } },	// Illinois Avenue
+	{ Railroad, RailroadGroup, 200, 0, { 25, 50, 100, 200, 0, 0 } },	// B. & O. Railroad
+	{ Street, 5, 260, 150, { 22, 110, 330, 800, 975, 1150 } },	// Atlantic Avenue
+	{ Street, 5, 260, 150, { 22, 110, 330, 800, 975, 1150 } },	// Ventnor Avenue
+	{ Utility, UtilityGroup, 150, 0, { 4, 10, 0, 0, 0, 0 } },	// Water Works
+	{ Street, 5, 280, 150, { 24, 120, 360, 850, 1025, 1200 } },	// Marvin Gardens
+	{ GoToJail, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Go To Jail
+	{ Street, 6, 300, 200, { 26, 130, 390, 900, 1100, 1275 } },	// Pacific Avenue
+	{ Street, 6, 300, 200, { 26, 130, 390, 900, 1100, 1275 } },	// North Carolina Avenue
+	{ Chest, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Community Chest
+	{ Street, 6, 320, 200, { 28, 150, 450, 1000, 1200, 1400 } },	// Pennsylvania Avenue
+	{ Railroad, RailroadGroup, 200, 0, { 25, 50, 100, 200, 0, 0 } },	// Short Line
+	{ Chance, NoGroup, 0, 0, { 0, 0, 0, 0, 0, 0 } },	// Chance
+	{ Street, 7, 350, 200, { 35, 175, 500, 1100, 1300, 1500 } },	// Park Place
+	{ LuxuryTax, NoGroup, 100, 0, { 0, 0, 0, 0, 0, 0 } },	// Luxury Tax
+	{ Street, 7, 400, 200, { 50, 200, 600, 1400, 1700, 2000 } }	// Boardwalk
+};
+
+const Card Board::Cards[2][BOARD_DECK_SIZE]={
+	// chance
+	{
+		{ CardAdvance, GoSpace, 0 },		// advance to Go
+		{ CardAdvance, 24, 0 },			// advance to Illinois Avenue
+		{ CardAdvance, 11, 0 },			// advance to St. Charles Place
+		{ CardNearestUtility, 0, 0 },		// advance to the nearest utility
+		{ CardNearestRailroad, 0, 0 },		// advance to the nearest railroad
+		{ CardNearestRailroad, 0, 0 },		// advance to the nearest railroad
+		{ CardMoney, 50, 0 },			// bank pays you a dividend
+		{ CardJailFree, 0, 0 },			// get out of jail free
+		{ CardBack, 3, 0 },			// go back three spaces
+		{ CardGoToJail, 0, 0 },			// go to jail
+		{ CardRepairs, 25, 100 },		// general repairs on all your property
+		{ CardMoney, -15, 0 },			// speeding fine
+		{ CardAdvance, 5, 0 },			// take a trip to Reading Railroad
+		{ CardAdvance, 39, 0 },			// advance to Boardwalk
+		{ CardPayEach, 50, 0 },			// elected chairman of the board
+		{ CardMoney, 150, 0 }			// building loan matures
+	},
+
+	// community chest
+	{
+		{ CardAdvance, GoSpace, 0 },		// advance to Go
+		{ CardMoney, 200, 0 },			// bank error in your favor
+		{ CardMoney, -50, 0 },			// doctor's fee
+		{ CardMoney, 50, 0 },			// sale of stock
+		{ CardJailFree, 0, 0 },			// get out of jail free
+		{ CardGoToJail, 0, 0 },			// go to jail
+		{ CardMoney, 100, 0 },			// holiday fund matures
+		{ CardMoney, 20, 0 },			// income tax refund
+		{ CardCollectEach, 10, 0 },		// it is your birthday
+		{ CardMoney, 100, 0 },			// life insurance matures
+		{ CardMoney, -100, 0 },			// hospital fees
+		{ CardMoney, -50, 0 },			// school fees
+		{ CardMoney, 25, 0 },			// consultancy fee
+		{ CardRepairs, 40, 115 },		// street repairs
+		{ CardMoney, 10, 0 },			// second prize in a beauty contest
+		{ CardMoney, 100, 0 }			// you inherit
+	}
+};
+
+const uint64_t Board::GroupMask[BOARD_GROUPS]={
+	0x000000000aULL,	// 1, 3
+	0x0000000340ULL,	// 6, 8, 9
+	0x0000006800ULL,	// 11, 13, 14
+	0x00000d0000ULL,	// 16, 18, 19
+	0x0001a00000ULL,	// 21, 23, 24
+	0x002c000000ULL,	// 26, 27, 29
+	0x0580000000ULL,	// 31, 32, 34
+	0xa000000000ULL,	// 37, 39
+	0x0802008020ULL,	// 5, 15, 25, 35
+	0x0010001000ULL	// 12, 28
+};
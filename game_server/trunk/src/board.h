@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// board.h: definition of the game board and its cards.
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+
+/// Spaces on the board.
+#define BOARD_SPACES		40
+
+/// Cards in each of the Chance and Community Chest decks.
+#define BOARD_DECK_SIZE		16
+
+/// Color groups, plus the railroads and the utilities.
+#define BOARD_GROUPS		10
+
+namespace Board {
+
+/// Kinds of spaces on the board.
+enum SpaceType { Go=0, Street, Railroad, Utility, Chance, Chest, IncomeTax, LuxuryTax, Jail, FreeParking, GoToJail };
+
+/// Group numbers of the railroads and the utilities.
+enum { RailroadGroup=8, UtilityGroup=9, NoGroup=0xFF };
+
+/// Well known positions.
+enum { GoSpace=0, JailSpace=10, FreeParkingSpace=20, GoToJailSpace=30 };
+
+/// Static description of a board space.
+struct Space {
+	/// What kind of space this is.
+	uint8_t type;
+
+	/// The group the space belongs to, or NoGroup.
+	uint8_t group;
+
+	/// The purchase price, or the tax for tax spaces.
+	uint16_t price;
+
+	/// The price of a house.
+	uint16_t houseCost;
+
+	/// Rent with no houses, one to four houses, and a hotel.
+	uint16_t rent[6];
+};
+
+/// The two card decks.
+enum Deck { ChanceDeck=0, ChestDeck };
+
+/// Effects of drawing a card.
+enum CardType {
+	CardMoney=0,		// receive arg from the bank, or pay it if negative
+	CardAdvance,		// advance to space arg, collecting salary when passing Go
+	CardNearestRailroad,	// advance to the next railroad and pay double rent
+	CardNearestUtility,	// advance to the next utility and pay ten times the dice
+	CardBack,		// go back arg spaces
+	CardGoToJail,		// go directly to jail
+	CardJailFree,		// keep until needed to get out of jail
+	CardRepairs,		// pay arg per house and arg2 per hotel
+	CardPayEach,		// pay arg to every other player
+	CardCollectEach		// collect arg from every other player
+};
+
+/// Static description of a card.
+struct Card {
+	/// What the card does.
+	uint8_t type;
+
+	/// The amount or space the card refers to.
+	int16_t arg;
+
+	/// Secondary amount, used by repairs.
+	int16_t arg2;
+};
+
+/// The spaces, in board order starting at Go.
+extern const Space Spaces[BOARD_SPACES];
+
+/// The cards of both decks, in printed order.
+extern const Card Cards[2][BOARD_DECK_SIZE];
+
+/// Bitmask of spaces in each group.
+extern const uint64_t GroupMask[BOARD_GROUPS];
+
+/// Salary collected for passing Go.
+const int GoSalary=200;
+
+/// Fee paid to get out of jail.
+const int BailFee=50;
+
+/// Houses and hotels the bank has to sell.
+const int BankHouses=32;
+const int BankHotels=12;
+
+/**
+ * Determines if a space can be bought.
+ *
+ * @param space The space.
+ * @return true if the space is a street, railroad or utility.
+ */
+inline bool isProperty(int space) {
+	return (Spaces[space].group!=NoGroup);
+}
+
+/**
+ * Returns the bit representing a space in the ownership masks.
+ *
+ * @param space The space.
+ * @return A bitmask with only that space set.
+ */
+inline uint64_t bit(int space) {
+	return ((uint64_t) 1 << space);
+}
+
+}
+
+#endif
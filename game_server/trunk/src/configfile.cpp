@@ -37,6 +37,7 @@ ConfigFile::ConfigFile(const std::string &path) {
 	m_LobbyServerIP="";
 	m_LobbyServerPort=0;
 	m_ContentPkg="";
+	m_ReplayPath="replays";
 
 	g_CfgFile=this;
 }
@@ -80,6 +81,10 @@ void ConfigFile::parse() throw(ConfigFile::Exception) {
 		else if (xmlStrcmp(child->name, (const xmlChar*) "content-pkg")==0)
 			m_ContentPkg=std::string((const char*) xmlNodeGetContent(child));
 
+		// replay log directory
+		else if (xmlStrcmp(child->name, (const xmlChar*) "replay-dir")==0)
+			m_ReplayPath=std::string((const char*) xmlNodeGetContent(child));
+
 		// lobby server data
 		else if (xmlStrcmp(child->name, (const xmlChar*) "lobby-server")==0) {
 			try {
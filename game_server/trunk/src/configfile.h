@@ -109,6 +109,12 @@ class ConfigFile {
 		 */
 		 std::string getContentPackagePath() const { return m_ContentPkg; }
 
+		/**
+		 * Returns the directory rooms write their replay logs to.
+		 * @return Path to the directory, or an empty string if logs are not kept.
+		 */
+		std::string getReplayPath() const { return m_ReplayPath; }
+
 	private:
 		/**
 		 * Parses the lobby-server XML section.
@@ -137,6 +143,9 @@ class ConfigFile {
 
 		/// Path to the content package.
 		std::string m_ContentPkg;
+
+		/// Directory for replay logs.
+		std::string m_ReplayPath;
 };
 
 #endif
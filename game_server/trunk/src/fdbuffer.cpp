@@ -19,86 +19,195 @@
  ***************************************************************************/
 // fdbuffer.cpp: implementation of the FDBuffer class.
 
-#include <cstdlib>
-#include <fcntl.h>
+#include <cerrno>
 #include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "fdbuffer.h"
+#include "utilities.h"
+
+#define INNER_SIZE	(1 << FDBUFFER_INNER_BITS)
+#define INNER_MASK	(INNER_SIZE-1)
+#define OUTER_SIZE	(1 << FDBUFFER_OUTER_BITS)
+#define OUTER_MASK	(OUTER_SIZE-1)
+#define OUTER_SPAN	((uint64_t) INNER_SIZE*OUTER_SIZE)
 
 FDBuffer::FDBuffer() {
-	FD_ZERO(&m_FDs);
-	m_NextExpire.tv_sec=0;
-	m_NextExpire.tv_usec=0;
+	m_Epoll=epoll_create(FDBUFFER_MAX_EVENTS);
+	m_Wakeup=eventfd(0, EFD_NONBLOCK);
+	m_Tick=now()/FDBUFFER_TICK;
+
+	// the wakeup event is the only one with a negative descriptor slot
+	struct epoll_event ev;
+	ev.events=EPOLLIN;
+	ev.data.u64=(uint64_t) -1;
+	epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Wakeup, &ev);
+}
 
-	pipe(m_ComPipe);
-	m_MaxFD=m_ComPipe[0]+1;
+FDBuffer::~FDBuffer() {
+	close(m_Wakeup);
+	close(m_Epoll);
+}
 
-	// make the pipe non-blocking
-	int flags=fcntl(m_ComPipe[0], F_GETFL);
-	fcntl(m_ComPipe[0], F_SETFL, flags | O_NONBLOCK);
+void FDBuffer::addSocket(int fd, int key) {
+	// the socket and its key come back together from epoll, with no lookups
+	struct epoll_event ev;
+	ev.events=EPOLLIN | EPOLLRDHUP;
+	ev.data.u64=((uint64_t) (uint32_t) fd << 32) | (uint32_t) key;
 
-	flags=fcntl(m_ComPipe[1], F_GETFL);
-	fcntl(m_ComPipe[1], F_SETFL, flags | O_NONBLOCK);
+	if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &ev)<0)
+		std::cout << "Unable to watch socket " << fd << std::endl;
+}
 
-	FD_SET(m_ComPipe[0], &m_FDs);
+void FDBuffer::removeSocket(int fd) {
+	epoll_ctl(m_Epoll, EPOLL_CTL_DEL, fd, NULL);
 }
 
-void FDBuffer::addSocket(int fd) {
-	FD_SET(fd, &m_FDs);
+void FDBuffer::watchOutput(int fd, int key, bool on) {
+	struct epoll_event ev;
+	ev.events=EPOLLIN | EPOLLRDHUP | (on ? (uint32_t) EPOLLOUT : 0u);
+	ev.data.u64=((uint64_t) (uint32_t) fd << 32) | (uint32_t) key;
 
-	if (fd>m_MaxFD)
-		m_MaxFD=fd;
+	epoll_ctl(m_Epoll, EPOLL_CTL_MOD, fd, &ev);
 }
 
-void FDBuffer::removeSocket(int fd) {
-	FD_CLR(fd, &m_FDs);
+void FDBuffer::setTimer(int key, int msec) {
+	// round up, so a timer never fires early
+	uint64_t ticks=(msec+FDBUFFER_TICK-1)/FDBUFFER_TICK;
+
+	Timer timer;
+	timer.key=key;
+	timer.expire=now()/FDBUFFER_TICK+(ticks>0 ? ticks : 1);
+
+	// the wheels might lag behind the clock until the next poll
+	if (timer.expire<=m_Tick)
+		timer.expire=m_Tick+1;
+
+	m_Timers[key]=timer.expire;
+	insert(timer);
 }
 
-void FDBuffer::setExpireTime(int delta) {
-	gettimeofday(&m_NextExpire, NULL);
-	m_NextExpire.tv_sec+=delta;
+void FDBuffer::cancelTimer(int key) {
+	// the filed timer is dropped once it comes up
+	m_Timers.erase(key);
 }
 
 FDBuffer::WaitCode FDBuffer::poll() {
-	// first see if we passed the designated timeout
-	struct timeval tv, now;
-	gettimeofday(&now, NULL);
+	m_ActiveFDs.clear();
+	m_Expired.clear();
+
+	struct epoll_event events[FDBUFFER_MAX_EVENTS];
+	int n=epoll_wait(m_Epoll, events, FDBUFFER_MAX_EVENTS, getTimeout());
+	if (n<0 && errno!=EINTR)
+		std::cout << "Unable to wait on sockets" << std::endl;
+
+	for (int i=0; i<n; i++) {
+		// someone wants our attention
+		if (events[i].data.u64==(uint64_t) -1) {
+			uint64_t count;
+			while(read(m_Wakeup, &count, sizeof(count))>0);
 
-	if (m_NextExpire.tv_sec>0 && now.tv_sec>m_NextExpire.tv_sec)
+			continue;
+		}
+
+		Ready ready;
+		ready.fd=(int) (events[i].data.u64 >> 32);
+		ready.key=(int) (uint32_t) events[i].data.u64;
+		ready.readable=((events[i].events & ~EPOLLOUT)!=0);
+		ready.writable=((events[i].events & EPOLLOUT)!=0);
+		m_ActiveFDs.push_back(ready);
+	}
+
+	advance();
+
+	if (!m_ActiveFDs.empty())
+		return DataReady;
+	else if (!m_Expired.empty())
 		return TimeExpired;
+	else
+		return NoAction;
+}
 
-	fd_set tmp;
-	FD_ZERO(&tmp);
+void FDBuffer::awake() {
+	uint64_t one=1;
+	write(m_Wakeup, &one, sizeof(one));
+}
 
-	// set a timeout if necessary
-	tmp=m_FDs;
-	tv.tv_sec=m_NextExpire.tv_sec-now.tv_sec;
-	tv.tv_usec=0;
+uint64_t FDBuffer::now() {
+	return Util::milliseconds();
+}
 
-	// wait for something to happen
-	select(m_MaxFD+1, &tmp, NULL, NULL, (m_NextExpire.tv_sec>0 ? &tv : NULL));
+void FDBuffer::insert(const Timer &timer) {
+	uint64_t delta=timer.expire-m_Tick;
 
-	m_ActiveFDs.clear();
-	for (int i=0; i<=m_MaxFD; i++) {
-		if (FD_ISSET(i, &tmp)) {
-			// signal sent through pipe
-			if (i==m_ComPipe[0]) {
-				char ch;
-				while(read(m_ComPipe[0], &ch, 1)!=-1);
+	if (delta<INNER_SIZE)
+		m_Inner[timer.expire & INNER_MASK].push_back(timer);
+	else if (delta<OUTER_SPAN)
+		m_Outer[(timer.expire >> FDBUFFER_INNER_BITS) & OUTER_MASK].push_back(timer);
+	else
+		m_Overflow.push_back(timer);
+}
+
+bool FDBuffer::isStale(const Timer &timer) const {
+	std::map<int, uint64_t>::const_iterator it=m_Timers.find(timer.key);
+	return (it==m_Timers.end() || (*it).second!=timer.expire);
+}
+
+void FDBuffer::advance() {
+	uint64_t current=now()/FDBUFFER_TICK;
+
+	while(m_Tick<current) {
+		m_Tick++;
+
+		// the inner wheel came round, so spread the next outer slot over it
+		if ((m_Tick & INNER_MASK)==0) {
+			// and once the outer wheel came round, bring in the far off timers too
+			if (((m_Tick >> FDBUFFER_INNER_BITS) & OUTER_MASK)==0) {
+				std::vector<Timer> overflow;
+				overflow.swap(m_Overflow);
+
+				for (int i=0; i<overflow.size(); i++) {
+					if (!isStale(overflow[i]))
+						insert(overflow[i]);
+				}
 			}
 
-			// a client socket has data or disconnected
-			else
-				m_ActiveFDs.push_back(i);
+			std::vector<Timer> outer;
+			outer.swap(m_Outer[(m_Tick >> FDBUFFER_INNER_BITS) & OUTER_MASK]);
+
+			for (int i=0; i<outer.size(); i++) {
+				if (!isStale(outer[i]))
+					insert(outer[i]);
+			}
 		}
-	}
 
-	if (m_ActiveFDs.empty())
-		return NoAction;
-	else
-		return DataReady;
+		std::vector<Timer> slot;
+		slot.swap(m_Inner[m_Tick & INNER_MASK]);
+
+		for (int i=0; i<slot.size(); i++) {
+			if (isStale(slot[i]))
+				continue;
+
+			m_Expired.push_back(slot[i].key);
+			m_Timers.erase(slot[i].key);
+		}
+	}
 }
 
-void FDBuffer::awake() {
-	write(m_ComPipe[1], "1", 1);
+int FDBuffer::getTimeout() const {
+	if (m_Timers.empty())
+		return -1;
+
+	// sleep until the next tick with anything filed, or until the inner wheel comes
+	// round and the outer wheel needs to be looked at
+	uint64_t next=m_Tick+1;
+	while((next & INNER_MASK)!=0 && m_Inner[next & INNER_MASK].empty())
+		next++;
+
+	uint64_t current=now();
+	uint64_t due=next*FDBUFFER_TICK;
+
+	return (due>current ? (int) (due-current) : 0);
 }
@@ -22,25 +22,74 @@
 #ifndef FDBUFFER_H
 #define FDBUFFER_H
 
-#include <sys/types.h>
-#include <sys/time.h>
+#include <map>
+#include <stdint.h>
 #include <vector>
 
+/// Milliseconds per tick of the timer wheel.
+#define FDBUFFER_TICK			10
+
+/// Bits of the tick counter covered by the inner wheel (256 ticks of 10ms).
+#define FDBUFFER_INNER_BITS		8
+
+/// Bits of the tick counter covered by the outer wheel (64 turns of the inner one).
+#define FDBUFFER_OUTER_BITS		6
+
+/// Most events taken from the kernel per poll.
+#define FDBUFFER_MAX_EVENTS		256
+
+/**
+ * Waits on the sockets and timers of many rooms at once.
+ * Each room worker owns one FDBuffer, which multiplexes the client sockets of all
+ * the rooms pinned to the worker over a single epoll instance. Sockets and timers are
+ * added under a key, normally the id number of the room they belong to, and poll()
+ * reports which keys need attention. The key travels with the socket through epoll,
+ * so each ready socket costs the same no matter how many are watched.
+ *
+ * Timers have millisecond deadlines, rounded up to the next FDBUFFER_TICK, and live
+ * in a hierarchical timing wheel. The inner wheel has a slot per tick for the next
+ * 2.56 seconds, the outer wheel has a slot per turn of the inner one for the next
+ * 2.7 minutes, and anything further out waits in an overflow list. Whenever the
+ * inner wheel comes round, the next outer slot is spread over it, so setting and
+ * expiring a timer costs the same no matter how many rooms are waiting. A key has at
+ * most one timer; setting it again replaces the previous one.
+ *
+ * Only the owning worker thread may use this class, except for awake().
+ */
 class FDBuffer {
 	public:
-		/// Reasons the wait() function returns.
+		/// Reasons the poll() function returns.
 		enum WaitCode { NoAction, TimeExpired, DataReady };
 
+		/// A socket with data waiting, or with room for data to be written.
+		struct Ready {
+			/// The socket file descriptor.
+			int fd;
+
+			/// The key the socket was added under.
+			int key;
+
+			/// Whether the socket has data to read, or disconnected.
+			bool readable;
+
+			/// Whether the socket can take more data to write.
+			bool writable;
+		};
+
 	public:
 		/// Creates an empty socket buffer.
 		FDBuffer();
 
+		/// Closes the epoll instance.
+		~FDBuffer();
+
 		/**
 		 * Adds a socket file descriptor to the internal set.
 		 *
 		 * @param fd The socket to add.
+		 * @param key The key to report the socket's activity under.
 		 */
-		void addSocket(int fd);
+		void addSocket(int fd, int key);
 
 		/**
 		 * Removes a socket file descriptor from the internal set.
@@ -50,57 +99,131 @@ class FDBuffer {
 		void removeSocket(int fd);
 
 		/**
-		 * Sets the amount of seconds before a timeout should be called.
+		 * Sets whether poll() should also report when a socket can take more data,
+		 * for as long as there is output queued for it.
 		 *
-		 * @param delta The amount of seconds.
+		 * @param fd The socket, which must have been added already.
+		 * @param key The key the socket was added under.
+		 * @param on true to watch for room to write, false to only watch for data.
 		 */
-		void setExpireTime(int seconds);
+		void watchOutput(int fd, int key, bool on);
 
 		/**
-		 * Waits on the set of sockets, either for data or timeout.
-		 * This method will do two important things:
-		 *   1) Wait for ANY socket to receive data
-		 *   2) Determine if the next timeout interval has been reached
+		 * Sets the amount of milliseconds before the timer for a key expires.
 		 *
-		 * There are three cases to consider:
-		 *   1) If NO socket has reported data and the next timeout has not been reached,
-		 *      the NoAction enum will be returned.
-		 *   2) If ANY socket has reported data, DataReady will be returned.
-		 *   3) If the next timeout has been reached, TimeExpired will be returned.
+		 * @param key The key.
+		 * @param msec The amount of milliseconds.
+		 */
+		void setTimer(int key, int msec);
+
+		/**
+		 * Cancels the timer for a key, if there is one.
+		 *
+		 * @param key The key.
+		 */
+		void cancelTimer(int key);
+
+		/**
+		 * Waits for any socket to receive data, for a timer to expire, or for a call to
+		 * awake(), whichever comes first.
+		 *
+		 * @return DataReady if any socket has data, TimeExpired if only timers expired,
+		 * NoAction otherwise.
 		 */
 		WaitCode poll();
 
 		/**
 		 * Interrupts an ongoing call to poll().
-		 * This method sends a signal to the internal polling system, terminating its
-		 * blocking state. This effectively causes poll() to return immediately.
+		 * This method may be called from any thread.
 		 */
 		void awake();
 
 		/**
-		 * Returns a vector of sockets with data ready to be read.
-		 * Note that this vector could be empty. Always call this method if the
-		 * poll() method returns the DataReady code.
+		 * Returns the sockets with data ready to be read, or ready to be written to if
+		 * asked for with watchOutput(), as of the last poll(). A socket that disconnected
+		 * is reported as having data.
+		 *
+		 * @return A vector of ready sockets.
+		 */
+		const std::vector<Ready>& getActiveSockets() const { return m_ActiveFDs; }
+
+		/**
+		 * Returns the keys whose timers expired, as of the last poll().
 		 *
-		 * @return A vector of socket file descriptors.
+		 * @return A vector of keys.
 		 */
-		std::vector<int> getActiveSockets() const { return m_ActiveFDs; }
+		const std::vector<int>& getExpiredTimers() const { return m_Expired; }
 
 	private:
-		/// The collection of socket file descriptors.
-		fd_set m_FDs;
+		/// A timer waiting in one of the wheels.
+		struct Timer {
+			/// The key the timer was set for.
+			int key;
+
+			/// The tick the timer expires on.
+			uint64_t expire;
+		};
+
+		/**
+		 * Returns the current time on a clock that never jumps.
+		 *
+		 * @return Milliseconds since some unspecified point.
+		 */
+		static uint64_t now();
+
+		/**
+		 * Files a timer in the slot matching how far off it is.
+		 *
+		 * @param timer The timer.
+		 */
+		void insert(const Timer &timer);
+
+		/**
+		 * Determines if a timer was cancelled or set again since it was filed.
+		 *
+		 * @param timer The timer.
+		 * @return true if the timer should be dropped, false otherwise.
+		 */
+		bool isStale(const Timer &timer) const;
+
+		/**
+		 * Moves the wheels up to the current tick, expiring the timers on the way.
+		 */
+		void advance();
+
+		/**
+		 * Works out how long poll() may sleep before a timer could expire.
+		 *
+		 * @return Milliseconds to wait, or -1 if no timer is pending.
+		 */
+		int getTimeout() const;
+
+		/// The epoll instance.
+		int m_Epoll;
+
+		/// Event used to interrupt poll().
+		int m_Wakeup;
+
+		/// Timers due within one turn of the inner wheel, by tick.
+		std::vector<Timer> m_Inner[1 << FDBUFFER_INNER_BITS];
+
+		/// Timers due within one turn of the outer wheel, by turn of the inner wheel.
+		std::vector<Timer> m_Outer[1 << FDBUFFER_OUTER_BITS];
+
+		/// Timers due even later than that.
+		std::vector<Timer> m_Overflow;
 
-		/// The next timeout event.
-		struct timeval m_NextExpire;
+		/// The tick each key's timer expires on; filed timers that disagree are stale.
+		std::map<int, uint64_t> m_Timers;
 
-		/// The highest file descriptor number.
-		int m_MaxFD;
+		/// The last tick the wheels were moved to.
+		uint64_t m_Tick;
 
-		/// Pipe for interrupting the blocking polling system.
-		int m_ComPipe[2];
+		/// Sockets with data waiting.
+		std::vector<Ready> m_ActiveFDs;
 
-		/// Vector of sockets with data waiting.
-		std::vector<int> m_ActiveFDs;
+		/// Keys with expired timers.
+		std::vector<int> m_Expired;
 };
 
 #endif
@@ -0,0 +1,1026 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// game.cpp: implementation of the Game class.
+
+#include <cstring>
+
+#include "game.h"
+
+using namespace Board;
+
+Game::Game() {
+	memset(m_Players, 0, sizeof(m_Players));
+	memset(m_Order, 0, sizeof(m_Order));
+	memset(m_Owned, 0, sizeof(m_Owned));
+	memset(m_Houses, 0, sizeof(m_Houses));
+	memset(m_Deck, 0, sizeof(m_Deck));
+	memset(m_Owed, 0, sizeof(m_Owed));
+
+	m_Turn=0;
+	m_Mortgaged=0;
+	m_BankHouses=BankHouses;
+	m_BankHotels=BankHotels;
+	m_DeckTop[ChanceDeck]=m_DeckTop[ChestDeck]=0;
+	m_JailCardHolder[ChanceDeck]=m_JailCardHolder[ChestDeck]=-1;
+	m_Stage=Idle;
+	m_Dice[0]=m_Dice[1]=0;
+	m_Doubles=0;
+	m_Again=false;
+	m_Offer=0;
+	m_Bidders=0;
+	m_Bidder=-1;
+	m_Leader=-1;
+	m_HighBid=0;
+	m_Round=0;
+	m_MaxRounds=0;
+	m_FreeParkReward=0;
+	m_IncomeTaxChoice=false;
+	m_Redistribute=false;
+	m_Winner=-1;
+	m_Quiet=false;
+	m_NumEvents=0;
+}
+
+void Game::start(const int order[GAME_PLAYERS], int maxRounds, int freeParkReward, bool incomeTaxChoice, bool redistribute) {
+	m_MaxRounds=maxRounds;
+	m_FreeParkReward=freeParkReward;
+	m_IncomeTaxChoice=incomeTaxChoice;
+	m_Redistribute=redistribute;
+
+	// everyone starts on Go with the same amount of cash
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		m_Order[i]=order[i];
+
+		m_Players[i].money=GAME_START_MONEY;
+		m_Players[i].position=GoSpace;
+		emit(MoneyChanged, i, 0, GAME_START_MONEY);
+	}
+
+	// shuffle both decks
+	for (int d=0; d<2; d++) {
+		for (int i=0; i<BOARD_DECK_SIZE; i++)
+			m_Deck[d][i]=i;
+
+		for (int i=BOARD_DECK_SIZE-1; i>0; i--) {
+			int j=draw(0, i);
+
+			uint8_t card=m_Deck[d][i];
+			m_Deck[d][i]=m_Deck[d][j];
+			m_Deck[d][j]=card;
+		}
+	}
+
+	m_Round=1;
+	m_Turn=0;
+	m_Stage=Rolling;
+
+	emit(TurnBegan, getCurrent(), 0, m_Round);
+	emit(Waiting, getDecider(), m_Stage, 0);
+}
+
+bool Game::act(int seat, const Action &action, int arg, int amount) {
+	if (seat<0 || seat!=getDecider())
+		return false;
+
+	// property management needs a space to work on
+	if (action>=Build && action<=Unmortgage && (arg<0 || arg>=BOARD_SPACES))
+		return false;
+
+	// as well as a point in the turn where the player is free to do it
+	bool managing=(m_Stage==Rolling || m_Stage==Ending);
+
+	PlayerState &p=m_Players[seat];
+
+	switch(action) {
+		case Roll: {
+			if (m_Stage!=Rolling)
+				return false;
+
+			m_Dice[0]=draw(1, 6);
+			m_Dice[1]=draw(1, 6);
+			emit(DiceRolled, seat, m_Dice[0], m_Dice[1]);
+
+			bool doubles=(m_Dice[0]==m_Dice[1]);
+			m_Again=false;
+
+			if (p.inJail) {
+				// doubles get the player out, but don't earn another roll
+				if (doubles)
+					release(seat);
+
+				// on the third try the player has to pay up and move on
+				else if (++p.jailTurns==3) {
+					owe(-1, BailFee);
+					release(seat);
+				}
+
+				else
+					m_Stage=Ending;
+			}
+
+			// three doubles in a row is speeding
+			else if (doubles && ++m_Doubles==3) {
+				sendToJail(seat);
+				m_Stage=Ending;
+			}
+
+			else
+				m_Again=doubles;
+
+			// players who stay in jail, or were just sent there, are done for the turn
+			if (m_Stage==Rolling) {
+				moveTo(seat, (p.position+m_Dice[0]+m_Dice[1])%BOARD_SPACES, true);
+				land(0);
+			}
+		} break;
+
+		case Buy: {
+			int price=Spaces[m_Offer].price;
+			if (m_Stage!=Buying || p.money<price)
+				return false;
+
+			addMoney(seat, -price);
+			m_Owned[seat]|=bit(m_Offer);
+			emit(OwnerChanged, seat, m_Offer, price);
+
+			proceed();
+		} break;
+
+		case Decline: {
+			if (m_Stage!=Buying)
+				return false;
+
+			// everyone still in the game may bid, starting with the player who declined
+			m_Bidders=0;
+			for (int i=0; i<GAME_PLAYERS; i++) {
+				if (!m_Players[i].bankrupt)
+					m_Bidders|=(1 << i);
+			}
+
+			m_Stage=Auctioning;
+			m_Bidder=seat;
+			m_Leader=-1;
+			m_HighBid=0;
+			emit(AuctionBid, seat, m_Offer, 0);
+		} break;
+
+		case Bid: {
+			if (m_Stage!=Auctioning || amount<=m_HighBid || amount>p.money)
+				return false;
+
+			m_Leader=seat;
+			m_HighBid=amount;
+			nextBidder();
+		} break;
+
+		case Pass: {
+			if (m_Stage!=Auctioning)
+				return false;
+
+			m_Bidders&=~(1 << seat);
+			nextBidder();
+		} break;
+
+		case Build: {
+			if (!managing || !canBuild(seat, arg))
+				return false;
+
+			// a fifth house is a hotel, which frees up the four houses it replaces
+			if (m_Houses[arg]==4) {
+				m_BankHouses+=4;
+				m_BankHotels--;
+			}
+
+			else
+				m_BankHouses--;
+
+			m_Houses[arg]++;
+			addMoney(seat, -Spaces[arg].houseCost);
+			emit(HousesChanged, seat, arg, m_Houses[arg]);
+		} break;
+
+		case Sell: {
+			if ((!managing && m_Stage!=Owing) || !canSell(seat, arg))
+				return false;
+
+			if (m_Houses[arg]==5) {
+				m_BankHouses-=4;
+				m_BankHotels++;
+			}
+
+			else
+				m_BankHouses++;
+
+			// buildings sell back at half price
+			m_Houses[arg]--;
+			addMoney(seat, Spaces[arg].houseCost/2);
+			emit(HousesChanged, seat, arg, m_Houses[arg]);
+		} break;
+
+		case Mortgage: {
+			if ((!managing && m_Stage!=Owing) || !canMortgage(seat, arg))
+				return false;
+
+			m_Mortgaged|=bit(arg);
+			addMoney(seat, Spaces[arg].price/2);
+			emit(MortgageChanged, seat, arg, 1);
+		} break;
+
+		case Unmortgage: {
+			if (!managing || !canUnmortgage(seat, arg))
+				return false;
+
+			// lifting a mortgage costs its value plus ten percent interest
+			m_Mortgaged&=~bit(arg);
+			addMoney(seat, -(Spaces[arg].price/2+Spaces[arg].price/20));
+			emit(MortgageChanged, seat, arg, 0);
+		} break;
+
+		case PayBail: {
+			if (m_Stage!=Rolling || !p.inJail || p.money<BailFee)
+				return false;
+
+			addMoney(seat, -BailFee);
+			release(seat);
+		} break;
+
+		case UseJailCard: {
+			if (m_Stage!=Rolling || !p.inJail || !p.jailCards)
+				return false;
+
+			// the card goes back into the deck it came from
+			int deck=(m_JailCardHolder[ChanceDeck]==seat ? ChanceDeck : ChestDeck);
+			m_JailCardHolder[deck]=-1;
+
+			p.jailCards--;
+			emit(JailCardsChanged, seat, deck, p.jailCards);
+			release(seat);
+		} break;
+
+		case PayFlatTax:
+		case PayPercentTax: {
+			if (m_Stage!=ChoosingTax)
+				return false;
+
+			if (action==PayFlatTax)
+				owe(-1, Spaces[p.position].price);
+			else
+				owe(-1, getWorth(seat)/10);
+
+			proceed();
+		} break;
+
+		case PayDebt: {
+			if (m_Stage!=Owing || p.money<getDebt())
+				return false;
+
+			proceed();
+		} break;
+
+		case DeclareBankrupt: {
+			if (m_Stage!=Owing)
+				return false;
+
+			bankrupt();
+		} break;
+
+		case EndTurn: {
+			if (m_Stage!=Ending)
+				return false;
+
+			nextTurn();
+		} break;
+
+		default: return false;
+	}
+
+	// let everyone know who the game is waiting on now
+	emit(Waiting, getDecider(), m_Stage, 0);
+
+	return true;
+}
+
+void Game::playDefault() {
+	int seat=getDecider();
+	if (seat==-1)
+		return;
+
+	PlayerState &p=m_Players[seat];
+
+	switch(m_Stage) {
+		// get out of jail for free if possible, then roll
+		case Rolling: {
+			if (p.inJail && p.jailCards)
+				act(seat, UseJailCard);
+
+			act(seat, Roll);
+		} break;
+
+		// buy whatever leaves enough cash in hand
+		case Buying: {
+			if (p.money-Spaces[m_Offer].price>=GAME_RESERVE)
+				act(seat, Buy);
+			else
+				act(seat, Decline);
+		} break;
+
+		// bid in small steps, up to the printed price
+		case Auctioning: {
+			int bid=m_HighBid+10;
+			if (bid<=Spaces[m_Offer].price && p.money-bid>=GAME_RESERVE)
+				act(seat, Bid, 0, bid);
+			else
+				act(seat, Pass);
+		} break;
+
+		// pay whichever tax is lower
+		case ChoosingTax: {
+			if (getWorth(seat)/10<Spaces[p.position].price)
+				act(seat, PayPercentTax);
+			else
+				act(seat, PayFlatTax);
+		} break;
+
+		// mortgage and sell until the debt is covered, or nothing is left
+		case Owing: {
+			int debt=getDebt();
+
+			bool raised=true;
+			while(p.money<debt && raised) {
+				raised=false;
+
+				for (int space=0; space<BOARD_SPACES && p.money<debt; space++) {
+					if (canMortgage(seat, space))
+						raised|=act(seat, Mortgage, space);
+					else if (canSell(seat, space))
+						raised|=act(seat, Sell, space);
+				}
+			}
+
+			if (p.money>=debt)
+				act(seat, PayDebt);
+			else
+				act(seat, DeclareBankrupt);
+		} break;
+
+		// build with whatever is left over, then pass the dice on
+		case Ending: {
+			bool built=true;
+			while(built) {
+				built=false;
+
+				for (int space=0; space<BOARD_SPACES; space++) {
+					if (canBuild(seat, space) && p.money-Spaces[space].houseCost>=GAME_RESERVE)
+						built|=act(seat, Build, space);
+				}
+			}
+
+			act(seat, EndTurn);
+		} break;
+
+		default: break;
+	}
+}
+
+void Game::save(Snapshot &snap) const {
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		const PlayerState &p=m_Players[i];
+		snap.addUint32(p.money);
+		snap.addByte(p.position);
+		snap.addByte(p.jailTurns);
+		snap.addByte(p.jailCards);
+		snap.addByte(p.inJail);
+		snap.addByte(p.bankrupt);
+
+		snap.addByte(m_Order[i]);
+		snap.addUint64(m_Owned[i]);
+	}
+
+	snap.addByte(m_Turn);
+	snap.addUint64(m_Mortgaged);
+	for (int i=0; i<BOARD_SPACES; i++)
+		snap.addByte(m_Houses[i]);
+
+	snap.addByte(m_BankHouses);
+	snap.addByte(m_BankHotels);
+
+	for (int d=0; d<2; d++) {
+		for (int i=0; i<BOARD_DECK_SIZE; i++)
+			snap.addByte(m_Deck[d][i]);
+
+		snap.addByte(m_DeckTop[d]);
+		snap.addByte(m_JailCardHolder[d]);
+	}
+
+	snap.addByte(m_Stage);
+	snap.addByte(m_Dice[0]);
+	snap.addByte(m_Dice[1]);
+	snap.addByte(m_Doubles);
+	snap.addByte(m_Again);
+	snap.addByte(m_Offer);
+	snap.addByte(m_Bidders);
+	snap.addByte(m_Bidder);
+	snap.addByte(m_Leader);
+	snap.addUint32(m_HighBid);
+	for (int i=0; i<=GAME_PLAYERS; i++)
+		snap.addUint32(m_Owed[i]);
+
+	snap.addUint32(m_Round);
+	snap.addUint32(m_MaxRounds);
+	snap.addUint32(m_FreeParkReward);
+	snap.addByte(m_IncomeTaxChoice);
+	snap.addByte(m_Redistribute);
+	snap.addByte(m_Winner);
+	snap.addUint64(m_Random.getState());
+}
+
+bool Game::load(Snapshot &snap) {
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		PlayerState &p=m_Players[i];
+		p.money=(int32_t) snap.uint32();
+		p.position=snap.byte();
+		p.jailTurns=snap.byte();
+		p.jailCards=snap.byte();
+		p.inJail=snap.byte();
+		p.bankrupt=snap.byte();
+
+		m_Order[i]=snap.byte();
+		m_Owned[i]=snap.uint64();
+	}
+
+	m_Turn=snap.byte();
+	m_Mortgaged=snap.uint64();
+	for (int i=0; i<BOARD_SPACES; i++)
+		m_Houses[i]=snap.byte();
+
+	m_BankHouses=snap.byte();
+	m_BankHotels=snap.byte();
+
+	for (int d=0; d<2; d++) {
+		for (int i=0; i<BOARD_DECK_SIZE; i++)
+			m_Deck[d][i]=snap.byte();
+
+		m_DeckTop[d]=snap.byte();
+		m_JailCardHolder[d]=(int8_t) snap.byte();
+	}
+
+	m_Stage=(Stage) snap.byte();
+	m_Dice[0]=snap.byte();
+	m_Dice[1]=snap.byte();
+	m_Doubles=snap.byte();
+	m_Again=snap.byte();
+	m_Offer=snap.byte();
+	m_Bidders=snap.byte();
+	m_Bidder=(int8_t) snap.byte();
+	m_Leader=(int8_t) snap.byte();
+	m_HighBid=(int32_t) snap.uint32();
+	for (int i=0; i<=GAME_PLAYERS; i++)
+		m_Owed[i]=(int32_t) snap.uint32();
+
+	m_Round=snap.uint32();
+	m_MaxRounds=snap.uint32();
+	m_FreeParkReward=snap.uint32();
+	m_IncomeTaxChoice=snap.byte();
+	m_Redistribute=snap.byte();
+	m_Winner=(int8_t) snap.byte();
+	m_Random.setState(snap.uint64());
+
+	m_NumEvents=0;
+
+	// anything out of range would send the engine off the end of its tables
+	if (!snap.good() || m_Turn>=GAME_PLAYERS || m_Stage>Over || m_Offer>=BOARD_SPACES)
+		return false;
+	if (m_Bidder<-1 || m_Bidder>=GAME_PLAYERS || m_Leader<-1 || m_Leader>=GAME_PLAYERS)
+		return false;
+	if (m_Winner<-1 || m_Winner>=GAME_PLAYERS)
+		return false;
+
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		if (m_Order[i]>=GAME_PLAYERS || m_Players[i].position>=BOARD_SPACES)
+			return false;
+	}
+
+	for (int d=0; d<2; d++) {
+		if (m_DeckTop[d]>=BOARD_DECK_SIZE || m_JailCardHolder[d]<-1 || m_JailCardHolder[d]>=GAME_PLAYERS)
+			return false;
+
+		for (int i=0; i<BOARD_DECK_SIZE; i++) {
+			if (m_Deck[d][i]>=BOARD_DECK_SIZE)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+int Game::getDecider() const {
+	switch(m_Stage) {
+		case Idle:
+		case Over: return -1;
+
+		case Auctioning: return m_Bidder;
+
+		default: return getCurrent();
+	}
+}
+
+void Game::emit(const EventType &type, int player, int arg, int amount) {
+	if (m_Quiet || m_NumEvents==GAME_MAX_EVENTS)
+		return;
+
+	Event &ev=m_Events[m_NumEvents++];
+	ev.type=type;
+	ev.player=player;
+	ev.arg=arg;
+	ev.amount=amount;
+}
+
+int Game::draw(int low, int high) {
+	return m_Random.range(low, high);
+}
+
+void Game::addMoney(int seat, int delta) {
+	m_Players[seat].money+=delta;
+	emit(MoneyChanged, seat, 0, m_Players[seat].money);
+}
+
+void Game::owe(int creditor, int amount) {
+	if (amount>0)
+		m_Owed[creditor==-1 ? GAME_PLAYERS : creditor]+=amount;
+}
+
+int Game::getDebt() const {
+	int debt=0;
+	for (int i=0; i<=GAME_PLAYERS; i++)
+		debt+=m_Owed[i];
+
+	return debt;
+}
+
+void Game::moveTo(int seat, int space, bool forward) {
+	PlayerState &p=m_Players[seat];
+
+	// wrapping around the board means the player passed Go
+	if (forward && space<p.position)
+		addMoney(seat, GoSalary);
+
+	p.position=space;
+	emit(Moved, seat, space, 0);
+}
+
+void Game::land(int rentFactor) {
+	int seat=getCurrent();
+	int space=m_Players[seat].position;
+	const Space &s=Spaces[space];
+
+	switch(s.type) {
+		case Street:
+		case Railroad:
+		case Utility: {
+			int owner=getOwner(space);
+
+			// the player gets first pick on unowned property
+			if (owner==-1) {
+				m_Offer=space;
+				m_Stage=Buying;
+				emit(Offered, seat, space, s.price);
+				return;
+			}
+
+			if (owner!=seat)
+				owe(owner, getRent(space, rentFactor));
+		} break;
+
+		case Chance: drawCard(ChanceDeck); return;
+		case Chest: drawCard(ChestDeck); return;
+
+		case IncomeTax: {
+			if (m_IncomeTaxChoice) {
+				m_Stage=ChoosingTax;
+				emit(TaxChoice, seat, space, s.price);
+				return;
+			}
+
+			owe(-1, s.price);
+		} break;
+
+		case LuxuryTax: owe(-1, s.price); break;
+
+		case FreeParking: {
+			if (m_FreeParkReward>0)
+				addMoney(seat, m_FreeParkReward);
+		} break;
+
+		case GoToJail: sendToJail(seat); break;
+
+		default: break;
+	}
+
+	proceed();
+}
+
+void Game::drawCard(int deck) {
+	int seat=getCurrent();
+	PlayerState &p=m_Players[seat];
+
+	// a get out of jail card is skipped while someone holds on to it
+	int index;
+	do {
+		index=m_Deck[deck][m_DeckTop[deck]];
+		m_DeckTop[deck]=(m_DeckTop[deck]+1)%BOARD_DECK_SIZE;
+	} while(Cards[deck][index].type==CardJailFree && m_JailCardHolder[deck]!=-1);
+
+	const Card &card=Cards[deck][index];
+	emit(CardDrawn, seat, deck, index);
+
+	switch(card.type) {
+		case CardMoney: {
+			if (card.arg>0)
+				addMoney(seat, card.arg);
+			else
+				owe(-1, -card.arg);
+		} break;
+
+		case CardAdvance: {
+			moveTo(seat, card.arg, true);
+			land(0);
+		} return;
+
+		case CardNearestRailroad:
+		case CardNearestUtility: {
+			int type=(card.type==CardNearestRailroad ? Railroad : Utility);
+
+			int space=p.position;
+			do {
+				space=(space+1)%BOARD_SPACES;
+			} while(Spaces[space].type!=type);
+
+			moveTo(seat, space, true);
+			land(type==Railroad ? 2 : 10);
+		} return;
+
+		case CardBack: {
+			moveTo(seat, (p.position+BOARD_SPACES-card.arg)%BOARD_SPACES, false);
+			land(0);
+		} return;
+
+		case CardGoToJail: sendToJail(seat); break;
+
+		case CardJailFree: {
+			m_JailCardHolder[deck]=seat;
+			p.jailCards++;
+			emit(JailCardsChanged, seat, deck, p.jailCards);
+		} break;
+
+		case CardRepairs: {
+			int cost=0;
+			for (int space=0; space<BOARD_SPACES; space++) {
+				if (m_Owned[seat] & bit(space))
+					cost+=(m_Houses[space]==5 ? card.arg2 : m_Houses[space]*card.arg);
+			}
+
+			owe(-1, cost);
+		} break;
+
+		case CardPayEach: {
+			for (int i=0; i<GAME_PLAYERS; i++) {
+				if (i!=seat && !m_Players[i].bankrupt)
+					owe(i, card.arg);
+			}
+		} break;
+
+		case CardCollectEach: {
+			// only the player whose turn it is can be made to raise money, so the
+			// others pay what cash they have on hand
+			for (int i=0; i<GAME_PLAYERS; i++) {
+				if (i==seat || m_Players[i].bankrupt)
+					continue;
+
+				int paid=(m_Players[i].money<card.arg ? m_Players[i].money : card.arg);
+				addMoney(i, -paid);
+				addMoney(seat, paid);
+			}
+		} break;
+
+		default: break;
+	}
+
+	proceed();
+}
+
+int Game::getRent(int space, int rentFactor) const {
+	int owner=getOwner(space);
+	if (owner==-1 || (m_Mortgaged & bit(space)))
+		return 0;
+
+	const Space &s=Spaces[space];
+	uint64_t group=GroupMask[s.group];
+	uint64_t owned=(m_Owned[owner] & group);
+
+	switch(s.type) {
+		// rent doubles with each railroad owned
+		case Railroad: {
+			int rent=s.rent[__builtin_popcountll(owned)-1];
+			return (rentFactor ? rent*rentFactor : rent);
+		}
+
+		// utilities charge a multiple of the dice
+		case Utility: {
+			int factor=(rentFactor ? rentFactor : s.rent[__builtin_popcountll(owned)-1]);
+			return (m_Dice[0]+m_Dice[1])*factor;
+		}
+
+		// a full color group doubles the rent on unimproved streets
+		default: {
+			if (m_Houses[space])
+				return s.rent[m_Houses[space]];
+
+			return (owned==group ? s.rent[0]*2 : s.rent[0]);
+		}
+	}
+}
+
+int Game::getOwner(int space) const {
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		if (m_Owned[i] & bit(space))
+			return i;
+	}
+
+	return -1;
+}
+
+int Game::getWorth(int seat) const {
+	int worth=m_Players[seat].money;
+
+	for (int space=0; space<BOARD_SPACES; space++) {
+		if (m_Owned[seat] & bit(space))
+			worth+=Spaces[space].price+m_Houses[space]*Spaces[space].houseCost;
+	}
+
+	return worth;
+}
+
+void Game::sendToJail(int seat) {
+	PlayerState &p=m_Players[seat];
+	p.position=JailSpace;
+	p.inJail=true;
+	p.jailTurns=0;
+
+	// no salary, and no rolling again
+	m_Again=false;
+
+	emit(Moved, seat, JailSpace, 0);
+	emit(Jailed, seat, JailSpace, 0);
+}
+
+void Game::release(int seat) {
+	m_Players[seat].inJail=false;
+	m_Players[seat].jailTurns=0;
+
+	emit(Released, seat, JailSpace, 0);
+}
+
+void Game::proceed() {
+	int seat=getCurrent();
+	PlayerState &p=m_Players[seat];
+
+	// the player has to raise money before the game can go on
+	int debt=getDebt();
+	if (debt>p.money) {
+		m_Stage=Owing;
+		emit(DebtOwed, seat, 0, debt);
+		return;
+	}
+
+	for (int i=0; i<=GAME_PLAYERS; i++) {
+		if (!m_Owed[i])
+			continue;
+
+		addMoney(seat, -m_Owed[i]);
+		if (i<GAME_PLAYERS)
+			addMoney(i, m_Owed[i]);
+
+		m_Owed[i]=0;
+	}
+
+	// doubles earn another roll
+	m_Stage=(m_Again && !p.inJail ? Rolling : Ending);
+}
+
+void Game::nextTurn() {
+	// skip bankrupt players, counting a new round each time the order wraps around
+	do {
+		m_Turn=(m_Turn+1)%GAME_PLAYERS;
+		if (m_Turn==0)
+			m_Round++;
+	} while(m_Players[m_Order[m_Turn]].bankrupt);
+
+	// out of time, so the richest player wins
+	if (m_MaxRounds>0 && m_Round>m_MaxRounds) {
+		int richest=-1;
+		for (int i=0; i<GAME_PLAYERS; i++) {
+			int seat=m_Order[i];
+			if (!m_Players[seat].bankrupt && (richest==-1 || getWorth(seat)>getWorth(richest)))
+				richest=seat;
+		}
+
+		finish(richest);
+		return;
+	}
+
+	m_Stage=Rolling;
+	m_Doubles=0;
+	m_Again=false;
+
+	emit(TurnBegan, getCurrent(), 0, m_Round);
+}
+
+void Game::nextBidder() {
+	// find the next player still bidding who isn't already in the lead
+	for (int i=1; i<=GAME_PLAYERS; i++) {
+		int seat=(m_Bidder+i)%GAME_PLAYERS;
+
+		if ((m_Bidders & (1 << seat)) && seat!=m_Leader) {
+			m_Bidder=seat;
+			emit(AuctionBid, seat, m_Offer, m_HighBid);
+			return;
+		}
+	}
+
+	// nobody is left to outbid the leader, if there is one
+	if (m_Leader!=-1) {
+		addMoney(m_Leader, -m_HighBid);
+		m_Owned[m_Leader]|=bit(m_Offer);
+		emit(OwnerChanged, m_Leader, m_Offer, m_HighBid);
+	}
+
+	m_Bidder=-1;
+	proceed();
+}
+
+void Game::bankrupt() {
+	int seat=getCurrent();
+	PlayerState &p=m_Players[seat];
+
+	// whatever cash is left goes to the players who are owed money, then the bank
+	for (int i=0; i<GAME_PLAYERS && p.money>0; i++) {
+		if (!m_Owed[i])
+			continue;
+
+		int paid=(m_Owed[i]<p.money ? m_Owed[i] : p.money);
+		addMoney(seat, -paid);
+		addMoney(i, paid);
+	}
+
+	memset(m_Owed, 0, sizeof(m_Owed));
+
+	if (p.money)
+		addMoney(seat, -p.money);
+
+	// buildings go back to the bank
+	for (int space=0; space<BOARD_SPACES; space++) {
+		if (!(m_Owned[seat] & bit(space)))
+			continue;
+
+		if (m_Houses[space]==5)
+			m_BankHotels++;
+		else
+			m_BankHouses+=m_Houses[space];
+
+		if (m_Houses[space]) {
+			m_Houses[space]=0;
+			emit(HousesChanged, seat, space, 0);
+		}
+	}
+
+	// as do the get out of jail cards
+	for (int d=0; d<2; d++) {
+		if (m_JailCardHolder[d]==seat)
+			m_JailCardHolder[d]=-1;
+	}
+
+	if (p.jailCards) {
+		p.jailCards=0;
+		emit(JailCardsChanged, seat, 0, 0);
+	}
+
+	p.bankrupt=true;
+	p.inJail=false;
+	emit(WentBankrupt, seat, 0, 0);
+
+	// see who is left
+	int left[GAME_PLAYERS];
+	int count=0;
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		if (!m_Players[i].bankrupt)
+			left[count++]=i;
+	}
+
+	// property is either dealt out at random to the players left, or returned to the bank
+	for (int space=0; space<BOARD_SPACES; space++) {
+		if (!(m_Owned[seat] & bit(space)))
+			continue;
+
+		int heir=(m_Redistribute ? left[draw(0, count-1)] : -1);
+
+		if (heir!=-1)
+			m_Owned[heir]|=bit(space);
+
+		else if (m_Mortgaged & bit(space)) {
+			m_Mortgaged&=~bit(space);
+			emit(MortgageChanged, -1, space, 0);
+		}
+
+		emit(OwnerChanged, heir, space, 0);
+	}
+
+	m_Owned[seat]=0;
+
+	if (count==1)
+		finish(left[0]);
+	else
+		nextTurn();
+}
+
+void Game::finish(int winner) {
+	m_Stage=Over;
+	m_Winner=winner;
+
+	emit(GameEnded, winner, 0, getWorth(winner));
+}
+
+bool Game::canBuild(int seat, int space) const {
+	const Space &s=Spaces[space];
+	if (s.type!=Street || !(m_Owned[seat] & bit(space)))
+		return false;
+
+	// the whole color group has to be owned, and none of it mortgaged
+	uint64_t group=GroupMask[s.group];
+	if ((m_Owned[seat] & group)!=group || (m_Mortgaged & group))
+		return false;
+
+	if (m_Houses[space]==5 || m_Players[seat].money<s.houseCost)
+		return false;
+
+	// houses go up evenly across the group
+	for (int other=0; other<BOARD_SPACES; other++) {
+		if ((group & bit(other)) && m_Houses[other]<m_Houses[space])
+			return false;
+	}
+
+	// and the bank has to have the pieces
+	return (m_Houses[space]==4 ? m_BankHotels>0 : m_BankHouses>0);
+}
+
+bool Game::canSell(int seat, int space) const {
+	if (!(m_Owned[seat] & bit(space)) || !m_Houses[space])
+		return false;
+
+	// houses come down evenly as well
+	uint64_t group=GroupMask[Spaces[space].group];
+	for (int other=0; other<BOARD_SPACES; other++) {
+		if ((group & bit(other)) && m_Houses[other]>m_Houses[space])
+			return false;
+	}
+
+	// breaking a hotel back down takes four houses from the bank
+	return (m_Houses[space]<5 || m_BankHouses>=4);
+}
+
+bool Game::canMortgage(int seat, int space) const {
+	if (!isProperty(space) || !(m_Owned[seat] & bit(space)) || (m_Mortgaged & bit(space)))
+		return false;
+
+	// buildings in the group have to be sold first
+	uint64_t group=GroupMask[Spaces[space].group];
+	for (int other=0; other<BOARD_SPACES; other++) {
+		if ((group & bit(other)) && m_Houses[other])
+			return false;
+	}
+
+	return true;
+}
+
+bool Game::canUnmortgage(int seat, int space) const {
+	if (!(m_Owned[seat] & m_Mortgaged & bit(space)))
+		return false;
+
+	return (m_Players[seat].money>=Spaces[space].price/2+Spaces[space].price/20);
+}
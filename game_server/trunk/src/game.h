@@ -0,0 +1,546 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// game.h: definition of the Game class.
+
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdint.h>
+
+#include "board.h"
+#include "protspec.h"
+#include "random.h"
+#include "snapshot.h"
+
+/// Seats at the table.
+#define GAME_PLAYERS		4
+
+/// Money each player starts out with.
+#define GAME_START_MONEY	1500
+
+/// Most events a single call into the game can produce.
+#define GAME_MAX_EVENTS		512
+
+/// Cash the default strategy tries to keep in hand.
+#define GAME_RESERVE		150
+
+/**
+ * Server side rules engine for a game of Monopoly.
+ * The game holds the complete state of the board: money and position per player,
+ * ownership and mortgages as bitmasks over the 40 spaces, house counts per space, and
+ * both card decks. Everything is kept in fixed size arrays inside the object, so
+ * copying a game is a flat memory copy and resolving a turn never allocates.
+ *
+ * Players act through act(), which checks the action is legal for that player at
+ * this point of the turn and applies it. Only one player is expected to act at any
+ * time, as reported by getDecider(). Each change to the board is recorded as an Event,
+ * which the room collects afterwards with getEvents() to inform the clients.
+ */
+class Game {
+	public:
+		/// Points in a turn where the game waits for a decision, numbered as in the protocol.
+		enum Stage {
+			Idle=GAME_STAGE_IDLE,	// the game has not started
+			Rolling=GAME_STAGE_ROLLING,	// the current player must roll, and may get out of jail or manage property first
+			Buying=GAME_STAGE_BUYING,	// the current player may buy the unowned property landed on
+			Auctioning=GAME_STAGE_AUCTIONING,	// the bidder may raise the bid on the property up for auction
+			ChoosingTax=GAME_STAGE_TAX,	// the current player chooses how to pay income tax
+			Owing=GAME_STAGE_OWING,	// the current player must raise money to pay debts, or go bankrupt
+			Ending=GAME_STAGE_ENDING,	// the current player may manage property, then ends the turn
+			Over=GAME_STAGE_OVER	// the game has a winner
+		};
+
+		/// Actions a player can take, numbered as in the protocol.
+		enum Action {
+			Roll=GAME_ACT_ROLL,	// roll the dice and move
+			Buy=GAME_ACT_BUY,	// buy the property on offer
+			Decline=GAME_ACT_DECLINE,	// put the property on offer up for auction
+			Bid=GAME_ACT_BID,	// bid an amount in the current auction
+			Pass=GAME_ACT_PASS,	// drop out of the current auction
+			Build=GAME_ACT_BUILD,	// build a house on a space
+			Sell=GAME_ACT_SELL,	// sell a house from a space
+			Mortgage=GAME_ACT_MORTGAGE,	// mortgage a space
+			Unmortgage=GAME_ACT_UNMORTGAGE,	// lift the mortgage on a space
+			PayBail=GAME_ACT_PAY_BAIL,	// pay to get out of jail
+			UseJailCard=GAME_ACT_JAIL_CARD,	// use a card to get out of jail
+			PayFlatTax=GAME_ACT_FLAT_TAX,	// pay the fixed income tax
+			PayPercentTax=GAME_ACT_PERCENT_TAX,	// pay a tenth of total worth as income tax
+			PayDebt=GAME_ACT_PAY_DEBT,	// pay off all debts
+			DeclareBankrupt=GAME_ACT_BANKRUPT,	// give up
+			EndTurn=GAME_ACT_END_TURN	// pass the dice to the next player
+		};
+
+		/// Changes reported to the clients, numbered as in the protocol.
+		enum EventType {
+			TurnBegan=GAME_EV_TURN,	// player's turn began, with amount being the round number
+			DiceRolled=GAME_EV_DICE,	// player rolled arg and amount
+			Moved=GAME_EV_MOVED,	// player moved to space arg
+			MoneyChanged=GAME_EV_MONEY,	// player now has amount in cash
+			OwnerChanged=GAME_EV_OWNER,	// space arg now belongs to player, or the bank if none
+			Offered=GAME_EV_OFFER,	// player may buy space arg for amount
+			AuctionBid=GAME_EV_AUCTION,	// player is up to bid on space arg, with amount being the highest bid
+			HousesChanged=GAME_EV_HOUSES,	// space arg now has amount houses, five being a hotel
+			MortgageChanged=GAME_EV_MORTGAGE,	// space arg is now mortgaged if amount is one
+			CardDrawn=GAME_EV_CARD,	// player drew card amount from deck arg
+			Jailed=GAME_EV_JAILED,	// player went to jail
+			Released=GAME_EV_RELEASED,	// player got out of jail
+			JailCardsChanged=GAME_EV_JAIL_CARDS,	// player now holds amount get out of jail cards
+			DebtOwed=GAME_EV_DEBT,	// player owes amount and must raise money
+			TaxChoice=GAME_EV_TAX_CHOICE,	// player must choose how to pay income tax
+			WentBankrupt=GAME_EV_BANKRUPT,	// player went bankrupt
+			GameEnded=GAME_EV_GAME_OVER,	// player won the game
+			Waiting=GAME_EV_WAITING	// player is expected to act next, with arg being the stage
+		};
+
+		/// A change to the game, as reported to clients.
+		struct Event {
+			/// The type of event.
+			uint8_t type;
+
+			/// The seat of the player the event is about, or -1 for none.
+			int8_t player;
+
+			/// The space, die or deck the event refers to.
+			uint8_t arg;
+
+			/// The amount of money, or other count, the event refers to.
+			int32_t amount;
+		};
+
+		/// State of a single player.
+		struct PlayerState {
+			/// Cash in hand.
+			int32_t money;
+
+			/// The space the player's token is on.
+			uint8_t position;
+
+			/// Turns spent in jail so far.
+			uint8_t jailTurns;
+
+			/// Get out of jail free cards held.
+			uint8_t jailCards;
+
+			/// Whether the player is in jail.
+			bool inJail;
+
+			/// Whether the player is out of the game.
+			bool bankrupt;
+		};
+
+	public:
+		/// Creates a game that has yet to start.
+		Game();
+
+		/**
+		 * Sets up the board and begins the first turn.
+		 *
+		 * @param order Seats in the order they take turns.
+		 * @param maxRounds Rounds to play before the richest player wins, or 0 for no limit.
+		 * @param freeParkReward Money the bank pays for landing on Free Parking.
+		 * @param incomeTaxChoice Whether players may pay a tenth of their worth as income tax.
+		 * @param redistribute Whether a bankrupt player's property is dealt out to the other
+		 * players at random, instead of being returned to the bank.
+		 */
+		void start(const int order[GAME_PLAYERS], int maxRounds, int freeParkReward, bool incomeTaxChoice, bool redistribute);
+
+		/**
+		 * Takes an action on behalf of a player.
+		 *
+		 * @param seat The player's seat.
+		 * @param action The action.
+		 * @param arg The space for property actions.
+		 * @param amount The amount for bids.
+		 * @return true if the action was taken, false if it is not allowed.
+		 */
+		bool act(int seat, const Action &action, int arg=0, int amount=0);
+
+		/**
+		 * Makes a sensible decision for the player the game is waiting on.
+		 * This is used for computer players, and for humans who run out of time.
+		 */
+		void playDefault();
+
+		/**
+		 * Returns the seat of the player the game is waiting on.
+		 *
+		 * @return The seat, or -1 if the game is not running.
+		 */
+		int getDecider() const;
+
+		/**
+		 * Returns the point of the turn the game is at.
+		 *
+		 * @return The current stage.
+		 */
+		Stage getStage() const { return m_Stage; }
+
+		/**
+		 * Returns the seat of the winner.
+		 *
+		 * @return The seat, or -1 if the game is not over.
+		 */
+		int getWinner() const { return m_Winner; }
+
+		/**
+		 * Returns the state of a player.
+		 *
+		 * @param seat The player's seat.
+		 * @return The player's state.
+		 */
+		const PlayerState& getPlayer(int seat) const { return m_Players[seat]; }
+
+		/**
+		 * Finds the owner of a space.
+		 *
+		 * @param space The space.
+		 * @return The owner's seat, or -1 if the bank owns the space.
+		 */
+		int getOwner(int space) const;
+
+		/**
+		 * Returns a player's total worth: cash, printed property prices and buildings.
+		 *
+		 * @param seat The player's seat.
+		 * @return The amount of money.
+		 */
+		int getWorth(int seat) const;
+
+		/**
+		 * Returns the total amount of money the current player owes.
+		 *
+		 * @return The amount of money.
+		 */
+		int getDebt() const;
+
+		/**
+		 * Checks if a house can be built on a space by its owner.
+		 *
+		 * @param seat The player's seat.
+		 * @param space The space.
+		 * @return true if so, false otherwise.
+		 */
+		bool canBuild(int seat, int space) const;
+
+		/**
+		 * Checks if a house can be sold back to the bank from a space.
+		 *
+		 * @param seat The player's seat.
+		 * @param space The space.
+		 * @return true if so, false otherwise.
+		 */
+		bool canSell(int seat, int space) const;
+
+		/**
+		 * Checks if a space can be mortgaged.
+		 *
+		 * @param seat The player's seat.
+		 * @param space The space.
+		 * @return true if so, false otherwise.
+		 */
+		bool canMortgage(int seat, int space) const;
+
+		/**
+		 * Checks if the mortgage on a space can be lifted.
+		 *
+		 * @param seat The player's seat.
+		 * @param space The space.
+		 * @return true if so, false otherwise.
+		 */
+		bool canUnmortgage(int seat, int space) const;
+
+		/**
+		 * Returns the space up for sale or auction.
+		 *
+		 * @return The space.
+		 */
+		int getOffer() const { return m_Offer; }
+
+		/**
+		 * Returns the highest bid in the current auction.
+		 *
+		 * @return The amount of money.
+		 */
+		int getHighBid() const { return m_HighBid; }
+
+		/**
+		 * Returns the round being played.
+		 *
+		 * @return The round number, starting at 1.
+		 */
+		int getRound() const { return m_Round; }
+
+		/**
+		 * Seeds the dice and card shuffles.
+		 *
+		 * @param seed The seed.
+		 */
+		void seed(uint64_t seed) { m_Random.seed(seed); }
+
+		/**
+		 * Turns event recording off or on, such as for simulating games that nobody watches.
+		 *
+		 * @param quiet true to stop recording events, false to record them.
+		 */
+		void setQuiet(bool quiet) { m_Quiet=quiet; }
+
+		/**
+		 * Saves the state of the game, leaving out recorded events.
+		 *
+		 * @param snap The snapshot to write to.
+		 */
+		void save(Snapshot &snap) const;
+
+		/**
+		 * Picks up a game saved by save(), replacing the state of this one.
+		 *
+		 * @param snap The snapshot to read from.
+		 * @return true if the saved state is valid, false otherwise.
+		 */
+		bool load(Snapshot &snap);
+
+		/**
+		 * Returns the events recorded since the last call to clearEvents().
+		 *
+		 * @return A pointer to the first event.
+		 */
+		const Event* getEvents() const { return m_Events; }
+
+		/**
+		 * Returns the number of events recorded since the last call to clearEvents().
+		 *
+		 * @return The number of events.
+		 */
+		int getEventCount() const { return m_NumEvents; }
+
+		/// Forgets the recorded events.
+		void clearEvents() { m_NumEvents=0; }
+
+	private:
+		/**
+		 * Returns the seat of the player whose turn it is.
+		 *
+		 * @return The seat.
+		 */
+		int getCurrent() const { return m_Order[m_Turn]; }
+
+		/**
+		 * Records an event.
+		 *
+		 * @param type The type of event.
+		 * @param player The player the event is about, or -1.
+		 * @param arg The space, die or deck.
+		 * @param amount The amount.
+		 */
+		void emit(const EventType &type, int player, int arg, int amount);
+
+		/**
+		 * Draws a random number within the given range.
+		 *
+		 * @param low The lower bound.
+		 * @param high The upper bound.
+		 * @return The number.
+		 */
+		int draw(int low, int high);
+
+		/**
+		 * Gives money to, or takes money from, a player.
+		 *
+		 * @param seat The player's seat.
+		 * @param delta The amount of money to add.
+		 */
+		void addMoney(int seat, int delta);
+
+		/**
+		 * Charges the current player an amount, payable when the move is resolved.
+		 *
+		 * @param creditor The seat of the player to pay, or -1 for the bank.
+		 * @param amount The amount of money.
+		 */
+		void owe(int creditor, int amount);
+
+		/**
+		 * Moves a player's token, collecting salary if it passes Go.
+		 *
+		 * @param seat The player's seat.
+		 * @param space The space to move to.
+		 * @param forward true if the token moves forward, false if it moves back.
+		 */
+		void moveTo(int seat, int space, bool forward);
+
+		/**
+		 * Resolves the space the current player landed on.
+		 *
+		 * @param rentFactor Multiplier for rent, as set by cards, or 0 for normal rent.
+		 */
+		void land(int rentFactor);
+
+		/**
+		 * Applies the card on top of a deck for the current player.
+		 *
+		 * @param deck The deck to draw from.
+		 */
+		void drawCard(int deck);
+
+		/**
+		 * Works out the rent due on a space.
+		 *
+		 * @param space The space.
+		 * @param rentFactor Multiplier for rent, as set by cards, or 0 for normal rent.
+		 * @return The rent.
+		 */
+		int getRent(int space, int rentFactor) const;
+
+		/**
+		 * Sends a player to jail.
+		 *
+		 * @param seat The player's seat.
+		 */
+		void sendToJail(int seat);
+
+		/**
+		 * Gets a player out of jail.
+		 *
+		 * @param seat The player's seat.
+		 */
+		void release(int seat);
+
+		/**
+		 * Pays what the current player owes if possible, then lets the turn carry on.
+		 */
+		void proceed();
+
+		/**
+		 * Gives the dice to the next player still in the game.
+		 */
+		void nextTurn();
+
+		/**
+		 * Moves the auction on to the next bidder, or closes it.
+		 */
+		void nextBidder();
+
+		/**
+		 * Removes the current player from the game, settling debts as far as possible.
+		 */
+		void bankrupt();
+
+		/**
+		 * Ends the game.
+		 *
+		 * @param winner The seat of the winner.
+		 */
+		void finish(int winner);
+
+		/// The players, by seat.
+		PlayerState m_Players[GAME_PLAYERS];
+
+		/// Seats in turn order.
+		uint8_t m_Order[GAME_PLAYERS];
+
+		/// Index into m_Order of the player whose turn it is.
+		int m_Turn;
+
+		/// Spaces owned by each player.
+		uint64_t m_Owned[GAME_PLAYERS];
+
+		/// Spaces that are mortgaged.
+		uint64_t m_Mortgaged;
+
+		/// Houses on each space, five being a hotel.
+		uint8_t m_Houses[BOARD_SPACES];
+
+		/// Houses the bank has left to sell.
+		int m_BankHouses;
+
+		/// Hotels the bank has left to sell.
+		int m_BankHotels;
+
+		/// Both decks of cards, as indices into Board::Cards.
+		uint8_t m_Deck[2][BOARD_DECK_SIZE];
+
+		/// The next card to draw from each deck.
+		uint8_t m_DeckTop[2];
+
+		/// The seat holding each deck's get out of jail card, or -1.
+		int8_t m_JailCardHolder[2];
+
+		/// The point of the turn the game is at.
+		Stage m_Stage;
+
+		/// The last dice rolled.
+		uint8_t m_Dice[2];
+
+		/// Doubles rolled in a row this turn.
+		uint8_t m_Doubles;
+
+		/// Whether the current player gets to roll again.
+		bool m_Again;
+
+		/// The space up for sale or auction.
+		uint8_t m_Offer;
+
+		/// Bitmask of seats still bidding in the auction.
+		uint8_t m_Bidders;
+
+		/// Seat of the player who is up to bid.
+		int8_t m_Bidder;
+
+		/// Seat of the highest bidder, or -1.
+		int8_t m_Leader;
+
+		/// The highest bid.
+		int32_t m_HighBid;
+
+		/// Money the current player owes each seat, and the bank last.
+		int32_t m_Owed[GAME_PLAYERS+1];
+
+		/// Full rounds played so far.
+		int m_Round;
+
+		/// Rounds to play, or 0 for no limit.
+		int m_MaxRounds;
+
+		/// Money paid for landing on Free Parking.
+		int m_FreeParkReward;
+
+		/// Whether players may pay a tenth of their worth as income tax.
+		bool m_IncomeTaxChoice;
+
+		/// Whether bankrupt players' property is dealt out to others.
+		bool m_Redistribute;
+
+		/// The winner, or -1.
+		int m_Winner;
+
+		/// Rolls the dice and picks cards.
+		Random m_Random;
+
+		/// Whether events are being dropped.
+		bool m_Quiet;
+
+		/// Events recorded since they were last cleared.
+		Event m_Events[GAME_MAX_EVENTS];
+
+		/// The number of recorded events.
+		int m_NumEvents;
+};
+
+#endif
@@ -19,25 +19,33 @@
  ***************************************************************************/
  // gameserver.cpp: main entry point into the program.
  
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <csignal>
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
  
 #include "configfile.h"
 #include "gameserver.h"
+#include "lobbylink.h"
 #include "protspec.h"
 #include "room.h"
 #include "roomengine.h"
 #include "serversocket.h"
+#include "taskpool.h"
  
 // globals
 ConfigFile *g_ConfigFile=NULL;
 RoomEngine *g_Engine=NULL;
+LobbyLink *g_Link=NULL;
+TaskPool *g_Pool=NULL;
 
 void* connectionHandler(void*);
 void handleClientConnection(Packet &p, ServerSocket::Client*);
-void handleLobbyServerConnection(Packet &p, ServerSocket::Client*);
 
 void* connectionHandler(void *arg) {
 	ServerSocket::Client *data=(ServerSocket::Client*) arg;
@@ -59,10 +67,6 @@ void* connectionHandler(void *arg) {
 		handleClientConnection(p, data);
 	}
 
-	// the parent lobby server is attempting to connect
-	else if (header==CONN_LOBBY)
-		handleLobbyServerConnection(p, data);
-
 	else {
 		std::cout << "Rejecting connection from " << data->getIP() << " (unknown source)\n";
 		close(socket);
@@ -72,55 +76,6 @@ void* connectionHandler(void *arg) {
 	pthread_exit(0);
 }
 
-void handleLobbyServerConnection(Packet &p, ServerSocket::Client *data) {
-	int socket=data->getSocket();
-
-	// verify that this is an authentic connection
-	if (data->getIP()!=g_ConfigFile->getLobbyServerIP()) {
-		std::cout << "Warning: rejecting unauthorized lobby server connection from: " << data->getIP() << std::endl;
-		close(socket);
-
-		return;
-	}
-
-	std::cout << "Accepted lobby server connection on " << data->getIP() << ":" << data->getPort() << std::endl;
-
-	// determine the lobby server's request
-	uint8_t request=p.byte();
-
-	// open a new room on this server
-	if (request==IS_OPENROOM) {
-		// gather data from the packet
-		int gid=p.uint32();
-		std::string owner=p.string();
-		char onlyFriends=p.byte();
-		int maxTurns=p.uint32();
-		int maxHumans=p.uint16();
-		int freeParkReward=p.uint32();
-		char incomeTaxChoice=p.byte();
-		char propMethod=p.byte();
-
-		// translate packet bytes to enums
-		Room::Rules::RedistMethod rmethod;
-		if (propMethod==PROP_RANDOM)
-			rmethod=Room::Rules::RandomToPlayers;
-		else
-			rmethod=Room::Rules::ReturnToBank;
-
-		// allocate a new room
-		Room *room=new Room(gid, owner);
-		Room::Rules rules(maxTurns, maxHumans, freeParkReward, (incomeTaxChoice==0x01), rmethod);
-
-		room->setRules(rules);
-		RoomEngine::instance()->openRoom(room);
-
-		std::cout << "Opened a room with gid " << gid << std::endl;
-	}
-
-	std::cout << "Disconnected lobby server connection on socket " << socket << std::endl;
-	close(socket);
-}
-
 void handleClientConnection(Packet &p, ServerSocket::Client *data) {
 	int socket=data->getSocket();
 
@@ -128,14 +83,24 @@ void handleClientConnection(Packet &p, ServerSocket::Client *data) {
 	std::string username=p.string();
 	int gid=p.uint32();
 
+	// clients coming back to a seat also send its session token, and how many game events they already have
+	uint64_t token=p.uint32();
+	token|=((uint64_t) p.uint32())<<32;
+	uint32_t seen=p.uint32();
+
 	std::cout << username << " wants to join room " << gid << std::endl;
 
 	std::string error;
-	if (!RoomEngine::instance()->addPlayerToRoom(gid, username, socket, error)) {
+	if (!RoomEngine::instance()->addPlayerToRoom(gid, username, socket, token, seen, error)) {
 		std::cout << "ERROR: " << error << std::endl;
 	}
 }
 
+void drainHandler(int sig) {
+	// the lobby link notices and starts moving rooms away
+	RoomEngine::instance()->setDraining();
+}
+
 int main(int argc, char *argv[]) {
 	// parse the config file
 	g_ConfigFile=new ConfigFile("config.xml");
@@ -155,10 +120,41 @@ int main(int argc, char *argv[]) {
 
 	std::cout << "[done]\n";
 
+	// every room logs its games here, so there is no running without it, unless
+	// logging was turned off with an empty path
+	std::string replays=g_ConfigFile->getReplayPath();
+	if (!replays.empty()) {
+		std::cout << "Preparing replay directory...\t";
+
+		if (mkdir(replays.c_str(), 0755)==-1 && errno!=EEXIST) {
+			std::cout << "[fail]\n";
+			std::cout << "Unable to create " << replays << ": " << strerror(errno) << std::endl;
+
+			exit(1);
+		}
+
+		std::cout << "[done]\n";
+	}
+
+	std::cout << "Creating task pool...\t\t";
+
+	// create the pool that computer players run their rollouts on
+	g_Pool=new TaskPool();
+	if (!g_Pool->start()) {
+		std::cout << "[fail]\n";
+		exit(1);
+	}
+
+	std::cout << "[done]\n";
+
 	std::cout << "Creating room engine...\t";
 
-	// create the room engine
+	// create the room engine, along with the workers that run its rooms
 	g_Engine=new RoomEngine();
+	if (!g_Engine->start()) {
+		std::cout << "[fail]\n";
+		exit(1);
+	}
 
 	std::cout << "[done]\n";
 
@@ -180,6 +176,20 @@ int main(int argc, char *argv[]) {
 
 	std::cout << "[done]\n";
 
+	std::cout << "Starting lobby server link...\t";
+
+	// the lobby server sends us rooms over this link, and we keep it up to date on how busy we are
+	g_Link=new LobbyLink();
+	if (!g_Link->start()) {
+		std::cout << "[fail]\n";
+		exit(1);
+	}
+
+	std::cout << "[done]\n";
+
+	// SIGUSR1 moves all games to other servers, so this one can be taken down
+	signal(SIGUSR1, drainHandler);
+
 	// print out some status messages
 	std::cout << "Tyranny Game Server " << GAME_SERVER_VERSION << " running...\n";
 
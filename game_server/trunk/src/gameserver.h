@@ -25,6 +25,12 @@
  
  // the current version of the server
  #define GAME_SERVER_VERSION	"0.1"
+
+// seconds between load reports sent to the lobby server
+#define GAME_SERVER_REPORT_INTERVAL	5
+
+// seconds between attempts to move rooms away while the server is drained
+#define GAME_SERVER_DRAIN_INTERVAL	5
  
 /**
  * Callback for handling client connections.
@@ -32,14 +38,6 @@
  */
 void* connectionHandler(void *arg);
 
-/**
- * Handles dealing with a connection from a lobby server.
- *
- * @param p The initial packet sent by the server.
- * @param socket The socket the lobby server is connecting to.
- */
-void handleLobbyServerConnection(Packet &p, int socket);
-
 /**
  * Handles dealing with a connection from a client.
  *
@@ -47,6 +45,13 @@ void handleLobbyServerConnection(Packet &p, int socket);
  * @param socket The socket the client is connecting to.
  */
 void handleClientConnection(Packet &p, int socket);
+
+/**
+ * Starts draining the server when it receives SIGUSR1.
+ *
+ * @param sig The signal number.
+ */
+void drainHandler(int sig);
  
  #endif
  
@@ -23,9 +23,11 @@
 #include "packet.h"
 #include "protspec.h"
 
-Human::Human(const std::string &username, int socket): Player(username) {
+Human::Human(const std::string &username, int socket): Player(username, HumanPlayer) {
 	m_Protocol=new Protocol(socket);
 	m_Accepted=false;
+	m_Token=0;
+	m_EventsSeen=0;
 }
 
 Human::~Human() {
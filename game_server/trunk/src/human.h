@@ -23,6 +23,7 @@
 #define HUMAN_H
 
 #include <iostream>
+#include <stdint.h>
 
 #include "player.h"
 #include "protocol.h"
@@ -47,11 +48,6 @@ class Human: public Player {
 		/// Frees memory used by this object.
 		virtual ~Human();
 
-		/**
-		 * Returns the runtime type identifier for this object.
-		 */
-		virtual std::string rtti() const { return "Human"; }
-
 		/**
 		 * Returns the player's protocol handler.
 		 *
@@ -73,12 +69,44 @@ class Human: public Player {
 		 */
 		bool isAccepted() const { return m_Accepted; }
 
+		/**
+		 * Sets the token the player presented to reclaim a seat.
+		 * @param token The token, or 0 for a new player.
+		 */
+		void setToken(uint64_t token) { m_Token=token; }
+
+		/**
+		 * Returns the token the player presented to reclaim a seat.
+		 * @return The token, or 0 for a new player.
+		 */
+		uint64_t getToken() const { return m_Token; }
+
+		/**
+		 * Sets the number of game events the player's client had received before it
+		 * reconnected.
+		 * @param count The number of events.
+		 */
+		void setEventsSeen(uint32_t count) { m_EventsSeen=count; }
+
+		/**
+		 * Returns the number of game events the player's client had received before it
+		 * reconnected.
+		 * @return The number of events.
+		 */
+		uint32_t getEventsSeen() const { return m_EventsSeen; }
+
 	private:
 		/// The communications protocol.
 		Protocol *m_Protocol;
 
 		/// Flags whether the player has been accepted to join by room owner.
 		bool m_Accepted;
+
+		/// Token presented to reclaim a seat, or 0.
+		uint64_t m_Token;
+
+		/// Game events the client had received before reconnecting.
+		uint32_t m_EventsSeen;
 };
 
 #endif
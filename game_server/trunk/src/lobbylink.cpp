@@ -0,0 +1,356 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// lobbylink.cpp: implementation of the LobbyLink class.
+
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clientsocket.h"
+#include "configfile.h"
+#include "gameserver.h"
+#include "lobbylink.h"
+#include "protspec.h"
+#include "room.h"
+#include "roomengine.h"
+
+LobbyLink *g_LobbyLink=NULL;
+
+LobbyLink::LobbyLink() {
+	m_Socket=-1;
+	m_LastHeard=0;
+
+	m_CPUs=sysconf(_SC_NPROCESSORS_ONLN);
+	if (m_CPUs<1)
+		m_CPUs=1;
+
+	g_LobbyLink=this;
+}
+
+LobbyLink* LobbyLink::instance() {
+	return g_LobbyLink;
+}
+
+bool LobbyLink::start() {
+	return (pthread_create(&m_Thread, NULL, &LobbyLink::linkProcess, this)==0);
+}
+
+void LobbyLink::sendKillRoom(int gid) {
+	lock();
+
+	Packet p;
+	p.addByte(IS_KILLROOM);
+	p.addUint32(gid);
+
+	// hold on to it until the link is back up
+	if (!send(p))
+		m_Closed.push_back(gid);
+
+	unlock();
+}
+
+void LobbyLink::sendMigrateRoom(int gid, const std::string &snapshot) {
+	lock();
+
+	Packet p;
+	p.addByte(IS_MIGRATEROOM);
+	p.addUint32(gid);
+	p.addString(snapshot);
+
+	// if the link is down, the room gives up waiting and plays on here
+	send(p);
+
+	unlock();
+}
+
+void LobbyLink::sendKeepRoom(int gid, const std::string &host, int port) {
+	lock();
+
+	Packet p;
+	p.addByte(IS_KEEPROOM);
+	p.addUint32(gid);
+	p.addString(host);
+	p.addUint32(port);
+
+	send(p);
+
+	unlock();
+}
+
+void* LobbyLink::linkProcess(void *arg) {
+	LobbyLink *link=(LobbyLink*) arg;
+	link->run();
+
+	pthread_exit(0);
+}
+
+void LobbyLink::run() {
+	while(1) {
+		if (connect()) {
+			serve();
+
+			lock();
+			close(m_Socket);
+			m_Socket=-1;
+			unlock();
+
+			std::cout << "Lost control link to lobby server" << std::endl;
+		}
+
+		sleep(LOBBYLINK_RETRY_INTERVAL);
+	}
+}
+
+bool LobbyLink::connect() {
+	ConfigFile *cfg=ConfigFile::instance();
+
+	ClientSocket cl;
+	try {
+		cl.connect(cfg->getLobbyServerIP(), cfg->getLobbyServerPort());
+	}
+
+	catch (const ClientSocket::Exception &ex) {
+		std::cout << "Unable to connect to lobby server: " << ex.getMessage() << std::endl;
+		if (cl.getFD()!=-1)
+			close(cl.getFD());
+
+		return false;
+	}
+
+	// introduce ourselves, so the lobby knows which of its servers this is
+	Packet p;
+	p.addByte(CONN_GAME);
+	p.addByte(IS_HELLO);
+	p.addString(cfg->getID());
+	if (!p.write(cl.getFD())) {
+		close(cl.getFD());
+		return false;
+	}
+
+	lock();
+	m_Socket=cl.getFD();
+	m_LastHeard=time(NULL);
+
+	// catch the lobby up on rooms that closed while we were away
+	std::vector<int> closed;
+	closed.swap(m_Closed);
+	for (int i=0; i<closed.size(); i++) {
+		Packet kp;
+		kp.addByte(IS_KILLROOM);
+		kp.addUint32(closed[i]);
+
+		if (!send(kp))
+			m_Closed.push_back(closed[i]);
+	}
+
+	unlock();
+
+	std::cout << "Established control link to lobby server" << std::endl;
+
+	return true;
+}
+
+void LobbyLink::serve() {
+	time_t lastBeat=0, lastReport=0, lastDrain=0;
+
+	while(1) {
+		// wake up at least once a second to keep the link alive
+		Packet p;
+		Packet::Result res=p.timedRead(m_Socket, 1, 0);
+		if (res==Packet::Disconnected || res==Packet::DataCorrupt)
+			return;
+
+		time_t now=time(NULL);
+		if (res==Packet::NoError) {
+			m_LastHeard=now;
+
+			uint8_t action=p.byte();
+			switch(action) {
+				case IS_OPENROOM: handleOpenRoom(p); break;
+				case IS_ADOPTROOM: handleAdoptRoom(p); break;
+				case IS_MIGRATED: handleMigrated(p); break;
+				case IS_DROPROOM: handleDropRoom(p); break;
+				default: break;
+			}
+		}
+
+		if (now-m_LastHeard>LOBBYLINK_TIMEOUT) {
+			std::cout << "Lobby server stopped responding" << std::endl;
+			return;
+		}
+
+		if (now-lastBeat>=LOBBYLINK_HEARTBEAT_INTERVAL) {
+			Packet hb;
+			hb.addByte(IS_HEARTBEAT);
+
+			lock();
+			send(hb);
+			unlock();
+
+			lastBeat=now;
+		}
+
+		if (now-lastReport>=GAME_SERVER_REPORT_INTERVAL) {
+			sendLoadReport();
+			lastReport=now;
+		}
+
+		// keep moving rooms away until none are left, since some only become movable once their game starts
+		if (RoomEngine::instance()->isDraining() && now-lastDrain>=GAME_SERVER_DRAIN_INTERVAL) {
+			RoomEngine::instance()->migrateRooms();
+			lastDrain=now;
+		}
+	}
+}
+
+void LobbyLink::handleOpenRoom(Packet &p) {
+	// gather data from the packet
+	uint32_t id=p.uint32();
+	int gid=p.uint32();
+	std::string owner=p.string();
+
+	// the lobby decides who may join, so the friends-only flag is of no use here
+	p.byte();
+
+	int maxTurns=p.uint32();
+	int maxHumans=p.uint16();
+	int freeParkReward=p.uint32();
+	char incomeTaxChoice=p.byte();
+	char propMethod=p.byte();
+
+	// translate packet bytes to enums
+	Room::Rules::RedistMethod rmethod;
+	if (propMethod==PROP_RANDOM)
+		rmethod=Room::Rules::RandomToPlayers;
+	else
+		rmethod=Room::Rules::ReturnToBank;
+
+	// allocate a new room
+	Room *room=new Room(gid, owner);
+	Room::Rules rules(maxTurns, maxHumans, freeParkReward, (incomeTaxChoice==0x01), rmethod);
+	room->setRules(rules);
+
+	Packet r;
+	r.addByte(IS_RESPONSE);
+	r.addUint32(id);
+
+	std::string error;
+	if (RoomEngine::instance()->openRoom(room, error)) {
+		std::cout << "Opened a room with gid " << gid << std::endl;
+
+		r.addByte(PKT_SUCCESS);
+		r.addString("");
+	}
+
+	else {
+		delete room;
+
+		r.addByte(PKT_ERROR);
+		r.addString(error);
+	}
+
+	lock();
+	send(r);
+	unlock();
+}
+
+void LobbyLink::handleAdoptRoom(Packet &p) {
+	uint32_t id=p.uint32();
+	std::string snapshot=p.string();
+
+	Packet r;
+	r.addByte(IS_RESPONSE);
+	r.addUint32(id);
+
+	std::string error;
+	Room *room=Room::restore(snapshot);
+	if (!room)
+		error="The room snapshot is invalid.";
+
+	else if (!RoomEngine::instance()->openRoom(room, error)) {
+		delete room;
+		room=NULL;
+	}
+
+	if (room) {
+		std::cout << "Adopted room with gid " << room->getGid() << std::endl;
+
+		r.addByte(PKT_SUCCESS);
+		r.addString("");
+	}
+
+	else {
+		r.addByte(PKT_ERROR);
+		r.addString(error);
+	}
+
+	lock();
+	send(r);
+	unlock();
+}
+
+void LobbyLink::handleMigrated(Packet &p) {
+	int gid=p.uint32();
+	bool moved=(p.byte()==PKT_SUCCESS);
+	std::string host=p.string();
+	int port=p.uint32();
+
+	RoomEngine::instance()->finishMigration(gid, moved, host, port);
+}
+
+void LobbyLink::handleDropRoom(Packet &p) {
+	RoomEngine::instance()->dropRoom(p.uint32());
+}
+
+void LobbyLink::sendLoadReport() {
+	int rooms, players;
+	RoomEngine::instance()->getLoad(rooms, players);
+
+	// the one minute load average, as a share of all processors
+	double avg=0;
+	getloadavg(&avg, 1);
+
+	int cpu=(int) (avg*100/m_CPUs);
+	if (cpu>100)
+		cpu=100;
+
+	Packet p;
+	p.addByte(IS_LOADREPORT);
+	p.addUint16(rooms);
+	p.addUint16(players);
+	p.addByte(cpu);
+
+	lock();
+	send(p);
+	unlock();
+}
+
+bool LobbyLink::send(Packet &p) {
+	if (m_Socket==-1)
+		return false;
+
+	// wake the link thread, which notices the broken link and reconnects
+	if (!p.write(m_Socket)) {
+		shutdown(m_Socket, SHUT_RDWR);
+		return false;
+	}
+
+	return true;
+}
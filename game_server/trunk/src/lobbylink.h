@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// lobbylink.h: definition of the LobbyLink class.
+
+#ifndef LOBBYLINK_H
+#define LOBBYLINK_H
+
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include "lockable.h"
+#include "packet.h"
+
+/// Seconds between heartbeats sent to the lobby server.
+#define LOBBYLINK_HEARTBEAT_INTERVAL	1
+
+/// Seconds the lobby server may stay silent before the link is considered dead.
+#define LOBBYLINK_TIMEOUT				5
+
+/// Seconds to wait before reconnecting a lost link.
+#define LOBBYLINK_RETRY_INTERVAL		2
+
+/**
+ * The control link to the lobby server.
+ * Rather than opening a new connection for every message, the game server keeps one
+ * connection to the lobby open for as long as it runs. The lobby sends requests to
+ * open rooms over it, each tagged with an id that is echoed back in the response,
+ * and the game server uses it to send heartbeats, load reports and rooms that have
+ * closed. Either side drops the link if the other stays silent for too long, after
+ * which the game server reconnects.
+ *
+ * Rooms that close while the link is down are remembered and reported as soon as
+ * it is back up.
+ *
+ * Rooms are moved between game servers over the link as well. A room to be moved is
+ * sent to the lobby as a snapshot, which the lobby hands to another server to adopt,
+ * and the lobby then tells the old server where the room went.
+ */
+class LobbyLink: public Lockable {
+	public:
+		/// Creates a link that is not yet connected.
+		LobbyLink();
+
+		/**
+		 * Returns the first instance of this class.
+		 *
+		 * @return A pointer to a LobbyLink object.
+		 */
+		static LobbyLink* instance();
+
+		/**
+		 * Starts the thread that connects to the lobby server and serves the link.
+		 *
+		 * @return true if the thread was started, false otherwise.
+		 */
+		bool start();
+
+		/**
+		 * Tells the lobby server that a room has closed.
+		 * This method may be called from any thread.
+		 *
+		 * @param gid The room's id number.
+		 */
+		void sendKillRoom(int gid);
+
+		/**
+		 * Asks the lobby server to move a room to another game server.
+		 * This method may be called from any thread.
+		 *
+		 * @param gid The room's id number.
+		 * @param snapshot The saved room.
+		 */
+		void sendMigrateRoom(int gid, const std::string &snapshot);
+
+		/**
+		 * Tells the lobby server that a room it moved to another game server played on
+		 * here after all, so it should take the room back.
+		 * This method may be called from any thread.
+		 *
+		 * @param gid The room's id number.
+		 * @param host The host of the server the room was moved to.
+		 * @param port The port of the server the room was moved to.
+		 */
+		void sendKeepRoom(int gid, const std::string &host, int port);
+
+	private:
+		/**
+		 * Entry point for the link thread.
+		 *
+		 * @param arg Pointer to the link.
+		 */
+		static void* linkProcess(void *arg);
+
+		/**
+		 * Connects and serves the link, reconnecting whenever it fails.
+		 */
+		void run();
+
+		/**
+		 * Connects to the lobby server and introduces this game server.
+		 *
+		 * @return true if the link is up, false otherwise.
+		 */
+		bool connect();
+
+		/**
+		 * Handles requests and keeps the link alive until it fails.
+		 */
+		void serve();
+
+		/**
+		 * Handles a request from the lobby server to open a room.
+		 *
+		 * @param p The packet to parse.
+		 */
+		void handleOpenRoom(Packet &p);
+
+		/**
+		 * Handles a request from the lobby server to take over a room moved from
+		 * another game server.
+		 *
+		 * @param p The packet to parse.
+		 */
+		void handleAdoptRoom(Packet &p);
+
+		/**
+		 * Handles the lobby server's word on where one of our rooms was moved to.
+		 *
+		 * @param p The packet to parse.
+		 */
+		void handleMigrated(Packet &p);
+
+		/**
+		 * Handles the lobby server's word that a room we took over went elsewhere.
+		 *
+		 * @param p The packet to parse.
+		 */
+		void handleDropRoom(Packet &p);
+
+		/**
+		 * Tells the lobby server how busy this server is.
+		 */
+		void sendLoadReport();
+
+		/**
+		 * Writes a packet to the link. If the write fails, the link is torn down.
+		 * The link must be locked.
+		 *
+		 * @param p The packet to send.
+		 * @return true if the packet was sent, false otherwise.
+		 */
+		bool send(Packet &p);
+
+		/// The socket of the link, or -1 if it is down.
+		int m_Socket;
+
+		/// Rooms that closed while the link was down.
+		std::vector<int> m_Closed;
+
+		/// When a packet last arrived from the lobby server.
+		time_t m_LastHeard;
+
+		/// Number of processors, for scaling the load average.
+		int m_CPUs;
+
+		/// The link thread.
+		pthread_t m_Thread;
+};
+
+#endif
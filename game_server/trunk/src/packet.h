@@ -128,12 +128,35 @@ class Packet {
 		 * Returns a variable length string from the packet.
 		 */
 		std::string string();
+
+		/**
+		 * Packs the size header into the internal buffer and returns the complete
+		 * frame, ready to be written to a socket. The frame is length() bytes long.
+		 *
+		 * @return A pointer to the raw frame.
+		 */
+		const uint8_t* pack();
+
+		/**
+		 * Returns the size of the complete frame, including the two size bytes.
+		 */
+		int length() const { return m_Size+2; }
+
+		/**
+		 * Loads a complete frame, as received from the network, into this packet.
+		 * The read position is reset so that the first call to byte() returns the header.
+		 *
+		 * @param frame The raw frame, starting with the two size bytes.
+		 * @param length The length of the frame, in bytes.
+		 * @return true if the frame was loaded, false if it is malformed or too large.
+		 */
+		bool assign(const uint8_t *frame, int length);
 		
 		/**
 		 * Writes the packet's internal buffer to the given socket file descriptor.
 		 * This method also handles partial sends, and so it is guaranteed that all
 		 * the data will be sent out if no error occurs. This method will block until
-		 * all data has been written.
+		 * all data has been written, so it should only be used on blocking sockets.
 		 *
 		 * @param sock The socket to write to.
 		 * @return True if the write succeeded, false otherwise.
@@ -149,6 +172,9 @@ class Packet {
 		 * simply means that no data has been received in the given time interval. A return
 		 * code of Disconnected or DataCorrupt should be handled appropriately.
 		 *
+		 * Short reads are handled, so a packet that arrives in several pieces is read in
+		 * full. Non-blocking sockets should use a PacketBuffer instead.
+		 *
 		 * @param socket The socket to read from.
 		 * @return A result code.
 		 */
@@ -166,6 +192,16 @@ class Packet {
 		Result timedRead(int socket, long int sec, long int usec);
 	
 	private:
+		/**
+		 * Reads exactly the given amount of bytes from a socket.
+		 *
+		 * @param socket The socket to read from.
+		 * @param dest Where to store the bytes.
+		 * @param bytes The amount of bytes to read.
+		 * @return NoError, TimedOut if no data arrived, or DataCorrupt if only part of it did.
+		 */
+		static Result receive(int socket, uint8_t *dest, int bytes);
+
 		/// The internal packet buffer of bytes
 		uint8_t m_Buffer[PACKET_BUFFER_MAX];
 
@@ -0,0 +1,148 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// packetbuffer.h: definition of the PacketBuffer class.
+
+#ifndef PACKETBUFFER_H
+#define PACKETBUFFER_H
+
+#include <stdint.h>
+
+#include "packet.h"
+
+// default capacity of a packet buffer (must be a power of two)
+#define PACKETBUFFER_DEFAULT	8192
+
+/**
+ * A ring buffer that turns a raw byte stream into packets, and back.
+ * TCP makes no promises about how the bytes of a packet are split up between reads: one
+ * read may return half a packet, or three packets and the size bytes of a fourth. This
+ * class accumulates whatever the socket has to offer and hands out complete packets one
+ * at a time, keeping any leftover bytes for the next read. It works with both blocking
+ * and non-blocking sockets, since reads are never allowed to block.
+ *
+ * In the other direction, packets can be appended as they are produced and then written
+ * out together with drain(), which sends everything queued in a single system call.
+ */
+class PacketBuffer {
+	public:
+		/**
+		 * Creates an empty buffer.
+		 *
+		 * @param capacity The capacity in bytes, rounded up to a power of two. It is
+		 * never less than the size of the largest possible packet.
+		 */
+		PacketBuffer(int capacity=PACKETBUFFER_DEFAULT);
+
+		/// Frees the buffer's storage.
+		~PacketBuffer();
+
+		/**
+		 * Returns the amount of buffered bytes.
+		 *
+		 * @return The number of bytes in the buffer.
+		 */
+		int size() const { return m_Tail-m_Head; }
+
+		/**
+		 * Checks if the buffer is empty.
+		 */
+		bool empty() const { return m_Tail==m_Head; }
+
+		/**
+		 * Checks if the buffer has no more room for data.
+		 */
+		bool full() const { return size()==m_Capacity; }
+
+		/// Discards all buffered data.
+		void clear() { m_Head=m_Tail=0; }
+
+		/**
+		 * Reads as much data from the socket as the buffer can hold, without blocking.
+		 * Note that once this method returns NoError, the buffer is full and there may still
+		 * be data waiting on the socket; extract some packets with next() and call this
+		 * method again.
+		 *
+		 * @param socket The socket to read from.
+		 * @return TimedOut if the socket has no more data right now, NoError if the buffer
+		 * filled up first, or Disconnected if the peer closed the connection.
+		 */
+		Packet::Result fill(int socket);
+
+		/**
+		 * Extracts the next complete packet from the buffer.
+		 *
+		 * @param p The packet to load.
+		 * @return NoError if a packet was extracted, TimedOut if more data is needed, or
+		 * DataCorrupt if the stream contains a malformed packet.
+		 */
+		Packet::Result next(Packet &p);
+
+		/**
+		 * Queues a complete packet to be written with drain().
+		 * The buffer grows as needed to make room for the packet.
+		 *
+		 * @param p The packet to queue.
+		 */
+		void append(Packet &p);
+
+		/**
+		 * Writes as much of the buffered data as the socket will accept, without blocking.
+		 * Everything queued so far is handed to the kernel at once as a single gather write.
+		 *
+		 * @param socket The socket to write to.
+		 * @return NoError if the buffer was emptied, TimedOut if the socket cannot take
+		 * any more data right now, or Disconnected if the socket is broken.
+		 */
+		Packet::Result drain(int socket);
+
+	private:
+		/// Buffers cannot be copied.
+		PacketBuffer(const PacketBuffer&);
+		PacketBuffer& operator=(const PacketBuffer&);
+
+		/**
+		 * Doubles the capacity of the buffer until it can hold the given amount of bytes.
+		 *
+		 * @param bytes The amount of bytes the buffer must be able to hold.
+		 */
+		void grow(uint32_t bytes);
+
+		/**
+		 * Copies bytes from the front of the buffer without removing them.
+		 *
+		 * @param dest Where to copy the bytes to.
+		 * @param bytes The amount of bytes to copy.
+		 */
+		void peek(uint8_t *dest, int bytes) const;
+
+		/// The buffer's storage.
+		uint8_t *m_Data;
+
+		/// The buffer's capacity, always a power of two.
+		uint32_t m_Capacity;
+
+		/// Position of the first buffered byte (grows without bound, wrapped on access).
+		uint32_t m_Head;
+
+		/// Position past the last buffered byte (grows without bound, wrapped on access).
+		uint32_t m_Tail;
+};
+
+#endif
@@ -21,6 +21,7 @@
 
 #include "player.h"
 
-Player::Player(const std::string &username) {
+Player::Player(const std::string &username, const Type &type) {
 	m_Username=username;
+	m_Type=type;
 }
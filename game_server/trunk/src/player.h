@@ -25,18 +25,36 @@
 #include <iostream>
 
 class Player {
+	public:
+		/// Kinds of players that can occupy a seat.
+		enum Type { HumanPlayer, ComputerPlayer };
+
 	public:
 		/**
 		 * Creates a player model object.
 		 *
 		 * @param username The player's username.
+		 * @param type The kind of player.
 		 */
-		Player(const std::string &username);
+		Player(const std::string &username, const Type &type);
+
+		/// Frees memory used by this object.
+		virtual ~Player() { }
 
 		/**
-		 * Returns the runtime type identifier for this object.
+		 * Returns the kind of player this is.
+		 * Rooms check this on every packet and broadcast, so it replaces a runtime cast.
+		 *
+		 * @return The player type.
 		 */
-		virtual std::string rtti() const { return "Player"; }
+		Type getType() const { return m_Type; }
+
+		/**
+		 * Determines if this player is a human connected over a socket.
+		 *
+		 * @return true if human, false if computer controlled.
+		 */
+		bool isHuman() const { return m_Type==HumanPlayer; }
 
 		/**
 		 * Returns the player's username.
@@ -48,6 +66,9 @@ class Player {
 	private:
 		/// The player's username.
 		std::string m_Username;
+
+		/// The kind of player.
+		Type m_Type;
 };
 
 #endif
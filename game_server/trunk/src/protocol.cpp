@@ -19,12 +19,85 @@
  ***************************************************************************/
 // protocol.cpp: implementation of the Protocol class.
 
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+
 #include "packet.h"
 #include "protocol.h"
 #include "protspec.h"
 
 Protocol::Protocol(int socket) {
 	m_Socket=socket;
+	m_Poller=NULL;
+	m_Key=0;
+	m_Waiting=false;
+	m_Dropped=false;
+
+	// all io on this socket is done without blocking
+	int flags=fcntl(m_Socket, F_GETFL);
+	fcntl(m_Socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+void Protocol::watch(FDBuffer *poller, int key) {
+	m_Poller=poller;
+	m_Key=key;
+
+	m_Poller->addSocket(m_Socket, m_Key);
+
+	// output might have piled up before the socket was watched
+	m_Waiting=false;
+	flush();
+}
+
+void Protocol::flush() {
+	if (m_Dropped)
+		return;
+
+	if (m_Output.drain(m_Socket)==Packet::Disconnected) {
+		drop("connection lost");
+		return;
+	}
+
+	// only ask to hear about room for more while there is something left to write
+	bool waiting=!m_Output.empty();
+	if (m_Poller && waiting!=m_Waiting) {
+		m_Poller->watchOutput(m_Socket, m_Key, waiting);
+		m_Waiting=waiting;
+	}
+}
+
+Packet::Result Protocol::next(Packet &p) {
+	Packet::Result res=m_Input.next(p);
+	if (res==Packet::DataCorrupt) {
+		m_Input.clear();
+		drop("corrupt packet");
+	}
+
+	return res;
+}
+
+void Protocol::send(Packet &p) {
+	if (m_Dropped)
+		return;
+
+	if (m_Output.size()>PROTOCOL_MAX_BACKLOG) {
+		drop("too much unsent data");
+		return;
+	}
+
+	m_Output.append(p);
+	flush();
+}
+
+void Protocol::drop(const char *reason) {
+	std::cout << "Dropping client on socket " << m_Socket << ": " << reason << std::endl;
+
+	m_Output.clear();
+	m_Dropped=true;
+
+	// the room hears about it like any other disconnect
+	shutdown(m_Socket, SHUT_RDWR);
 }
 
 void Protocol::sendPlayerJoined(const std::string &username, int index) {
@@ -32,20 +105,20 @@ void Protocol::sendPlayerJoined(const std::string &username, int index) {
 	p.addByte(GAME_PLAYER_JOINED);
 	p.addString(username);
 	p.addByte(index);
-	p.write(m_Socket);
+	send(p);
 }
 
 void Protocol::sendPlayerQuit(int index) {
 	Packet p;
 	p.addByte(GAME_PLAYER_QUIT);
 	p.addByte(index);
-	p.write(m_Socket);
+	send(p);
 }
 
 void Protocol::sendStartControl() {
 	Packet p;
 	p.addByte(GMRM_START_WAIT);
-	p.write(m_Socket);
+	send(p);
 }
 
 void Protocol::sendTurnOrder(const std::vector<int> &order) {
@@ -55,7 +128,7 @@ void Protocol::sendTurnOrder(const std::vector<int> &order) {
 	for (int i=0; i<4; i++)
 		p.addByte(order[i]);
 
-	p.write(m_Socket);
+	send(p);
 }
 
 void Protocol::sendTokenSelected(int index, int piece) {
@@ -63,7 +136,7 @@ void Protocol::sendTokenSelected(int index, int piece) {
 	p.addByte(GAME_SELECTED_TOK);
 	p.addByte(index);
 	p.addByte(piece);
-	p.write(m_Socket);
+	send(p);
 }
 
 void Protocol::notify(const Protocol::Notification &note) {
@@ -81,5 +154,40 @@ void Protocol::notify(const Protocol::Notification &note) {
 	else if (note==Protocol::TokenSelectionEnd)
 		p.addByte(GAME_DONE_TOK);
 
-	p.write(m_Socket);
+	send(p);
+}
+
+void Protocol::sendGameEvents(const Game::Event *events, int count) {
+	for (int i=0; i<count; i+=PROTOCOL_EVENTS_PER_PACKET) {
+		int n=(count-i<PROTOCOL_EVENTS_PER_PACKET ? count-i : PROTOCOL_EVENTS_PER_PACKET);
+
+		Packet p;
+		p.addByte(GAME_EVENT);
+		p.addByte(n);
+
+		for (int j=i; j<i+n; j++) {
+			p.addByte(events[j].type);
+			p.addByte(events[j].player);
+			p.addByte(events[j].arg);
+			p.addUint32(events[j].amount);
+		}
+
+		send(p);
+	}
+}
+
+void Protocol::sendSessionToken(uint64_t token) {
+	Packet p;
+	p.addByte(GAME_SESSION);
+	p.addUint32((uint32_t) token);
+	p.addUint32((uint32_t) (token >> 32));
+	send(p);
+}
+
+void Protocol::sendMigrate(const std::string &host, int port) {
+	Packet p;
+	p.addByte(GAME_MIGRATE);
+	p.addString(host);
+	p.addUint32(port);
+	send(p);
 }
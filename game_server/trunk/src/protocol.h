@@ -24,6 +24,25 @@
 
 #include <vector>
 
+#include "fdbuffer.h"
+#include "game.h"
+#include "packet.h"
+#include "packetbuffer.h"
+
+/// Most game events sent in a single packet, to stay within the packet buffer.
+#define PROTOCOL_EVENTS_PER_PACKET	128
+
+/// Amount of unsent data after which a client is considered too slow to keep up.
+#define PROTOCOL_MAX_BACKLOG		(256*1024)
+
+/**
+ * Speaks the game protocol with a single client.
+ * The client's socket is never blocked on, so a client that stops reading can't hold
+ * up the other rooms run by the same worker. Packets are queued and written out as
+ * the socket takes them, with the worker's FDBuffer reporting when there is room for
+ * more. A client that lets more than PROTOCOL_MAX_BACKLOG bytes pile up is dropped:
+ * its socket is shut down, which the room then notices as a disconnect.
+ */
 class Protocol {
 	public:
 		/// Various notifications sent to players.
@@ -37,6 +56,20 @@ class Protocol {
 		 */
 		Protocol(int socket);
 
+		/**
+		 * Adds the socket to a worker's FDBuffer, which then reports data sent by the
+		 * client, and room for more output whenever some is queued.
+		 *
+		 * @param poller The FDBuffer.
+		 * @param key The key to report the socket's activity under.
+		 */
+		void watch(FDBuffer *poller, int key);
+
+		/**
+		 * Writes as much queued output as the socket takes, without blocking.
+		 */
+		void flush();
+
 		/**
 		 * Returns this protocol's socket file descriptor.
 		 *
@@ -44,6 +77,24 @@ class Protocol {
 		 */
 		int getSocket() const { return m_Socket; }
 
+		/**
+		 * Reads whatever data the client has sent into the input buffer, without blocking.
+		 * Use next() afterwards to extract complete packets.
+		 *
+		 * @return A result code, as described by PacketBuffer::fill().
+		 */
+		Packet::Result receive() { return m_Input.fill(m_Socket); }
+
+		/**
+		 * Extracts the next complete packet sent by the client.
+		 * A client that sends a corrupt packet is dropped, since the rest of its
+		 * input can no longer be framed.
+		 *
+		 * @param p The packet to load.
+		 * @return A result code, as described by PacketBuffer::next().
+		 */
+		Packet::Result next(Packet &p);
+
 		/**
 		 * Informs the client that player with the given index number just joined the room.
 		 * Each player is indexed for consistency across clients, so the server can
@@ -94,9 +145,68 @@ class Protocol {
 		 */
 		void notify(const Protocol::Notification &note);
 
+		/**
+		 * Sends the client a batch of changes to the game.
+		 * Each event is encoded as its type, the player's seat (0xFF for none), the
+		 * space or other argument, and a 32-bit amount.
+		 *
+		 * @param events The events to send.
+		 * @param count The number of events.
+		 */
+		void sendGameEvents(const Game::Event *events, int count);
+
+		/**
+		 * Gives the client the token that lets it reclaim its seat if it has to
+		 * reconnect, such as after the room moves to another server.
+		 *
+		 * @param token The token.
+		 */
+		void sendSessionToken(uint64_t token);
+
+		/**
+		 * Tells the client that the room moved to another game server, which it
+		 * should reconnect to with its session token.
+		 *
+		 * @param host The host or IP address of the server.
+		 * @param port The port number of the server.
+		 */
+		void sendMigrate(const std::string &host, int port);
+
 	private:
+		/**
+		 * Queues a packet for the client and writes out what the socket takes.
+		 *
+		 * @param p The packet.
+		 */
+		void send(Packet &p);
+
+		/**
+		 * Gives up on the client, discarding its output and shutting down its socket.
+		 *
+		 * @param reason Why the client is dropped.
+		 */
+		void drop(const char *reason);
+
 		/// The communications socket.
 		int m_Socket;
+
+		/// Data received from the client that has yet to be parsed.
+		PacketBuffer m_Input;
+
+		/// Data for the client that the socket did not take yet.
+		PacketBuffer m_Output;
+
+		/// The FDBuffer watching the socket, if any.
+		FDBuffer *m_Poller;
+
+		/// The key the socket is watched under.
+		int m_Key;
+
+		/// Whether the FDBuffer reports room for more output.
+		bool m_Waiting;
+
+		/// Whether the client was given up on.
+		bool m_Dropped;
 };
 
 #endif
@@ -27,9 +27,22 @@
 #define CONN_LOBBY		0x01
 #define CONN_GAME		0x02
 
+/// General codes.
+#define PKT_ERROR		0x00
+#define PKT_SUCCESS		0x01
+
 /// Inter-server communication.
 #define IS_OPENROOM		0x00
 #define IS_KILLROOM		0x01
+#define IS_LOADREPORT	0x02
+#define IS_HELLO		0x03
+#define IS_HEARTBEAT	0x04
+#define IS_RESPONSE		0x05
+#define IS_MIGRATEROOM	0x06
+#define IS_ADOPTROOM	0x07
+#define IS_MIGRATED		0x08
+#define IS_DROPROOM		0x09
+#define IS_KEEPROOM		0x0A
 
 /// Room parameters.
 #define PROP_RANDOM			0x00	// property distributed randomly to players
@@ -49,5 +62,57 @@
 #define GAME_TURN_TOK		0xD4
 #define GAME_SELECTED_TOK	0xD5
 #define GAME_DONE_TOK		0xD6
+#define GAME_EVENT		0xD7
+#define GAME_ACTION		0xD8
+#define GAME_SESSION		0xD9
+#define GAME_MIGRATE		0xDA
+
+/// Actions sent with GAME_ACTION.
+#define GAME_ACT_ROLL			0x00
+#define GAME_ACT_BUY			0x01
+#define GAME_ACT_DECLINE		0x02
+#define GAME_ACT_BID			0x03
+#define GAME_ACT_PASS			0x04
+#define GAME_ACT_BUILD			0x05
+#define GAME_ACT_SELL			0x06
+#define GAME_ACT_MORTGAGE		0x07
+#define GAME_ACT_UNMORTGAGE		0x08
+#define GAME_ACT_PAY_BAIL		0x09
+#define GAME_ACT_JAIL_CARD		0x0A
+#define GAME_ACT_FLAT_TAX		0x0B
+#define GAME_ACT_PERCENT_TAX	0x0C
+#define GAME_ACT_PAY_DEBT		0x0D
+#define GAME_ACT_BANKRUPT		0x0E
+#define GAME_ACT_END_TURN		0x0F
+
+/// Events batched in GAME_EVENT.
+#define GAME_EV_TURN			0x00
+#define GAME_EV_DICE			0x01
+#define GAME_EV_MOVED			0x02
+#define GAME_EV_MONEY			0x03
+#define GAME_EV_OWNER			0x04
+#define GAME_EV_OFFER			0x05
+#define GAME_EV_AUCTION			0x06
+#define GAME_EV_HOUSES			0x07
+#define GAME_EV_MORTGAGE		0x08
+#define GAME_EV_CARD			0x09
+#define GAME_EV_JAILED			0x0A
+#define GAME_EV_RELEASED		0x0B
+#define GAME_EV_JAIL_CARDS		0x0C
+#define GAME_EV_DEBT			0x0D
+#define GAME_EV_TAX_CHOICE		0x0E
+#define GAME_EV_BANKRUPT		0x0F
+#define GAME_EV_GAME_OVER		0x10
+#define GAME_EV_WAITING			0x11
+
+/// Stages of a turn, sent with GAME_EV_WAITING.
+#define GAME_STAGE_IDLE			0x00
+#define GAME_STAGE_ROLLING		0x01
+#define GAME_STAGE_BUYING		0x02
+#define GAME_STAGE_AUCTIONING	0x03
+#define GAME_STAGE_TAX			0x04
+#define GAME_STAGE_OWING		0x05
+#define GAME_STAGE_ENDING		0x06
+#define GAME_STAGE_OVER			0x07
 
 #endif
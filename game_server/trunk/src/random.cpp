@@ -0,0 +1,105 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// random.cpp: implementation of the Random class.
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "random.h"
+
+/// Multiplier of the underlying linear congruential generator.
+#define RANDOM_MULTIPLIER	6364136223846793005ULL
+/// Increment of the underlying linear congruential generator, which must be odd.
+#define RANDOM_INCREMENT	1442695040888963407ULL
+
+Random::Random(uint64_t seed) {
+	this->seed(seed);
+}
+
+uint64_t Random::makeSeed() {
+	uint64_t seed=0;
+
+	// prefer the kernel's entropy, but make do with the clock and process id
+	int fd=open("/dev/urandom", O_RDONLY);
+	if (fd!=-1) {
+		if (read(fd, &seed, sizeof(seed))!=sizeof(seed))
+			seed=0;
+
+		close(fd);
+	}
+
+	if (!seed) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		seed=((uint64_t) ts.tv_sec*1000000000+ts.tv_nsec) ^ ((uint64_t) getpid() << 32);
+	}
+
+	return seed;
+}
+
+void Random::seed(uint64_t seed) {
+	m_State=0;
+	next();
+	m_State+=seed;
+	next();
+}
+
+uint32_t Random::next() {
+	uint64_t old=m_State;
+	m_State=old*RANDOM_MULTIPLIER+RANDOM_INCREMENT;
+
+	// output the high bits, rotated by an amount taken from the highest ones
+	uint32_t xorshifted=(uint32_t) (((old >> 18) ^ old) >> 27);
+	uint32_t rot=(uint32_t) (old >> 59);
+
+	return (xorshifted >> rot) | (xorshifted << ((32-rot) & 31));
+}
+
+int Random::range(int low, int high) {
+	return low+(int) below((uint32_t) (high-low)+1);
+}
+
+void Random::shuffle(std::vector<int> &v) {
+	for (int i=v.size()-1; i>0; i--) {
+		int j=below(i+1);
+
+		int tmp=v[i];
+		v[i]=v[j];
+		v[j]=tmp;
+	}
+}
+
+uint32_t Random::below(uint32_t bound) {
+	// scale a 32-bit draw by the bound, and throw away the few draws that would
+	// make some results more likely than others
+	uint64_t m=(uint64_t) next()*bound;
+	uint32_t low=(uint32_t) m;
+	if (low<bound) {
+		uint32_t threshold=(0-bound)%bound;
+		while(low<threshold) {
+			m=(uint64_t) next()*bound;
+			low=(uint32_t) m;
+		}
+	}
+
+	return (uint32_t) (m >> 32);
+}
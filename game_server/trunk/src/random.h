@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// random.h: definition of the Random class.
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A small, fast pseudo-random number generator (PCG32).
+ * Every room owns one, so draws never contend with other rooms the way the
+ * C library's shared rand() does, and a game seeded the same way rolls the same
+ * dice, which is what makes it possible to replay it. Objects are cheap to copy,
+ * and a copy carries on with the same sequence as the original.
+ */
+class Random {
+	public:
+		/**
+		 * Creates a generator.
+		 *
+		 * @param seed The seed.
+		 */
+		Random(uint64_t seed=0);
+
+		/**
+		 * Makes a seed that differs from one call to the next, for generators whose
+		 * sequence doesn't need to be known in advance.
+		 *
+		 * @return The seed.
+		 */
+		static uint64_t makeSeed();
+
+		/**
+		 * Restarts the generator.
+		 *
+		 * @param seed The seed.
+		 */
+		void seed(uint64_t seed);
+
+		/**
+		 * Draws a number.
+		 *
+		 * @return A number, uniform over all 32-bit values.
+		 */
+		uint32_t next();
+
+		/**
+		 * Draws a number within a range, with every number in the range equally likely.
+		 *
+		 * @param low The lower bound.
+		 * @param high The upper bound, which must be no less than the lower bound.
+		 * @return The number.
+		 */
+		int range(int low, int high);
+
+		/**
+		 * Puts the elements of a vector in random order, with every order equally likely.
+		 *
+		 * @param v The vector.
+		 */
+		void shuffle(std::vector<int> &v);
+
+		/**
+		 * Returns the generator's state, so that it can be carried on elsewhere.
+		 *
+		 * @return The state.
+		 */
+		uint64_t getState() const { return m_State; }
+
+		/**
+		 * Carries on from a saved state.
+		 *
+		 * @param state The state, as returned by getState().
+		 */
+		void setState(uint64_t state) { m_State=state; }
+
+	private:
+		/**
+		 * Draws a number below a bound, without bias.
+		 *
+		 * @param bound The bound, which must be greater than 0.
+		 * @return The number.
+		 */
+		uint32_t below(uint32_t bound);
+
+		/// Current state.
+		uint64_t m_State;
+};
+
+#endif
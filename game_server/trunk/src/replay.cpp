@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// replay.cpp: command line tool that plays back game replay logs.
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "game.h"
+#include "replayreader.h"
+#include "utilities.h"
+
+void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [-q] [-t] log...\n"
+		  << "Plays back replay logs written by the game server, and checks that every\n"
+		  << "game ends the way it did when it was played.\n\n"
+		  << "  -q\tonly report logs that fail to replay, and the totals\n"
+		  << "  -t\twrite every decision and the state it was made in to standard output\n";
+}
+
+int main(int argc, char *argv[]) {
+	bool quiet=false;
+	bool trace=false;
+	std::vector<std::string> paths;
+
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q")==0)
+			quiet=true;
+		else if (strcmp(argv[i], "-t")==0)
+			trace=true;
+		else if (argv[i][0]=='-') {
+			usage(argv[0]);
+			return 2;
+		}
+		else
+			paths.push_back(argv[i]);
+	}
+
+	if (paths.empty()) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	int failed=0;
+	long moves=0;
+	uint64_t start=Util::milliseconds();
+
+	ReplayReader reader;
+	for (int i=0; i<paths.size(); i++) {
+		try {
+			reader.load(paths[i]);
+
+			Game game;
+			int n=reader.replay(game, trace ? &std::cout : NULL);
+			moves+=n;
+
+			if (!quiet) {
+				std::cerr << paths[i] << ": room " << reader.getGid() << ", seed " << reader.getSeed()
+					  << ", " << n << " moves, ";
+
+				if (game.getStage()==Game::Over)
+					std::cerr << "won by seat " << game.getWinner() << std::endl;
+				else if (reader.hasMoved())
+					std::cerr << "moved to another server" << std::endl;
+				else
+					std::cerr << "unfinished" << std::endl;
+			}
+		}
+
+		catch (const ReplayReader::Exception &ex) {
+			std::cerr << paths[i] << ": " << ex.getMessage() << std::endl;
+			failed++;
+		}
+	}
+
+	uint64_t elapsed=Util::milliseconds()-start;
+	std::cerr << "Replayed " << paths.size() << " logs (" << failed << " failed), " << moves << " moves in "
+		  << elapsed << " ms";
+	if (elapsed>0)
+		std::cerr << ", " << paths.size()*1000/elapsed << " logs/s";
+	std::cerr << std::endl;
+
+	return (failed ? 1 : 0);
+}
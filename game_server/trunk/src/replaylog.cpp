@@ -0,0 +1,163 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// replaylog.cpp: implementation of the ReplayLog class.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "replaylog.h"
+#include "snapshot.h"
+
+ReplayLog::ReplayLog() {
+	m_FD=-1;
+}
+
+ReplayLog::~ReplayLog() {
+	close();
+}
+
+bool ReplayLog::open(const std::string &path, int gid, uint64_t seed) {
+	close();
+
+	m_FD=::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_FD==-1)
+		return false;
+
+	m_Path=path;
+
+	m_Buffer.append(REPLAY_MAGIC);
+	put(REPLAY_VERSION, 1);
+	put(gid, 4);
+	put(seed, 8);
+
+	return true;
+}
+
+void ReplayLog::logStart(uint32_t seed, const int order[GAME_PLAYERS], int maxRounds, int freeParkReward,
+			 bool incomeTaxChoice, bool redistribute) {
+	if (m_FD==-1)
+		return;
+
+	put(StartRecord, 1);
+	put(seed, 4);
+	for (int i=0; i<GAME_PLAYERS; i++)
+		put(order[i], 1);
+
+	put(maxRounds, 4);
+	put(freeParkReward, 4);
+	put((incomeTaxChoice ? REPLAY_FLAG_TAX_CHOICE : 0) | (redistribute ? REPLAY_FLAG_REDISTRIBUTE : 0), 1);
+}
+
+void ReplayLog::logResume(uint32_t moves, const Game &game) {
+	if (m_FD==-1)
+		return;
+
+	Snapshot snap;
+	game.save(snap);
+
+	put(ResumeRecord, 1);
+	put(moves, 4);
+	put(snap.data().size(), 4);
+	m_Buffer.append(snap.data());
+}
+
+void ReplayLog::logAction(int seat, const Game::Action &action, int arg, int amount) {
+	if (m_FD==-1)
+		return;
+
+	put(ActionRecord, 1);
+	put(seat, 1);
+	put(action, 1);
+	put(arg, 1);
+	put((uint32_t) amount, 4);
+
+	if (m_Buffer.size()>=REPLAY_BUFFER_SIZE)
+		flush();
+}
+
+void ReplayLog::logDefault() {
+	if (m_FD==-1)
+		return;
+
+	put(DefaultRecord, 1);
+
+	if (m_Buffer.size()>=REPLAY_BUFFER_SIZE)
+		flush();
+}
+
+void ReplayLog::logEnd(const Game &game) {
+	if (m_FD==-1)
+		return;
+
+	put(EndRecord, 1);
+	put(game.getWinner(), 1);
+	put(game.getRound(), 4);
+	for (int i=0; i<GAME_PLAYERS; i++)
+		put((uint32_t) game.getWorth(i), 4);
+
+	flush();
+}
+
+void ReplayLog::logMoved() {
+	if (m_FD==-1)
+		return;
+
+	put(MovedRecord, 1);
+	close();
+}
+
+void ReplayLog::close() {
+	if (m_FD==-1)
+		return;
+
+	flush();
+
+	::close(m_FD);
+	m_FD=-1;
+}
+
+void ReplayLog::discard() {
+	if (m_FD==-1)
+		return;
+
+	close();
+	unlink(m_Path.c_str());
+}
+
+void ReplayLog::flush() {
+	const char *data=m_Buffer.data();
+	int left=m_Buffer.size();
+
+	while(left>0) {
+		int n=::write(m_FD, data, left);
+		if (n<=0)
+			break;
+
+		data+=n;
+		left-=n;
+	}
+
+	m_Buffer.clear();
+}
+
+void ReplayLog::put(uint64_t value, int size) {
+	for (int i=0; i<size; i++)
+		m_Buffer.push_back((char) ((value >> (i*8)) & 0xFF));
+}
@@ -0,0 +1,175 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// replaylog.h: definition of the ReplayLog class.
+
+#ifndef REPLAYLOG_H
+#define REPLAYLOG_H
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+#include "game.h"
+
+/// Marks the start of a replay log.
+#define REPLAY_MAGIC		"TYRP"
+/// Version of the replay log format.
+#define REPLAY_VERSION		3
+/// Bytes buffered before they are written out.
+#define REPLAY_BUFFER_SIZE	4096
+
+/// The game can pay a tenth of total worth as income tax.
+#define REPLAY_FLAG_TAX_CHOICE		0x01
+/// A bankrupt player's property is dealt out to the other players.
+#define REPLAY_FLAG_REDISTRIBUTE	0x02
+
+/**
+ * Records what happens to a game, compactly enough to keep a log for every room.
+ * The game engine is deterministic once seeded, so the log only holds its inputs:
+ * the seed and rules it was started with, the moves players made, and the default
+ * moves taken when the timer ran out on somebody. ReplayReader feeds these back to a
+ * game engine to reproduce the game exactly.
+ *
+ * A log begins with REPLAY_MAGIC, a byte for REPLAY_VERSION, the room's id (uint32)
+ * and the room's seed (uint64). Records follow, each a type byte and its fields, with
+ * all integers little-endian:
+ *   StartRecord: game seed (uint32), the seats in turn order (4 bytes), maximum
+ *     rounds (uint32), Free Parking reward (uint32), REPLAY_FLAG_* bits (byte)
+ *   ResumeRecord: moves made so far (uint32), length of the game state (uint32), the
+ *     game state as saved by Game::save()
+ *   ActionRecord: seat (byte), action (byte), space (byte), amount (uint32)
+ *   DefaultRecord: no fields
+ *   MovedRecord: no fields
+ *   EndRecord: winner (byte), round (uint32), worth of every player (uint32 each)
+ *
+ * A game moved to another game server is logged there too. The old server's log ends
+ * with a MovedRecord, and the new server's log starts with a ResumeRecord in place of
+ * a StartRecord, so each log can be replayed on its own.
+ */
+class ReplayLog {
+	public:
+		/// Types of records.
+		enum RecordType {
+			StartRecord=0x01,
+			ActionRecord=0x02,
+			DefaultRecord=0x03,
+			EndRecord=0x04,
+			ResumeRecord=0x05,
+			MovedRecord=0x06
+		};
+
+	public:
+		/// Creates a log that is not yet open, and ignores anything recorded.
+		ReplayLog();
+
+		/// Writes out anything buffered and closes the log.
+		~ReplayLog();
+
+		/**
+		 * Creates a log file and writes its header.
+		 *
+		 * @param path The path of the file.
+		 * @param gid The room's id number.
+		 * @param seed The room's seed.
+		 * @return true if the file was created, false otherwise.
+		 */
+		bool open(const std::string &path, int gid, uint64_t seed);
+
+		/**
+		 * Records the start of a game.
+		 *
+		 * @param seed The seed the game was given.
+		 * @param order Seats in the order they take turns.
+		 * @param maxRounds Rounds to play before the richest player wins, or 0 for no limit.
+		 * @param freeParkReward Money the bank pays for landing on Free Parking.
+		 * @param incomeTaxChoice Whether players may pay a tenth of their worth as income tax.
+		 * @param redistribute Whether a bankrupt player's property is dealt out to the other players.
+		 */
+		void logStart(uint32_t seed, const int order[GAME_PLAYERS], int maxRounds, int freeParkReward,
+			      bool incomeTaxChoice, bool redistribute);
+
+		/**
+		 * Records that a game moved here from another game server picks up where it was.
+		 *
+		 * @param moves The number of moves made in the game so far.
+		 * @param game The game, as it was restored.
+		 */
+		void logResume(uint32_t moves, const Game &game);
+
+		/**
+		 * Records a move the game accepted.
+		 *
+		 * @param seat The player's seat.
+		 * @param action The action.
+		 * @param arg The space for property actions.
+		 * @param amount The amount for bids.
+		 */
+		void logAction(int seat, const Game::Action &action, int arg, int amount);
+
+		/**
+		 * Records that the game made the default move for the player it was waiting on.
+		 */
+		void logDefault();
+
+		/**
+		 * Records how a game ended, so that replays can be checked against it.
+		 *
+		 * @param game The game, which is over.
+		 */
+		void logEnd(const Game &game);
+
+		/**
+		 * Records that the game went on on another game server, and closes the log.
+		 */
+		void logMoved();
+
+		/**
+		 * Writes out anything buffered and closes the log. Later records are ignored.
+		 */
+		void close();
+
+		/**
+		 * Closes the log and removes its file, for a game that is played out elsewhere.
+		 */
+		void discard();
+
+	private:
+		/// Writes out the buffered records.
+		void flush();
+
+		/**
+		 * Buffers an integer, least significant byte first.
+		 *
+		 * @param value The integer.
+		 * @param size The number of bytes to write.
+		 */
+		void put(uint64_t value, int size);
+
+		/// The log file, or -1 if the log is closed.
+		int m_FD;
+
+		/// The path of the log file.
+		std::string m_Path;
+
+		/// Records yet to be written out.
+		std::string m_Buffer;
+};
+
+#endif
@@ -0,0 +1,201 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// replayreader.cpp: implementation of the ReplayReader class.
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "replaylog.h"
+#include "replayreader.h"
+#include "snapshot.h"
+
+ReplayReader::ReplayReader() {
+	m_Pos=0;
+	m_Records=0;
+	m_Gid=0;
+	m_Seed=0;
+	m_Moved=false;
+}
+
+void ReplayReader::load(const std::string &path) throw(ReplayReader::Exception) {
+	FILE *f=fopen(path.c_str(), "rb");
+	if (!f)
+		throw ReplayReader::Exception("Unable to open replay log.");
+
+	m_Data.clear();
+
+	unsigned char chunk[4096];
+	size_t n;
+	while((n=fread(chunk, 1, sizeof(chunk), f))>0)
+		m_Data.insert(m_Data.end(), chunk, chunk+n);
+
+	fclose(f);
+
+	// check the header
+	m_Pos=0;
+	size_t magic=strlen(REPLAY_MAGIC);
+	if (m_Data.size()<magic || memcmp(&m_Data[0], REPLAY_MAGIC, magic)!=0)
+		throw ReplayReader::Exception("Not a replay log.");
+
+	m_Pos=magic;
+	if (get(1)!=REPLAY_VERSION)
+		throw ReplayReader::Exception("Unsupported replay log version.");
+
+	m_Gid=get(4);
+	m_Seed=get(8);
+	m_Records=m_Pos;
+}
+
+int ReplayReader::replay(Game &game, std::ostream *trace) throw(ReplayReader::Exception) {
+	m_Pos=m_Records;
+	game.setQuiet(true);
+
+	m_Moved=false;
+
+	int first=(m_Pos==m_Data.size() ? 0 : get(1));
+	int moves=0;
+
+	// a game started on this server
+	if (first==ReplayLog::StartRecord) {
+		uint32_t seed=get(4);
+		int order[GAME_PLAYERS];
+		bool seated[GAME_PLAYERS]={ false };
+		for (int i=0; i<GAME_PLAYERS; i++) {
+			order[i]=get(1);
+
+			// every seat must take exactly one turn
+			if (order[i]>=GAME_PLAYERS || seated[order[i]])
+				throw ReplayReader::Exception("Replay log has an invalid turn order.");
+
+			seated[order[i]]=true;
+		}
+
+		int maxRounds=get(4);
+		int freeParkReward=get(4);
+		int flags=get(1);
+
+		game.seed(seed);
+		game.start(order, maxRounds, freeParkReward, flags & REPLAY_FLAG_TAX_CHOICE, flags & REPLAY_FLAG_REDISTRIBUTE);
+	}
+
+	// or one moved here from another server, which picks up from the state it was in
+	else if (first==ReplayLog::ResumeRecord) {
+		moves=get(4);
+		size_t length=get(4);
+		if (m_Pos+length>m_Data.size())
+			throw ReplayReader::Exception("Replay log is truncated.");
+
+		Snapshot snap(std::string(m_Data.begin()+m_Pos, m_Data.begin()+m_Pos+length));
+		m_Pos+=length;
+
+		if (!game.load(snap) || !snap.good())
+			throw ReplayReader::Exception("Replay log resumes an invalid game.");
+	}
+
+	else
+		throw ReplayReader::Exception("Replay log does not start with a game.");
+
+	while(m_Pos<m_Data.size()) {
+		int type=get(1);
+
+		switch(type) {
+			case ReplayLog::ActionRecord: {
+				int seat=get(1);
+				int action=get(1);
+				int arg=get(1);
+				int amount=(int32_t) get(4);
+
+				if (trace)
+					this->trace(*trace, game, action, arg, amount);
+
+				if (seat!=game.getDecider() || action>GAME_ACT_END_TURN || !game.act(seat, (Game::Action) action, arg, amount)) {
+					std::stringstream ss;
+					ss << "Move " << moves+1 << " was refused on replay.";
+					throw ReplayReader::Exception(ss.str());
+				}
+			} break;
+
+			case ReplayLog::DefaultRecord: {
+				if (trace)
+					this->trace(*trace, game, -1, 0, 0);
+
+				if (game.getDecider()==-1)
+					throw ReplayReader::Exception("Default move logged after the game ended.");
+
+				game.playDefault();
+			} break;
+
+			case ReplayLog::EndRecord: {
+				int winner=(int8_t) get(1);
+				int round=get(4);
+
+				bool same=(game.getStage()==Game::Over && game.getWinner()==winner && game.getRound()==round);
+				for (int i=0; i<GAME_PLAYERS; i++) {
+					if ((int32_t) get(4)!=game.getWorth(i))
+						same=false;
+				}
+
+				if (!same)
+					throw ReplayReader::Exception("Replay ended differently from the logged game.");
+			} break;
+
+			// the rest of the game is in another server's log
+			case ReplayLog::MovedRecord: {
+				if (m_Pos!=m_Data.size())
+					throw ReplayReader::Exception("Records logged after the game moved away.");
+
+				m_Moved=true;
+			} break;
+
+			default: throw ReplayReader::Exception("Unknown record in replay log.");
+		}
+
+		if (type!=ReplayLog::EndRecord && type!=ReplayLog::MovedRecord)
+			moves++;
+	}
+
+	return moves;
+}
+
+uint64_t ReplayReader::get(int size) throw(ReplayReader::Exception) {
+	if (m_Pos+size>m_Data.size())
+		throw ReplayReader::Exception("Replay log is truncated.");
+
+	uint64_t value=0;
+	for (int i=0; i<size; i++)
+		value|=(uint64_t) m_Data[m_Pos++] << (i*8);
+
+	return value;
+}
+
+void ReplayReader::trace(std::ostream &out, const Game &game, int action, int arg, int amount) {
+	int seat=game.getDecider();
+
+	// one line per decision: who decided, at what point, with what at stake, and what
+	// they chose
+	out << game.getRound() << ' ' << seat << ' ' << game.getStage();
+	for (int i=0; i<GAME_PLAYERS; i++) {
+		const Game::PlayerState &player=game.getPlayer(i);
+		out << ' ' << player.money << ' ' << (int) player.position << ' ' << game.getWorth(i);
+	}
+
+	out << ' ' << action << ' ' << arg << ' ' << amount << '\n';
+}
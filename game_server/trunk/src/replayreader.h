@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// replayreader.h: definition of the ReplayReader class.
+
+#ifndef REPLAYREADER_H
+#define REPLAYREADER_H
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "game.h"
+
+/**
+ * Reads logs written by ReplayLog and plays them back on a game engine.
+ */
+class ReplayReader {
+	public:
+		/// Exception thrown when a log can't be read or replayed.
+		class Exception {
+			public:
+				Exception(const std::string &msg) { m_Message=msg; }
+
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The reason for this exception.
+				std::string m_Message;
+		};
+
+	public:
+		/// Creates a reader with no log loaded.
+		ReplayReader();
+
+		/**
+		 * Reads a log file into memory and checks its header.
+		 *
+		 * @param path The path of the file.
+		 */
+		void load(const std::string &path) throw(ReplayReader::Exception);
+
+		/**
+		 * Plays the loaded log back. The game is checked against the end of the log, if
+		 * the log got that far. A log written after the game moved here from another
+		 * server picks up from the state the game was in.
+		 *
+		 * @param game A game that has yet to start.
+		 * @param trace Stream to write every logged decision to, along with the state it
+		 * was made in, or NULL.
+		 * @return The number of moves made in the game, including those made on the
+		 * server the game moved from.
+		 */
+		int replay(Game &game, std::ostream *trace=NULL) throw(ReplayReader::Exception);
+
+		/**
+		 * Returns the id of the room the log was written by.
+		 *
+		 * @return The room's id number.
+		 */
+		int getGid() const { return m_Gid; }
+
+		/**
+		 * Returns the seed of the room the log was written by.
+		 *
+		 * @return The seed.
+		 */
+		uint64_t getSeed() const { return m_Seed; }
+
+		/**
+		 * Determines if the game replayed last moved to another game server, where the
+		 * rest of it was logged.
+		 *
+		 * @return true if so, false otherwise.
+		 */
+		bool hasMoved() const { return m_Moved; }
+
+	private:
+		/**
+		 * Reads an integer, least significant byte first.
+		 *
+		 * @param size The number of bytes to read.
+		 * @return The integer.
+		 */
+		uint64_t get(int size) throw(ReplayReader::Exception);
+
+		/**
+		 * Writes a decision and the state it was made in.
+		 *
+		 * @param out The stream to write to.
+		 * @param game The game, before the decision.
+		 * @param action The action, or -1 for the default move.
+		 * @param arg The space for property actions.
+		 * @param amount The amount for bids.
+		 */
+		void trace(std::ostream &out, const Game &game, int action, int arg, int amount);
+
+		/// The contents of the log.
+		std::vector<unsigned char> m_Data;
+
+		/// Offset of the next byte to read.
+		size_t m_Pos;
+
+		/// Offset of the first record.
+		size_t m_Records;
+
+		/// The id of the room the log was written by.
+		int m_Gid;
+
+		/// The room's seed.
+		uint64_t m_Seed;
+
+		/// Whether the game replayed last moved to another game server.
+		bool m_Moved;
+};
+
+#endif
@@ -19,12 +19,11 @@
  ***************************************************************************/
 // room.cpp: implementation of the Room class.
 
-#include <sys/ioctl.h>
-#include <sys/select.h>
-#include <sys/time.h>
 #include <sstream>
+#include <unistd.h>
 
 #include "aiplayer.h"
+#include "configfile.h"
 #include "human.h"
 #include "packet.h"
 #include "protspec.h"
@@ -32,22 +31,119 @@
 #include "utilities.h"
 
 Room::Room(int gid, const std::string &owner) {
+	init(gid, owner);
+
+	// log the seed, so that the room's games can be replayed
+	m_Seed=Random::makeSeed();
+	m_Random.seed(m_Seed);
+	std::cout << "Room " << m_Gid << " seeded with " << m_Seed << std::endl;
+
+	m_TurnOrder=Util::generateTurnOrder(m_Random, 4);
+}
+
+Room::Room(int gid, const std::string &owner, const Snapshot &) {
+	// the seed and turn order come from the snapshot
+	init(gid, owner);
+	m_Seed=0;
+	m_TurnOrder=std::vector<int>(4);
+}
+
+void Room::init(int gid, const std::string &owner) {
 	m_Gid=gid;
 	m_Owner=owner;
 	m_Rules=Rules(0, 0, 0, false, Rules::RandomToPlayers);
 	m_Phase=Init;
+	m_NumHumans=0;
+	m_CurPlayer=-1;
+	m_EventCount=0;
+	m_Moves=0;
+	m_Poller=NULL;
 	m_Players=std::vector<Player*>(4);
 	m_ChosenPieces=std::vector<int>(4);
-	m_TurnOrder=Util::generateTurnOrder();
+	m_Tokens=std::vector<uint64_t>(4);
+	m_Reserved=std::vector<std::string>(4);
+	m_HeldUntil=std::vector<uint64_t>(4);
 
 	// initialize the players vector to be all NULL by default, and
 	// set all chosen pieces to be -1 (not claimed)
 	for (int i=0; i<4; i++) {
 		m_Players[i]=NULL;
 		m_ChosenPieces[i]=-1;
+		m_Tokens[i]=0;
+		m_HeldUntil[i]=0;
 	}
 }
 
+Room::~Room() {
+	// close() already let go of any humans' sockets
+	for (int i=0; i<4; i++)
+		delete m_Players[i];
+}
+
+Room* Room::restore(const std::string &data) {
+	Snapshot snap(data);
+	if (snap.byte()!=ROOM_SNAPSHOT_VERSION)
+		return NULL;
+
+	int gid=snap.uint32();
+	std::string owner=snap.string();
+	Room *room=new Room(gid, owner, snap);
+
+	int maxTurns=snap.uint32();
+	int maxHumans=snap.byte();
+	int freeParkReward=snap.uint32();
+	bool itChoice=snap.byte();
+	Rules::RedistMethod method=(snap.byte()==Rules::ReturnToBank ? Rules::ReturnToBank : Rules::RandomToPlayers);
+	room->m_Rules=Rules(maxTurns, maxHumans, freeParkReward, itChoice, method);
+
+	// carry on drawing from the same sequence the room was seeded with
+	room->m_Seed=snap.uint64();
+	room->m_Random.setState(snap.uint64());
+
+	bool valid=true;
+	for (int i=0; i<4; i++) {
+		room->m_TurnOrder[i]=snap.byte();
+		room->m_ChosenPieces[i]=snap.byte();
+
+		if (room->m_TurnOrder[i]>=4 || room->m_ChosenPieces[i]<1 || room->m_ChosenPieces[i]>ROOM_TOKENS)
+			valid=false;
+	}
+
+	// humans' seats are kept warm by computer players until they reconnect
+	for (int i=0; i<4; i++) {
+		int type=snap.byte();
+		if (type==0)
+			continue;
+
+		std::string username=snap.string();
+		room->m_Players[i]=new AIPlayer(username);
+
+		if (type==1) {
+			room->m_Reserved[i]=username;
+			room->m_Tokens[i]=snap.uint64();
+
+			// players who already dropped keep what was left of their grace period
+			uint32_t grace=snap.uint32();
+			if (grace)
+				room->m_HeldUntil[i]=Util::milliseconds()+grace;
+		}
+	}
+
+	// clients that followed the room only need events sent from here on
+	room->m_EventCount=snap.uint32();
+	room->m_Moves=snap.uint32();
+
+	if (!valid || !room->m_Game.load(snap) || !snap.good()) {
+		delete room;
+		return NULL;
+	}
+
+	room->m_Phase=Resuming;
+	std::cout << "Room " << gid << " restored from a snapshot, seeded with " << room->m_Seed << std::endl;
+
+	return room;
+}
+
 void Room::setRules(const Room::Rules &rules) {
 	Lockable::lock();
 
@@ -83,6 +179,16 @@ Room::Phase Room::getPhase() {
 	return phase;
 }
 
+int Room::getHumanCount() {
+	lock();
+
+	int count=m_NumHumans;
+
+	unlock();
+
+	return count;
+}
+
 bool Room::allowNewPlayers(std::string &result) {
 	lock();
 
@@ -106,81 +212,513 @@ bool Room::allowNewPlayers(std::string &result) {
 	return yes;
 }
 
-void Room::addOwner(Player *player) {
+void Room::attach(FDBuffer *poller) {
 	lock();
 
-	m_Players[0]=player;
+	m_Poller=poller;
 
-	unlock();
-}
+	// a room moved here waits for its players instead of an owner
+	if (m_Phase==Resuming) {
+		// the rest of the game is logged here, picking up from where it was
+		openLog();
+		m_Log.logResume(m_Moves, m_Game);
 
-void Room::queuePlayer(Player *player) {
-	lock();
+		uint64_t until=Util::milliseconds()+ROOM_RESUME_TIMEOUT;
+		for (int i=0; i<4; i++) {
+			if (!m_HeldUntil[i])
+				m_HeldUntil[i]=until;
+		}
+
+		m_Poller->setTimer(m_Gid, ROOM_RESUME_TIMEOUT);
+	}
 
-	m_Queued.push(player);
-	m_FDBuffer.awake();
+	// the room closes if the owner doesn't show up in time
+	else {
+		m_Phase=AwaitOwner;
+		m_Poller->setTimer(m_Gid, ROOM_OWNER_TIMEOUT);
+	}
 
 	unlock();
 }
 
-void Room::begin() {
+void Room::join(Human *player) {
 	lock();
 
-	// first we flag the new phase
-	m_Phase=AwaitMorePlayers;
+	// players with a session token are back for a seat held for them
+	if (player->getToken() && m_Phase!=Terminating)
+		reclaimSeat(player);
 
-	// and tell the owner he has control
-	Human *owner=static_cast<Human*>(m_Players[0]);
-	owner->getProtocol()->sendStartControl();
-	owner->getProtocol()->sendPlayerJoined(owner->getUsername(), 0);
+	else if (m_Phase==AwaitOwner) {
+		// the owner gets the first slot, and the game can begin
+		if (player->getUsername()==m_Owner) {
+			seatHuman(player, 0);
+			start();
+		}
 
-	// and add the owner's fd
-	m_FDBuffer.addSocket(owner->getProtocol()->getSocket());
+		else {
+			std::cout << player->getUsername() << " is not the owner of room " << m_Gid << std::endl;
+			::close(player->getProtocol()->getSocket());
+			delete player;
+		}
+	}
 
-	// start the relay loop
-	bool loop=true;
-	while(loop) {
-		unlock();
+	else if (m_Phase==Terminating) {
+		::close(player->getProtocol()->getSocket());
+		delete player;
+	}
+
+	else
+		addPlayer(player);
 
-		// see if any clients have sent data
-		FDBuffer::WaitCode code=m_FDBuffer.poll();
+	unlock();
+}
 
-		lock();
+void Room::handleSocket(int fd) {
+	lock();
+
+	int seat=findSeat(fd);
+	if (seat==-1) {
+		unlock();
+		return;
+	}
 
-		// cache active sockets
-		m_ActiveSockets=mapToPlayers(m_FDBuffer.getActiveSockets());
+	Human *hp=getHuman(seat);
 
-		// purge any disconnected players now
-		handleDisconnectedPlayers();
+	Protocol *protocol=hp->getProtocol();
+	Packet::Result res=protocol->receive();
 
-		// take action based on what happened
+	// a single read may have delivered several packets
+	Packet p;
+	Packet::Result parsed=Packet::NoError;
+	while(m_Phase!=Terminating && (parsed=protocol->next(p))==Packet::NoError) {
 		switch(m_Phase) {
 			// we are waiting for the owner to start the room
-			case AwaitMorePlayers: handleAwaitMorePlayers(code); break;
+			case AwaitMorePlayers: handleAwaitMorePlayers(hp, p); break;
 
-			// decide turn orders for current players
-			case FindTurnOrder: handleFindTurnOrder(code); break;
+			// players take turns choosing their tokens
+			case TokenSelection: handleTokenPacket(seat, p); break;
 
-			// end the game room
-			case Terminating: loop=false; break;
+			// the game is under way
+			case Playing: handlePlayingPacket(seat, p); break;
 
-			// this shouldn't happen
+			// clients have nothing to say in the other phases
 			default: break;
 		}
+	}
+
+	// garbage from a client leaves nothing to read the rest of its input by
+	if (parsed==Packet::DataCorrupt)
+		res=Packet::Disconnected;
+
+	// determine if this client disconnected
+	if (res==Packet::Disconnected) {
+		// certain phases are exceptional
+		if (m_Phase==AwaitMorePlayers && hp==m_Players[0])
+			m_Phase=Terminating;
+
+		// once turns are handed out, the seat is held in case the player comes back
+		bool started=(m_Phase==FindTurnOrder || m_Phase==TokenSelection || m_Phase==Playing ||
+			m_Phase==Migrating || m_Phase==Resuming);
+		if (started)
+			holdSeat(seat);
+		else
+			removePlayer(hp, false);
+
+		// with nobody watching, the game waits for someone to come back
+		if (started && m_NumHumans==0 && m_Phase==Playing) {
+			m_Phase=Resuming;
+			m_Poller->setTimer(m_Gid, ROOM_RECONNECT_GRACE);
+		}
 
-		// we also need to accept queued players
-		handleQueuedPlayers();
+		// though there is no point in going on before the game has begun, and a room
+		// being moved keeps its seats for the move to decide what happens next
+		else if (started && m_NumHumans==0 && m_Phase!=Resuming && m_Phase!=Migrating)
+			m_Phase=Terminating;
+
+		// the computer player might be the one everyone is waiting on
+		else if (m_Phase==TokenSelection && m_CurPlayer!=-1 && m_TurnOrder[m_CurPlayer]==seat)
+			m_Poller->setTimer(m_Gid, ROOM_AI_DELAY);
+		else if (m_Phase==Playing)
+			schedule();
 	}
 
+	unlock();
+}
+
+void Room::flushSocket(int fd) {
+	lock();
+
+	int seat=findSeat(fd);
+	if (seat!=-1)
+		getHuman(seat)->getProtocol()->flush();
+
+	unlock();
+}
+
+void Room::handleTimer() {
+	lock();
+
+	// give up on dropped players who took too long to come back
+	releaseExpiredSeats();
+
+	switch(m_Phase) {
+		// the owner never showed up
+		case AwaitOwner: {
+			std::cout << "Owner of room " << m_Gid << " never joined" << std::endl;
+			m_Phase=Terminating;
+		} break;
+
+		// decide turn orders for current players
+		case FindTurnOrder: handleFindTurnOrder(); break;
+
+		// let players choose their tokens
+		case TokenSelection: handleTokenSelection(); break;
+
+		// the player the game is waiting on is a computer, or took too long
+		case Playing: {
+			int decider=m_Game.getDecider();
+			AIPlayer *ai=getComputer(decider);
+
+			Game::Action action;
+			int arg, amount;
+			if (!ai || !ai->decide(action, arg, amount) || !act(decider, action, arg, amount))
+				playDefault();
+
+			flushEvents();
+			schedule();
+		} break;
+
+		// the clients have seen the final standings
+		case GameOver: m_Phase=Terminating; break;
+
+		// nobody said where the room went, so it stays here
+		case Migrating: {
+			std::cout << "Move of room " << m_Gid << " timed out, playing on" << std::endl;
+			playOn();
+		} break;
+
+		// some players never reconnected after the move
+		case Resuming: resume(); break;
+
+		default: break;
+	}
+
+	unlock();
+}
+
+bool Room::isFinished() {
+	lock();
+
+	bool finished=(m_Phase==Terminating);
+
+	unlock();
+
+	return finished;
+}
+
+void Room::close() {
+	lock();
+
+	m_Phase=Terminating;
+	m_Poller->cancelTimer(m_Gid);
+
 	// disconnect all clients
 	for (int i=0; i<4; i++) {
-		Human *hp=dynamic_cast<Human*>(m_Players[i]);
-		if (hp)
-			close(hp->getProtocol()->getSocket());
+		Human *hp=getHuman(i);
+		if (hp) {
+			// the last packets, such as where the room moved to, go out if the socket takes them
+			hp->getProtocol()->flush();
 
-		delete hp;
+			m_Poller->removeSocket(hp->getProtocol()->getSocket());
+			::close(hp->getProtocol()->getSocket());
+		}
+
+		delete m_Players[i];
 		m_Players[i]=NULL;
 	}
+
+	m_Seats.clear();
+	m_NumHumans=0;
+
+	m_Log.close();
+
+	unlock();
+}
+
+bool Room::beginMigration(std::string &snapshot) {
+	lock();
+
+	// only games under way are worth moving
+	if (m_Phase!=Playing) {
+		unlock();
+		return false;
+	}
+
+	Snapshot snap;
+	save(snap);
+	snapshot=snap.data();
+
+	// hold the game until we hear where it went
+	m_Phase=Migrating;
+	m_Poller->setTimer(m_Gid, ROOM_MIGRATE_TIMEOUT);
+
+	unlock();
+
+	return true;
+}
+
+bool Room::endMigration(bool moved, const std::string &host, int port) {
+	lock();
+
+	// the room might have stopped waiting and played on, and then it must not live on both servers
+	if (m_Phase!=Migrating) {
+		bool kept=(moved && m_Phase!=Terminating);
+		if (kept)
+			std::cout << "Room " << m_Gid << " was moved to " << host << ":" << port << " too late, keeping it" << std::endl;
+
+		unlock();
+		return !kept;
+	}
+
+	// send everyone to the new server, where their seats are waiting
+	if (moved) {
+		std::cout << "Room " << m_Gid << " moved to " << host << ":" << port << std::endl;
+		m_Log.logMoved();
+
+		for (int i=0; i<4; i++) {
+			Human *hp=getHuman(i);
+			if (hp)
+				hp->getProtocol()->sendMigrate(host, port);
+		}
+
+		m_Phase=Terminating;
+	}
+
+	else
+		playOn();
+
+	unlock();
+
+	return true;
+}
+
+bool Room::abandon() {
+	lock();
+
+	// once a player is back, the room is here to stay
+	bool dropped=(m_Phase==Resuming || m_Phase==AwaitOwner);
+	if (m_Phase==Resuming) {
+		std::cout << "Room " << m_Gid << " went to another server, dropping it" << std::endl;
+		m_Log.discard();
+	}
+
+	else if (m_Phase==AwaitOwner)
+		std::cout << "Room " << m_Gid << " was opened elsewhere, dropping it" << std::endl;
+
+	if (dropped)
+		m_Phase=Terminating;
+
+	unlock();
+
+	return dropped;
+}
+
+void Room::reclaimSeat(Human *hp) {
+	int seat=-1;
+	for (int i=0; i<4; i++) {
+		if (!m_Reserved[i].empty() && m_Reserved[i]==hp->getUsername() && m_Tokens[i]==hp->getToken())
+			seat=i;
+	}
+
+	// the events the client lost must still be at hand, or there is no catching it up
+	uint32_t seen=hp->getEventsSeen();
+	if (seat==-1 || seen>m_EventCount || m_EventCount-seen>m_History.size()) {
+		std::cout << hp->getUsername() << " is unable to reclaim a seat in room " << m_Gid << std::endl;
+		::close(hp->getProtocol()->getSocket());
+		delete hp;
+
+		return;
+	}
+
+	// the computer player only kept the seat warm
+	delete m_Players[seat];
+	m_Reserved[seat].clear();
+
+	seatHuman(hp, seat);
+	catchUp(seat, seen);
+
+	// a game on hold carries on as soon as someone is back
+	if (m_Phase==Resuming)
+		resume();
+
+	// the player might be the one everyone is waiting on
+	else if (m_Phase==Playing && m_Game.getDecider()==seat)
+		schedule();
+	else if (m_Phase==TokenSelection && m_CurPlayer!=-1 && m_TurnOrder[m_CurPlayer]==seat) {
+		hp->getProtocol()->notify(Protocol::ChooseToken);
+		m_Poller->setTimer(m_Gid, ROOM_TOKEN_TIMEOUT);
+	}
+}
+
+void Room::resume() {
+	releaseExpiredSeats();
+
+	if (m_NumHumans==0) {
+		std::cout << "Nobody reconnected to room " << m_Gid << std::endl;
+		m_Phase=Terminating;
+		return;
+	}
+
+	m_Phase=Playing;
+	remindDecider();
+	schedule();
+}
+
+void Room::playOn() {
+	// everyone dropped while the room was being moved, so the game waits for them here
+	if (m_NumHumans==0) {
+		m_Phase=Resuming;
+		m_Poller->setTimer(m_Gid, ROOM_RECONNECT_GRACE);
+		return;
+	}
+
+	m_Phase=Playing;
+	remindDecider();
+	schedule();
+}
+
+void Room::holdSeat(int index) {
+	Human *hp=getHuman(index);
+	int fd=hp->getProtocol()->getSocket();
+
+	m_Poller->removeSocket(fd);
+	::close(fd);
+
+	m_Seats.erase(fd);
+	m_NumHumans--;
+
+	// the other clients are only told once the seat is given up
+	m_Players[index]=new AIPlayer(hp->getUsername());
+	m_Reserved[index]=hp->getUsername();
+	m_HeldUntil[index]=Util::milliseconds()+ROOM_RECONNECT_GRACE;
+
+	std::cout << "Holding seat " << index << " in room " << m_Gid << " for " << hp->getUsername() << std::endl;
+
+	delete hp;
+}
+
+void Room::releaseSeat(int index) {
+	std::stringstream ss;
+	ss << "Computer " << index+1;
+
+	delete m_Players[index];
+	m_Players[index]=new AIPlayer(ss.str());
+	m_Reserved[index].clear();
+	m_Tokens[index]=0;
+
+	for (int j=0; j<4; j++) {
+		Human *other=getHuman(j);
+		if (other) {
+			other->getProtocol()->sendPlayerQuit(index);
+			other->getProtocol()->sendPlayerJoined(m_Players[index]->getUsername(), index);
+		}
+	}
+}
+
+void Room::releaseExpiredSeats() {
+	uint64_t now=Util::milliseconds();
+	for (int i=0; i<4; i++) {
+		if (!m_Reserved[i].empty() && now>=m_HeldUntil[i])
+			releaseSeat(i);
+	}
+}
+
+void Room::catchUp(int index, uint32_t seen) {
+	Protocol *protocol=getHuman(index)->getProtocol();
+
+	// seats may have changed hands in the meantime
+	for (int i=0; i<4; i++) {
+		if (i!=index && m_Players[i])
+			protocol->sendPlayerJoined(m_Players[i]->getUsername(), i);
+	}
+
+	// so may have tokens
+	for (int i=0; i<4; i++) {
+		if (m_ChosenPieces[i]!=-1)
+			protocol->sendTokenSelected(i, m_ChosenPieces[i]);
+	}
+
+	// and the game went on without the player
+	std::vector<Game::Event> missed(m_History.end()-(m_EventCount-seen), m_History.end());
+	if (!missed.empty())
+		protocol->sendGameEvents(&missed[0], missed.size());
+}
+
+void Room::remindDecider() {
+	Game::Event ev;
+	ev.type=Game::Waiting;
+	ev.player=m_Game.getDecider();
+	ev.arg=m_Game.getStage();
+	ev.amount=0;
+
+	broadcastEvents(&ev, 1);
+}
+
+void Room::save(Snapshot &snap) const {
+	snap.addByte(ROOM_SNAPSHOT_VERSION);
+	snap.addUint32(m_Gid);
+	snap.addString(m_Owner);
+
+	snap.addUint32(m_Rules.getMaxTurns());
+	snap.addByte(m_Rules.getMaxHumans());
+	snap.addUint32(m_Rules.getFreeParkReward());
+	snap.addByte(m_Rules.getIncomeTaxChoice());
+	snap.addByte(m_Rules.getRedistributionMethod());
+
+	snap.addUint64(m_Seed);
+	snap.addUint64(m_Random.getState());
+
+	for (int i=0; i<4; i++) {
+		snap.addByte(m_TurnOrder[i]);
+		snap.addByte(m_ChosenPieces[i]);
+	}
+
+	// seats are saved as 0 for empty, 1 for humans and 2 for computers, and seats held
+	// for dropped players count as human, along with what is left of their grace period
+	uint64_t now=Util::milliseconds();
+	for (int i=0; i<4; i++) {
+		Player *player=m_Players[i];
+		if (!player) {
+			snap.addByte(0);
+			continue;
+		}
+
+		bool held=!m_Reserved[i].empty();
+		bool human=(player->isHuman() || held);
+
+		snap.addByte(human ? 1 : 2);
+		snap.addString(held ? m_Reserved[i] : player->getUsername());
+
+		if (human) {
+			snap.addUint64(m_Tokens[i]);
+			snap.addUint32(held && m_HeldUntil[i]>now ? m_HeldUntil[i]-now : 0);
+		}
+	}
+
+	snap.addUint32(m_EventCount);
+	snap.addUint32(m_Moves);
+	m_Game.save(snap);
+}
+
+void Room::start() {
+	// first we flag the new phase
+	m_Phase=AwaitMorePlayers;
+	m_Poller->cancelTimer(m_Gid);
+
+	// and tell the owner he has control
+	Human *owner=static_cast<Human*>(m_Players[0]);
+	owner->getProtocol()->sendStartControl();
+	owner->getProtocol()->sendPlayerJoined(owner->getUsername(), 0);
 }
 
 void Room::removePlayer(Player *player, bool replace) {
@@ -197,11 +735,12 @@ void Room::removePlayer(Player *player, bool replace) {
 			}
 
 			// if this is a human player, close the socket as well
-			Human *hp=dynamic_cast<Human*>(player);
-			if (hp) {
-				m_FDBuffer.removeSocket(hp->getProtocol()->getSocket());
-				close(hp->getProtocol()->getSocket());
+			if (player->isHuman()) {
+				int fd=static_cast<Human*>(player)->getProtocol()->getSocket();
+				m_Poller->removeSocket(fd);
+				::close(fd);
 
+				m_Seats.erase(fd);
 				m_NumHumans--;
 			}
 
@@ -210,7 +749,7 @@ void Room::removePlayer(Player *player, bool replace) {
 				if (i==j)
 					continue;
 
-				Human *other=dynamic_cast<Human*>(m_Players[j]);
+				Human *other=getHuman(j);
 				if (other) {
 					other->getProtocol()->sendPlayerQuit(i);
 
@@ -225,26 +764,36 @@ void Room::removePlayer(Player *player, bool replace) {
 	}
 }
 
-std::vector<Human*> Room::mapToPlayers(const std::vector<int> &fds) {
-	std::vector<Human*> players;
+int Room::findSeat(int fd) {
+	std::tr1::unordered_map<int, int>::iterator it=m_Seats.find(fd);
+	if (it==m_Seats.end())
+		return -1;
 
-	for (int i=0; i<fds.size(); i++) {
-		for (int j=0; j<m_Players.size(); j++) {
-			Human *hp=dynamic_cast<Human*> (m_Players[j]);
-			if (hp && hp->getProtocol()->getSocket()==fds[i])
-				players.push_back(hp);
-		}
-	}
+	return (*it).second;
+}
 
-	return players;
+void Room::seatHuman(Human *hp, int index) {
+	int fd=hp->getProtocol()->getSocket();
+
+	m_Players[index]=hp;
+	m_Seats[fd]=index;
+	m_NumHumans++;
+
+	// the token lets the player reclaim the seat should the room move to another server
+	m_Tokens[index]=Random::makeSeed();
+	if (!m_Tokens[index])
+		m_Tokens[index]=1;
+
+	hp->getProtocol()->sendSessionToken(m_Tokens[index]);
+	hp->getProtocol()->watch(m_Poller, m_Gid);
 }
 
 void Room::broadcastPlayerJoined(Player *player, int index) {
 	// see if this a human player
-	Human *hp=dynamic_cast<Human*>(player);
+	Human *hp=(player->isHuman() ? static_cast<Human*>(player) : NULL);
 
 	for (int i=0; i<4; i++) {
-		Human *other=dynamic_cast<Human*>(m_Players[i]);
+		Human *other=getHuman(i);
 		if (other) {
 			other->getProtocol()->sendPlayerJoined(player->getUsername(), index);
 
@@ -257,7 +806,7 @@ void Room::broadcastPlayerJoined(Player *player, int index) {
 
 void Room::broadcastTurnOrder() {
 	for (int i=0; i<4; i++) {
-		Human *hp=dynamic_cast<Human*>(m_Players[i]);
+		Human *hp=getHuman(i);
 		if (hp)
 			hp->getProtocol()->sendTurnOrder(m_TurnOrder);
 	}
@@ -265,7 +814,7 @@ void Room::broadcastTurnOrder() {
 
 void Room::broadcastNotification(const Protocol::Notification &note) {
 	for (int i=0; i<4; i++) {
-		Human *hp=dynamic_cast<Human*>(m_Players[i]);
+		Human *hp=getHuman(i);
 		if (hp)
 			hp->getProtocol()->notify(note);
 	}
@@ -273,7 +822,7 @@ void Room::broadcastNotification(const Protocol::Notification &note) {
 
 void Room::broadcastTokenChosen(int player, int piece) {
 	for (int i=0; i<4; i++) {
-		Human *hp=dynamic_cast<Human*>(m_Players[i]);
+		Human *hp=getHuman(i);
 		if (hp)
 			hp->getProtocol()->sendTokenSelected(player, piece);
 	}
@@ -295,96 +844,230 @@ void Room::assignAI() {
 	}
 }
 
-void Room::handleDisconnectedPlayers() {
-	for (int i=0; i<m_ActiveSockets.size(); i++) {
-		Human *hp=m_ActiveSockets[i];
-		int n;
+void Room::addPlayer(Human *hp) {
+	// verify we have a slot
+	if (m_NumHumans==4) {
+		::close(hp->getProtocol()->getSocket());
+		delete hp;
 
-		if (hp && ioctl(hp->getProtocol()->getSocket(), FIONREAD, &n)>-1) {
-			// determine if this client disconnected
-			if (n==0) {
-				// certain phases are exceptional
-				if (m_Phase==AwaitMorePlayers && hp->getUsername()==m_Players[0]->getUsername())
-					m_Phase=Terminating;
+		return;
+	}
 
-				// otherwise remove this player from the vector and fd buffer
-				removePlayer(hp, false);
-				m_ActiveSockets.erase(m_ActiveSockets.begin()+i);
-			}
+	// add him into the vector
+	for (int i=0; i<4; i++) {
+		if (!m_Players[i]) {
+			// seat him and add his socket to the buffer
+			seatHuman(hp, i);
+
+			broadcastPlayerJoined(hp, i);
+
+			return;
 		}
 	}
+
+	// TODO: if the game is in progress, assign this player a piece
+	::close(hp->getProtocol()->getSocket());
+	delete hp;
 }
 
-void Room::handleQueuedPlayers() {
-	while(!m_Queued.empty()) {
-		// this cannot fail... riiight? :P
-		Human *hp=static_cast<Human*>(m_Queued.front());
-		m_Queued.pop();
+void Room::handleAwaitMorePlayers(Human *hp, Packet &p) {
+	// if the owner replied, see if he wants to start the game room
+	if (hp==m_Players[0] && p.byte()==GMRM_BEGIN_GAME) {
+		// now fill all empty slots with computer players
+		assignAI();
 
-		// verify we have a slot
-		if (m_NumHumans==4) {
-			close(hp->getProtocol()->getSocket());
-			delete hp;
+		// inform everyone of the turn order
+		broadcastTurnOrder();
 
-			continue;
-		}
+		// and give the clients time to show it
+		m_Poller->setTimer(m_Gid, ROOM_TURN_ORDER_DELAY);
+		m_Phase=FindTurnOrder;
+	}
+}
 
-		// add him into the vector
-		for (int i=0; i<4; i++) {
-			if (!m_Players[i]) {
-				m_Players[i]=hp;
-				m_NumHumans++;
+void Room::handleFindTurnOrder() {
+	// first tell all clients that token selection has begun
+	broadcastNotification(Protocol::TokenSelectionBegin);
+
+	// -1 means that the first player has yet to receive token selection control
+	m_CurPlayer=-1;
 
-				// add his socket to the buffer
-				m_FDBuffer.addSocket(hp->getProtocol()->getSocket());
+	// let clients breathe and set the next phase
+	m_Poller->setTimer(m_Gid, ROOM_TOKEN_DELAY);
+	m_Phase=TokenSelection;
+}
 
-				broadcastPlayerJoined(hp, i);
+void Room::handleTokenSelection() {
+	// nobody has been asked yet
+	if (m_CurPlayer==-1) {
+		promptToken();
+		return;
+	}
 
-				break;
-			}
-		}
+	// the player up next is a computer, or took too long, so take the first free token
+	int piece=1;
+	while(isTokenTaken(piece))
+		piece++;
 
-		// TODO: if the game is in progress, assign this player a piece
+	chooseToken(piece);
+}
+
+void Room::handleTokenPacket(int seat, Packet &p) {
+	// only the player up next may choose
+	if (p.byte()!=GAME_SELECTED_TOK || m_CurPlayer==-1 || m_TurnOrder[m_CurPlayer]!=seat)
+		return;
+
+	int piece=p.byte();
+	if (piece<1 || piece>ROOM_TOKENS || isTokenTaken(piece))
+		return;
+
+	chooseToken(piece);
+}
+
+bool Room::isTokenTaken(int piece) const {
+	for (int i=0; i<4; i++) {
+		if (m_ChosenPieces[i]==piece)
+			return true;
 	}
+
+	return false;
 }
 
-void Room::handleAwaitMorePlayers(const FDBuffer::WaitCode &fdc) {
-	// the only thing we care about is socket action
-	if (fdc!=FDBuffer::DataReady)
+void Room::chooseToken(int piece) {
+	int seat=m_TurnOrder[m_CurPlayer];
+	m_ChosenPieces[seat]=piece;
+
+	broadcastTokenChosen(seat, piece);
+	promptToken();
+}
+
+void Room::promptToken() {
+	m_CurPlayer++;
+
+	// everyone has a token, so let the game begin
+	if (m_CurPlayer==4) {
+		broadcastNotification(Protocol::TokenSelectionEnd);
+		beginGame();
 		return;
+	}
 
-	for (int i=0; i<m_ActiveSockets.size(); i++) {
-		Packet p;
-		p.read(m_ActiveSockets[i]->getProtocol()->getSocket());
+	// humans are asked and given time to choose, computers choose shortly
+	Human *hp=getHuman(m_TurnOrder[m_CurPlayer]);
+	if (hp) {
+		hp->getProtocol()->notify(Protocol::ChooseToken);
+		m_Poller->setTimer(m_Gid, ROOM_TOKEN_TIMEOUT);
+	}
 
-		// if the owner replied, see if he wants to start the game room
-		if (m_ActiveSockets[i]->getUsername()==m_Players[0]->getUsername() && p.byte()==GMRM_BEGIN_GAME) {
-				// now fill all empty slots with computer players
-				assignAI();
+	else
+		m_Poller->setTimer(m_Gid, ROOM_AI_DELAY);
+}
 
-				// inform everyone of the turn order
-				broadcastTurnOrder();
+void Room::beginGame() {
+	int order[GAME_PLAYERS];
+	for (int i=0; i<GAME_PLAYERS; i++)
+		order[i]=m_TurnOrder[i];
 
-				m_Phase=FindTurnOrder;
-		}
+	bool redistribute=(m_Rules.getRedistributionMethod()==Rules::RandomToPlayers);
+	uint32_t seed=m_Random.next();
+
+	openLog();
+	m_Log.logStart(seed, order, m_Rules.getMaxTurns(), m_Rules.getFreeParkReward(), m_Rules.getIncomeTaxChoice(), redistribute);
+
+	m_Game.seed(seed);
+	m_Game.start(order, m_Rules.getMaxTurns(), m_Rules.getFreeParkReward(), m_Rules.getIncomeTaxChoice(), redistribute);
+	m_Phase=Playing;
+
+	flushEvents();
+	schedule();
+}
+
+void Room::handlePlayingPacket(int seat, Packet &p) {
+	if (p.byte()!=GAME_ACTION)
+		return;
+
+	int action=p.byte();
+	int arg=p.byte();
+	int amount=p.uint32();
+
+	if (action>GAME_ACT_END_TURN)
+		return;
+
+	// illegal moves are simply ignored
+	if (act(seat, (Game::Action) action, arg, amount)) {
+		flushEvents();
+		schedule();
 	}
 }
 
-void Room::handleFindTurnOrder(const FDBuffer::WaitCode &fdc) {
-	// nothing to do but wait for the client's animations to complete
-	if (fdc==FDBuffer::TimeExpired) {
-		// first tell all clients that token selection has begun
-		broadcastNotification(Protocol::TokenSelectionBegin);
+bool Room::act(int seat, const Game::Action &action, int arg, int amount) {
+	if (!m_Game.act(seat, action, arg, amount))
+		return false;
 
-		// -1 means that the first player has yet to receive token selection control
-		m_CurPlayer=-1;
+	m_Log.logAction(seat, action, arg, amount);
+	m_Moves++;
 
-		// let clients breathe and set the next phase
-		m_FDBuffer.setExpireTime(2);
-		m_Phase=TokenSelection;
+	return true;
+}
+
+void Room::playDefault() {
+	m_Log.logDefault();
+	m_Game.playDefault();
+	m_Moves++;
+}
+
+void Room::openLog() {
+	std::string dir=ConfigFile::instance()->getReplayPath();
+	if (dir.empty())
+		return;
+
+	// a game moved here gets a log of its own, in case both servers share a directory
+	std::stringstream ss;
+	ss << dir << "/" << m_Gid << "-" << m_Seed;
+	if (m_Moves)
+		ss << "+" << m_Moves;
+	ss << ".rpl";
+
+	if (!m_Log.open(ss.str(), m_Gid, m_Seed))
+		std::cout << "Unable to create replay log " << ss.str() << std::endl;
+}
+
+void Room::flushEvents() {
+	broadcastEvents(m_Game.getEvents(), m_Game.getEventCount());
+	m_Game.clearEvents();
+}
+
+void Room::broadcastEvents(const Game::Event *events, int count) {
+	for (int i=0; i<4; i++) {
+		Human *hp=getHuman(i);
+		if (hp)
+			hp->getProtocol()->sendGameEvents(events, count);
 	}
+
+	// keep the latest events around for players who drop and come back
+	m_History.insert(m_History.end(), events, events+count);
+	if (m_History.size()>ROOM_HISTORY_MAX)
+		m_History.erase(m_History.begin(), m_History.end()-ROOM_HISTORY_MAX);
+
+	m_EventCount+=count;
 }
 
-void Room::handleTokenSelection(const FDBuffer::WaitCode &fdc) {
+void Room::schedule() {
+	// leave the final standings up for a while
+	if (m_Game.getStage()==Game::Over) {
+		m_Log.logEnd(m_Game);
+		m_Log.close();
 
+		m_Phase=GameOver;
+		m_Poller->setTimer(m_Gid, ROOM_GAMEOVER_DELAY);
+	}
+
+	// humans get time to think, while computers weigh their moves during a short pause
+	else if (getHuman(m_Game.getDecider()))
+		m_Poller->setTimer(m_Gid, ROOM_TURN_TIMEOUT);
+	else {
+		int decider=m_Game.getDecider();
+		getComputer(decider)->think(m_Game, decider, m_Random.next());
+
+		m_Poller->setTimer(m_Gid, ROOM_AI_DELAY);
+	}
 }
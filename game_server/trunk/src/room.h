@@ -22,18 +22,87 @@
 #ifndef ROOM_H
 #define ROOM_H
 
+#include <deque>
 #include <iostream>
 #include <map>
-#include <queue>
+#include <tr1/unordered_map>
 #include <vector>
 
+#include "aiplayer.h"
 #include "fdbuffer.h"
+#include "game.h"
 #include "lockable.h"
 #include "human.h"
 #include "player.h"
+#include "random.h"
+#include "replaylog.h"
+#include "snapshot.h"
+
+/// Milliseconds a new room waits for its owner to join before closing.
+#define ROOM_OWNER_TIMEOUT		7000
+
+/// Milliseconds the clients are given to show the turn order.
+#define ROOM_TURN_ORDER_DELAY	3000
+
+/// Milliseconds the clients are given before token selection starts.
+#define ROOM_TOKEN_DELAY		2000
+
+/// Milliseconds a player has to choose a token before one is chosen for them.
+#define ROOM_TOKEN_TIMEOUT		30000
+
+/// Milliseconds a player has to make a move before the default one is made.
+#define ROOM_TURN_TIMEOUT		60000
+
+/// Milliseconds computer players wait before making a move, so clients can follow along.
+#define ROOM_AI_DELAY			500
+
+/// Milliseconds the final standings are shown before the room closes.
+#define ROOM_GAMEOVER_DELAY		10000
+
+/// Milliseconds a room waits to hear where it was moved to before it plays on, well above the lobby's SERVERPOOL_MIGRATE_TIMEOUT.
+#define ROOM_MIGRATE_TIMEOUT	15000
+
+/// Milliseconds a room moved from another server waits for its players to reconnect.
+#define ROOM_RESUME_TIMEOUT		15000
+
+/// Milliseconds a dropped player's seat is held for them to reconnect.
+#define ROOM_RECONNECT_GRACE	30000
+
+/// Most recent game events kept for catching up players who reconnect.
+#define ROOM_HISTORY_MAX		1024
+
+/// Version of the room snapshot format.
+#define ROOM_SNAPSHOT_VERSION	5
+
+/// Number of tokens to choose from.
+#define ROOM_TOKENS				6
 
 /**
  * Model class for game rooms.
+ * A room is a state machine driven by the worker thread it is pinned to. The worker
+ * calls into the room whenever a player joins, one of its players sends data, or its
+ * timer expires, and the room reacts by advancing its phase. Since only that worker
+ * ever runs a room's game logic, the lock is only needed by other threads peeking at
+ * the room, such as for load reports.
+ *
+ * Once every player has a token, the game itself is played out by a Game object,
+ * which enforces the rules. The room feeds it the actions its clients send, makes
+ * the moves for computer players and for humans who take too long, and passes the
+ * resulting events on to all clients.
+ *
+ * A room with a game under way can be moved to another game server. The room saves
+ * itself to a snapshot and pauses until the lobby says where it went, and the server
+ * picking it up restores it from the snapshot and holds every human's seat until the
+ * player reconnects with the session token the room handed out when seating them.
+ * Should the lobby place the room elsewhere after all, that copy is dropped before
+ * anyone joins it, and should the answer come only after the room gave up waiting
+ * and played on, the lobby is asked to take the room back.
+ *
+ * The same token lets a player whose connection drops once turns are handed out come
+ * back. The seat is held for ROOM_RECONNECT_GRACE, with a computer player making its
+ * moves in the meantime. The room keeps the most recent game events, so a client that
+ * reconnects is only sent those it did not get before. If everyone drops, the game
+ * waits instead.
  */
 class Room: public Lockable {
 	public:
@@ -106,7 +175,7 @@ class Room: public Lockable {
 
 	public:
 		/// Phases in the room's lifespan.
-		enum Phase { Init=0, AwaitOwner, AwaitMorePlayers, FindTurnOrder, TokenSelection, Terminating };
+		enum Phase { Init=0, AwaitOwner, AwaitMorePlayers, FindTurnOrder, TokenSelection, Playing, GameOver, Migrating, Resuming, Terminating };
 
 	public:
 		/**
@@ -117,6 +186,18 @@ class Room: public Lockable {
 		 */
 		Room(int gid, const std::string &owner);
 
+		/// Frees the players still seated, if the room was never attached or closed.
+		~Room();
+
+		/**
+		 * Creates a room from a snapshot taken by another game server. The room waits
+		 * for its human players to reconnect before the game carries on.
+		 *
+		 * @param data The snapshot.
+		 * @return The room, or NULL if the snapshot is invalid.
+		 */
+		static Room* restore(const std::string &data);
+
 		/**
 		 * Sets the rules for this room.
 		 *
@@ -145,6 +226,13 @@ class Room: public Lockable {
 		 */
 		Phase getPhase();
 
+		/**
+		 * Returns the amount of human players in this room.
+		 *
+		 * @return The number of humans.
+		 */
+		int getHumanCount();
+
 		/**
 		 * Returns the room's id number.
 		 *
@@ -152,6 +240,14 @@ class Room: public Lockable {
 		 */
 		int getGid() const { return m_Gid; }
 
+		/**
+		 * Returns the seed everything random in this room was drawn from. Seeding a
+		 * room the same way reproduces its turn order, dice and cards.
+		 *
+		 * @return The seed.
+		 */
+		uint64_t getSeed() const { return m_Seed; }
+
 		/**
 		 * Returns the room's owner.
 		 *
@@ -168,29 +264,101 @@ class Room: public Lockable {
 		bool allowNewPlayers(std::string &result);
 
 		/**
-		 * Adds the owner as a joined player.
-		 * Call this method only once: when the room is awaiting an owner, a call
-		 * to this method flags the game to "begin." Subsequent calls may corrupt
-		 * the state of the room (to be fixed in the future).
+		 * Hands this room to the worker that runs it, and starts waiting for the owner.
+		 *
+		 * @param poller The worker's socket buffer, which the room's sockets and timer are added to.
+		 */
+		void attach(FDBuffer *poller);
+
+		/**
+		 * Adds a player who connected to this room. Until the owner joins, anyone else
+		 * is turned away.
+		 *
+		 * @param player The player, whose socket the room takes over.
+		 */
+		void join(Human *player);
+
+		/**
+		 * Handles data, or a disconnect, on one of this room's sockets.
+		 *
+		 * @param fd The socket.
+		 */
+		void handleSocket(int fd);
+
+		/**
+		 * Writes out output queued for one of this room's sockets, once it has room.
+		 *
+		 * @param fd The socket.
+		 */
+		void flushSocket(int fd);
+
+		/**
+		 * Handles this room's timer expiring.
+		 */
+		void handleTimer();
+
+		/**
+		 * Determines if this room is done and should be closed.
 		 *
-		 * @param player The owner player object.
+		 * @return true if yes, false if no.
 		 */
-		void addOwner(Player *player);
+		bool isFinished();
 
 		/**
-		 * Adds a given player to the internal room queue.
-		 * When the room cycles, it will add the player to the game.
+		 * Disconnects all clients and stops watching their sockets.
+		 */
+		void close();
+
+		/**
+		 * Pauses the game and saves the room, so that it can be moved to another game
+		 * server. Only rooms with a game under way can be moved.
 		 *
-		 * @param player The player to add.
+		 * @param snapshot This gets set to the saved room if the return value is true.
+		 * @return true if the room was saved, false if it can't be moved.
 		 */
-		void queuePlayer(Player *player);
+		bool beginMigration(std::string &snapshot);
 
 		/**
-		 * Starts the procedure to play the game in the room.
+		 * Finishes a move started by beginMigration(). If the room was moved, its
+		 * clients are sent to the new server and the room closes, otherwise the game
+		 * carries on here.
+		 *
+		 * @param moved true if another game server took over the room, false otherwise.
+		 * @param host The host of the new server.
+		 * @param port The port of the new server.
+		 * @return false if the room was moved, but already gave up waiting and played on,
+		 * in which case the copy on the new server has to go; true otherwise.
 		 */
-		void begin();
+		bool endMigration(bool moved, const std::string &host, int port);
+
+		/**
+		 * Closes a room the lobby no longer wants here: one restored from a snapshot
+		 * before any of its players came back, since it was moved to another game
+		 * server after all, or one still waiting for its owner, since the lobby gave
+		 * up on opening it here.
+		 *
+		 * @return true if the room was dropped, false if it is here to stay.
+		 */
+		bool abandon();
 
 	private:
+		/**
+		 * Creates an empty room to be filled in from a snapshot, without seeding it.
+		 *
+		 * @param gid The room id number.
+		 * @param owner The room owner.
+		 * @param snap The snapshot the room is restored from.
+		 */
+		Room(int gid, const std::string &owner, const Snapshot &snap);
+
+		/**
+		 * Sets up the state shared by both constructors.
+		 *
+		 * @param gid The room id number.
+		 * @param owner The room owner.
+		 */
+		void init(int gid, const std::string &owner);
+
 		/**
 		 * Removes a given player from the room.
 		 * This method also notifies all clients of the disconnected player,
@@ -203,13 +371,101 @@ class Room: public Lockable {
 		void removePlayer(Player *player, bool replace);
 
 		/**
-		 * Maps a vector of socket file descriptors to the human players who
-		 * are connected through them.
+		 * Finds the seat of the human player connected through a socket.
+		 *
+		 * @param fd The socket file descriptor.
+		 * @return The seat index, or -1 if the socket is not one of ours.
+		 */
+		int findSeat(int fd);
+
+		/**
+		 * Returns the human player sitting in a seat.
+		 *
+		 * @param index The seat index.
+		 * @return The player, or NULL if the seat is empty or computer controlled.
+		 */
+		Human* getHuman(int index) {
+			Player *player=m_Players[index];
+			return (player && player->isHuman() ? static_cast<Human*>(player) : NULL);
+		}
+
+		/**
+		 * Returns the computer player sitting in a seat.
 		 *
-		 * @param fds A vector of file descriptors.
-		 * @return A translated vector of matching players.
+		 * @param index The seat index.
+		 * @return The player, or NULL if the seat is empty or human controlled.
 		 */
-		std::vector<Human*> mapToPlayers(const std::vector<int> &fds);
+		AIPlayer* getComputer(int index) {
+			Player *player=m_Players[index];
+			return (player && !player->isHuman() ? static_cast<AIPlayer*>(player) : NULL);
+		}
+
+		/**
+		 * Seats a human player and starts watching the player's socket.
+		 *
+		 * @param hp The player.
+		 * @param index The seat index.
+		 */
+		void seatHuman(Human *hp, int index);
+
+		/**
+		 * Gives a player back the seat held for them since the room was moved here.
+		 *
+		 * @param hp The player, who must have the seat's session token.
+		 */
+		void reclaimSeat(Human *hp);
+
+		/**
+		 * Carries on with the game once every player reconnected after a move or while
+		 * the game waited for them, or gave up waiting on the rest. Seats nobody came
+		 * back for go to computer players.
+		 */
+		void resume();
+
+		/**
+		 * Carries on with the game here after a move fell through, or waits for the
+		 * players if they all dropped in the meantime.
+		 */
+		void playOn();
+
+		/**
+		 * Holds the seat of a human player who disconnected, until they reconnect or
+		 * the grace period runs out. A computer player makes the moves meanwhile.
+		 *
+		 * @param index The seat index.
+		 */
+		void holdSeat(int index);
+
+		/**
+		 * Gives a held seat to a computer player for good, and tells everyone.
+		 *
+		 * @param index The seat index.
+		 */
+		void releaseSeat(int index);
+
+		/// Gives up the held seats whose grace period ran out.
+		void releaseExpiredSeats();
+
+		/**
+		 * Sends a player who reclaimed a seat what happened while they were away.
+		 *
+		 * @param index The seat index.
+		 * @param seen The number of game events the player's client already has.
+		 */
+		void catchUp(int index, uint32_t seen);
+
+		/**
+		 * Tells all clients again who the game is waiting on, since moves sent while
+		 * the game was on hold were dropped.
+		 */
+		void remindDecider();
+
+		/**
+		 * Saves the room and the game being played.
+		 *
+		 * @param snap The snapshot to save to.
+		 */
+		void save(Snapshot &snap) const;
 
 		/**
 		 * Alerts all connected clients that a player (computer or human) has joined
@@ -236,33 +492,125 @@ class Room: public Lockable {
 		 * Alerts all clients that the given player has chosen a token.
 		 *
 		 * @param player Index of the player who chosen the token.
-		 * @param piece The index of the token (range is [0,5]).
+		 * @param piece The index of the token (range is [1,6]).
 		 */
 		void broadcastTokenChosen(int player, int piece);
 
 		/// Assigns computer players to empty slots.
 		void assignAI();
 
-		/// Removes any disconnected or dead clients.
-		void handleDisconnectedPlayers();
+		/**
+		 * Gives a player who joined after the owner a free slot.
+		 *
+		 * @param hp The player.
+		 */
+		void addPlayer(Human *hp);
 
-		/// Tries to add waiting players to the game room player list.
-		void handleQueuedPlayers();
+		/**
+		 * Starts the pre-game phase once the owner has joined.
+		 */
+		void start();
 
 		/**
 		 * Handles general player actions during the pre-game phase.
+		 *
+		 * @param hp The player who sent the packet.
+		 * @param p The packet.
 		 */
-		void handleAwaitMorePlayers(const FDBuffer::WaitCode &fdc);
+		void handleAwaitMorePlayers(Human *hp, Packet &p);
 
 		/**
-		 * Handles assigning turn orders to players.
+		 * Handles assigning turn orders to players, once the clients are done animating.
 		 */
-		void handleFindTurnOrder(const FDBuffer::WaitCode &fdc);
+		void handleFindTurnOrder();
 
 		/**
 		 * Handles dealing with the token selection process.
 		 */
-		void handleTokenSelection(const FDBuffer::WaitCode &fdc);
+		void handleTokenSelection();
+
+		/**
+		 * Handles a token chosen by a player during token selection.
+		 *
+		 * @param seat The seat of the player who sent the packet.
+		 * @param p The packet.
+		 */
+		void handleTokenPacket(int seat, Packet &p);
+
+		/**
+		 * Determines if a token was already chosen by someone.
+		 *
+		 * @param piece The token [1,6].
+		 * @return true if so, false otherwise.
+		 */
+		bool isTokenTaken(int piece) const;
+
+		/**
+		 * Gives the player who is up next the given token.
+		 *
+		 * @param piece The token [1,6].
+		 */
+		void chooseToken(int piece);
+
+		/**
+		 * Passes token selection on to the next player in turn order, or starts the
+		 * game once everyone has a token.
+		 */
+		void promptToken();
+
+		/**
+		 * Sets up the board and hands the dice to the first player.
+		 */
+		void beginGame();
+
+		/**
+		 * Handles game actions sent by a player.
+		 *
+		 * @param seat The seat of the player who sent the packet.
+		 * @param p The packet.
+		 */
+		void handlePlayingPacket(int seat, Packet &p);
+
+		/**
+		 * Takes an action in the game on behalf of a player, and logs it.
+		 *
+		 * @param seat The player's seat.
+		 * @param action The action.
+		 * @param arg The space for property actions.
+		 * @param amount The amount for bids.
+		 * @return true if the action was taken, false if it is not allowed.
+		 */
+		bool act(int seat, const Game::Action &action, int arg, int amount);
+
+		/**
+		 * Makes the default move for the player the game is waiting on, and logs it.
+		 */
+		void playDefault();
+
+		/**
+		 * Creates the log of the game, if the server is set up for it.
+		 */
+		void openLog();
+
+		/**
+		 * Sends the events produced by the game to all clients.
+		 */
+		void flushEvents();
+
+		/**
+		 * Sends game events to all clients, and keeps them for players who drop and
+		 * come back.
+		 *
+		 * @param events The events.
+		 * @param count The number of events.
+		 */
+		void broadcastEvents(const Game::Event *events, int count);
+
+		/**
+		 * Sets the timer for whoever the game is waiting on, or for closing the room
+		 * once the game is over.
+		 */
+		void schedule();
 
 		/// The id number of the room.
 		int m_Gid;
@@ -304,14 +652,41 @@ class Room: public Lockable {
 		/// The players (both human and computer) in this room.
 		std::vector<Player*> m_Players;
 
-		/// Players waiting to be added to the game.
-		std::queue<Player*> m_Queued;
+		/// Session token of each human's seat, for reconnecting.
+		std::vector<uint64_t> m_Tokens;
+
+		/// Username of the player each seat is held for, while the room waits for them to reconnect.
+		std::vector<std::string> m_Reserved;
+
+		/// When each held seat is given up, in milliseconds.
+		std::vector<uint64_t> m_HeldUntil;
+
+		/// The most recent game events, for catching up players who reconnect.
+		std::deque<Game::Event> m_History;
+
+		/// Number of game events sent to clients since the game began.
+		uint32_t m_EventCount;
+
+		/// Number of moves made since the game began, on this server or any it moved from.
+		uint32_t m_Moves;
+
+		/// The game being played.
+		Game m_Game;
+
+		/// The seed of the room's random number generator.
+		uint64_t m_Seed;
+
+		/// Draws turn orders and seeds for the game and computer players.
+		Random m_Random;
+
+		/// Record of the game, for replaying it.
+		ReplayLog m_Log;
 
-		/// Temporary vector for active player sockets.
-		std::vector<Human*> m_ActiveSockets;
+		/// Seat index of each human player, by socket file descriptor.
+		std::tr1::unordered_map<int, int> m_Seats;
 
-		/// A controller for connected clients.
-		FDBuffer m_FDBuffer;
+		/// The socket buffer of the worker running this room.
+		FDBuffer *m_Poller;
 };
 
 #endif
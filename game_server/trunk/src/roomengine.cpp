@@ -19,20 +19,16 @@
  ***************************************************************************/
 // roomengine.cpp: implementation of the RoomEngine class.
 
-#include <sys/socket.h>
-#include <sys/time.h>
+#include <unistd.h>
 
-#include "configfile.h"
-#include "clientsocket.h"
 #include "human.h"
-#include "packet.h"
-#include "protspec.h"
+#include "lobbylink.h"
 #include "roomengine.h"
-#include "thread.h"
 
 RoomEngine *g_RoomEngine=NULL;
 
 RoomEngine::RoomEngine() {
+	m_Draining=false;
 	g_RoomEngine=this;
 }
 
@@ -40,132 +36,332 @@ RoomEngine* RoomEngine::instance() {
 	return g_RoomEngine;
 }
 
-void* RoomEngine::roomProcess(void *arg) {
-	ThreadData *data=(ThreadData*) arg;
+bool RoomEngine::start(int workers) {
+	if (workers<=0)
+		workers=sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers<1)
+		workers=1;
 
-	std::cout << "New thread started...\n";
+	for (int i=0; i<workers; i++) {
+		Worker *worker=new Worker(this);
+		if (!worker->start())
+			return false;
 
-	// now wait on the owner for up to 5 minutes
-	Thread::lock(&data->ownerJoinMutex);
-	data->room->setPhase(Room::AwaitOwner);
+		m_Workers.push_back(worker);
+	}
 
-	Thread::sleep(&data->ownerJoinCV, &data->ownerJoinMutex, 7);
+	return true;
+}
 
-	// determine if the owner joined or not
-	bool begin=false;
-	if (data->owner) {
-		data->room->addOwner(data->owner);
-		begin=true;
+bool RoomEngine::openRoom(Room *room, std::string &error) {
+	if (m_Draining) {
+		error="This server is being drained.";
+		return false;
 	}
 
-	Thread::unlock(&data->ownerJoinMutex);
+	lock();
 
-	// start the game room now
-	if (begin)
-		data->room->begin();
+	// the lobby might be retrying a request we already carried out
+	if (m_Rooms.find(room->getGid())!=m_Rooms.end()) {
+		unlock();
+		error="A room with this id is already open.";
+		return false;
+	}
 
-	// tell the lobby server that this room is closing
-	try {
-		ClientSocket cl;
-		cl.connect(ConfigFile::instance()->getLobbyServerIP(), ConfigFile::instance()->getLobbyServerPort());
+	// pin the room to the worker with the fewest rooms
+	Worker *worker=m_Workers[0];
+	for (int i=1; i<m_Workers.size(); i++) {
+		if (m_Workers[i]->getRoomCount()<worker->getRoomCount())
+			worker=m_Workers[i];
+	}
 
-		Packet lp;
-		lp.addByte(CONN_GAME);
-		lp.addByte(IS_KILLROOM);
-		lp.addUint32(data->room->getGid());
-		lp.write(cl.getFD());
+	worker->addRooms(1);
 
-		cl.disconnect();
+	Slot &slot=m_Rooms[room->getGid()];
+	slot.room=room;
+	slot.worker=worker;
+
+	unlock();
+
+	worker->post(room);
+
+	return true;
+}
+
+void RoomEngine::closeRoom(int gid) {
+	lock();
+
+	std::map<int, Slot>::iterator it=m_Rooms.find(gid);
+	if (it!=m_Rooms.end()) {
+		(*it).second.worker->addRooms(-1);
+		m_Rooms.erase(it);
 	}
 
-	catch (const ClientSocket::Exception &ex) {
-		std::cout << "ClientSocket Error: " << ex.getMessage() << std::endl;
+	unlock();
+}
+
+bool RoomEngine::addPlayerToRoom(int gid, const std::string &username, int socket, uint64_t token, uint32_t seen,
+		std::string &error) {
+	lock();
+
+	// verify the room exists
+	std::map<int, Slot>::iterator it=m_Rooms.find(gid);
+	if (it==m_Rooms.end()) {
+		unlock();
+		error="No such room exists.";
+		return false;
 	}
 
-	std::cout << "Terminating game room " << data->room->getGid() << std::endl;
+	Worker *worker=(*it).second.worker;
 
-	pthread_exit(0);
+	unlock();
+
+	Human *player=new Human(username, socket);
+	player->setToken(token);
+	player->setEventsSeen(seen);
+
+	// the room decides what to do with the player on its own thread
+	worker->post(gid, player);
+
+	return true;
 }
 
-void RoomEngine::openRoom(Room *room) {
+void RoomEngine::migrateRooms() {
 	lock();
 
-	// create a new thread data object
-	ThreadData *data=new ThreadData(room);
+	// rooms that can't be moved yet simply ignore the request
+	for (std::map<int, Slot>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it)
+		(*it).second.worker->postMigrate((*it).first);
+
+	unlock();
+}
 
-	// add the room to the map
-	m_Rooms[room->getGid()]=data;
+void RoomEngine::finishMigration(int gid, bool moved, const std::string &host, int port) {
+	lock();
 
-	// start a new thread for this room
-	pthread_create(&data->thread, NULL, &RoomEngine::roomProcess, (void*) data);
+	std::map<int, Slot>::iterator it=m_Rooms.find(gid);
+	if (it!=m_Rooms.end())
+		(*it).second.worker->postMigrated(gid, moved, host, port);
 
 	unlock();
 }
 
-void RoomEngine::closeRoom(Room *room) {
+void RoomEngine::dropRoom(int gid) {
 	lock();
 
-	m_Rooms.erase(room->getGid());
+	std::map<int, Slot>::iterator it=m_Rooms.find(gid);
+	if (it!=m_Rooms.end())
+		(*it).second.worker->postDrop(gid);
 
-	ThreadData *data=m_Rooms[room->getGid()];
-	delete data;
+	unlock();
+}
+
+void RoomEngine::getLoad(int &rooms, int &players) {
+	lock();
+
+	rooms=m_Rooms.size();
+	players=0;
+
+	for (std::map<int, Slot>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it)
+		players+=(*it).second.room->getHumanCount();
 
 	unlock();
 }
 
-bool RoomEngine::addPlayerToRoom(int gid, const std::string &username, int socket, std::string &error) {
+RoomEngine::Worker::Worker(RoomEngine *engine) {
+	m_Engine=engine;
+	m_RoomCount=0;
+}
+
+bool RoomEngine::Worker::start() {
+	return (pthread_create(&m_Thread, NULL, &RoomEngine::Worker::workerProcess, this)==0);
+}
+
+void RoomEngine::Worker::post(Room *room) {
+	Message msg;
+	msg.type=Message::OpenRoom;
+	msg.gid=room->getGid();
+	msg.room=room;
+	msg.player=NULL;
+
+	post(msg);
+}
+
+void RoomEngine::Worker::post(int gid, Human *player) {
+	Message msg;
+	msg.type=Message::JoinRoom;
+	msg.gid=gid;
+	msg.room=NULL;
+	msg.player=player;
+
+	post(msg);
+}
+
+void RoomEngine::Worker::postMigrate(int gid) {
+	Message msg;
+	msg.type=Message::MigrateRoom;
+	msg.gid=gid;
+	msg.room=NULL;
+	msg.player=NULL;
+
+	post(msg);
+}
+
+void RoomEngine::Worker::postMigrated(int gid, bool moved, const std::string &host, int port) {
+	Message msg;
+	msg.type=Message::RoomMigrated;
+	msg.gid=gid;
+	msg.room=NULL;
+	msg.player=NULL;
+	msg.moved=moved;
+	msg.host=host;
+	msg.port=port;
+
+	post(msg);
+}
+
+void RoomEngine::Worker::postDrop(int gid) {
+	Message msg;
+	msg.type=Message::DropRoom;
+	msg.gid=gid;
+	msg.room=NULL;
+	msg.player=NULL;
+
+	post(msg);
+}
+
+void RoomEngine::Worker::post(const Message &msg) {
 	lock();
+	m_Inbox.push_back(msg);
+	unlock();
 
-	// verify the room exists
-	if (m_Rooms.find(gid)==m_Rooms.end()) {
-		unlock();
-		error="No such room exists.";
-		return false;
-	}
+	m_Poller.awake();
+}
+
+void* RoomEngine::Worker::workerProcess(void *arg) {
+	Worker *worker=(Worker*) arg;
+	worker->run();
+
+	pthread_exit(0);
+}
 
-	ThreadData *data=m_Rooms[gid];
-	Thread::lock(&data->ownerJoinMutex);
+void RoomEngine::Worker::run() {
+	std::vector<Message> inbox;
 
-	Room *room=data->room;
+	while(1) {
+		m_Poller.poll();
 
-	// create a new human object
-	Human *hp=new Human(username, socket);
+		// take on whatever other threads handed us
+		lock();
+		inbox.swap(m_Inbox);
+		unlock();
 
-	// if the room is awaiting its owner, join the player if he is in fact that owner
-	if (room->getPhase()==Room::AwaitOwner) {
-		if (username==room->getOwner()) {
-			// also wake the room process thread
-			data->owner=hp;
-			Thread::signal(&data->ownerJoinCV);
+		for (int i=0; i<inbox.size(); i++) {
+			Message &msg=inbox[i];
+
+			// a new room starts waiting for its owner, or for its players if it was moved here
+			if (msg.type==Message::OpenRoom) {
+				m_Rooms[msg.gid]=msg.room;
+				msg.room->attach(&m_Poller);
+
+				if (msg.room->getPhase()==Room::Resuming)
+					std::cout << "Room " << msg.gid << " is waiting for its players to reconnect" << std::endl;
+				else
+					std::cout << "Room " << msg.gid << " is waiting for its owner" << std::endl;
+
+				continue;
+			}
+
+			// the other messages are for a room that may have closed in the meantime
+			std::map<int, Room*>::iterator it=m_Rooms.find(msg.gid);
+			if (it==m_Rooms.end()) {
+				if (msg.player) {
+					close(msg.player->getProtocol()->getSocket());
+					delete msg.player;
+				}
+
+				continue;
+			}
+
+			Room *room=(*it).second;
+			switch(msg.type) {
+				// a player joins the room
+				case Message::JoinRoom: room->join(msg.player); break;
+
+				// the room is asked to move, and the lobby finds it a new server
+				case Message::MigrateRoom: {
+					std::string snapshot;
+					if (room->beginMigration(snapshot))
+						LobbyLink::instance()->sendMigrateRoom(msg.gid, snapshot);
+				} break;
+
+				// the lobby found the room a new server, or gave up, though the room might have
+				// stopped waiting for word already, in which case the lobby has to take it back
+				case Message::RoomMigrated: {
+					if (!room->endMigration(msg.moved, msg.host, msg.port))
+						LobbyLink::instance()->sendKeepRoom(msg.gid, msg.host, msg.port);
+				} break;
+
+				// the lobby moved or opened the room elsewhere after all, and already
+				// forgot about this copy, whose id may belong to another room by now
+				case Message::DropRoom: {
+					if (room->abandon()) {
+						reap(room, false);
+						continue;
+					}
+				} break;
+
+				default: break;
+			}
+
+			reap(room);
 		}
 
-		else {
-			error="This is not the room owner";
-			Thread::unlock(&data->ownerJoinMutex);
-			unlock();
+		inbox.clear();
+
+		// sockets with data, that disconnected, or that can take more of their output
+		const std::vector<FDBuffer::Ready> &ready=m_Poller.getActiveSockets();
+		for (int i=0; i<ready.size(); i++) {
+			std::map<int, Room*>::iterator it=m_Rooms.find(ready[i].key);
+			if (it!=m_Rooms.end()) {
+				Room *room=(*it).second;
+				if (ready[i].writable)
+					room->flushSocket(ready[i].fd);
+				if (ready[i].readable)
+					room->handleSocket(ready[i].fd);
+
+				reap(room);
+			}
+		}
 
-			return false;
+		// rooms whose timers ran out
+		const std::vector<int> &expired=m_Poller.getExpiredTimers();
+		for (int i=0; i<expired.size(); i++) {
+			std::map<int, Room*>::iterator it=m_Rooms.find(expired[i]);
+			if (it!=m_Rooms.end()) {
+				Room *room=(*it).second;
+				room->handleTimer();
+				reap(room);
+			}
 		}
 	}
+}
 
-	// other phases when the player could join
-	else
-		room->queuePlayer(hp);
+void RoomEngine::Worker::reap(Room *room, bool notify) {
+	if (!room->isFinished())
+		return;
 
-	Thread::unlock(&data->ownerJoinMutex);
+	int gid=room->getGid();
+	std::cout << "Terminating game room " << gid << std::endl;
 
-	unlock();
-	return true;
-}
+	// nobody can find the room anymore once the engine forgets it
+	m_Engine->closeRoom(gid);
+	m_Rooms.erase(gid);
 
-RoomEngine::ThreadData::ThreadData(Room *room) {
-	this->room=room;
-	Thread::createCondVar(&ownerJoinCV);
-	Thread::createMutex(&ownerJoinMutex);
-	owner=NULL;
-}
+	room->close();
+	delete room;
 
-RoomEngine::ThreadData::~ThreadData() {
-	Thread::destroyCondVar(&ownerJoinCV);
-	Thread::destroyMutex(&ownerJoinMutex);
+	// tell the lobby server that this room is closing
+	if (notify)
+		LobbyLink::instance()->sendKillRoom(gid);
 }
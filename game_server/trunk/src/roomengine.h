@@ -24,7 +24,9 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
 
+#include "fdbuffer.h"
 #include "human.h"
 #include "lockable.h"
 #include "room.h"
@@ -32,8 +34,16 @@
 /**
  * The core of the game server.
  * This class is responsible for managing the game server itself; it handles
- * accepting or rejecting client connections, room threads, user threads, and
- * the overall mechanics of each room game.
+ * accepting or rejecting client connections, and running every room's game.
+ *
+ * Rooms don't get a thread of their own. Instead, a fixed pool of workers, one per
+ * processor, each waits on the sockets and timers of many rooms at once through a
+ * shared FDBuffer, and drives whichever rooms need attention. A room stays pinned to
+ * the worker it was first given, so its game logic never runs on two threads at once.
+ * Other threads hand rooms and players to a worker through its inbox.
+ *
+ * A server being drained stops taking new rooms, and moves the games under way in
+ * its rooms to other game servers through the lobby.
  */
 class RoomEngine: public Lockable {
 	public:
@@ -48,25 +58,28 @@ class RoomEngine: public Lockable {
 		static RoomEngine* instance();
 
 		/**
-		 * Routine for handling and managing a given game room.
+		 * Starts the worker threads.
 		 *
-		 * @param arg A pointer to a Room object.
+		 * @param workers The amount of workers, or 0 for one per processor.
+		 * @return true if all workers were started, false otherwise.
 		 */
-		static void* roomProcess(void *arg);
+		bool start(int workers=0);
 
 		/**
 		 * Opens a new game room with the given parameters.
 		 *
 		 * @param room The room to open.
+		 * @param error This gets set to a description of the error that occurred, if any.
+		 * @return true if the room was opened, false otherwise.
 		 */
-		void openRoom(Room *room);
+		bool openRoom(Room *room, std::string &error);
 
 		/**
-		 * Closes the given game room.
+		 * Forgets a game room that has closed.
 		 *
-		 * @param room The room to close.
+		 * @param gid The room's id number.
 		 */
-		void closeRoom(Room *room);
+		void closeRoom(int gid);
 
 		/**
 		 * Adds a player to a game room.
@@ -74,49 +87,225 @@ class RoomEngine: public Lockable {
 		 * @param gid The room's id number.
 		 * @param username The user's username.
 		 * @param socket The user's connection socket.
+		 * @param token The session token the user reconnects with, or 0 for none.
+		 * @param seen The number of game events the user's client received before reconnecting.
 		 * @param error This gets set to a description of the error that occurred, if any.
-		 * @return true if the user was able to join, false otherwise.
+		 * @return true if the user was handed to the room, false otherwise.
+		 */
+		bool addPlayerToRoom(int gid, const std::string &username, int socket, uint64_t token, uint32_t seen,
+				std::string &error);
+
+		/**
+		 * Stops taking new rooms, so that the server can be shut down once its games
+		 * have moved elsewhere. This method is safe to call from a signal handler.
+		 */
+		void setDraining() { m_Draining=true; }
+
+		/**
+		 * Determines if the server is being drained.
+		 *
+		 * @return true if yes, false if no.
+		 */
+		bool isDraining() const { return m_Draining; }
+
+		/**
+		 * Asks every room with a game under way to move to another game server.
+		 */
+		void migrateRooms();
+
+		/**
+		 * Passes on the lobby's word on where a room was moved to.
+		 *
+		 * @param gid The room's id number.
+		 * @param moved true if another game server took over the room, false otherwise.
+		 * @param host The host of the new server.
+		 * @param port The port of the new server.
+		 */
+		void finishMigration(int gid, bool moved, const std::string &host, int port);
+
+		/**
+		 * Closes a room taken over from another game server, if none of its players
+		 * came back yet, since the lobby moved it elsewhere after all.
+		 *
+		 * @param gid The room's id number.
+		 */
+		void dropRoom(int gid);
+
+		/**
+		 * Measures how busy this server is, for the lobby to balance rooms by.
+		 *
+		 * @param rooms Set to the amount of open rooms.
+		 * @param players Set to the amount of human players in those rooms.
 		 */
-		bool addPlayerToRoom(int gid, const std::string &username, int socket, std::string &error);
+		void getLoad(int &rooms, int &players);
 
 	private:
-		/// Storage object for threads and their associated data.
-		class ThreadData {
+		/// A thread running the rooms pinned to it.
+		class Worker: public Lockable {
 			public:
-				/// Default constructor
-				ThreadData() { };
+				/**
+				 * Creates a worker with no rooms.
+				 *
+				 * @param engine The engine the worker belongs to.
+				 */
+				Worker(RoomEngine *engine);
 
 				/**
-				 * Creates a new thread data object for the given room.
+				 * Starts the worker thread.
 				 *
-				 * @param handle A handle to the thread.
-				 * @param room The room to keep track of.
+				 * @return true if the thread was started, false otherwise.
 				 */
-				ThreadData(Room *room);
+				bool start();
 
 				/**
-				 * Frees data associated with this thread.
+				 * Hands a new room to this worker. This method may be called from any thread.
+				 *
+				 * @param room The room.
+				 */
+				void post(Room *room);
+
+				/**
+				 * Hands a player who connected to one of this worker's rooms over to it.
+				 * This method may be called from any thread.
+				 *
+				 * @param gid The room's id number.
+				 * @param player The player.
+				 */
+				void post(int gid, Human *player);
+
+				/**
+				 * Asks one of this worker's rooms to move to another game server.
+				 * This method may be called from any thread.
+				 *
+				 * @param gid The room's id number.
+				 */
+				void postMigrate(int gid);
+
+				/**
+				 * Tells one of this worker's rooms where it was moved to.
+				 * This method may be called from any thread.
+				 *
+				 * @param gid The room's id number.
+				 * @param moved true if another game server took over the room, false otherwise.
+				 * @param host The host of the new server.
+				 * @param port The port of the new server.
 				 */
-				~ThreadData();
+				void postMigrated(int gid, bool moved, const std::string &host, int port);
+
+				/**
+				 * Tells one of this worker's rooms to give up a move to this server.
+				 * This method may be called from any thread.
+				 *
+				 * @param gid The room's id number.
+				 */
+				void postDrop(int gid);
+
+				/**
+				 * Returns the amount of rooms pinned to this worker.
+				 *
+				 * @return The number of rooms.
+				 */
+				int getRoomCount() const { return m_RoomCount; }
+
+				/**
+				 * Counts a room pinned to, or closed on, this worker. The engine must be locked.
+				 *
+				 * @param delta 1 for a new room, -1 for a closed one.
+				 */
+				void addRooms(int delta) { m_RoomCount+=delta; }
+
+			private:
+				/// Something handed to the worker by another thread.
+				struct Message {
+					/// What the worker is asked to do.
+					enum Type { OpenRoom=0, JoinRoom, MigrateRoom, RoomMigrated, DropRoom };
+
+					/// The kind of message.
+					Type type;
+
+					/// The room's id number.
+					int gid;
+
+					/// A new room, or NULL.
+					Room *room;
+
+					/// A player joining the room, or NULL.
+					Human *player;
+
+					/// Whether the room was moved, for RoomMigrated.
+					bool moved;
+
+					/// The host the room was moved to, for RoomMigrated.
+					std::string host;
+
+					/// The port the room was moved to, for RoomMigrated.
+					int port;
+				};
+
+				/**
+				 * Adds a message to the inbox and wakes the worker.
+				 *
+				 * @param msg The message.
+				 */
+				void post(const Message &msg);
+
+				/**
+				 * Entry point for the worker thread.
+				 *
+				 * @param arg Pointer to the worker.
+				 */
+				static void* workerProcess(void *arg);
+
+				/**
+				 * Runs rooms until the process exits.
+				 */
+				void run();
+
+				/**
+				 * Closes a room if it is done.
+				 *
+				 * @param room The room.
+				 * @param notify false if the lobby server already forgot about the room.
+				 */
+				void reap(Room *room, bool notify=true);
+
+				/// The engine this worker belongs to.
+				RoomEngine *m_Engine;
 
 				/// Thread handle.
-				pthread_t thread;
+				pthread_t m_Thread;
 
-				/// Conditional variable used to wait for the room owner to join.
-				pthread_cond_t ownerJoinCV;
+				/// Waits on the sockets and timers of all rooms on this worker.
+				FDBuffer m_Poller;
 
-				/// Associated mutex with the ownerJoinCV conditional variable.
-				pthread_mutex_t ownerJoinMutex;
+				/// The rooms run by this worker, by id number. Only the worker thread uses this.
+				std::map<int, Room*> m_Rooms;
 
-				/// Room managed by this thread.
-				Room *room;
+				/// Rooms pinned to this worker, as counted by the engine.
+				int m_RoomCount;
 
-				/// Temporary holding pointer for the room owner.
-				Human *owner;
+				/// Messages waiting to be handled, guarded by the worker's lock.
+				std::vector<Message> m_Inbox;
+		};
+
+		/// An open room, along with the worker it is pinned to.
+		struct Slot {
+			/// The room.
+			Room *room;
+
+			/// The worker running the room.
+			Worker *worker;
 		};
 
 	private:
-		std::map<int, ThreadData*> m_Rooms;
+		/// The open rooms, by id number.
+		std::map<int, Slot> m_Rooms;
+
+		/// The worker threads.
+		std::vector<Worker*> m_Workers;
+
+		/// Whether the server is being drained, set from a signal handler.
+		volatile bool m_Draining;
 };
 
 #endif
@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// snapshot.cpp: implementation of the Snapshot class.
+
+#include "snapshot.h"
+
+Snapshot::Snapshot() {
+	m_Pos=0;
+	m_Good=true;
+}
+
+Snapshot::Snapshot(const std::string &data) {
+	m_Data=data;
+	m_Pos=0;
+	m_Good=true;
+}
+
+void Snapshot::addString(const std::string &str) {
+	addUint16(str.size());
+	m_Data.append(str);
+}
+
+std::string Snapshot::string() {
+	int length=uint16();
+	if (m_Pos+length>m_Data.size()) {
+		m_Good=false;
+		return "";
+	}
+
+	std::string str=m_Data.substr(m_Pos, length);
+	m_Pos+=length;
+
+	return str;
+}
+
+void Snapshot::add(uint64_t n, int size) {
+	for (int i=0; i<size; i++)
+		m_Data.push_back((char) ((n >> (i*8)) & 0xFF));
+}
+
+uint64_t Snapshot::get(int size) {
+	if (m_Pos+size>m_Data.size()) {
+		m_Good=false;
+		m_Pos=m_Data.size();
+
+		return 0;
+	}
+
+	uint64_t n=0;
+	for (int i=0; i<size; i++)
+		n|=(uint64_t) (uint8_t) m_Data[m_Pos++] << (i*8);
+
+	return n;
+}
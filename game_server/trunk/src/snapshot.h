@@ -0,0 +1,148 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// snapshot.h: definition of the Snapshot class.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <iostream>
+#include <stdint.h>
+
+/**
+ * A buffer for saving the state of a room, so that another game server can pick it up.
+ * Values are written and read back in the same order, with integers stored least
+ * significant byte first, much like a Packet but without a size limit or a header.
+ * Reading past the end yields zeros and marks the snapshot as bad, so a truncated or
+ * corrupt snapshot can be checked for once, after everything was read.
+ */
+class Snapshot {
+	public:
+		/// Creates an empty snapshot, to write to.
+		Snapshot();
+
+		/**
+		 * Creates a snapshot from saved data, to read from.
+		 *
+		 * @param data The data.
+		 */
+		Snapshot(const std::string &data);
+
+		/**
+		 * Adds a single byte.
+		 *
+		 * @param n The byte.
+		 */
+		void addByte(uint8_t n) { add(n, 1); }
+
+		/**
+		 * Adds a 2 byte unsigned integer.
+		 *
+		 * @param n The integer.
+		 */
+		void addUint16(uint16_t n) { add(n, 2); }
+
+		/**
+		 * Adds a 4 byte unsigned integer.
+		 *
+		 * @param n The integer.
+		 */
+		void addUint32(uint32_t n) { add(n, 4); }
+
+		/**
+		 * Adds an 8 byte unsigned integer.
+		 *
+		 * @param n The integer.
+		 */
+		void addUint64(uint64_t n) { add(n, 8); }
+
+		/**
+		 * Adds a string, preceded by its length.
+		 *
+		 * @param str The string, which may not be longer than 65535 bytes.
+		 */
+		void addString(const std::string &str);
+
+		/**
+		 * Reads a byte.
+		 */
+		uint8_t byte() { return get(1); }
+
+		/**
+		 * Reads a 2 byte unsigned integer.
+		 */
+		uint16_t uint16() { return get(2); }
+
+		/**
+		 * Reads a 4 byte unsigned integer.
+		 */
+		uint32_t uint32() { return get(4); }
+
+		/**
+		 * Reads an 8 byte unsigned integer.
+		 */
+		uint64_t uint64() { return get(8); }
+
+		/**
+		 * Reads a string.
+		 */
+		std::string string();
+
+		/**
+		 * Checks if everything read so far was actually there.
+		 *
+		 * @return true if no read went past the end, false otherwise.
+		 */
+		bool good() const { return m_Good; }
+
+		/**
+		 * Returns the saved data.
+		 *
+		 * @return The data.
+		 */
+		const std::string& data() const { return m_Data; }
+
+	private:
+		/**
+		 * Adds an integer.
+		 *
+		 * @param n The integer.
+		 * @param size The number of bytes to add.
+		 */
+		void add(uint64_t n, int size);
+
+		/**
+		 * Reads an integer.
+		 *
+		 * @param size The number of bytes to read.
+		 * @return The integer, or 0 if the data ran out.
+		 */
+		uint64_t get(int size);
+
+		/// The saved data.
+		std::string m_Data;
+
+		/// Offset of the next byte to read.
+		size_t m_Pos;
+
+		/// Whether every read so far was within the data.
+		bool m_Good;
+};
+
+#endif
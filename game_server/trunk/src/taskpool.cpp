@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// taskpool.cpp: implementation of the TaskPool class.
+
+#include <cerrno>
+#include <unistd.h>
+
+#include "taskpool.h"
+
+TaskPool *g_TaskPool=NULL;
+
+TaskPool::TaskPool() {
+	g_TaskPool=this;
+
+	sem_init(&m_Waiting, 0, 0);
+	m_Next=0;
+}
+
+TaskPool* TaskPool::instance() {
+	return g_TaskPool;
+}
+
+bool TaskPool::start(int workers) {
+	if (workers<=0)
+		workers=sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers<1)
+		workers=1;
+
+	// all workers have to exist before any of them goes looking for tasks to steal
+	for (int i=0; i<workers; i++)
+		m_Workers.push_back(new Worker(this, i));
+
+	for (int i=0; i<workers; i++) {
+		if (!m_Workers[i]->start())
+			return false;
+	}
+
+	return true;
+}
+
+void TaskPool::submit(const std::vector<Task*> &tasks) {
+	lock();
+
+	int next=m_Next;
+	m_Next=(m_Next+tasks.size())%m_Workers.size();
+
+	unlock();
+
+	// deal the tasks out, and only then wake up as many workers
+	for (int i=0; i<tasks.size(); i++)
+		m_Workers[(next+i)%m_Workers.size()]->push(tasks[i]);
+
+	for (int i=0; i<tasks.size(); i++)
+		sem_post(&m_Waiting);
+}
+
+TaskPool::Worker::Worker(TaskPool *pool, int index) {
+	m_Pool=pool;
+	m_Index=index;
+}
+
+bool TaskPool::Worker::start() {
+	return (pthread_create(&m_Thread, NULL, &TaskPool::Worker::workerProcess, this)==0);
+}
+
+void TaskPool::Worker::push(Task *task) {
+	lock();
+	m_Queue.push_back(task);
+	unlock();
+}
+
+TaskPool::Task* TaskPool::Worker::pop() {
+	lock();
+
+	Task *task=NULL;
+	if (!m_Queue.empty()) {
+		task=m_Queue.back();
+		m_Queue.pop_back();
+	}
+
+	unlock();
+
+	return task;
+}
+
+TaskPool::Task* TaskPool::Worker::steal() {
+	lock();
+
+	Task *task=NULL;
+	if (!m_Queue.empty()) {
+		task=m_Queue.front();
+		m_Queue.pop_front();
+	}
+
+	unlock();
+
+	return task;
+}
+
+void* TaskPool::Worker::workerProcess(void *arg) {
+	Worker *worker=(Worker*) arg;
+	worker->run();
+
+	return NULL;
+}
+
+void TaskPool::Worker::run() {
+	std::vector<Worker*> &workers=m_Pool->m_Workers;
+
+	while(1) {
+		// wait until there is a task to be had
+		if (sem_wait(&m_Pool->m_Waiting)<0) {
+			if (errno!=EINTR)
+				return;
+
+			continue;
+		}
+
+		// every task is queued before it is counted, so one is bound to turn up
+		Task *task=pop();
+		for (int i=1; !task; i++)
+			task=(i%workers.size()==0 ? pop() : workers[(m_Index+i)%workers.size()]->steal());
+
+		task->run();
+		delete task;
+	}
+}
@@ -0,0 +1,157 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// taskpool.h: definition of the TaskPool class.
+
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <deque>
+#include <pthread.h>
+#include <semaphore.h>
+#include <vector>
+
+#include "lockable.h"
+
+/**
+ * A pool of threads for short, processor bound jobs, such as the rollouts computer
+ * players run to weigh their moves.
+ * Every worker has a queue of its own, and submitted tasks are dealt out over all of
+ * them. A worker takes tasks from the back of its own queue, and once that runs dry it
+ * steals from the front of the others, so a burst of work from one room spreads over
+ * every processor without all the workers contending for a single queue.
+ */
+class TaskPool: public Lockable {
+	public:
+		/// A job to run on the pool.
+		class Task {
+			public:
+				/// Frees memory used by this object.
+				virtual ~Task() { }
+
+				/**
+				 * Does the work. The pool deletes the task once this returns.
+				 */
+				virtual void run()=0;
+		};
+
+	public:
+		/// Creates a pool with no workers.
+		TaskPool();
+
+		/**
+		 * Returns the first instance of this class.
+		 *
+		 * @return A pointer to a TaskPool object.
+		 */
+		static TaskPool* instance();
+
+		/**
+		 * Starts the worker threads.
+		 *
+		 * @param workers The amount of workers, or 0 for one per processor.
+		 * @return true if all workers were started, false otherwise.
+		 */
+		bool start(int workers=0);
+
+		/**
+		 * Queues tasks to be run. This method may be called from any thread.
+		 *
+		 * @param tasks The tasks, which the pool takes ownership of.
+		 */
+		void submit(const std::vector<Task*> &tasks);
+
+	private:
+		/// A thread running tasks.
+		class Worker: public Lockable {
+			public:
+				/**
+				 * Creates a worker with an empty queue.
+				 *
+				 * @param pool The pool the worker belongs to.
+				 * @param index The worker's position in the pool.
+				 */
+				Worker(TaskPool *pool, int index);
+
+				/**
+				 * Starts the worker thread.
+				 *
+				 * @return true if the thread was started, false otherwise.
+				 */
+				bool start();
+
+				/**
+				 * Adds a task to the back of this worker's queue.
+				 *
+				 * @param task The task.
+				 */
+				void push(Task *task);
+
+				/**
+				 * Takes a task from the back of this worker's queue.
+				 *
+				 * @return The task, or NULL if the queue is empty.
+				 */
+				Task* pop();
+
+				/**
+				 * Takes a task from the front of this worker's queue, on behalf of another worker.
+				 *
+				 * @return The task, or NULL if the queue is empty.
+				 */
+				Task* steal();
+
+			private:
+				/**
+				 * Entry point for the worker thread.
+				 *
+				 * @param arg Pointer to the worker.
+				 */
+				static void* workerProcess(void *arg);
+
+				/**
+				 * Runs tasks until the process exits.
+				 */
+				void run();
+
+				/// The pool this worker belongs to.
+				TaskPool *m_Pool;
+
+				/// The worker's position in the pool.
+				int m_Index;
+
+				/// Thread handle.
+				pthread_t m_Thread;
+
+				/// Tasks waiting to be run, guarded by the worker's lock.
+				std::deque<Task*> m_Queue;
+		};
+
+	private:
+		/// Counts the tasks waiting across all queues.
+		sem_t m_Waiting;
+
+		/// The worker threads.
+		std::vector<Worker*> m_Workers;
+
+		/// The worker the next submitted task goes to, guarded by the lock.
+		int m_Next;
+};
+
+#endif
@@ -22,24 +22,28 @@
 #ifndef UTILITIES_H
 #define UTILITIES_H
 
+#include <stdint.h>
 #include <vector>
 
+#include "random.h"
+
 namespace Util {
 
 /**
- * Draws a random positive number (32-bit integer) within the given range.
+ * Generates a random turn order.
  *
- * @param low The lower bound.
- * @param high The upper bound.
+ * @param random The generator to draw from.
+ * @param players The number of players.
+ * @return A vector of player indices, in turn order.
  */
-int randomInt(int low, int high);
+std::vector<int> generateTurnOrder(Random &random, int players);
 
 /**
- * Generates a random turn order for four players.
+ * Reads a clock that is not affected by changes to the system time.
  *
- * @return A vector of player indices, in turn order.
+ * @return The clock's reading, in milliseconds.
  */
-std::vector<int> generateTurnOrder();
+uint64_t milliseconds();
 
 }
 
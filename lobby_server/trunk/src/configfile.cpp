@@ -35,6 +35,8 @@ ConfigFile::ConfigFile(const std::string &path) {
 	m_IP="";
 	m_Port=0;
 	m_MaxClients=0;
+	m_ReactorThreads=0;
+	m_DBPoolSize=0;
 
 	g_CfgFile=this;
 }
@@ -80,6 +82,12 @@ void ConfigFile::parse() throw(ConfigFile::Exception) {
 			m_MaxClients=atoi(pval);
 		}
 
+		// reactor threads
+		else if (xmlStrcmp(child->name, (const xmlChar*) "reactor-threads")==0) {
+			const char *pval=(const char*) xmlNodeGetContent(child);
+			m_ReactorThreads=atoi(pval);
+		}
+
 		// server list
 		else if (xmlStrcmp(child->name, (const xmlChar*) "servers")==0) {
 			try {
@@ -116,6 +124,7 @@ void ConfigFile::parseServerList(void *node) throw(ConfigFile::Exception) {
 		const char *id=NULL;
 		const char *ip=NULL;
 		int port=0;
+		int weight=1;
 
 		// get the server identifier
 		id=(const char*) xmlGetProp(snode, (xmlChar*) "id");
@@ -134,6 +143,12 @@ void ConfigFile::parseServerList(void *node) throw(ConfigFile::Exception) {
 				port=atoi(pval);
 			}
 
+			// relative capacity, if this server is bigger or smaller than the others
+			else if (xmlStrcmp(enode->name, (const xmlChar*) "weight")==0) {
+				const char *pval=(const char*) xmlNodeGetContent(enode);
+				weight=atoi(pval);
+			}
+
 			enode=enode->next;
 		}
 
@@ -144,9 +159,11 @@ void ConfigFile::parseServerList(void *node) throw(ConfigFile::Exception) {
 			throw ConfigFile::Exception("Missing IP address for game server.");
 		else if (port==0)
 			throw ConfigFile::Exception("Missing port number for game server.");
+		else if (weight<=0)
+			throw ConfigFile::Exception("Game server weight must be a positive number.");
 
 		// otherwise create an object for this server and add it to the list
-		ConfigFile::Server server(std::string(id), std::string(ip), port);
+		ConfigFile::Server server(std::string(id), std::string(ip), port, weight);
 		m_GameServers.push_back(server);
 
 		snode=snode->next;
@@ -179,6 +196,10 @@ void ConfigFile::parseMySQLSection(void *node) throw(ConfigFile::Exception) {
 		else if (xmlStrcmp(snode->name, (const xmlChar*) "port")==0)
 			port=atoi((const char*) xmlNodeGetContent(snode));
 
+		// the pool size is optional
+		else if (xmlStrcmp(snode->name, (const xmlChar*) "pool-size")==0)
+			m_DBPoolSize=atoi((const char*) xmlNodeGetContent(snode));
+
 		snode=snode->next;
 	}
 
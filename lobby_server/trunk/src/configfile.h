@@ -63,7 +63,8 @@ class ConfigFile {
 				/**
 				 * Default constructor for setting data for this server object.
 				 */
-				Server(const std::string &id, const std::string &ip, int port): m_ID(id), m_IP(ip), m_Port(port) { };
+				Server(const std::string &id, const std::string &ip, int port, int weight=1):
+						m_ID(id), m_IP(ip), m_Port(port), m_Weight(weight) { };
 
 				/**
 				 * Returns the identifier string for this server.
@@ -83,6 +84,12 @@ class ConfigFile {
 				 */
 				int getPort() const { return m_Port; }
 
+				/**
+				 * Returns the share of rooms the server should get relative to the others.
+				 * @return The server weight.
+				 */
+				int getWeight() const { return m_Weight; }
+
 			private:
 				/// The unique server identifier string.
 				std::string m_ID;
@@ -92,6 +99,9 @@ class ConfigFile {
 
 				/// The port number of the server.
 				int m_Port;
+
+				/// The relative capacity of the server.
+				int m_Weight;
 		};
 
 	public:
@@ -138,6 +148,12 @@ class ConfigFile {
 		 */
 		int getMaxClients() const { return m_MaxClients; }
 
+		/**
+		 * Returns the amount of reactor threads servicing client connections.
+		 * @return Number of reactor threads, or 0 for one per core.
+		 */
+		int getReactorThreads() const { return m_ReactorThreads; }
+
 		/**
 		 * Returns a list of defined game servers.
 		 * @return Vector of game servers associated with this login server.
@@ -174,6 +190,12 @@ class ConfigFile {
 		 */
 		std::string getDBPassword() const { return m_DBPassword; }
 
+		/**
+		 * Returns the maximum number of database connections to keep open.
+		 * @return The size of the connection pool, or 0 for the default.
+		 */
+		int getDBPoolSize() const { return m_DBPoolSize; }
+
 	private:
 		/**
 		 * Parses the list of associated game servers.
@@ -202,6 +224,9 @@ class ConfigFile {
 		/// Maximum number of client connections allowed.
 		int m_MaxClients;
 
+		/// Number of reactor threads, or 0 for one per core.
+		int m_ReactorThreads;
+
 		/// List of associated game servers.
 		std::vector<ConfigFile::Server> m_GameServers;
 
@@ -219,6 +244,9 @@ class ConfigFile {
 
 		/// The database user password.
 		std::string m_DBPassword;
+
+		/// The maximum number of database connections, or 0 for the default.
+		int m_DBPoolSize;
 };
 
 #endif
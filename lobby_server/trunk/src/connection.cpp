@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// connection.cpp: implementation of the Connection class.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "connection.h"
+#include "reactor.h"
+
+// amount of unsent data after which a peer is considered too slow to keep up
+#define CONNECTION_MAX_BACKLOG	(256*1024)
+
+Connection::Connection(const std::string &ip, int port, int socket) {
+	m_IP=ip;
+	m_Port=port;
+	m_Socket=socket;
+	m_State=Handshake;
+	m_User=NULL;
+	m_Owner=0;
+	m_Scheduled=false;
+	m_Refs=1;
+
+	pthread_mutex_init(&m_Mutex, NULL);
+
+	// all io on this socket is done without blocking
+	int flags=fcntl(m_Socket, F_GETFL);
+	fcntl(m_Socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+Connection::~Connection() {
+	if (m_Socket!=-1)
+		::close(m_Socket);
+
+	pthread_mutex_destroy(&m_Mutex);
+}
+
+void Connection::ref() {
+	__sync_add_and_fetch(&m_Refs, 1);
+}
+
+void Connection::unref() {
+	if (__sync_sub_and_fetch(&m_Refs, 1)==0)
+		delete this;
+}
+
+void Connection::setState(const State &state) {
+	pthread_mutex_lock(&m_Mutex);
+
+	if (m_State!=Closing && m_State!=Closed)
+		m_State=state;
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+Connection::State Connection::getState() {
+	pthread_mutex_lock(&m_Mutex);
+
+	State state=m_State;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return state;
+}
+
+bool Connection::activate(User *user) {
+	pthread_mutex_lock(&m_Mutex);
+
+	// the reactor thread may have given up on this connection in the meantime
+	bool open=(m_State!=Closing && m_State!=Closed);
+	if (open) {
+		m_User=user;
+		m_State=Active;
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return open;
+}
+
+User* Connection::detachUser() {
+	pthread_mutex_lock(&m_Mutex);
+
+	User *user=m_User;
+	m_User=NULL;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return user;
+}
+
+User* Connection::getUser() {
+	pthread_mutex_lock(&m_Mutex);
+
+	User *user=m_User;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return user;
+}
+
+bool Connection::next(Packet &p) {
+	State state=getState();
+	if (state==Closing || state==Closed)
+		return false;
+
+	Packet::Result res=m_Input.next(p);
+	if (res==Packet::DataCorrupt) {
+		std::cout << "Dropping connection from " << m_IP << ": corrupt packet\n";
+
+		m_Input.clear();
+		shutdown();
+	}
+
+	return (res==Packet::NoError);
+}
+
+void Connection::send(Packet &p) {
+	pthread_mutex_lock(&m_Mutex);
+
+	// nobody is listening anymore
+	if (m_State==Closed) {
+		pthread_mutex_unlock(&m_Mutex);
+		return;
+	}
+
+	// don't let a client that stopped reading eat up all our memory; drop whatever
+	// is queued so the reactor thread closes the connection right away
+	if (m_Output.size()>CONNECTION_MAX_BACKLOG) {
+		if (m_State!=Closing)
+			std::cout << "Dropping connection from " << m_IP << ": too much unsent data\n";
+
+		m_Output.clear();
+		m_State=Closing;
+	}
+
+	else
+		m_Output.append(p);
+
+	// only the first packet since the last flush needs to wake the reactor thread
+	bool schedule=!m_Scheduled;
+	m_Scheduled=true;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	if (schedule)
+		Reactor::instance()->schedule(this);
+}
+
+bool Connection::flush() {
+	pthread_mutex_lock(&m_Mutex);
+
+	m_Scheduled=false;
+	Packet::Result res=m_Output.drain(m_Socket);
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return (res!=Packet::Disconnected);
+}
+
+void Connection::shutdown() {
+	pthread_mutex_lock(&m_Mutex);
+
+	if (m_State==Closed) {
+		pthread_mutex_unlock(&m_Mutex);
+		return;
+	}
+
+	m_State=Closing;
+
+	// have the reactor thread notice, in case it's not the one calling us
+	bool schedule=!m_Scheduled;
+	m_Scheduled=true;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	if (schedule)
+		Reactor::instance()->schedule(this);
+}
+
+bool Connection::isFinished() {
+	pthread_mutex_lock(&m_Mutex);
+
+	bool done=(m_State==Closing && m_Output.empty());
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return done;
+}
+
+void Connection::close() {
+	pthread_mutex_lock(&m_Mutex);
+
+	m_State=Closed;
+	m_Output.clear();
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+bool Connection::isClosed() {
+	pthread_mutex_lock(&m_Mutex);
+
+	bool closed=(m_State==Closed);
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return closed;
+}
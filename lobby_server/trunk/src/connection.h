@@ -0,0 +1,261 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// connection.h: definition of the Connection class.
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include "packet.h"
+#include "packetbuffer.h"
+
+class Reactor;
+class User;
+
+/**
+ * A non-blocking socket connection owned by a reactor thread.
+ * Every accepted socket is wrapped in a Connection and handed off to one of the
+ * reactor threads, which is then the only thread that reads from it. Incoming
+ * bytes are accumulated in a PacketBuffer until one or more complete packets can
+ * be extracted, so short reads never corrupt the stream.
+ *
+ * Outgoing packets may be queued from any thread. Rather than writing each packet
+ * as it is produced, they pile up in an output buffer and the owning reactor thread
+ * writes them all out together once per event loop iteration. A burst of broadcasts
+ * therefore costs one system call per connection instead of one per packet.
+ *
+ * A connection may outlive its socket, since threads fanning out broadcasts can
+ * still hold it after the reactor has closed it. It is therefore reference counted:
+ * the reactor holds one reference, and anyone else keeping a pointer around must
+ * take their own with ref() and give it up with unref().
+ */
+class Connection {
+	public:
+		/// The stages a connection goes through.
+		enum State { Handshake, Authenticating, Verifying, Active, Control, Closing, Closed };
+
+	public:
+		/**
+		 * Wraps an accepted socket.
+		 * The socket is switched to non-blocking mode.
+		 *
+		 * @param ip The IP address of the peer.
+		 * @param port The port of the peer.
+		 * @param socket The accepted socket.
+		 */
+		Connection(const std::string &ip, int port, int socket);
+
+		/**
+		 * Takes another reference to this connection.
+		 */
+		void ref();
+
+		/**
+		 * Gives up a reference to this connection, deleting it if none are left.
+		 */
+		void unref();
+
+		/**
+		 * Returns the IP address of the peer.
+		 *
+		 * @return The peer's IP address.
+		 */
+		std::string getIP() const { return m_IP; }
+
+		/**
+		 * Returns the port of the peer.
+		 *
+		 * @return The peer's port.
+		 */
+		int getPort() const { return m_Port; }
+
+		/**
+		 * Returns the socket for this connection.
+		 *
+		 * @return The socket file descriptor.
+		 */
+		int getSocket() const { return m_Socket; }
+
+		/**
+		 * Sets the current stage of this connection.
+		 * A connection that is shutting down stays that way.
+		 *
+		 * @param state The new state.
+		 */
+		void setState(const State &state);
+
+		/**
+		 * Returns the current stage of this connection.
+		 *
+		 * @return The connection's state.
+		 */
+		State getState();
+
+		/**
+		 * Associates an authenticated user with this connection and makes it active.
+		 * The connection takes over the caller's reference to the user. This method
+		 * may be called from any thread.
+		 *
+		 * @param user The user.
+		 * @return true if the user was attached, false if the connection is already
+		 * closed, in which case the caller keeps its reference.
+		 */
+		bool activate(User *user);
+
+		/**
+		 * Detaches the authenticated user from this connection, handing the connection's
+		 * reference to the user over to the caller.
+		 *
+		 * @return The user, or NULL if the connection was never authenticated.
+		 */
+		User* detachUser();
+
+		/**
+		 * Returns the authenticated user on this connection.
+		 *
+		 * @return The user, or NULL if the connection is not authenticated.
+		 */
+		User* getUser();
+
+		/**
+		 * Sets the reactor thread that owns this connection.
+		 *
+		 * @param owner The index of the owning reactor thread.
+		 */
+		void setOwner(int owner) { m_Owner=owner; }
+
+		/**
+		 * Returns the reactor thread that owns this connection.
+		 *
+		 * @return The index of the owning reactor thread.
+		 */
+		int getOwner() const { return m_Owner; }
+
+		/**
+		 * Reads data available on the socket into the input buffer.
+		 * Only the owning reactor thread should call this method. Once it returns,
+		 * use next() to extract any packets that were completed.
+		 *
+		 * @return TimedOut if the socket is drained, NoError if the input buffer filled
+		 * up first (call this method again once packets have been extracted), or
+		 * Disconnected if the peer has gone away.
+		 */
+		Packet::Result fill() { return m_Input.fill(m_Socket); }
+
+		/**
+		 * Extracts the next complete packet from the input buffer.
+		 * If the peer sent a malformed packet, the connection is shut down.
+		 *
+		 * @param p The packet to load.
+		 * @return true if a packet was extracted, false if more data is needed.
+		 */
+		bool next(Packet &p);
+
+		/**
+		 * Queues a packet to be sent to the peer.
+		 * The packet is written by the owning reactor thread at the end of its current
+		 * event loop iteration. This method may be called from any thread.
+		 *
+		 * @param p The packet to send.
+		 */
+		void send(Packet &p);
+
+		/**
+		 * Writes as much queued data as the socket will accept.
+		 * Only the owning reactor thread should call this method.
+		 *
+		 * @return false if the socket is broken, true otherwise.
+		 */
+		bool flush();
+
+		/**
+		 * Flags this connection to be closed once all queued data has been sent.
+		 * No further packets are read from the peer. This method may be called from
+		 * any thread.
+		 */
+		void shutdown();
+
+		/**
+		 * Determines if this connection can be closed by its reactor thread.
+		 *
+		 * @return true if shutdown() was called and all queued data was sent.
+		 */
+		bool isFinished();
+
+		/**
+		 * Marks this connection as closed by its reactor thread.
+		 * Packets sent from now on are silently discarded, and users can no longer be
+		 * attached. The socket itself is closed once the last reference is released.
+		 */
+		void close();
+
+		/**
+		 * Determines if this connection was closed by its reactor thread.
+		 *
+		 * @return true if the connection is closed, false otherwise.
+		 */
+		bool isClosed();
+
+	private:
+		/**
+		 * Closes the socket, if it is still open. Use unref() instead of deleting
+		 * connections directly.
+		 */
+		~Connection();
+
+		/// Number of references held to this connection.
+		int m_Refs;
+
+		/// The peer's IP address.
+		std::string m_IP;
+
+		/// The peer's port.
+		int m_Port;
+
+		/// The socket file descriptor.
+		int m_Socket;
+
+		/// The stage of this connection.
+		State m_State;
+
+		/// The authenticated user, if any.
+		User *m_User;
+
+		/// Index of the owning reactor thread.
+		int m_Owner;
+
+		/// Bytes received that do not yet form a complete packet.
+		PacketBuffer m_Input;
+
+		/// Packets waiting to be written.
+		PacketBuffer m_Output;
+
+		/// Whether the owning reactor thread has been asked to flush the output buffer.
+		bool m_Scheduled;
+
+		/// Guards the output buffer, which is shared between threads.
+		pthread_mutex_t m_Mutex;
+};
+
+#endif
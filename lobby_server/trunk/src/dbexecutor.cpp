@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// dbexecutor.cpp: implementation of the DBExecutor class.
+
+#include "dbexecutor.h"
+
+// global instance of the executor
+DBExecutor *g_Executor=NULL;
+
+void DBExecutor::Task::fail(const DBMySQL::Exception &ex) {
+	std::cout << "** DBMYSQL *** : " << ex.getMessage() << std::endl;
+}
+
+DBExecutor::DBExecutor(int threads) {
+	m_ThreadCount=(threads>0 ? threads : 1);
+
+	pthread_mutex_init(&m_Mutex, NULL);
+	pthread_cond_init(&m_Cond, NULL);
+
+	g_Executor=this;
+}
+
+DBExecutor* DBExecutor::instance() {
+	return g_Executor;
+}
+
+void DBExecutor::start() throw(DBExecutor::Exception) {
+	for (int i=0; i<m_ThreadCount; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, &DBExecutor::workerProcess, this)!=0)
+			throw DBExecutor::Exception("Unable to start database thread.");
+
+		m_Threads.push_back(thread);
+	}
+}
+
+void DBExecutor::submit(Task *task) {
+	const void *strand=task->getStrand();
+
+	pthread_mutex_lock(&m_Mutex);
+
+	// wait for earlier tasks on the same strand to finish first
+	std::tr1::unordered_map<const void*, std::deque<Task*> >::iterator it=m_Strands.find(strand);
+	if (strand && it!=m_Strands.end())
+		(*it).second.push_back(task);
+
+	else {
+		// mark the strand as busy
+		if (strand)
+			m_Strands[strand];
+
+		m_Ready.push_back(task);
+		pthread_cond_signal(&m_Cond);
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void* DBExecutor::workerProcess(void *arg) {
+	DBExecutor *executor=(DBExecutor*) arg;
+	executor->run();
+
+	pthread_exit(0);
+}
+
+void DBExecutor::run() {
+	while(1) {
+		pthread_mutex_lock(&m_Mutex);
+
+		while(m_Ready.empty())
+			pthread_cond_wait(&m_Cond, &m_Mutex);
+
+		Task *task=m_Ready.front();
+		m_Ready.pop_front();
+
+		pthread_mutex_unlock(&m_Mutex);
+
+		const void *strand=task->getStrand();
+		execute(task);
+
+		if (!strand)
+			continue;
+
+		pthread_mutex_lock(&m_Mutex);
+
+		// let the next task on this strand go, or free the strand if there is none
+		std::deque<Task*> &waiting=m_Strands[strand];
+		if (waiting.empty())
+			m_Strands.erase(strand);
+
+		else {
+			m_Ready.push_back(waiting.front());
+			waiting.pop_front();
+			pthread_cond_signal(&m_Cond);
+		}
+
+		pthread_mutex_unlock(&m_Mutex);
+	}
+}
+
+void DBExecutor::execute(Task *task) {
+	bool success=false;
+
+	try {
+		// the connection goes back to the pool before the completion callbacks run
+		pDBMySQL db=DBMySQL::synthesize();
+		task->run(db.get());
+		success=true;
+	}
+
+	catch (const DBMySQL::Exception &ex) {
+		task->fail(ex);
+	}
+
+	if (success)
+		task->complete();
+
+	delete task;
+}
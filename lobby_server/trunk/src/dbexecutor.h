@@ -0,0 +1,191 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// dbexecutor.h: definition of the DBExecutor class.
+
+#ifndef DBEXECUTOR_H
+#define DBEXECUTOR_H
+
+#include <deque>
+#include <iostream>
+#include <pthread.h>
+#include <tr1/unordered_map>
+#include <vector>
+
+#include "dbmysql.h"
+
+/**
+ * Runs database queries on a dedicated pool of threads.
+ * Lobby code never talks to MySQL on a reactor thread. Instead it wraps the work in a
+ * Task and submits it here, where one of the executor threads leases a pooled
+ * connection, runs the query, and then calls back into the task with the outcome.
+ * Since there are only as many executor threads as pooled connections, the number of
+ * connections to MySQL stays capped no matter how many clients are online.
+ *
+ * Tasks may name a strand. Tasks on the same strand run one at a time, in the order
+ * they were submitted, so a client's requests can't overtake each other. Tasks on
+ * different strands, or on none, run in parallel.
+ */
+class DBExecutor {
+	public:
+		/**
+		 * A general exception for executor problems.
+		 */
+		class Exception {
+			public:
+				/// Default constructor for executor exceptions.
+				Exception(const std::string &msg): m_Message(msg) { };
+
+				/**
+				 * Returns the reason for this exception.
+				 * @return Message string
+				 */
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The message for this exception.
+				std::string m_Message;
+		};
+
+		/**
+		 * A unit of database work.
+		 * Both run() and the completion callbacks are called on an executor thread, so
+		 * completions must only touch state that is safe to share between threads.
+		 */
+		class Task {
+			public:
+				/**
+				 * Creates a task.
+				 *
+				 * @param strand The strand to run the task on, or NULL for none.
+				 */
+				Task(const void *strand=NULL): m_Strand(strand) { }
+
+				/// Frees resources held by the task.
+				virtual ~Task() { }
+
+				/**
+				 * Runs the queries of this task.
+				 *
+				 * @param db A database handle leased for the duration of this call.
+				 * @throw An exception if a query failed.
+				 */
+				virtual void run(DBMySQL *db) throw(DBMySQL::Exception)=0;
+
+				/**
+				 * Called after run() returned successfully.
+				 */
+				virtual void complete() { }
+
+				/**
+				 * Called if run() threw an exception, or no connection could be leased.
+				 *
+				 * @param ex The reason the task failed.
+				 */
+				virtual void fail(const DBMySQL::Exception &ex);
+
+				/**
+				 * Returns the strand this task runs on.
+				 *
+				 * @return The strand, or NULL for none.
+				 */
+				const void* getStrand() const { return m_Strand; }
+
+			private:
+				/// The strand this task runs on.
+				const void *m_Strand;
+		};
+
+	public:
+		/**
+		 * Creates an executor with the given amount of threads.
+		 *
+		 * @param threads The amount of executor threads.
+		 */
+		DBExecutor(int threads);
+
+		/**
+		 * Returns a pointer to the global executor.
+		 *
+		 * @return A pointer to a DBExecutor object.
+		 */
+		static DBExecutor* instance();
+
+		/**
+		 * Starts the executor threads.
+		 * @throw A DBExecutor::Exception if an error occurs.
+		 */
+		void start() throw(DBExecutor::Exception);
+
+		/**
+		 * Queues a task to be run. This method never blocks on the database.
+		 * Ownership of the task is transferred to the executor, which deletes it once
+		 * it has completed or failed.
+		 *
+		 * @param task The task to run.
+		 */
+		void submit(Task *task);
+
+		/**
+		 * Returns the amount of executor threads.
+		 *
+		 * @return The number of threads.
+		 */
+		int getThreadCount() const { return m_ThreadCount; }
+
+	private:
+		/**
+		 * Entry point for executor threads.
+		 *
+		 * @param arg Pointer to the executor.
+		 */
+		static void* workerProcess(void *arg);
+
+		/**
+		 * Takes tasks off the queue and runs them until the process exits.
+		 */
+		void run();
+
+		/**
+		 * Runs a single task, reporting its outcome back to it.
+		 *
+		 * @param task The task to run.
+		 */
+		void execute(Task *task);
+
+		/// Amount of executor threads.
+		int m_ThreadCount;
+
+		/// The executor threads.
+		std::vector<pthread_t> m_Threads;
+
+		/// Tasks that may run right away.
+		std::deque<Task*> m_Ready;
+
+		/// Tasks waiting on each busy strand. A strand is busy while it has an entry here.
+		std::tr1::unordered_map<const void*, std::deque<Task*> > m_Strands;
+
+		/// Guards the queues.
+		pthread_mutex_t m_Mutex;
+
+		/// Signaled when a task becomes ready.
+		pthread_cond_t m_Cond;
+};
+
+#endif
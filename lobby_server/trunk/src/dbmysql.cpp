@@ -21,7 +21,9 @@
 
 #include <cstring>
 #include <cstdlib>
-#include <sstream>
+#include <pthread.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
 
 #include "dbmysql.h"
 
@@ -32,42 +34,138 @@ std::string g_DB="";
 std::string g_User="";
 std::string g_Password="";
 
+// the connection pool
+static std::vector<DBMySQL*> g_Idle;
+static int g_Open=0;
+static int g_PoolSize=DBMYSQL_POOL_SIZE;
+static pthread_mutex_t g_PoolMutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_PoolCond=PTHREAD_COND_INITIALIZER;
+
+// the queries behind each prepared statement, in the order of DBMySQL::StatementId
+// placeholders for one batch of a batched update; there must be DBMYSQL_BATCH_SIZE of them
+#define DBMYSQL_BATCH_PARAMS8	"?, ?, ?, ?, ?, ?, ?, ?"
+#define DBMYSQL_BATCH_PARAMS	DBMYSQL_BATCH_PARAMS8 ", " DBMYSQL_BATCH_PARAMS8 ", " DBMYSQL_BATCH_PARAMS8 ", " DBMYSQL_BATCH_PARAMS8
+
+// only the login queries look users up by name; everything after that goes by uid
+static const char *g_Statements[]={
+	"SELECT uid FROM users WHERE username=? AND password=?",
+	"SELECT uid, email, muted, real_name, age, bio FROM users WHERE username=?",
+	"UPDATE users SET online=? WHERE uid IN (" DBMYSQL_BATCH_PARAMS ")",
+	"SELECT points, games_played, won, lost FROM statistics WHERE uid=?",
+	"SELECT real_name, email, age, bio FROM users WHERE uid=?",
+	"UPDATE users SET real_name=?, email=?, age=?, bio=? WHERE uid=?",
+	"UPDATE users SET password=? WHERE uid=?",
+	"SELECT O.username FROM userlists AS L JOIN users AS O ON L.other_id=O.uid WHERE L.uid=? AND L.blocked=?",
+	"DELETE L FROM userlists AS L JOIN users AS O ON L.other_id=O.uid "
+		"WHERE L.uid=? AND L.blocked=? AND O.username IN (" DBMYSQL_BATCH_PARAMS ")",
+	"INSERT IGNORE INTO userlists (uid, other_id, added, blocked) SELECT ?, uid, NOW(), ? "
+		"FROM users WHERE username IN (" DBMYSQL_BATCH_PARAMS ")",
+	"INSERT INTO userlists (uid, other_id, added, blocked) SELECT ?, uid, NOW(), ? FROM users WHERE username=?"
+};
+
+// initial space reserved for string columns; longer values are fetched separately
+#define DBMYSQL_COLUMN_BUFFER	128
+
 DBMySQL::DBMySQL(const std::string &host, int port, const std::string &db) {
 	m_Host=host;
 	m_Port=port;
 	m_Database=db;
 	m_Handle=NULL;
+	m_Broken=false;
+	m_LastUsed=0;
 
-	// initialize the mysql client library
-	mysql_library_init(0, NULL, NULL);
+	for (int i=0; i<StmtCount; i++)
+		m_Statements[i]=NULL;
 }
 
 DBMySQL::~DBMySQL() {
 	// close any current connections
 	if (m_Handle)
-		mysql_close(m_Handle);
-
-	mysql_library_end();
+		disconnect();
 }
 
-void DBMySQL::cache(const std::string &host, int port, const std::string &db, const std::string &user, const std::string &password) {
+void DBMySQL::cache(const std::string &host, int port, const std::string &db, const std::string &user,
+					const std::string &password, int poolSize) {
 	g_Host=host;
 	g_Port=port;
 	g_DB=db;
 	g_User=user;
 	g_Password=password;
+	g_PoolSize=(poolSize>0 ? poolSize : DBMYSQL_POOL_SIZE);
+
+	// initialize the mysql client library once, before any threads use it
+	mysql_library_init(0, NULL, NULL);
 }
 
 pDBMySQL DBMySQL::synthesize() throw(DBMySQL::Exception) {
-	try {
-		std::auto_ptr<DBMySQL> db(new DBMySQL(g_Host, g_Port, g_DB));
-		db->connect(g_User, g_Password);
-		return db;
+	if (g_Host.empty())
+		throw DBMySQL::Exception("No database connection information was cached.");
+
+	DBMySQL *db=NULL;
+
+	pthread_mutex_lock(&g_PoolMutex);
+
+	// wait until there's either an idle connection or room for a new one
+	while(g_Idle.empty() && g_Open>=g_PoolSize)
+		pthread_cond_wait(&g_PoolCond, &g_PoolMutex);
+
+	if (!g_Idle.empty()) {
+		db=g_Idle.back();
+		g_Idle.pop_back();
 	}
 
-	catch (const DBMySQL::Exception &ex) {
-		throw ex;
+	else
+		g_Open++;
+
+	pthread_mutex_unlock(&g_PoolMutex);
+
+	// the server may have dropped connections that sat around for too long
+	if (db && time(NULL)-db->m_LastUsed>=DBMYSQL_PING_INTERVAL && !db->ping()) {
+		delete db;
+		db=NULL;
 	}
+
+	// open a new connection in place of the one we couldn't reuse
+	if (!db) {
+		try {
+			db=new DBMySQL(g_Host, g_Port, g_DB);
+			db->connect(g_User, g_Password);
+		}
+
+		catch (const DBMySQL::Exception &ex) {
+			delete db;
+
+			pthread_mutex_lock(&g_PoolMutex);
+			g_Open--;
+			pthread_cond_signal(&g_PoolCond);
+			pthread_mutex_unlock(&g_PoolMutex);
+
+			throw ex;
+		}
+	}
+
+	return pDBMySQL(db, DBMySQL::release);
+}
+
+void DBMySQL::release(DBMySQL *db) {
+	// connections that lost contact with the server are of no use to anyone
+	if (db->m_Broken || !db->m_Handle) {
+		delete db;
+		db=NULL;
+	}
+
+	else
+		db->m_LastUsed=time(NULL);
+
+	pthread_mutex_lock(&g_PoolMutex);
+
+	if (db)
+		g_Idle.push_back(db);
+	else
+		g_Open--;
+
+	pthread_cond_signal(&g_PoolCond);
+	pthread_mutex_unlock(&g_PoolMutex);
 }
 
 void DBMySQL::connect(const std::string &user, const std::string &password) throw(DBMySQL::Exception) {
@@ -85,272 +183,432 @@ void DBMySQL::connect(const std::string &user, const std::string &password) thro
 
 		throw DBMySQL::Exception("Unable to connect to MySQL server.");
 	}
+
+	m_Broken=false;
 }
 
 void DBMySQL::disconnect() throw(DBMySQL::Exception) {
 	if (!m_Handle)
 		throw DBMySQL::Exception("There is no current connection.");
 
+	// prepared statements belong to the connection
+	for (int i=0; i<StmtCount; i++) {
+		if (m_Statements[i])
+			mysql_stmt_close(m_Statements[i]);
+
+		m_Statements[i]=NULL;
+	}
+
 	mysql_close(m_Handle);
 	m_Handle=NULL;
 }
 
+bool DBMySQL::ping() {
+	if (!m_Handle || mysql_ping(m_Handle)) {
+		m_Broken=true;
+		return false;
+	}
+
+	return true;
+}
+
 void DBMySQL::prepare() throw(DBMySQL::Exception) {
 	if (!m_Handle)
 		throw DBMySQL::Exception("There is no current connection.");
 
 	// reset all user online flags
-	if (mysql_query(m_Handle, "UPDATE users SET online=0"))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+	query("UPDATE users SET online=0");
 }
 
 bool DBMySQL::authenticate(const std::string &username, const std::string &password) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+	int uid;
 
-	// form the sql string
-	std::string sql="SELECT uid FROM users WHERE username='"+username+"' AND password='"+password+"'";
+	Statement stmt(this, StmtAuthenticate);
+	stmt.param(username).param(password).column(uid);
+	stmt.execute();
 
-	// and query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+	// the username-password pair is valid if there's a matching row
+	return stmt.fetch();
+}
 
-	// grab the results
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row=mysql_fetch_row(result);
-	bool success=(row ? true : false);
+bool DBMySQL::loadUser(User *user, ProfileCache::Profile &profile, ProfileCache::Statistics &stats) throw(DBMySQL::Exception) {
+	int uid, muted=0;
+	profile.age=0;
 
-	// clean up
-	mysql_free_result(result);
+	// the statement must be done with before the lists are loaded on the same connection
+	{
+		Statement stmt(this, StmtLoadUser);
+		stmt.param(user->getUsername()).column(uid).column(profile.email).column(muted).column(profile.name).column(profile.age).column(profile.bio);
+		stmt.execute();
 
-	return success;
-}
+		if (!stmt.fetch())
+			throw DBMySQL::Exception("The given user could not be found in the database.");
+	}
 
-void DBMySQL::loadUser(User *user) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+	// all later queries for this user go by the primary key
+	user->setUid(uid);
+	user->setEmail(profile.email);
+	user->setIsMuted(muted!=0);
 
-	// form the sql string
-	std::string sql="SELECT * FROM users WHERE username='"+user->getUsername()+"'";
+	// statistics are only on record once the user has played
+	bool found;
+	{
+		Statement stmt(this, StmtStatistics);
+		stmt.param(uid).column(stats.points).column(stats.gamesPlayed).column(stats.won).column(stats.lost);
+		stmt.execute();
 
-	// and query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+		found=stmt.fetch();
+	}
 
-	// grab the results
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row=mysql_fetch_row(result);
+	// load the user's friend list and blocked list
+	std::vector<std::string> friends, blocked;
+	getUserList(uid, friends, false);
+	getUserList(uid, blocked, true);
 
-	if (!row) {
-		mysql_free_result(result);
-		throw DBMySQL::Exception("The given user could not be found in the database.");
-	}
+	user->setFriendList(friends);
+	user->setBlockedList(blocked);
 
-	// email address (column indexed 3)
-	if (row[3])
-		user->setEmail(std::string(row[3]));
+	return found;
+}
 
-	// muted flag
-	if (row[5])
-		user->setIsMuted((int) row[5]);
+void DBMySQL::flagUsersOnline(const std::vector<int> &online, const std::vector<int> &offline) throw(DBMySQL::Exception) {
+	if (online.empty() && offline.empty())
+		return;
+
+	query("START TRANSACTION");
 
-	// load the user's friend list and blocked list
-	std::vector<std::string> friends, blocked;
 	try {
-		getUserList(user->getUsername(), friends, false);
-		getUserList(user->getUsername(), blocked, true);
+		// flag a batch of users at a time
+		for (int i=0; i<online.size(); i+=DBMYSQL_BATCH_SIZE) {
+			Statement stmt(this, StmtFlagOnline);
+			stmt.param(1);
+			bindBatch(stmt, online, i);
+			stmt.execute();
+		}
 
-		user->setFriendList(friends);
-		user->setBlockedList(blocked);
+		for (int i=0; i<offline.size(); i+=DBMYSQL_BATCH_SIZE) {
+			Statement stmt(this, StmtFlagOnline);
+			stmt.param(0);
+			bindBatch(stmt, offline, i);
+			stmt.execute();
+		}
 	}
 
 	catch (const DBMySQL::Exception &ex) {
+		if (!m_Broken)
+			mysql_rollback(m_Handle);
+
 		throw ex;
 	}
 
-	// clean up
-	mysql_free_result(result);
+	commit();
 }
 
-void DBMySQL::flagUserOnline(const std::string &username, bool online) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+void DBMySQL::getUserStatistics(int uid, int &points, int &gamesPlayed, int &won, int &lost) throw(DBMySQL::Exception) {
+	Statement stmt(this, StmtStatistics);
+	stmt.param(uid).column(points).column(gamesPlayed).column(won).column(lost);
+	stmt.execute();
 
-	// form the sql string
-	std::string sql="UPDATE users SET online="+std::string(online ? "1" : "0")+" WHERE username='"+username+"'";
+	if (!stmt.fetch())
+		throw DBMySQL::Exception("The given user could not be found in the database.");
+}
 
-	// query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+void DBMySQL::getUserProfile(int uid, std::string &name, std::string &email, int &age, std::string &bio) throw(DBMySQL::Exception) {
+	Statement stmt(this, StmtProfile);
+	stmt.param(uid).column(name).column(email).column(age).column(bio);
+	stmt.execute();
+
+	if (!stmt.fetch())
+		throw DBMySQL::Exception("The given user could not be found in the database.");
 }
 
-void DBMySQL::getUserStatistics(const std::string &username, int &points, int &gamesPlayed, int &won, int &lost) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+void DBMySQL::updateUserProfile(int uid, const std::string &name, const std::string &email, int age, const std::string &bio) throw(DBMySQL::Exception) {
+	Statement stmt(this, StmtUpdateProfile);
+	stmt.param(name).param(email).param(age).param(bio).param(uid);
+	stmt.execute();
+}
 
-	// form the sql string
-	std::string sql="SELECT points, games_played, won, lost FROM statistics WHERE uid=(SELECT uid FROM users WHERE username='"+username+"')";
+void DBMySQL::updateUserPassword(int uid, const std::string &password) throw(DBMySQL::Exception) {
+	Statement stmt(this, StmtUpdatePassword);
+	stmt.param(password).param(uid);
+	stmt.execute();
+}
 
-	// query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+void DBMySQL::getUserList(int uid, std::vector<std::string> &friends, bool blocked) throw(DBMySQL::Exception) {
+	std::string other;
 
-	// get the results
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row=mysql_fetch_row(result);
+	Statement stmt(this, StmtUserList);
+	stmt.param(uid).param(blocked ? 1 : 0).column(other);
+	stmt.execute();
 
-	if (!row) {
-		mysql_free_result(result);
-		throw DBMySQL::Exception("The given user could not be found in the database.");
+	while(stmt.fetch())
+		friends.push_back(other);
+}
+
+void DBMySQL::updateUserList(int uid, const std::vector<std::string> &added, const std::vector<std::string> &removed,
+							 bool blocked) throw(DBMySQL::Exception) {
+	if (added.empty() && removed.empty())
+		return;
+
+	// either the whole change lands, or none of it does
+	query("START TRANSACTION");
+
+	try {
+		// drop the old entries, a batch of usernames at a time
+		for (int i=0; i<removed.size(); i+=DBMYSQL_BATCH_SIZE) {
+			Statement stmt(this, StmtRemoveListBatch);
+			stmt.param(uid).param(blocked ? 1 : 0);
+			bindBatch(stmt, removed, i);
+			stmt.execute();
+		}
+
+		// and resolve and insert the new ones in the same way; unknown usernames
+		// simply don't match, and names already on the other list are left there
+		for (int i=0; i<added.size(); i+=DBMYSQL_BATCH_SIZE) {
+			Statement stmt(this, StmtInsertListBatch);
+			stmt.param(uid).param(blocked ? 1 : 0);
+			bindBatch(stmt, added, i);
+			stmt.execute();
+		}
 	}
 
-	// now get the data stored in this row
-	if (row[0]) points=atoi(row[0]);
-	if (row[1]) gamesPlayed=atoi(row[1]);
-	if (row[2]) won=atoi(row[2]);
-	if (row[3]) lost=atoi(row[3]);
+	catch (const DBMySQL::Exception &ex) {
+		// a broken connection rolls back by itself when it is discarded
+		if (!m_Broken)
+			mysql_rollback(m_Handle);
 
-	// we're done
-	mysql_free_result(result);
+		throw ex;
+	}
+
+	commit();
 }
 
-void DBMySQL::getUserProfile(const std::string &username, std::string &name, std::string &email, int &age, std::string &bio) throw(DBMySQL::Exception) {
+DBMySQL::RequestResult DBMySQL::addUserToList(int uid, const std::string &other, bool blocked) throw(DBMySQL::Exception) {
+	Statement stmt(this, StmtAddToList);
+	stmt.param(uid).param(blocked ? 1 : 0).param(other);
+
+	try {
+		stmt.execute();
+	}
+
+	catch (const DBMySQL::Exception &ex) {
+		// determine what when wrong
+		if (stmt.getError()==ER_DUP_ENTRY)
+			return DBMySQL::DuplicateEntry;
+		else
+			throw ex;
+	}
+
+	// nothing was inserted if the other username doesn't exist
+	return (stmt.getAffectedRows()>0 ? DBMySQL::NoError : DBMySQL::UnknownUser);
+}
+
+MYSQL_STMT* DBMySQL::getStatement(const StatementId &id) throw(DBMySQL::Exception) {
 	if (!m_Handle)
 		throw DBMySQL::Exception("There is no current connection.");
 
-	// form the sql string
-	std::string sql="SELECT real_name, email, age, bio FROM users WHERE username='"+username+"'";
+	if (m_Statements[id])
+		return m_Statements[id];
 
-	// query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+	MYSQL_STMT *stmt=mysql_stmt_init(m_Handle);
+	if (!stmt)
+		throw DBMySQL::Exception("Unable to allocate MySQL statement handle.");
 
-	// get the results
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row=mysql_fetch_row(result);
+	if (mysql_stmt_prepare(stmt, g_Statements[id], strlen(g_Statements[id]))) {
+		std::string error=mysql_stmt_error(stmt);
+		checkError(mysql_stmt_errno(stmt));
+		mysql_stmt_close(stmt);
 
-	if (!row) {
-		mysql_free_result(result);
-		throw DBMySQL::Exception("The given user could not be found in the database.");
+		throw DBMySQL::Exception("Unable to prepare database query: "+error);
 	}
 
-	// now verify non-null data and save it
-	if (row[0]) name=std::string(row[0]);
-	if (row[1]) email=std::string(row[1]);
-	if (row[2]) age=atoi(row[2]);
-	if (row[3]) bio=std::string(row[3]);
-
-	// free memory
-	mysql_free_result(result);
+	m_Statements[id]=stmt;
+	return stmt;
 }
 
-void DBMySQL::updateUserProfile(const std::string &username, const std::string &name, const std::string &email, int &age, const std::string &bio) throw(DBMySQL::Exception) {
+void DBMySQL::query(const char *sql) throw(DBMySQL::Exception) {
 	if (!m_Handle)
 		throw DBMySQL::Exception("There is no current connection.");
 
-	// form the sql string
-	std::stringstream ss;
-	ss  << "UPDATE users SET real_name='" << name << "', email='" << email << "', age="
-		<< age << ", bio='" << bio << "' WHERE username='" << username << "'";
-
-	// query the server
-	if (mysql_query(m_Handle, ss.str().c_str()))
+	if (mysql_query(m_Handle, sql)) {
+		checkError(mysql_errno(m_Handle));
 		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+	}
 }
 
-void DBMySQL::updateUserPassword(const std::string &username, const std::string &password) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+void DBMySQL::commit() throw(DBMySQL::Exception) {
+	if (mysql_commit(m_Handle)) {
+		checkError(mysql_errno(m_Handle));
+		throw DBMySQL::Exception("Unable to commit database transaction: "+std::string(mysql_error(m_Handle)));
+	}
+}
 
-	// form the sql string
-	std::string sql="UPDATE users SET password='"+password+"' WHERE username='"+username+"'";
+void DBMySQL::bindBatch(Statement &stmt, const std::vector<std::string> &names, int first) {
+	// pad a short batch by repeating its first name, which matches nothing extra
+	for (int i=0; i<DBMYSQL_BATCH_SIZE; i++)
+		stmt.param(first+i<names.size() ? names[first+i] : names[first]);
+}
 
-	// query the server
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+void DBMySQL::bindBatch(Statement &stmt, const std::vector<int> &uids, int first) {
+	for (int i=0; i<DBMYSQL_BATCH_SIZE; i++)
+		stmt.param(first+i<uids.size() ? uids[first+i] : uids[first]);
 }
 
-void DBMySQL::getUserList(const std::string &username, std::vector<std::string> &friends, bool blocked) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+void DBMySQL::checkError(unsigned int error) {
+	if (error==CR_SERVER_GONE_ERROR || error==CR_SERVER_LOST)
+		m_Broken=true;
+}
 
-	std::string sql="SELECT username FROM (SELECT other_id AS uid FROM userlists WHERE uid=(SELECT uid FROM users WHERE username='"+username+"') AND blocked="+(blocked ? "1" : "0")+") AS T NATURAL JOIN users";
+DBMySQL::Statement::Statement(DBMySQL *db, const StatementId &id) throw(DBMySQL::Exception) {
+	m_DB=db;
+	m_Handle=db->getStatement(id);
+	m_Error=0;
+}
 
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+DBMySQL::Statement::~Statement() {
+	mysql_stmt_free_result(m_Handle);
+}
 
-	// get the results
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row;
+DBMySQL::Statement& DBMySQL::Statement::param(const std::string &value) {
+	Param p;
+	p.text=value;
+	p.number=0;
+	p.length=value.size();
+	p.isText=true;
+
+	m_Params.push_back(p);
+	return *this;
+}
 
-	while((row=mysql_fetch_row(result)))
-		friends.push_back(std::string(row[0]));
+DBMySQL::Statement& DBMySQL::Statement::param(int value) {
+	Param p;
+	p.number=value;
+	p.length=0;
+	p.isText=false;
 
-	mysql_free_result(result);
+	m_Params.push_back(p);
+	return *this;
 }
 
-void DBMySQL::updateUserList(const std::string &username, const std::vector<std::string> &list, bool blocked) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+DBMySQL::Statement& DBMySQL::Statement::column(std::string &value) {
+	Column c;
+	c.text=&value;
+	c.number=NULL;
+	c.buffer.resize(DBMYSQL_COLUMN_BUFFER);
+	c.length=0;
+	c.isNull=0;
 
-	// first find this user's uid and cache it
-	std::string sql="SELECT uid FROM users WHERE username='"+username+"'";
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+	m_Columns.push_back(c);
+	return *this;
+}
 
-	// get the results of this query
-	MYSQL_RES *result=mysql_store_result(m_Handle);
-	MYSQL_ROW row=mysql_fetch_row(result);
-	if (!row)
-		throw DBMySQL::Exception("Unable to find user's uid in database.");
+DBMySQL::Statement& DBMySQL::Statement::column(int &value) {
+	Column c;
+	c.text=NULL;
+	c.number=&value;
+	c.buffer.resize(sizeof(int));
+	c.length=0;
+	c.isNull=0;
 
-	// cache the uid
-	std::string uid=std::string(row[0]);
-	mysql_free_result(result);
+	m_Columns.push_back(c);
+	return *this;
+}
 
-	// next purge all friend list entries for this user
-	sql="DELETE FROM userlists WHERE uid="+uid+" AND blocked="+(blocked ? "1" : "0");
-	if (mysql_query(m_Handle, sql.c_str()))
-		throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+void DBMySQL::Statement::execute() throw(DBMySQL::Exception) {
+	// now that all parameters are known, point mysql at them
+	std::vector<MYSQL_BIND> binds(m_Params.size());
+	for (int i=0; i<m_Params.size(); i++) {
+		Param &p=m_Params[i];
+		MYSQL_BIND &b=binds[i];
+		memset(&b, 0, sizeof(b));
+
+		if (p.isText) {
+			b.buffer_type=MYSQL_TYPE_STRING;
+			b.buffer=(void*) p.text.data();
+			b.buffer_length=p.length;
+			b.length=&p.length;
+		}
 
-	// now insert the updated records
-	for (int i=0; i<list.size(); i++) {
-		// find this user's uid
-		sql="SELECT uid FROM users WHERE username='"+list[i]+"'";
-		if (mysql_query(m_Handle, sql.c_str()))
-			throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
-
-		result=mysql_store_result(m_Handle);
-		row=mysql_fetch_row(result);
-		if (row) {
-			std::string otherUid=std::string(row[0]);
-			mysql_free_result(result);
-
-			// add this user list entry
-			sql="INSERT INTO userlists VALUES("+uid+", "+otherUid+", NULL, "+(blocked ? "1" : "0")+")";
-			if (mysql_query(m_Handle, sql.c_str()))
-				throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_error(m_Handle)));
+		else {
+			b.buffer_type=MYSQL_TYPE_LONG;
+			b.buffer=&p.number;
 		}
 	}
+
+	if ((!binds.empty() && mysql_stmt_bind_param(m_Handle, &binds[0])) || mysql_stmt_execute(m_Handle))
+		fail();
+
+	if (m_Columns.empty())
+		return;
+
+	// buffer the whole result so other statements can run before it's fetched
+	if (mysql_stmt_store_result(m_Handle))
+		fail();
+
+	m_Results.resize(m_Columns.size());
+	for (int i=0; i<m_Columns.size(); i++) {
+		Column &c=m_Columns[i];
+		MYSQL_BIND &b=m_Results[i];
+		memset(&b, 0, sizeof(b));
+
+		b.buffer_type=(c.text ? MYSQL_TYPE_STRING : MYSQL_TYPE_LONG);
+		b.buffer=&c.buffer[0];
+		b.buffer_length=c.buffer.size();
+		b.length=&c.length;
+		b.is_null=&c.isNull;
+	}
+
+	if (mysql_stmt_bind_result(m_Handle, &m_Results[0]))
+		fail();
 }
 
-DBMySQL::RequestResult DBMySQL::addUserToList(const std::string &username, const std::string &other, bool blocked) throw(DBMySQL::Exception) {
-	if (!m_Handle)
-		throw DBMySQL::Exception("There is no current connection.");
+bool DBMySQL::Statement::fetch() throw(DBMySQL::Exception) {
+	int res=mysql_stmt_fetch(m_Handle);
+	if (res==MYSQL_NO_DATA)
+		return false;
 
-	// form the sql string
-	std::string sql="INSERT INTO userlists VALUES((SELECT uid FROM users WHERE username='"+username+"'),";
-	sql+=" (SELECT uid FROM users WHERE username='"+other+"'), NOW(), "+(blocked ? "1" : "0")+")";
+	else if (res==1)
+		fail();
 
-	// query the server
-	if (mysql_query(m_Handle, sql.c_str())) {
-		// determine what when wrong
-		std::string error=std::string(mysql_error(m_Handle));
-		if (error.find("Duplicate")!=-1)
-			return DBMySQL::DuplicateEntry;
-		else
-			throw DBMySQL::Exception("Unable to complete database query: "+error);
+	for (int i=0; i<m_Columns.size(); i++) {
+		Column &c=m_Columns[i];
+		if (c.isNull)
+			continue;
+
+		if (c.number) {
+			memcpy(c.number, &c.buffer[0], sizeof(int));
+			continue;
+		}
+
+		// fetch the rest of any string that didn't fit into its buffer
+		if (res==MYSQL_DATA_TRUNCATED && c.length>c.buffer.size()) {
+			c.buffer.resize(c.length);
+
+			MYSQL_BIND &b=m_Results[i];
+			b.buffer=&c.buffer[0];
+			b.buffer_length=c.buffer.size();
+
+			if (mysql_stmt_fetch_column(m_Handle, &b, i, 0))
+				fail();
+		}
+
+		c.text->assign(&c.buffer[0], c.length);
 	}
 
-	return DBMySQL::NoError;
+	// the buffers may have been swapped out for larger ones
+	if (res==MYSQL_DATA_TRUNCATED && mysql_stmt_bind_result(m_Handle, &m_Results[0]))
+		fail();
+
+	return true;
+}
+
+unsigned long DBMySQL::Statement::getAffectedRows() {
+	return (unsigned long) mysql_stmt_affected_rows(m_Handle);
+}
+
+void DBMySQL::Statement::fail() throw(DBMySQL::Exception) {
+	m_Error=mysql_stmt_errno(m_Handle);
+	m_DB->checkError(m_Error);
+
+	throw DBMySQL::Exception("Unable to complete database query: "+std::string(mysql_stmt_error(m_Handle)));
 }
@@ -22,17 +22,40 @@
 #ifndef DBMYSQL_H
 #define DBMYSQL_H
 
-#include <memory>
+#include <ctime>
 #include <iostream>
+#include <tr1/memory>
 #include <vector>
 #include <mysql/mysql.h>
 
+#include "profilecache.h"
 #include "user.h"
 
-class DBMySQL;
+/// Default maximum number of simultaneous database connections.
+#define DBMYSQL_POOL_SIZE		8
+
+/// Seconds a pooled connection may sit idle before it is pinged on its next use.
+#define DBMYSQL_PING_INTERVAL	30
+
+/// Number of usernames matched by one statement in batched updates.
+#define DBMYSQL_BATCH_SIZE		32
 
-typedef std::auto_ptr<DBMySQL> pDBMySQL;
+class DBMySQL;
 
+/// A database handle leased from the connection pool, returned once the last copy goes away.
+typedef std::tr1::shared_ptr<DBMySQL> pDBMySQL;
+
+/**
+ * A connection to the MySQL server.
+ * Connections are pooled: synthesize() hands out an idle connection if there is one,
+ * opens a new one if the pool is not yet full, and otherwise waits for one to be
+ * returned. Connections that have been idle for a while are pinged before they are
+ * handed out again, and those that lose contact with the server are thrown away
+ * instead of being returned to the pool.
+ *
+ * All queries taking user input run as prepared statements, which are prepared on
+ * each connection the first time they are needed and kept for its lifetime.
+ */
 class DBMySQL {
 	public:
 		/// Determines if a user is either playing in a room, the owner of a room, or neither.
@@ -85,14 +108,17 @@ class DBMySQL {
 		 * @param db The database name.
 		 * @param user The database account username.
 		 * @param password The database account password.
+		 * @param poolSize The maximum number of connections to keep open.
 		 */
-		static void cache(const std::string &host, int port, const std::string &db, const std::string &user, const std::string &password);
+		static void cache(const std::string &host, int port, const std::string &db, const std::string &user,
+						  const std::string &password, int poolSize=DBMYSQL_POOL_SIZE);
 
 		/**
-		 * Creates a new handle using cache data.
+		 * Leases a handle from the connection pool, using cache data to open new connections.
+		 * If all connections are in use, this method waits for one to become available.
 		 * Make sure to call cache() beforehand, otherwise this method will throw an exception.
 		 *
-		 * @return A ready-to-use database handle.
+		 * @return A ready-to-use database handle, returned to the pool once it goes out of scope.
 		 */
 		static pDBMySQL synthesize() throw(DBMySQL::Exception);
 
@@ -112,6 +138,13 @@ class DBMySQL {
 		 */
 		void disconnect() throw(DBMySQL::Exception);
 
+		/**
+		 * Checks whether the connection to the database server is still alive.
+		 *
+		 * @return true if the server responded, false otherwise.
+		 */
+		bool ping();
+
 		/**
 		 * Cleans out stale data from the database and prepares it for a new run of
 		 * the lobby server.
@@ -131,88 +164,287 @@ class DBMySQL {
 		 * Gathers and loads a user's data from the database.
 		 *
 		 * @param user The user to load.
+		 * @param profile Set to the user's profile.
+		 * @param stats Set to the user's statistics, if there are any.
+		 * @return true if the user has statistics on record, false otherwise.
 		 * @throw An exception if an error occurred.
 		 */
-		void loadUser(User *user) throw(DBMySQL::Exception);
+		bool loadUser(User *user, ProfileCache::Profile &profile, ProfileCache::Statistics &stats) throw(DBMySQL::Exception);
 
 		/**
-		 * Flags a user as either online or offline.
+		 * Flags users as either online or offline, in a single transaction.
 		 *
-		 * @param username The user to flag.
-		 * @param online True for online, false for offline.
+		 * @param online The uids of users who are now online.
+		 * @param offline The uids of users who are now offline.
 		 */
-		void flagUserOnline(const std::string &username, bool online) throw(DBMySQL::Exception);
+		void flagUsersOnline(const std::vector<int> &online, const std::vector<int> &offline) throw(DBMySQL::Exception);
 
 		/**
 		 * Returns the user's game statistics as recorded in the database.
 		 *
-		 * @param username The user for whom to get statistics.
+		 * @param uid The user for whom to get statistics.
 		 * @param points The points for the user.
 		 * @param gamesPlayed The amount of games the user played.
 		 * @param won The amount of games the user won.
 		 * @param lost The amount of games the user lost.
 		 */
-		void getUserStatistics(const std::string &username, int &points, int &gamesPlayed, int &won, int &lost) throw(DBMySQL::Exception);
+		void getUserStatistics(int uid, int &points, int &gamesPlayed, int &won, int &lost) throw(DBMySQL::Exception);
 
 		/**
 		 * Returns the user's profile data as recorded in the database.
 		 *
-		 * @param username The user for whom to get a profile.
+		 * @param uid The user for whom to get a profile.
 		 * @param name The user's real name.
 		 * @param email The user's email address.
 		 * @param age The user's age.
 		 * @param bio The user's biography.
 		 */
-		void getUserProfile(const std::string &username, std::string &name, std::string &email, int &age, std::string &bio) throw(DBMySQL::Exception);
+		void getUserProfile(int uid, std::string &name, std::string &email, int &age, std::string &bio) throw(DBMySQL::Exception);
 
 		/**
 		 * Updates the user's profile data and stores it in the database.
 		 *
-		 * @param username The user for whom to update the profile.
+		 * @param uid The user for whom to update the profile.
 		 * @param name The user's real name.
 		 * @param email The user's email address.
 		 * @param age The user's age.
 		 * @param bio The user's biography.
 		 */
-		void updateUserProfile(const std::string &username, const std::string &name, const std::string &email, int &age, const std::string &bio) throw(DBMySQL::Exception);
+		void updateUserProfile(int uid, const std::string &name, const std::string &email, int age, const std::string &bio) throw(DBMySQL::Exception);
 
 		/**
 		 * Updates a user's password with a new one.
 		 *
-		 * @param username The user whose password should be changed.
+		 * @param uid The user whose password should be changed.
 		 * @param password The new password for the user.
 		 */
-		void updateUserPassword(const std::string &username, const std::string &password) throw(DBMySQL::Exception);
+		void updateUserPassword(int uid, const std::string &password) throw(DBMySQL::Exception);
 
 		/**
 		 * Returns a user's friend list or blocked user list.
 		 *
-		 * @param username The user in question.
+		 * @param uid The user in question.
 		 * @param list A vector of usernames.
 		 * @param blocked True for blocked list, false for friends list.
 		 */
-		void getUserList(const std::string &username, std::vector<std::string> &list, bool blocked) throw(DBMySQL::Exception);
+		void getUserList(int uid, std::vector<std::string> &list, bool blocked) throw(DBMySQL::Exception);
 
 		/**
-		 * Updates either a user's friend list or blocked user list.
+		 * Applies changes to either a user's friend list or blocked user list.
+		 * The changes are made in a single transaction, resolving usernames in batches
+		 * rather than one at a time. Usernames that don't exist are ignored.
 		 *
-		 * @param username The user for whom to update a friend list.
-		 * @param list The list of usernames.
+		 * @param uid The user for whom to update a friend list.
+		 * @param added Usernames to add to the list.
+		 * @param removed Usernames to remove from the list.
 		 * @param blocked True to update blocked list, false for friends list.
 		 */
-		void updateUserList(const std::string &username, const std::vector<std::string> &list, bool blocked) throw(DBMySQL::Exception);
+		void updateUserList(int uid, const std::vector<std::string> &added,
+							const std::vector<std::string> &removed, bool blocked) throw(DBMySQL::Exception);
 
 		/**
 		 * Adds another user to the friends/blocked list of this user.
 		 *
-		 * @param username The user whose list should be modified.
+		 * @param uid The user whose list should be modified.
 		 * @param other The username of the user to add.
 		 * @param blocked True to add to the blocked list, false for friends list.
 		 * @return An code describing the results of the add request.
 		 */
-		RequestResult addUserToList(const std::string &username, const std::string &other, bool blocked) throw(DBMySQL::Exception);
+		RequestResult addUserToList(int uid, const std::string &other, bool blocked) throw(DBMySQL::Exception);
 
 	private:
+		/// Queries that are run as prepared statements.
+		enum StatementId {
+			StmtAuthenticate,
+			StmtLoadUser,
+			StmtFlagOnline,
+			StmtStatistics,
+			StmtProfile,
+			StmtUpdateProfile,
+			StmtUpdatePassword,
+			StmtUserList,
+			StmtRemoveListBatch,
+			StmtInsertListBatch,
+			StmtAddToList,
+			StmtCount
+		};
+
+		/**
+		 * A single execution of a prepared statement.
+		 * Parameters are bound in the order of the placeholders in the query, and result
+		 * columns in the order they are selected. NULL columns leave their target untouched.
+		 */
+		class Statement {
+			public:
+				/**
+				 * Prepares to run a statement on a connection.
+				 *
+				 * @param db The connection to run the statement on.
+				 * @param id The statement to run.
+				 * @throw An exception if the statement could not be prepared.
+				 */
+				Statement(DBMySQL *db, const StatementId &id) throw(DBMySQL::Exception);
+
+				/// Discards any results that were not fetched.
+				~Statement();
+
+				/**
+				 * Binds the next string parameter.
+				 *
+				 * @param value The parameter value.
+				 */
+				Statement& param(const std::string &value);
+
+				/**
+				 * Binds the next integer parameter.
+				 *
+				 * @param value The parameter value.
+				 */
+				Statement& param(int value);
+
+				/**
+				 * Binds the next result column to a string.
+				 *
+				 * @param value Set to the column value by fetch().
+				 */
+				Statement& column(std::string &value);
+
+				/**
+				 * Binds the next result column to an integer.
+				 *
+				 * @param value Set to the column value by fetch().
+				 */
+				Statement& column(int &value);
+
+				/**
+				 * Runs the statement with the bound parameters.
+				 *
+				 * @throw An exception if the query failed.
+				 */
+				void execute() throw(DBMySQL::Exception);
+
+				/**
+				 * Fetches the next row of the result into the bound columns.
+				 *
+				 * @return true if a row was fetched, false if there are no more rows.
+				 * @throw An exception if the row could not be fetched.
+				 */
+				bool fetch() throw(DBMySQL::Exception);
+
+				/**
+				 * Returns the MySQL error code of the last failed operation.
+				 *
+				 * @return An error code, or 0 if none.
+				 */
+				unsigned int getError() const { return m_Error; }
+
+				/**
+				 * Returns the amount of rows changed by the statement.
+				 *
+				 * @return The number of affected rows.
+				 */
+				unsigned long getAffectedRows();
+
+			private:
+				/// Storage for a bound parameter.
+				struct Param {
+					std::string text;
+					int number;
+					unsigned long length;
+					bool isText;
+				};
+
+				/// Storage for a bound result column.
+				struct Column {
+					std::string *text;
+					int *number;
+					std::vector<char> buffer;
+					unsigned long length;
+					my_bool isNull;
+				};
+
+				/**
+				 * Raises an exception for the last error on the statement.
+				 */
+				void fail() throw(DBMySQL::Exception);
+
+				/// The connection running the statement.
+				DBMySQL *m_DB;
+
+				/// The prepared statement handle.
+				MYSQL_STMT *m_Handle;
+
+				/// Bound parameters.
+				std::vector<Param> m_Params;
+
+				/// Bound result columns.
+				std::vector<Column> m_Columns;
+
+				/// Result column bindings handed to MySQL.
+				std::vector<MYSQL_BIND> m_Results;
+
+				/// The last MySQL error code.
+				unsigned int m_Error;
+		};
+
+		/**
+		 * Returns a prepared statement handle, preparing it on first use.
+		 *
+		 * @param id The statement to look up.
+		 * @return The statement handle.
+		 * @throw An exception if the statement could not be prepared.
+		 */
+		MYSQL_STMT* getStatement(const StatementId &id) throw(DBMySQL::Exception);
+
+		/**
+		 * Runs a query that takes no user input and returns no rows.
+		 *
+		 * @param sql The query to run.
+		 * @throw An exception if the query failed.
+		 */
+		void query(const char *sql) throw(DBMySQL::Exception);
+
+		/**
+		 * Commits the current transaction.
+		 *
+		 * @throw An exception if the transaction could not be committed.
+		 */
+		void commit() throw(DBMySQL::Exception);
+
+		/**
+		 * Binds one batch of usernames to a batch statement.
+		 * A short batch is padded by repeating its first username.
+		 *
+		 * @param stmt The statement to bind to.
+		 * @param names The usernames.
+		 * @param first Index of the first username in the batch.
+		 */
+		void bindBatch(Statement &stmt, const std::vector<std::string> &names, int first);
+
+		/**
+		 * Binds one batch of uids to a batch statement.
+		 * A short batch is padded by repeating its first uid.
+		 *
+		 * @param stmt The statement to bind to.
+		 * @param uids The uids.
+		 * @param first Index of the first uid in the batch.
+		 */
+		void bindBatch(Statement &stmt, const std::vector<int> &uids, int first);
+
+		/**
+		 * Notes a MySQL error, flagging the connection as broken if the server went away.
+		 *
+		 * @param error The MySQL error code.
+		 */
+		void checkError(unsigned int error);
+
+		/**
+		 * Returns a leased handle to the connection pool.
+		 *
+		 * @param db The handle to return.
+		 */
+		static void release(DBMySQL *db);
+
 		/// The server address.
 		std::string m_Host;
 
@@ -224,6 +456,15 @@ class DBMySQL {
 
 		/// The MySQL connection handle.
 		MYSQL *m_Handle;
+
+		/// Statements prepared on this connection so far.
+		MYSQL_STMT *m_Statements[StmtCount];
+
+		/// Whether the connection to the server has been lost.
+		bool m_Broken;
+
+		/// When this connection was last returned to the pool.
+		time_t m_LastUsed;
 };
 
 #endif
@@ -20,166 +20,448 @@
 // lobbyserver.cpp: entry point for the lobby server
 
 #include <iostream>
+#include <csignal>
 #include <cstdlib>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "configfile.h"
+#include "connection.h"
+#include "dbexecutor.h"
 #include "dbmysql.h"
 #include "lobbyserver.h"
 #include "packet.h"
+#include "profilecache.h"
 #include "protspec.h"
 #include "protocol.h"
+#include "reactor.h"
 #include "serverpool.h"
 #include "serversocket.h"
 #include "user.h"
 #include "usermanager.h"
+#include "usertable.h"
 
 // globals
 ConfigFile *g_ConfigFile;
+ProfileCache *g_Profiles;
 ServerPool *g_Pool;
 UserManager *g_UserManager;
+UserTable *g_Usernames;
 
-void* connectionHandler(void*);
-void handleClientConnection(ServerSocket::Client*);
-void handleGameServerConnection(Packet &p, ServerSocket::Client*);
+void handleClientConnection(Connection*);
+void handleAuthentication(Packet &p, Connection*);
+void handleGameServerConnection(Packet &p, Connection*);
+void handleControlPacket(Packet &p, Connection*);
 
-void* connectionHandler(void *arg) {
-	ServerSocket::Client *data=(ServerSocket::Client*) arg;
-	int socket=data->getSocket();
-	
-	// read an initial packet
-	Packet p;
-	if (p.read(socket)!=Packet::NoError) {
-		close(socket);
-		pthread_exit(0);
+void connectionHandler(Connection *conn, Packet &p) {
+	switch(conn->getState()) {
+		// the first packet identifies the peer
+		case Connection::Handshake: {
+			uint8_t header=p.byte();
+
+			// connection from a client
+			if (header==CONN_CLIENT)
+				handleClientConnection(conn);
+
+			// connection from a game server
+			else if (header==CONN_GAME)
+				handleGameServerConnection(p, conn);
+
+			else {
+				std::cout << "Unknown connection from source: " << conn->getIP() << std::endl;
+				conn->shutdown();
+			}
+		} break;
+
+		// the client replied to our authentication request
+		case Connection::Authenticating: handleAuthentication(p, conn); break;
+
+		// packets sent while the credentials are being checked are dropped
+		case Connection::Verifying: break;
+
+		// regular lobby traffic
+		case Connection::Active: conn->getUser()->getProtocol()->parsePacket(p); break;
+
+		// traffic on a game server's control link
+		case Connection::Control: handleControlPacket(p, conn); break;
+
+		default: break;
 	}
+}
 
-	uint8_t header=p.byte();
+void disconnectHandler(Connection *conn) {
+	User *user=conn->detachUser();
 
-	// connection from a client
-	if (header==CONN_CLIENT)
-		handleClientConnection(data);
+	// we're done with this user
+	if (user) {
+		g_UserManager->removeUser(user);
 
-	// connection from a game server
-	else if (header==CONN_GAME)
-		handleGameServerConnection(p, data);
+		// the user lingers until any broadcasts or queries still holding it are done
+		user->unref();
+	}
 
+	// or with this game server's control link
 	else
-		std::cout << "Unknown connection from source: " << data->getIP() << std::endl;
+		g_Pool->detachLink(conn);
 
-	pthread_exit(0);
+	std::cout << "Disconnected client on socket " << conn->getSocket() << std::endl;
 }
 
-void handleClientConnection(ServerSocket::Client *data) {
-	int socket=data->getSocket();
+void handleClientConnection(Connection *conn) {
+	std::cout << "Accepted client connection from " << conn->getIP() << std::endl;
 
-	std::cout << "Accepted client connection from " << data->getIP() << std::endl;
-	
 	// send the client an authentication request
-	Packet p, rp;
+	Packet p;
 	p.addByte(AUTH_REQUEST);
-	p.write(socket);
+	conn->send(p);
 
-	// wait for a response
-	rp.read(socket);
+	// and wait for a response
+	conn->setState(Connection::Authenticating);
+}
 
-	// verify the packet
-	if (rp.byte()==AUTH_DATA) {
-		Packet p2;
-		std::string username=rp.string();
-		std::string password=rp.string();
+/**
+ * Checks a client's credentials and loads their account off the reactor threads.
+ */
+class AuthTask: public DBExecutor::Task {
+	public:
+		AuthTask(Connection *conn, const std::string &username, const std::string &password):
+				DBExecutor::Task(strand(conn, username)), m_Connection(conn), m_Username(username), m_Password(password), m_User(NULL),
+				m_HasStats(false) {
+			m_Connection->ref();
+		}
 
-		try {
-			// create a database connection manager and try to authenticate this user
-			DBMySQL db(g_ConfigFile->getDBHost(), g_ConfigFile->getDBPort(), g_ConfigFile->getDBName());
-			db.connect(g_ConfigFile->getDBUser(), g_ConfigFile->getDBPassword());
+		~AuthTask() {
+			if (m_User)
+				m_User->unref();
 
+			m_Connection->unref();
+		}
+
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
 			// this username-password pair must exist in the database
-			if (db.authenticate(username, password)) {
-				// update the client
-				p2.addByte(AUTH_SUCCESS);
-				p2.addString(g_ConfigFile->getName());
-				p2.write(socket);
+			if (!db->authenticate(m_Username, m_Password))
+				return;
 
-				// load this user's data from the database
-				User *user=new User(username, password);
-				db.loadUser(user);
+			// load this user's data from the database
+			m_User=new User(m_Username, m_Password);
+			m_HasStats=db->loadUser(m_User, m_Profile, m_Stats);
+		}
 
-				// create a new protocol object
-				Protocol *p=new Protocol(socket);
-				p->setUser(user);
-				user->setProtocol(p);
+		void complete() {
+			if (!m_User) {
+				Packet p;
+				p.addByte(AUTH_ERROR);
+				p.addString("Incorrect username or password.");
+				m_Connection->send(p);
+				m_Connection->shutdown();
 
-				// add him to the pool
-				g_UserManager->addUser(user);
+				return;
+			}
 
-				// send the user a list of rooms open now
-				g_UserManager->sendRoomList(user->getUsername());
+			// create a new protocol object
+			Protocol *prot=new Protocol(m_Connection);
+			prot->setUser(m_User);
+			m_User->setProtocol(prot);
+
+			// from now on, packets go straight to the protocol, unless the client left in the meantime;
+			// the connection gets a reference of its own, since a disconnect can drop it at any time,
+			// while ours keeps the user alive until this task is done with it
+			User *user=m_User;
+			user->ref();
+			if (!m_Connection->activate(user)) {
+				user->unref();
+				return;
+			}
+
+			// update the client
+			Packet p;
+			p.addByte(AUTH_SUCCESS);
+			p.addString(g_ConfigFile->getName());
+			m_Connection->send(p);
 
-				// begin the communications loop
-				p->communicationLoop();
+			// keep his profile at hand for as long as he's online
+			g_Profiles->add(user->getId(), user->getUid(), m_Profile, (m_HasStats ? &m_Stats : NULL));
 
-				// we're done with this user
+			// add him to the pool
+			g_UserManager->addUser(user);
+
+			// a disconnect that raced us may have missed the user being added
+			if (m_Connection->isClosed()) {
 				g_UserManager->removeUser(user);
-				delete user;
-				delete p;
+				return;
 			}
 
-			else {
-				p2.addByte(AUTH_ERROR);
-				p2.addString("Incorrect username or password.");
-				p2.write(socket);
-			}
+			// send the user a list of rooms open now
+			g_UserManager->sendRoomList(user->getId());
+		}
 
-			db.disconnect();
+		void fail(const DBMySQL::Exception &ex) {
+			DBExecutor::Task::fail(ex);
+			m_Connection->shutdown();
 		}
 
-		catch (const DBMySQL::Exception &ex) {
-			std::cout << "** DBMYSQL *** : " << ex.getMessage() << std::endl;
+	private:
+		/**
+		 * Picks the strand to load a user on. A user who was online before shares the
+		 * strand profile edits are written on, so an edit flushed at logout is stored
+		 * before the profile is read again. Other usernames have no writes to wait for.
+		 *
+		 * @param conn The connection the client authenticates on.
+		 * @param username The username the client sent.
+		 * @return The strand.
+		 */
+		static const void* strand(Connection *conn, const std::string &username) {
+			UserId id=UserTable::instance()->find(username);
+			if (id==UserTable::None)
+				return conn;
+
+			return &UserTable::instance()->lookup(id);
 		}
+
+		/// The connection the client authenticates on.
+		Connection *m_Connection;
+
+		/// The username the client sent.
+		std::string m_Username;
+
+		/// The password the client sent.
+		std::string m_Password;
+
+		/// The loaded user, if the credentials were valid.
+		User *m_User;
+
+		/// The loaded user's profile.
+		ProfileCache::Profile m_Profile;
+
+		/// The loaded user's statistics.
+		ProfileCache::Statistics m_Stats;
+
+		/// Whether the user has statistics on record.
+		bool m_HasStats;
+};
+
+void handleAuthentication(Packet &rp, Connection *conn) {
+	// verify the packet
+	if (rp.byte()==AUTH_DATA) {
+		std::string username=rp.string();
+		std::string password=rp.string();
+
+		// ignore the client until the database has had its say
+		conn->setState(Connection::Verifying);
+		DBExecutor::instance()->submit(new AuthTask(conn, username, password));
+
+		return;
 	}
 
 	// otherwise alert the client
-	else {
-		Packet p2;
-		p2.addByte(AUTH_ERROR);
-		p2.addString("Unexpected response packet.");
-		p2.write(socket);
-	}
+	Packet p2;
+	p2.addByte(AUTH_ERROR);
+	p2.addString("Unexpected response packet.");
+	conn->send(p2);
 
-	close(socket);
-	
-	std::cout << "Disconnected client on socket " << socket << std::endl;
+	conn->shutdown();
 }
 
-void handleGameServerConnection(Packet &p, ServerSocket::Client *data) {
-	int socket=data->getSocket();
-
+void handleGameServerConnection(Packet &p, Connection *conn) {
 	// verify this connection is in fact authentic
 	std::vector<ConfigFile::Server> servers=g_ConfigFile->getGameServerList();
 	bool authentic=false;
 	for (int i=0; i<servers.size(); i++) {
-		if (servers[i].getIP()==data->getIP())
+		if (servers[i].getIP()==conn->getIP())
 			authentic=true;
 	}
 
 	if (!authentic) {
-		std::cout << "Warning: rejecting unauthorized game server connection from: " << data->getIP() << std::endl;
-		close(socket);
+		std::cout << "Warning: rejecting unauthorized game server connection from: " << conn->getIP() << std::endl;
+		conn->shutdown();
 
 		return;
 	}
 
-	std::cout << "Accepted game server connection from " << data->getIP() << std::endl;
-
 	// see what the game server wants
 	uint8_t action=p.byte();
 
-	// a game room has closed
-	if (action==IS_KILLROOM)
-		g_UserManager->unregisterGameRoom(p.uint32());
+	// the game server opens its control link, which stays up for as long as it runs
+	if (action==IS_HELLO) {
+		std::string id=p.string();
+		if (!g_Pool->attachLink(id, conn)) {
+			std::cout << "Warning: rejecting control link for unknown game server " << id << " from: "
+				  << conn->getIP() << std::endl;
+			conn->shutdown();
 
-	close(socket);
+			return;
+		}
+
+		std::cout << "Accepted control link from game server " << id << " at " << conn->getIP() << std::endl;
+		conn->setState(Connection::Control);
+
+		return;
+	}
+
+	// everything else, closing rooms included, goes over the control link, where
+	// the sending server is known
+	std::cout << "Warning: rejecting game server request " << (int) action << " outside its control link from: "
+		  << conn->getIP() << std::endl;
+	conn->shutdown();
+}
+
+/**
+ * Moves a room from one game server to another. The room's snapshot is handed to
+ * the new server, and the old one is told where the room went, or that it stays put.
+ * A server that was handed the snapshot but not picked in the end drops its copy.
+ */
+class MigrateRoomRequest: public ServerPool::Request {
+	public:
+		MigrateRoomRequest(Connection *source, const std::string &sourceHost, int sourcePort, int gid,
+				const std::string &snapshot):
+				m_Source(source), m_SourceHost(sourceHost), m_SourcePort(sourcePort), m_Gid(gid),
+				m_Snapshot(snapshot), m_Port(0) {
+			m_Source->ref();
+		}
+
+		~MigrateRoomRequest() {
+			m_Source->unref();
+		}
+
+		void assign(const std::string &host, int port, Packet &p) {
+			m_Host=host;
+			m_Port=port;
+
+			// the snapshot carries the room's id along with everything else
+			p.addString(m_Snapshot);
+		}
+
+		void complete() {
+			// the room may have closed on the old server while the new one took it over,
+			// and its id may even belong to another room by now, so the copy has to go
+			if (!g_UserManager->moveGameRoom(m_Gid, m_Host, m_Port, m_SourceHost, m_SourcePort)) {
+				std::cout << "Room " << m_Gid << " closed while it was being moved, dropping it from "
+					  << m_Host << ":" << m_Port << std::endl;
+				g_Pool->dropRoom(m_Gid, m_Host, m_Port);
+
+				return;
+			}
+
+			std::cout << "Moved room " << m_Gid << " from " << m_SourceHost << ":" << m_SourcePort
+				  << " to " << m_Host << ":" << m_Port << std::endl;
+
+			// players looking for the room now find it on the new server
+			g_Pool->releaseRoom(m_SourceHost, m_SourcePort);
+
+			Packet r;
+			r.addByte(IS_MIGRATED);
+			r.addUint32(m_Gid);
+			r.addByte(PKT_SUCCESS);
+			r.addString(m_Host);
+			r.addUint32(m_Port);
+			m_Source->send(r);
+		}
+
+		bool withdraw(Packet &p) {
+			p.addByte(IS_DROPROOM);
+			p.addUint32(m_Gid);
+
+			return true;
+		}
+
+		void fail(const std::string &error) {
+			std::cout << "Unable to move room " << m_Gid << ": " << error << std::endl;
+
+			// the last server tried still counts the room
+			if (m_Port)
+				g_Pool->releaseRoom(m_Host, m_Port);
+
+			// the room carries on where it is
+			Packet r;
+			r.addByte(IS_MIGRATED);
+			r.addUint32(m_Gid);
+			r.addByte(PKT_ERROR);
+			r.addString("");
+			r.addUint32(0);
+			m_Source->send(r);
+		}
+
+	private:
+		Connection *m_Source;
+		std::string m_SourceHost;
+		int m_SourcePort;
+		int m_Gid;
+		std::string m_Snapshot;
+		std::string m_Host;
+		int m_Port;
+};
+
+void handleControlPacket(Packet &p, Connection *conn) {
+	// a link the pool already gave up on is just waiting to be closed
+	if (!g_Pool->heard(conn))
+		return;
+
+	uint8_t action=p.byte();
+	switch(action) {
+		// let the game server know we're still here as well
+		case IS_HEARTBEAT: {
+			Packet r;
+			r.addByte(IS_HEARTBEAT);
+			conn->send(r);
+		} break;
+
+		// the game server tells us how busy it is
+		case IS_LOADREPORT: {
+			int rooms=p.uint16();
+			int players=p.uint16();
+			int cpu=p.byte();
+
+			g_Pool->reportLoad(conn, rooms, players, cpu);
+		} break;
+
+		// a game room has closed, though only the server hosting it gets to say so
+		case IS_KILLROOM: {
+			int gid=p.uint32();
+
+			std::string host;
+			int port;
+			if (g_Pool->getLinkServer(conn, host, port))
+				g_UserManager->unregisterGameRoom(gid, host, port);
+		} break;
+
+		// the game server answered one of our requests
+		case IS_RESPONSE: {
+			uint32_t id=p.uint32();
+			bool success=(p.byte()==PKT_SUCCESS);
+			std::string error=p.string();
+
+			g_Pool->respond(conn, id, success, error);
+		} break;
+
+		// the game server wants one of its rooms moved elsewhere
+		case IS_MIGRATEROOM: {
+			int gid=p.uint32();
+			std::string snapshot=p.string();
+
+			std::string host;
+			int port;
+			if (g_Pool->getLinkServer(conn, host, port))
+				g_Pool->migrateRoom(new MigrateRoomRequest(conn, host, port, gid, snapshot), conn);
+		} break;
+
+		// the game server gave up waiting on a move and played on, so the room comes back to it
+		case IS_KEEPROOM: {
+			int gid=p.uint32();
+			std::string movedHost=p.string();
+			int movedPort=p.uint32();
+
+			std::string host;
+			int port;
+			if (g_Pool->getLinkServer(conn, host, port) && g_UserManager->moveGameRoom(gid, host, port, movedHost, movedPort)) {
+				std::cout << "Room " << gid << " stayed on " << host << ":" << port << " after all" << std::endl;
+				g_Pool->recallRoom(gid, movedHost, movedPort, conn);
+			}
+		} break;
+
+		default: {
+			std::cout << "Unknown control packet " << (int) action << " from game server at " << conn->getIP() << std::endl;
+		} break;
+	}
 }
 
 int main(int argc, char *argv[]) {
@@ -192,7 +474,7 @@ int main(int argc, char *argv[]) {
 
 		// cache database data
 		DBMySQL::cache(g_ConfigFile->getDBHost(), g_ConfigFile->getDBPort(), g_ConfigFile->getDBName(),
-					   g_ConfigFile->getDBUser(), g_ConfigFile->getDBPassword());
+					   g_ConfigFile->getDBUser(), g_ConfigFile->getDBPassword(), g_ConfigFile->getDBPoolSize());
 	}
 
 	catch (const ConfigFile::Exception &ex) {
@@ -210,7 +492,6 @@ int main(int argc, char *argv[]) {
 	try {
 		pDBMySQL db=DBMySQL::synthesize();
 		db->prepare();
-		db->disconnect();
 	}
 
 	catch (const DBMySQL::Exception &ex) {
@@ -220,6 +501,23 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
+	std::cout << "[done]\n";
+	std::cout << "Starting database threads...\t";
+
+	// one thread per pooled connection, so no query ever waits on a lease
+	int poolSize=g_ConfigFile->getDBPoolSize();
+	DBExecutor *executor=new DBExecutor(poolSize>0 ? poolSize : DBMYSQL_POOL_SIZE);
+	try {
+		executor->start();
+	}
+
+	catch (const DBExecutor::Exception &ex) {
+		std::cout << "[fail]\n";
+		std::cout << ex.getMessage() << std::endl;
+
+		exit(1);
+	}
+
 	std::cout << "[done]\n";
 
 	// create the server socket and activate it
@@ -240,9 +538,31 @@ int main(int argc, char *argv[]) {
 	std::cout << "[done]\n";
 	std::cout << "Creating user manager...\t";
 
-	// create the user manager
+	// create the user manager, along with the table of usernames it works with
+	g_Usernames=new UserTable;
 	g_UserManager=new UserManager;
 
+	// and the cache of profiles it keeps for online users
+	g_Profiles=new ProfileCache;
+	try {
+		g_UserManager->start();
+		g_Profiles->start();
+	}
+
+	catch (const UserManager::Exception &ex) {
+		std::cout << "[fail]\n";
+		std::cout << ex.getMessage() << std::endl;
+
+		exit(1);
+	}
+
+	catch (const ProfileCache::Exception &ex) {
+		std::cout << "[fail]\n";
+		std::cout << ex.getMessage() << std::endl;
+
+		exit(1);
+	}
+
 	std::cout << "[done]\n";
 	std::cout << "Creating server pool...\t\t";
 
@@ -250,7 +570,7 @@ int main(int argc, char *argv[]) {
 	g_Pool=new ServerPool;
 	std::vector<ConfigFile::Server> servers=g_ConfigFile->getGameServerList();
 	for (int i=0; i<servers.size(); i++)
-		g_Pool->addGameServer(servers[i].getIDString(), servers[i].getIP(), servers[i].getPort());
+		g_Pool->addGameServer(servers[i].getIDString(), servers[i].getIP(), servers[i].getPort(), servers[i].getWeight());
 
 	if (servers.empty()) {
 		std::cout << "[fail]\nAt least one game server must be defined in the configuration file.\n";
@@ -260,20 +580,73 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	else
-		std::cout << "[done]\n";
+	try {
+		g_Pool->start();
+	}
+
+	catch (const ServerPool::Exception &ex) {
+		std::cout << "[fail]\n";
+		std::cout << ex.getMessage() << std::endl;
+
+		exit(1);
+	}
+
+	std::cout << "[done]\n";
+	std::cout << "Starting reactor...\t\t";
+
+	// peers that vanish mid-write should not take the server down with them
+	signal(SIGPIPE, SIG_IGN);
+
+	// start the reactor threads that will service all connections
+	Reactor *reactor=new Reactor(g_ConfigFile->getReactorThreads());
+	try {
+		reactor->start();
+	}
+
+	catch (const Reactor::Exception &ex) {
+		std::cout << "[fail]\n";
+		std::cout << ex.getMessage() << std::endl;
+
+		exit(1);
+	}
+
+	std::cout << "[done]\n";
 
 	// print out some status messages
-	std::cout << "Tyranny Lobby Server " << LOBBY_SERVER_VERSION << " running...\n";
+	std::cout << "Tyranny Lobby Server " << LOBBY_SERVER_VERSION << " running on " << reactor->getThreadCount() << " threads...\n";
 	
 	// start waiting for connections
 	while(1) {
 		ServerSocket::Client *cl=sock.accept();
+		if (!cl)
+			continue;
+
+		// turn away clients once we are at capacity
+		int maxClients=g_ConfigFile->getMaxClients();
+		if (maxClients>0 && reactor->getConnectionCount()>=maxClients) {
+			std::cout << "Rejecting connection from " << cl->getIP() << ": server is full\n";
+
+			Packet p;
+			p.addByte(AUTH_ERROR);
+			p.addString("The server is full. Please try again later.");
+			p.write(cl->getSocket());
+
+			close(cl->getSocket());
+			delete cl;
+			continue;
+		}
+
+		// hand the connection off to one of the reactor threads
+		Connection *conn=new Connection(cl->getIP(), cl->getPort(), cl->getSocket());
+		delete cl;
+
+		try {
+			reactor->attach(conn);
+		}
 
-		// if a client connected, start a new thread to handle the connection
-		if (cl) {
-			pthread_t th;
-			pthread_create(&th, NULL, &connectionHandler, cl);
+		catch (const Reactor::Exception &ex) {
+			std::cout << ex.getMessage() << std::endl;
+			conn->unref();
 		}
 	}
 	
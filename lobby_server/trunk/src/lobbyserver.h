@@ -22,16 +22,27 @@
 #ifndef LOBBYSERVER_H
 #define LOBBYSERVER_H
 
+#include "packet.h"
+
 // the current version of the server
 #define LOBBY_SERVER_VERSION	"0.1"
 
+class Connection;
+
 /*
  * Callback for handling client connections.
- * Whenever a new client establishes a connection to this server,
- * this function is responsible for allocating a protocol and 
- * verifying data from the client.
+ * Whenever a connection delivers a complete packet, the reactor thread that
+ * owns it calls this function. Depending on the connection's state, it is
+ * responsible for identifying the peer, authenticating clients, allocating a
+ * protocol and dispatching packets from the client.
+ */
+void connectionHandler(Connection *conn, Packet &p);
+
+/*
+ * Callback for handling disconnected clients.
+ * Called by the owning reactor thread right before the connection is freed.
  */
-void* connectionHandler(void *arg);
+void disconnectHandler(Connection *conn);
 
 #endif
 
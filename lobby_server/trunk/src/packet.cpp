@@ -20,6 +20,7 @@
 // packet.cpp: implementation of Packet class
 
 #include <cerrno>
+#include <cstring>
 #include <sys/socket.h>
 
 #include "packet.h"
@@ -35,11 +36,18 @@ void Packet::clear() {
 }
 
 void Packet::addByte(uint8_t byte) {
+	// never write past the end of the buffer
+	if (m_Pos+1>PACKET_BUFFER_MAX)
+		return;
+
 	m_Buffer[m_Pos++]=byte;
 	m_Size+=1;
 }
 
 void Packet::addUint16(uint16_t n) {
+	if (m_Pos+2>PACKET_BUFFER_MAX)
+		return;
+
 	// pack a 16-bit integer into the packet
 	m_Buffer[m_Pos++]=(uint8_t) n;
 	m_Buffer[m_Pos++]=(uint8_t) (n >> 8);
@@ -47,6 +55,9 @@ void Packet::addUint16(uint16_t n) {
 }
 
 void Packet::addUint32(uint32_t n) {
+	if (m_Pos+4>PACKET_BUFFER_MAX)
+		return;
+
 	// pack a 32-bit integer into the buffer
 	m_Buffer[m_Pos++]=(uint8_t) n;
 	m_Buffer[m_Pos++]=(uint8_t) (n >> 8);
@@ -57,7 +68,7 @@ void Packet::addUint32(uint32_t n) {
 }
 
 void Packet::addString(const std::string &str) {
-	if (str.size()>PACKET_STRING_MAX)
+	if (str.size()>PACKET_STRING_MAX || m_Pos+2+str.size()>PACKET_BUFFER_MAX)
 		return;
 	
 	// add the string size first
@@ -67,10 +78,19 @@ void Packet::addString(const std::string &str) {
 }
 
 uint8_t Packet::byte() {
+	// never read past the end of the packet
+	if (m_Pos+1>m_Size+2)
+		return 0;
+
 	return m_Buffer[m_Pos++];
 }
 
 uint16_t Packet::uint16() {
+	if (m_Pos+2>m_Size+2) {
+		m_Pos=m_Size+2;
+		return 0;
+	}
+
 	// unpack a 16-bit integer from the buffer
 	uint16_t n=(m_Buffer[m_Pos] | m_Buffer[m_Pos+1] << 8);
 	m_Pos+=2;
@@ -79,6 +99,11 @@ uint16_t Packet::uint16() {
 }
 
 uint32_t Packet::uint32() {
+	if (m_Pos+4>m_Size+2) {
+		m_Pos=m_Size+2;
+		return 0;
+	}
+
 	// unpack a 32-bit integer from the buffer
 	uint32_t n=(m_Buffer[m_Pos] | (m_Buffer[m_Pos+1] << 8) | 
 				(m_Buffer[m_Pos+2] << 16) | (m_Buffer[m_Pos+3] << 24));
@@ -91,52 +116,107 @@ std::string Packet::string() {
 	uint16_t length=uint16();
 	
 	// avoid crashing if the length is corrupt
-	if (length>PACKET_STRING_MAX)
+	if (length>PACKET_STRING_MAX || m_Pos+length>m_Size+2)
 		return "";
 	
-	std::string str="";
-	for (int i=0; i<length; i++)
-		str+=(char) byte();
+	std::string str((const char*) m_Buffer+m_Pos, length);
+	m_Pos+=length;
 	
 	return str;
 }
 
-bool Packet::write(int fd) {
+const uint8_t* Packet::pack() {
 	// save the packet size to buffer
 	m_Buffer[0]=m_Size;
 	m_Buffer[1]=(m_Size >> 8);
 
+	return m_Buffer;
+}
+
+bool Packet::assign(const uint8_t *frame, int length) {
+	if (length<2 || length>PACKET_BUFFER_MAX)
+		return false;
+
+	// the size bytes must agree with the frame we were given
+	int size=(frame[0] | (frame[1] << 8));
+	if (size!=length-2)
+		return false;
+
+	memcpy(m_Buffer, frame, length);
+	m_Size=size;
+	m_Pos=2;
+
+	return true;
+}
+
+bool Packet::write(int fd) {
+	pack();
+
+	// keep going until the size bytes and the entire body are out
 	int sent=0, remaining=m_Size+2;
-	int n;
-	while(sent<m_Size) {
-		if ((n=send(fd, m_Buffer+sent, remaining, 0))==-1)
+	while(remaining>0) {
+		int n=send(fd, m_Buffer+sent, remaining, MSG_NOSIGNAL);
+		if (n<0 && errno==EINTR)
+			continue;
+		else if (n<=0)
 			return false;
 		
 		sent+=n;
 		remaining-=n;
 	}
 
-	return (n!=-1);
+	return true;
 }
 
 Packet::Result Packet::read(int fd) {
 	// read the size first
-	int n=recv(fd, m_Buffer, 2, 0);
-	if (n==-1 && errno==EWOULDBLOCK)
-		return TimedOut;
-	else if (n==0)
-		return Disconnected;
-	
-	int size=(m_Buffer[0] | (m_Buffer[1] >> 8));
-	int bytes=recv(fd, m_Buffer+2, size, 0);
+	Result res=receive(fd, m_Buffer, 2);
+	if (res!=NoError)
+		return res;
 	
-	if (bytes!=size || bytes<=0) {
-		std::cout << "read " << bytes << " was expecting " << size << std::endl;
+	int size=(m_Buffer[0] | (m_Buffer[1] << 8));
+	if (size==0 || size+2>PACKET_BUFFER_MAX) {
+		std::cout << "Corrupt packet size: " << size << std::endl;
 		return DataCorrupt;
 	}
+
+	// the body may arrive in several pieces
+	res=receive(fd, m_Buffer+2, size);
+	if (res==TimedOut) {
+		// the stream is out of sync now that the size bytes are gone
+		std::cout << "Timed out waiting for " << size << " bytes" << std::endl;
+		return DataCorrupt;
+	}
+
+	else if (res!=NoError)
+		return res;
 	
 	m_Size=size;
 	m_Pos=2;
 	
 	return NoError;
 }
+
+Packet::Result Packet::receive(int fd, uint8_t *dest, int bytes) {
+	int got=0;
+	while(got<bytes) {
+		int n=recv(fd, dest+got, bytes-got, 0);
+		if (n>0)
+			got+=n;
+
+		else if (n==0)
+			return Disconnected;
+
+		else if (errno==EINTR)
+			continue;
+
+		// only report a time out if nothing at all was read
+		else if (errno==EAGAIN || errno==EWOULDBLOCK)
+			return (got==0 ? TimedOut : DataCorrupt);
+
+		else
+			return Disconnected;
+	}
+
+	return NoError;
+}
@@ -0,0 +1,199 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// packetbuffer.cpp: implementation of the PacketBuffer class.
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "packetbuffer.h"
+
+PacketBuffer::PacketBuffer(int capacity) {
+	// the buffer must always be able to hold one complete packet
+	m_Capacity=1;
+	while(m_Capacity<capacity || m_Capacity<PACKET_BUFFER_MAX)
+		m_Capacity<<=1;
+
+	m_Data=new uint8_t[m_Capacity];
+	m_Head=m_Tail=0;
+}
+
+PacketBuffer::~PacketBuffer() {
+	delete [] m_Data;
+}
+
+Packet::Result PacketBuffer::fill(int fd) {
+	while(1) {
+		uint32_t free=m_Capacity-size();
+		if (free==0)
+			return Packet::NoError;
+
+		// the free space may wrap around the end of the storage
+		uint32_t tail=m_Tail & (m_Capacity-1);
+		uint32_t first=m_Capacity-tail;
+		if (first>free)
+			first=free;
+
+		struct iovec iov[2];
+		iov[0].iov_base=m_Data+tail;
+		iov[0].iov_len=first;
+		iov[1].iov_base=m_Data;
+		iov[1].iov_len=free-first;
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov=iov;
+		msg.msg_iovlen=(free>first ? 2 : 1);
+
+		int n=recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (n>0) {
+			m_Tail+=n;
+
+			// a short read from a stream socket means it has been drained
+			if (n<free)
+				return Packet::TimedOut;
+		}
+
+		else if (n==0)
+			return Packet::Disconnected;
+
+		else if (errno==EINTR)
+			continue;
+
+		else if (errno==EAGAIN || errno==EWOULDBLOCK)
+			return Packet::TimedOut;
+
+		else
+			return Packet::Disconnected;
+	}
+}
+
+Packet::Result PacketBuffer::next(Packet &p) {
+	if (size()<2)
+		return Packet::TimedOut;
+
+	// decode the size bytes first
+	uint8_t header[2];
+	peek(header, 2);
+
+	int length=(header[0] | (header[1] << 8))+2;
+	if (length==2 || length>PACKET_BUFFER_MAX)
+		return Packet::DataCorrupt;
+
+	// wait for the rest of the packet to arrive
+	if (size()<length)
+		return Packet::TimedOut;
+
+	uint8_t frame[PACKET_BUFFER_MAX];
+	peek(frame, length);
+	m_Head+=length;
+
+	if (!p.assign(frame, length))
+		return Packet::DataCorrupt;
+
+	return Packet::NoError;
+}
+
+void PacketBuffer::append(Packet &p) {
+	const uint8_t *frame=p.pack();
+	uint32_t length=p.length();
+
+	if (size()+length>m_Capacity)
+		grow(size()+length);
+
+	// the packet may wrap around the end of the storage
+	uint32_t tail=m_Tail & (m_Capacity-1);
+	uint32_t first=m_Capacity-tail;
+	if (first>length)
+		first=length;
+
+	memcpy(m_Data+tail, frame, first);
+	memcpy(m_Data, frame+first, length-first);
+	m_Tail+=length;
+}
+
+Packet::Result PacketBuffer::drain(int fd) {
+	while(!empty()) {
+		uint32_t head=m_Head & (m_Capacity-1);
+		uint32_t first=m_Capacity-head;
+		if (first>size())
+			first=size();
+
+		struct iovec iov[2];
+		iov[0].iov_base=m_Data+head;
+		iov[0].iov_len=first;
+		iov[1].iov_base=m_Data;
+		iov[1].iov_len=size()-first;
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov=iov;
+		msg.msg_iovlen=(iov[1].iov_len>0 ? 2 : 1);
+
+		int requested=size();
+		int n=sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n>0) {
+			m_Head+=n;
+
+			// a short write means the socket's send buffer is full
+			if (n<requested)
+				return Packet::TimedOut;
+		}
+
+		else if (n<0 && errno==EINTR)
+			continue;
+
+		else if (n<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+			return Packet::TimedOut;
+
+		else
+			return Packet::Disconnected;
+	}
+
+	return Packet::NoError;
+}
+
+void PacketBuffer::grow(uint32_t bytes) {
+	uint32_t capacity=m_Capacity;
+	while(capacity<bytes)
+		capacity<<=1;
+
+	// move the buffered data to the front of the new storage
+	uint8_t *data=new uint8_t[capacity];
+	uint32_t count=size();
+	peek(data, count);
+
+	delete [] m_Data;
+	m_Data=data;
+	m_Capacity=capacity;
+	m_Head=0;
+	m_Tail=count;
+}
+
+void PacketBuffer::peek(uint8_t *dest, int bytes) const {
+	uint32_t head=m_Head & (m_Capacity-1);
+	uint32_t first=m_Capacity-head;
+	if (first>bytes)
+		first=bytes;
+
+	memcpy(dest, m_Data+head, first);
+	memcpy(dest+first, m_Data, bytes-first);
+}
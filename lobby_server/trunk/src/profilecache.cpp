@@ -0,0 +1,199 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// profilecache.cpp: implementation of the ProfileCache class.
+
+#include <unistd.h>
+
+#include "dbexecutor.h"
+#include "profilecache.h"
+
+// global instance of the profile cache
+ProfileCache *g_ProfileCache=NULL;
+
+/**
+ * Writes an edited profile to the database.
+ */
+class ProfileWriteTask: public DBExecutor::Task {
+	public:
+		ProfileWriteTask(const void *strand, int uid, const ProfileCache::Profile &profile):
+				DBExecutor::Task(strand), m_Uid(uid), m_Profile(profile) { }
+
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->updateUserProfile(m_Uid, m_Profile.name, m_Profile.email, m_Profile.age, m_Profile.bio);
+		}
+
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
+		}
+
+	private:
+		int m_Uid;
+		ProfileCache::Profile m_Profile;
+};
+
+ProfileCache::ProfileCache() {
+	pthread_mutex_init(&m_Mutex, NULL);
+
+	g_ProfileCache=this;
+}
+
+ProfileCache::~ProfileCache() {
+	pthread_mutex_destroy(&m_Mutex);
+}
+
+ProfileCache* ProfileCache::instance() {
+	return g_ProfileCache;
+}
+
+void ProfileCache::start() throw(ProfileCache::Exception) {
+	if (pthread_create(&m_Thread, NULL, &ProfileCache::flushProcess, this)!=0)
+		throw ProfileCache::Exception("Unable to start profile flush thread.");
+}
+
+void ProfileCache::add(UserId id, int uid, const Profile &profile, const Statistics *stats) {
+	pthread_mutex_lock(&m_Mutex);
+
+	Entry &entry=m_Entries[id];
+	entry.uid=uid;
+	entry.hasStats=(stats!=NULL);
+	if (stats)
+		entry.stats=*stats;
+
+	// a session that logged in again before its last edit was flushed read the
+	// profile from the database too early; the cached edit is the newer one, and
+	// stays dirty until the flush thread writes it
+	if (!entry.dirty)
+		entry.profile=profile;
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void ProfileCache::evict(UserId id) {
+	pthread_mutex_lock(&m_Mutex);
+
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	if (it==m_Entries.end()) {
+		pthread_mutex_unlock(&m_Mutex);
+		return;
+	}
+
+	// don't leave the last edits waiting on the flush thread
+	if ((*it).second.dirty)
+		write(id, (*it).second.uid, (*it).second.profile);
+
+	m_Entries.erase(it);
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+bool ProfileCache::getProfile(UserId id, Profile &profile) {
+	pthread_mutex_lock(&m_Mutex);
+
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	bool found=(it!=m_Entries.end());
+	if (found)
+		profile=(*it).second.profile;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return found;
+}
+
+bool ProfileCache::getStatistics(UserId id, Statistics &stats) {
+	pthread_mutex_lock(&m_Mutex);
+
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	bool found=(it!=m_Entries.end() && (*it).second.hasStats);
+	if (found)
+		stats=(*it).second.stats;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return found;
+}
+
+void ProfileCache::fillStatistics(UserId id, const Statistics &stats) {
+	pthread_mutex_lock(&m_Mutex);
+
+	// users that went offline in the meantime have no entry to fill
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	if (it!=m_Entries.end()) {
+		(*it).second.stats=stats;
+		(*it).second.hasStats=true;
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void ProfileCache::invalidateStatistics(UserId id) {
+	pthread_mutex_lock(&m_Mutex);
+
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	if (it!=m_Entries.end())
+		(*it).second.hasStats=false;
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void ProfileCache::updateProfile(UserId id, int uid, const Profile &profile) {
+	pthread_mutex_lock(&m_Mutex);
+
+	std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.find(id);
+	if (it!=m_Entries.end()) {
+		(*it).second.profile=profile;
+		(*it).second.dirty=true;
+	}
+
+	// without an entry there's nothing to hold the edit, so write it through
+	else
+		write(id, uid, profile);
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void* ProfileCache::flushProcess(void *arg) {
+	ProfileCache *cache=(ProfileCache*) arg;
+	cache->run();
+
+	pthread_exit(0);
+}
+
+void ProfileCache::run() {
+	while(1) {
+		sleep(PROFILECACHE_FLUSH_INTERVAL);
+
+		pthread_mutex_lock(&m_Mutex);
+
+		for (std::tr1::unordered_map<UserId, Entry>::iterator it=m_Entries.begin(); it!=m_Entries.end(); ++it) {
+			if ((*it).second.dirty) {
+				write((*it).first, (*it).second.uid, (*it).second.profile);
+				(*it).second.dirty=false;
+			}
+		}
+
+		pthread_mutex_unlock(&m_Mutex);
+	}
+}
+
+void ProfileCache::write(UserId id, int uid, const Profile &profile) {
+	// the interned name never moves, so writes for the same user stay in order; they are
+	// queued with the cache locked so a flush can't be overtaken by a newer edit
+	DBExecutor::instance()->submit(new ProfileWriteTask(&UserTable::instance()->lookup(id), uid, profile));
+}
@@ -0,0 +1,208 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// profilecache.h: definition of the ProfileCache class.
+
+#ifndef PROFILECACHE_H
+#define PROFILECACHE_H
+
+#include <iostream>
+#include <pthread.h>
+#include <tr1/unordered_map>
+
+#include "usertable.h"
+
+/// Seconds profile edits are held in memory before they are written to the database.
+#define PROFILECACHE_FLUSH_INTERVAL	5
+
+/**
+ * Keeps the profiles and statistics of online users in memory.
+ * Clients ask for these far more often than they change, so they are loaded along
+ * with the rest of a user's account at login and served from memory afterwards.
+ *
+ * Profile edits are written behind: they update the cache right away, and a
+ * background thread writes the latest version of each edited profile to the database
+ * every few seconds, so a user saving their profile repeatedly costs a single query.
+ * A user's pending edits are also written out as soon as they log off, at which
+ * point their entry is dropped.
+ *
+ * Statistics only change once a game is over, so they are dropped from the cache
+ * when a room closes and read from the database again on the next request.
+ */
+class ProfileCache {
+	public:
+		/**
+		 * A general exception for cache problems.
+		 */
+		class Exception {
+			public:
+				/// Default constructor for cache exceptions.
+				Exception(const std::string &msg): m_Message(msg) { };
+
+				/**
+				 * Returns the reason for this exception.
+				 * @return Message string
+				 */
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The message for this exception.
+				std::string m_Message;
+		};
+
+		/// A user's profile.
+		struct Profile {
+			std::string name;
+			std::string email;
+			int age;
+			std::string bio;
+		};
+
+		/// A user's game statistics.
+		struct Statistics {
+			int points;
+			int gamesPlayed;
+			int won;
+			int lost;
+		};
+
+	public:
+		/// Default constructor.
+		ProfileCache();
+
+		/// Frees memory associated with this object.
+		~ProfileCache();
+
+		/**
+		 * Returns the global profile cache.
+		 *
+		 * @return A pointer to a ProfileCache object.
+		 */
+		static ProfileCache* instance();
+
+		/**
+		 * Starts the thread writing edited profiles to the database.
+		 * @throw A ProfileCache::Exception if an error occurs.
+		 */
+		void start() throw(ProfileCache::Exception);
+
+		/**
+		 * Creates the entry for a user who just logged in.
+		 * If the user still has an entry with unsaved edits, its profile is kept.
+		 *
+		 * @param id The user.
+		 * @param uid The user's key in the database.
+		 * @param profile The user's profile.
+		 * @param stats The user's statistics, or NULL if they are not known.
+		 */
+		void add(UserId id, int uid, const Profile &profile, const Statistics *stats);
+
+		/**
+		 * Writes out any pending edits of a user who logged off, and drops their entry.
+		 *
+		 * @param id The user.
+		 */
+		void evict(UserId id);
+
+		/**
+		 * Looks up a user's profile.
+		 *
+		 * @param id The user.
+		 * @param profile Set to the profile if it is cached.
+		 * @return true if the profile was cached, false otherwise.
+		 */
+		bool getProfile(UserId id, Profile &profile);
+
+		/**
+		 * Looks up a user's statistics.
+		 *
+		 * @param id The user.
+		 * @param stats Set to the statistics if they are cached.
+		 * @return true if the statistics were cached, false otherwise.
+		 */
+		bool getStatistics(UserId id, Statistics &stats);
+
+		/**
+		 * Caches statistics read from the database, if the user is still online.
+		 *
+		 * @param id The user.
+		 * @param stats The user's statistics.
+		 */
+		void fillStatistics(UserId id, const Statistics &stats);
+
+		/**
+		 * Forgets a user's statistics, so they are read from the database next time.
+		 *
+		 * @param id The user.
+		 */
+		void invalidateStatistics(UserId id);
+
+		/**
+		 * Records an edit of a user's profile, to be written to the database shortly.
+		 *
+		 * @param id The user.
+		 * @param uid The user's key in the database.
+		 * @param profile The new profile.
+		 */
+		void updateProfile(UserId id, int uid, const Profile &profile);
+
+	private:
+		/// A cached user.
+		struct Entry {
+			Entry(): uid(0), hasStats(false), dirty(false) { }
+
+			int uid;
+			Profile profile;
+			Statistics stats;
+			bool hasStats;
+			bool dirty;
+		};
+
+		/**
+		 * Entry point for the flush thread.
+		 *
+		 * @param arg Pointer to the cache.
+		 */
+		static void* flushProcess(void *arg);
+
+		/**
+		 * Writes out all edited profiles every few seconds, until the process exits.
+		 */
+		void run();
+
+		/**
+		 * Queues a profile to be written to the database. The cache must be locked.
+		 *
+		 * @param id The user.
+		 * @param uid The user's key in the database.
+		 * @param profile The profile to write.
+		 */
+		void write(UserId id, int uid, const Profile &profile);
+
+		/// Cached users, keyed by id.
+		std::tr1::unordered_map<UserId, Entry> m_Entries;
+
+		/// Guards the entries.
+		pthread_mutex_t m_Mutex;
+
+		/// The flush thread.
+		pthread_t m_Thread;
+};
+
+#endif
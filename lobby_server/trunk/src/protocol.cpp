@@ -19,31 +19,27 @@
  ***************************************************************************/
 // protocol.cpp: implementation of the Protocol class.
 
-#include "clientsocket.h"
 #include "configfile.h"
+#include "connection.h"
+#include "dbexecutor.h"
 #include "dbmysql.h"
 #include "packet.h"
+#include "profilecache.h"
 #include "protocol.h"
 #include "protspec.h"
 #include "room.h"
 #include "serverpool.h"
 #include "user.h"
 #include "usermanager.h"
+#include "usertable.h"
 
-Protocol::Protocol(int socket): m_Socket(socket) {
+Protocol::Protocol(Connection *conn): m_Connection(conn) {
 	m_User=NULL;
+	m_Connection->ref();
 }
 
-void Protocol::communicationLoop() {
-	Packet p;
-	Packet::Result res;
-
-	do {
-		// read a single packet
-		res=p.read(m_Socket);
-		parsePacket(p);
-
-	} while(res!=Packet::DataCorrupt && res!=Packet::Disconnected);
+Protocol::~Protocol() {
+	m_Connection->unref();
 }
 
 void Protocol::sendUserLoggedIn(User *other, const Protocol::UserStatus &status) {
@@ -58,14 +54,14 @@ void Protocol::sendUserLoggedIn(User *other, const Protocol::UserStatus &status)
 		case Protocol::UserFriend: p.addByte(USER_FRIEND); break;
 	}
 
-	p.write(m_Socket);
+	m_Connection->send(p);
 }
 
 void Protocol::sendUserLoggedOut(User *other) {
 	Packet p;
 	p.addByte(LB_USEROUT);
 	p.addString(other->getUsername());
-	p.write(m_Socket);
+	m_Connection->send(p);
 }
 
 void Protocol::sendChatMessage(const std::string &user, const std::string &message) {
@@ -73,7 +69,27 @@ void Protocol::sendChatMessage(const std::string &user, const std::string &messa
 	p.addByte(LB_CHATMESSAGE);
 	p.addString(user);
 	p.addString(message);
-	p.write(m_Socket);
+	m_Connection->send(p);
+}
+
+void Protocol::sendStatistics(const ProfileCache::Statistics &stats) {
+	Packet p;
+	p.addByte(LB_STATISTICS);
+	p.addUint32(stats.points);
+	p.addUint32(stats.gamesPlayed);
+	p.addUint32(stats.won);
+	p.addUint32(stats.lost);
+	m_Connection->send(p);
+}
+
+void Protocol::sendProfile(const ProfileCache::Profile &profile) {
+	Packet p;
+	p.addByte(LB_USERPROFILE_REQ);
+	p.addString(profile.name);
+	p.addString(profile.email);
+	p.addUint16(profile.age);
+	p.addString(profile.bio);
+	m_Connection->send(p);
 }
 
 void Protocol::sendRoomUpdate(const Room *room) {
@@ -94,11 +110,11 @@ void Protocol::sendRoomUpdate(const Room *room) {
 	p.addByte(LB_ROOMLIST_UPD);
 	p.addByte(LB_ROOM_UPDATE);
 	p.addUint32(room->getGid());
-	p.addString(room->getOwner());
+	p.addString(UserTable::instance()->lookup(room->getOwner()));
 	p.addUint16(room->getPlayers().size());
 	p.addByte(st);
 	p.addByte(ty);
-	p.write(m_Socket);
+	m_Connection->send(p);
 }
 
 void Protocol::sendRoomDelete(int gid) {
@@ -106,7 +122,7 @@ void Protocol::sendRoomDelete(int gid) {
 	p.addByte(LB_ROOMLIST_UPD);
 	p.addByte(LB_ROOM_DELETE);
 	p.addUint32(gid);
-	p.write(m_Socket);
+	m_Connection->send(p);
 }
 
 void Protocol::sendRoomList(const std::vector<Room*> &list) {
@@ -132,13 +148,13 @@ void Protocol::sendRoomList(const std::vector<Room*> &list) {
 
 		// add this room's data to the packet
 		p.addUint32(room->getGid());
-		p.addString(room->getOwner());
+		p.addString(UserTable::instance()->lookup(room->getOwner()));
 		p.addUint16(room->getPlayers().size());
 		p.addByte(st);
 		p.addByte(ty);
 	}
 
-	p.write(m_Socket);
+	m_Connection->send(p);
 }
 
 void Protocol::parsePacket(Packet &p) {
@@ -192,228 +208,432 @@ void Protocol::handleUserChatMessage(Packet &p) {
 	std::string message=p.string();
 
 	// let the user manager handle this action
-	UserManager::instance()->broadcastChatMessage(m_User->getUsername(), message);
+	UserManager::instance()->broadcastChatMessage(m_User->getId(), message);
 }
 
-void Protocol::handleStatistics(Packet &p) {
-	int points, gamesPlayed, won, lost;
+/**
+ * Base class for queries run on behalf of a logged in user.
+ * Tasks keep both the user and its connection alive until they are done, and run on
+ * the connection's strand so the client's requests are answered in order.
+ */
+class UserTask: public DBExecutor::Task {
+	public:
+		UserTask(User *user, Connection *conn): DBExecutor::Task(conn), m_User(user), m_Connection(conn) {
+			m_User->ref();
+			m_Connection->ref();
+		}
 
-	try {
-		// connect to the database and get the statistics
-		pDBMySQL db=DBMySQL::synthesize();
-		db->getUserStatistics(m_User->getUsername(), points, gamesPlayed, won, lost);
-		db->disconnect();
+		~UserTask() {
+			m_Connection->unref();
+			m_User->unref();
+		}
 
-		// reply to the client
-		Packet r;
-		r.addByte(LB_STATISTICS);
-		r.addUint32(points);
-		r.addUint32(gamesPlayed);
-		r.addUint32(won);
-		r.addUint32(lost);
-		r.write(m_Socket);
-	}
+	protected:
+		/// The user the queries are run for.
+		User *m_User;
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to get statistics from database: " << ex.getMessage() << std::endl;
-	}
-}
+		/// The user's connection.
+		Connection *m_Connection;
+};
 
-void Protocol::handleUserProfileRequest(Packet &p) {
-	std::string name, email, bio;
-	int age;
+/**
+ * Fetches a user's statistics.
+ */
+class StatisticsTask: public UserTask {
+	public:
+		StatisticsTask(User *user, Connection *conn): UserTask(user, conn) { }
 
-	try {
-		// connect to the database and get the profile data
-		pDBMySQL db=DBMySQL::synthesize();
-		db->getUserProfile(m_User->getUsername(), name, email, age, bio);
-		db->disconnect();
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->getUserStatistics(m_User->getUid(), m_Stats.points, m_Stats.gamesPlayed, m_Stats.won, m_Stats.lost);
+		}
 
-		// reply to the client
-		Packet r;
-		r.addByte(LB_USERPROFILE_REQ);
-		r.addString(name);
-		r.addString(email);
-		r.addUint16(age);
-		r.addString(bio);
-		r.write(m_Socket);
-	}
+		void complete() {
+			// later requests can be answered from memory
+			ProfileCache::instance()->fillStatistics(m_User->getId(), m_Stats);
+			m_User->getProtocol()->sendStatistics(m_Stats);
+		}
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to get user profile from database: " << ex.getMessage() << std::endl;
-	}
-}
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to get statistics from database: " << ex.getMessage() << std::endl;
+		}
 
-void Protocol::handleUserProfileUpdate(Packet &p) {
-	// cache the packet data
-	std::string name=p.string();
-	std::string email=p.string();
-	int age=p.uint16();
-	std::string bio=p.string();
-
-	try {
-		// connect to the database and update the profile data
-		pDBMySQL db=DBMySQL::synthesize();
-		db->updateUserProfile(m_User->getUsername(), name, email, age, bio);
-		db->disconnect();
-	}
+	private:
+		ProfileCache::Statistics m_Stats;
+};
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
-	}
-}
+/**
+ * Fetches a user's profile.
+ */
+class ProfileRequestTask: public UserTask {
+	public:
+		ProfileRequestTask(User *user, Connection *conn): UserTask(user, conn) { }
 
-void Protocol::handleChangePassword(Packet &p) {
-	// get the new password for the user
-	std::string password=p.string();
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->getUserProfile(m_User->getUid(), m_Profile.name, m_Profile.email, m_Profile.age, m_Profile.bio);
+		}
 
-	try {
-		// connect to the database and update user's password
-		pDBMySQL db=DBMySQL::synthesize();
-		db->updateUserPassword(m_User->getUsername(), password);
-		db->disconnect();
-	}
+		void complete() {
+			m_User->getProtocol()->sendProfile(m_Profile);
+		}
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
-	}
-}
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to get user profile from database: " << ex.getMessage() << std::endl;
+		}
 
-void Protocol::handleUserListRequest(Packet &p, bool blocked) {
-	try {
-		std::vector<std::string> friends;
+	private:
+		ProfileCache::Profile m_Profile;
+};
 
-		// connect to the database and get the user's friend list
-		pDBMySQL db=DBMySQL::synthesize();
-		db->getUserList(m_User->getUsername(), friends, blocked);
-		db->disconnect();
+/**
+ * Stores a user's new password.
+ */
+class PasswordTask: public UserTask {
+	public:
+		PasswordTask(User *user, Connection *conn, const std::string &password):
+				UserTask(user, conn), m_Password(password) { }
 
-		// reply with this data
-		Packet r;
-		r.addByte((blocked ? LB_BLOCKED_REQ : LB_FRIENDS_REQ));
-		r.addUint16(friends.size());
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->updateUserPassword(m_User->getUid(), m_Password);
+		}
 
-		// add each username
-		for (int i=0; i<friends.size(); i++) {
-			std::string username=friends[i];
-			r.addString(username);
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
 		}
 
-		r.write(m_Socket);
-	}
+	private:
+		std::string m_Password;
+};
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
-	}
-}
+/**
+ * Fetches a user's friend or blocked list.
+ */
+class ListRequestTask: public UserTask {
+	public:
+		ListRequestTask(User *user, Connection *conn, bool blocked): UserTask(user, conn), m_Blocked(blocked) { }
 
-void Protocol::handleUserListUpdate(Packet &p, bool blocked) {
-	// read the amount of usernames in the list
-	int count=p.uint16();
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->getUserList(m_User->getUid(), m_List, m_Blocked);
+		}
 
-	// read the usernames
-	std::vector<std::string> list;
-	for (int i=0; i<count; i++)
-		list.push_back(p.string());
+		void complete() {
+			// reply with this data
+			Packet r;
+			r.addByte((m_Blocked ? LB_BLOCKED_REQ : LB_FRIENDS_REQ));
+			r.addUint16(m_List.size());
 
-	try {
-		// connect to the database and get the appropriate list
-		pDBMySQL db=DBMySQL::synthesize();
-		db->updateUserList(m_User->getUsername(), list, blocked);
-		db->disconnect();
+			// add each username
+			for (int i=0; i<m_List.size(); i++)
+				r.addString(m_List[i]);
 
-		// store the old blocked list
-		std::vector<std::string> oldBlocked=m_User->getBlockedList();
+			m_Connection->send(r);
+		}
 
-		// also update the user object
-		if (blocked)
-			m_User->setBlockedList(list);
-		else
-			m_User->setFriendList(list);
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to update user profile: " << ex.getMessage() << std::endl;
+		}
 
-		// now find out which users have been removed from the blocked list, and if
-		// they are online, inform them that we are online too
-		for (int i=0; i<oldBlocked.size(); i++) {
-			bool removed=true;
+	private:
+		bool m_Blocked;
+		std::vector<std::string> m_List;
+};
+
+/**
+ * Replaces a user's friend or blocked list.
+ */
+class ListUpdateTask: public UserTask {
+	public:
+		ListUpdateTask(User *user, Connection *conn, const std::vector<std::string> &list, bool blocked):
+				UserTask(user, conn), m_List(list), m_Blocked(blocked) { }
+
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			// earlier updates on this strand have already been applied to the user object,
+			// so it tells us exactly what the database holds for this list now
+			User::ListView current=(m_Blocked ? m_User->getBlockedList() : m_User->getFriendList());
+			UserTable *table=UserTable::instance();
+
+			// only names that are new need to be written
+			User::List wanted;
+			std::vector<std::string> added, removed;
+			for (int i=0; i<m_List.size(); i++) {
+				// a name that was never interned is on no list, and might not even exist,
+				// so the database gets to decide on it
+				UserId id=table->find(m_List[i]);
+				if (id==UserTable::None)
+					added.push_back(m_List[i]);
+				else if (wanted.insert(id).second && current->find(id)==current->end())
+					added.push_back(m_List[i]);
+			}
 
-			for (int j=0; j<list.size(); j++) {
-				if (oldBlocked[i]==list[j])
-					removed=false;
+			// and only names that were dropped need to be deleted
+			for (User::List::const_iterator it=current->begin(); it!=current->end(); ++it) {
+				if (wanted.find(*it)==wanted.end())
+					removed.push_back(table->lookup(*it));
 			}
 
-			// if this user was removed, alert him of our presence
-			if (removed)
-				UserManager::instance()->sendUserStatusUpdate(oldBlocked[i], m_User->getUsername(), true);
+			db->updateUserList(m_User->getUid(), added, removed, m_Blocked);
+
+			// the database skips usernames that don't exist or are on the other list,
+			// so the user object gets whatever it actually stored instead
+			if (!added.empty()) {
+				m_List.clear();
+				db->getUserList(m_User->getUid(), m_List, m_Blocked);
+			}
 		}
-	}
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to update user friend list: " << ex.getMessage() << std::endl;
-	}
-}
+		void complete() {
+			// store the old blocked list
+			User::ListView oldBlocked=m_User->getBlockedList();
+
+			// also update the user object
+			if (m_Blocked)
+				m_User->setBlockedList(m_List);
+			else
+				m_User->setFriendList(m_List);
+
+			// now find out which users have been removed from the blocked list, and if
+			// they are online, inform them that we are online too
+			User::ListView newBlocked=m_User->getBlockedList();
+			for (User::List::const_iterator it=oldBlocked->begin(); it!=oldBlocked->end(); ++it) {
+				// if this user was removed, alert him of our presence
+				if (newBlocked->find(*it)==newBlocked->end())
+					UserManager::instance()->sendUserStatusUpdate(*it, m_User->getId(), true);
+			}
+		}
 
-void Protocol::handleUserRequest(Packet &p) {
-	// read the user and list target
-	std::string username=p.string();
-	char list=p.byte();
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to update user friend list: " << ex.getMessage() << std::endl;
+		}
 
-	// verify the user isn't trying to add himself
-	if (username==m_User->getUsername()) {
-		Packet r;
-		r.addByte(MSG_ERROR);
-		r.addString("You cannot add yourself to a friend or blocked list.");
-		r.write(m_Socket);
+	private:
+		std::vector<std::string> m_List;
+		bool m_Blocked;
+};
+
+/**
+ * Adds a single user to a friend or blocked list.
+ */
+class UserRequestTask: public UserTask {
+	public:
+		UserRequestTask(User *user, Connection *conn, const std::string &username, bool blocked):
+				UserTask(user, conn), m_Username(username), m_Blocked(blocked) { }
+
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			m_Result=db->addUserToList(m_User->getUid(), m_Username, m_Blocked);
+		}
 
-		return;
-	}
+		void complete() {
+			// determine the results
+			if (m_Result==DBMySQL::NoError) {
+				std::string msg="Successfully added user to ";
 
-	try {
-		// connect to the database and add the user to the list
-		pDBMySQL db=DBMySQL::synthesize();
-		DBMySQL::RequestResult res=db->addUserToList(m_User->getUsername(), username, (list==REQ_FRIENDS ? false : true));
-		db->disconnect();
+				// complete the message string and update the user object
+				if (!m_Blocked) {
+					msg+="friends list.";
 
-		// determine the results
-		if (res==DBMySQL::NoError) {
-			std::string msg="Successfully added user to ";
+					m_User->addFriend(UserTable::instance()->intern(m_Username));
+				}
 
-			// complete the message string and update the user object
-			if (list==REQ_FRIENDS) {
-				msg+="friends list.";
+				else {
+					msg+="blocked list.";
 
-				std::vector<std::string> friends=m_User->getFriendList();
-				friends.push_back(username);
-				m_User->setFriendList(friends);
-			}
+					UserId id=UserTable::instance()->intern(m_Username);
+					m_User->addBlocked(id);
+
+					// make sure the blocked user can no longer see us if he's online right now
+					UserManager::instance()->sendUserStatusUpdate(id, m_User->getId(), false);
+				}
 
-			else {
-				msg+="blocked list.";
+				Packet r;
+				r.addByte(MSG_INFO);
+				r.addString(msg);
+				m_Connection->send(r);
+			}
 
-				std::vector<std::string> blocked=m_User->getBlockedList();
-				blocked.push_back(username);
-				m_User->setBlockedList(blocked);
+			else if (m_Result==DBMySQL::DuplicateEntry) {
+				Packet r;
+				r.addByte(MSG_ERROR);
+				r.addString("The given user already exists in one of your lists.");
+				m_Connection->send(r);
+			}
 
-				// make sure the blocked user can no longer see us if he's online right now
-				UserManager::instance()->sendUserStatusUpdate(username, m_User->getUsername(), false);
+			else if (m_Result==DBMySQL::UnknownUser) {
+				Packet r;
+				r.addByte(MSG_ERROR);
+				r.addString("The given user does not exist.");
+				m_Connection->send(r);
 			}
+		}
+
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to update user friend list: " << ex.getMessage() << std::endl;
+		}
+
+	private:
+		std::string m_Username;
+		bool m_Blocked;
+		DBMySQL::RequestResult m_Result;
+};
+
+/**
+ * Asks a game server to open a room for a user, and answers the user once it did.
+ */
+class OpenRoomRequest: public ServerPool::Request {
+	public:
+		OpenRoomRequest(User *user, Connection *conn, const std::string &password, bool onlyFriends,
+				const Room::Rules &rules, int propertyMethod):
+				m_User(user), m_Connection(conn), m_Password(password), m_OnlyFriends(onlyFriends),
+				m_Rules(rules), m_PropertyMethod(propertyMethod), m_Gid(-1), m_Port(0) {
+			m_User->ref();
+			m_Connection->ref();
+		}
+
+		~OpenRoomRequest() {
+			m_Connection->unref();
+			m_User->unref();
+		}
+
+		void assign(const std::string &host, int port, Packet &p) {
+			m_Host=host;
+			m_Port=port;
+
+			// register a new game room on the server that was picked, or move it over if
+			// the previous server failed to open it
+			if (m_Gid==-1)
+				m_Gid=UserManager::instance()->registerGameRoom(m_User->getId(), m_Password, m_OnlyFriends, m_Rules, host, port);
+			else
+				UserManager::instance()->moveGameRoom(m_Gid, host, port);
+
+			p.addUint32(m_Gid);
+			p.addString(m_User->getUsername());
+			p.addByte(m_OnlyFriends ? 0x00 : 0x01);
+			p.addUint32(m_Rules.getMaxTurns());
+			p.addUint16(m_Rules.getMaxHumans());
+			p.addUint32(m_Rules.getFreeParkReward());
+			p.addByte(m_Rules.getIncomeTaxChoice() ? 0x00 : 0x01);
+			p.addByte(m_PropertyMethod);
+		}
 
+		void complete() {
+			// make sure to join the owner into the room
+			std::string error;
+			UserManager::instance()->joinGameRoom(m_Gid, m_User->getId(), m_Password, error);
+
+			// reply to the client
 			Packet r;
-			r.addByte(MSG_INFO);
-			r.addString(msg);
-			r.write(m_Socket);
+			r.addByte(LB_CREATEROOM);
+			r.addByte(PKT_SUCCESS);
+			r.addUint32(m_Gid);
+			r.addString(m_Host);
+			r.addUint32(m_Port);
+			m_Connection->send(r);
+		}
+
+		bool withdraw(Packet &p) {
+			// the server may have opened the room after all, and it must not linger there
+			p.addByte(IS_DROPROOM);
+			p.addUint32(m_Gid);
+
+			return true;
 		}
 
-		else if (res==DBMySQL::DuplicateEntry) {
+		void fail(const std::string &error) {
+			std::cout << "Unable to open room on game server: " << error << std::endl;
+
+			// unregister the room, if it got that far
+			if (m_Gid!=-1)
+				UserManager::instance()->unregisterGameRoom(m_Gid);
+
+			// since the game server didn't open the room, error out
 			Packet r;
-			r.addByte(MSG_ERROR);
-			r.addString("The given user already exists in one of your lists.");
-			r.write(m_Socket);
+			r.addByte(LB_CREATEROOM);
+			r.addByte(PKT_ERROR);
+			r.addString("Unable to connect to game server. Contact an administrator.");
+			m_Connection->send(r);
 		}
-	}
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to update user friend list: " << ex.getMessage() << std::endl;
+	private:
+		User *m_User;
+		Connection *m_Connection;
+		std::string m_Password;
+		bool m_OnlyFriends;
+		Room::Rules m_Rules;
+		int m_PropertyMethod;
+		int m_Gid;
+		std::string m_Host;
+		int m_Port;
+};
+
+void Protocol::handleStatistics(Packet &p) {
+	// most of the time the statistics are still in memory
+	ProfileCache::Statistics stats;
+	if (ProfileCache::instance()->getStatistics(m_User->getId(), stats))
+		sendStatistics(stats);
+
+	// otherwise the reply is sent once the database gets back to us
+	else
+		DBExecutor::instance()->submit(new StatisticsTask(m_User, m_Connection));
+}
+
+void Protocol::handleUserProfileRequest(Packet &p) {
+	ProfileCache::Profile profile;
+	if (ProfileCache::instance()->getProfile(m_User->getId(), profile))
+		sendProfile(profile);
+
+	else
+		DBExecutor::instance()->submit(new ProfileRequestTask(m_User, m_Connection));
+}
+
+void Protocol::handleUserProfileUpdate(Packet &p) {
+	// cache the packet data
+	ProfileCache::Profile profile;
+	profile.name=p.string();
+	profile.email=p.string();
+	profile.age=p.uint16();
+	profile.bio=p.string();
+
+	// the database catches up in the background
+	ProfileCache::instance()->updateProfile(m_User->getId(), m_User->getUid(), profile);
+}
+
+void Protocol::handleChangePassword(Packet &p) {
+	// get the new password for the user
+	std::string password=p.string();
+
+	DBExecutor::instance()->submit(new PasswordTask(m_User, m_Connection, password));
+}
+
+void Protocol::handleUserListRequest(Packet &p, bool blocked) {
+	DBExecutor::instance()->submit(new ListRequestTask(m_User, m_Connection, blocked));
+}
+
+void Protocol::handleUserListUpdate(Packet &p, bool blocked) {
+	// read the amount of usernames in the list
+	int count=p.uint16();
+
+	// read the usernames
+	std::vector<std::string> list;
+	for (int i=0; i<count; i++)
+		list.push_back(p.string());
+
+	DBExecutor::instance()->submit(new ListUpdateTask(m_User, m_Connection, list, blocked));
+}
+
+void Protocol::handleUserRequest(Packet &p) {
+	// read the user and list target
+	std::string username=p.string();
+	char list=p.byte();
+
+	// verify the user isn't trying to add himself
+	if (username==m_User->getUsername()) {
+		Packet r;
+		r.addByte(MSG_ERROR);
+		r.addString("You cannot add yourself to a friend or blocked list.");
+		m_Connection->send(r);
+
+		return;
 	}
+
+	DBExecutor::instance()->submit(new UserRequestTask(m_User, m_Connection, username, (list==REQ_FRIENDS ? false : true)));
 }
 
 void Protocol::handleCreateRoom(Packet &p) {
@@ -427,13 +647,13 @@ void Protocol::handleCreateRoom(Packet &p) {
 	char onlyFriends=p.byte();
 
 	// see if this user already started a room, or is playing in a room now
-	UserManager::UserActivity activity=UserManager::instance()->isUserActive(m_User->getUsername());
+	UserManager::UserActivity activity=UserManager::instance()->isUserActive(m_User->getId());
 	if (activity==UserManager::RoomOwner) {
 		Packet r;
 		r.addByte(LB_CREATEROOM);
 		r.addByte(PKT_ERROR);
 		r.addString("You have already started a game room.");
-		r.write(m_Socket);
+		m_Connection->send(r);
 	}
 
 	else if (activity==UserManager::Participant) {
@@ -441,7 +661,7 @@ void Protocol::handleCreateRoom(Packet &p) {
 		r.addByte(LB_CREATEROOM);
 		r.addByte(PKT_ERROR);
 		r.addString("You are already playing in another game room.");
-		r.write(m_Socket);
+		m_Connection->send(r);
 	}
 
 	// otherwise the user is free to start a new room!
@@ -452,67 +672,13 @@ void Protocol::handleCreateRoom(Packet &p) {
 		else
 			rMethod=Room::Rules::ReturnToBank;
 
-		// have the server pool assign this room a server
-		std::string host;
-		int port;
-		ServerPool::instance()->selectGameServer(host, port);
-
 		// prepare a rules object
 		Room::Rules rules(maxTurns, maxHumans, freeParkReward, incomeTaxChoice, rMethod);
 
-		// register a new game room
-		int gid=UserManager::instance()->registerGameRoom(m_User->getUsername(), password, onlyFriends, rules, host, port);
-
-		// establish a connection to the game server
-		try {
-			ClientSocket sock;
-			sock.connect(host, port);
-
-			// send a packet to open a new room
-			Packet gs;
-			gs.addByte(CONN_LOBBY);
-			gs.addByte(IS_OPENROOM);
-			gs.addUint32(gid);
-			gs.addString(m_User->getUsername());
-			gs.addByte(onlyFriends ? 0x00 : 0x01);
-			gs.addUint32(maxTurns);
-			gs.addUint16(maxHumans);
-			gs.addUint32(freeParkReward);
-			gs.addByte(incomeTaxChoice ? 0x00 : 0x01);
-			gs.addByte(propertyMethod);
-
-			gs.write(sock.getFD());
-			sock.disconnect();
-		}
-
-		catch (const ClientSocket::Exception &ex) {
-			std::cout << "Unable to communicate with game server: " << ex.getMessage() << std::endl;
-
-			// unregister the room
-			UserManager::instance()->unregisterGameRoom(gid);
-
-			// since we can't get in touch with the game server, error out
-			Packet r;
-			r.addByte(LB_CREATEROOM);
-			r.addByte(PKT_ERROR);
-			r.addString("Unable to connect to game server. Contact an administrator.");
-			r.write(m_Socket);
-
-			return;
-		}
-
-		// make sure to join the owner into the room
-		std::string error;
-		UserManager::instance()->joinGameRoom(gid, m_User->getUsername(), password, error);
-
-		// reply to the client
-		Packet r;
-		r.addByte(LB_CREATEROOM);
-		r.addByte(PKT_SUCCESS);
-		r.addUint32(gid);
-		r.addString(host);
-		r.addUint32(port);
-		r.write(m_Socket);
+		// have the server pool pick a server and open the room there; the client is
+		// answered once the game server responds
+		ServerPool::instance()->openRoom(new OpenRoomRequest(m_User, m_Connection, password, onlyFriends,
+															 rules, propertyMethod));
 	}
 }
 
@@ -521,34 +687,28 @@ void Protocol::handleJoinRoom(Packet &p) {
 	int gid=p.uint32();
 	std::string password=p.string();
 
-	try {
-		// prepare response packet
-		Packet r;
-		r.addByte(LB_JOINROOM);
-
-		// try to join the room
-		std::string host, error;
-		int port;
-		if (UserManager::instance()->joinGameRoom(gid, m_User->getUsername(), password, host, port, error)) {
-			r.addByte(PKT_SUCCESS);
-			r.addUint32(gid);
-			r.addString(host);
-			r.addUint32(port);
-		}
-
-		else {
-			r.addByte(PKT_ERROR);
-			r.addString(error);
-		}
+	// prepare response packet
+	Packet r;
+	r.addByte(LB_JOINROOM);
 
-		r.write(m_Socket);
+	// try to join the room
+	std::string host, error;
+	int port;
+	if (UserManager::instance()->joinGameRoom(gid, m_User->getId(), password, host, port, error)) {
+		r.addByte(PKT_SUCCESS);
+		r.addUint32(gid);
+		r.addString(host);
+		r.addUint32(port);
 	}
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to join game room: " << ex.getMessage() << std::endl;
+	else {
+		r.addByte(PKT_ERROR);
+		r.addString(error);
 	}
+
+	m_Connection->send(r);
 }
 
 void Protocol::handleRoomListRefresh(Packet &p) {
-	UserManager::instance()->sendRoomList(m_User->getUsername());
+	UserManager::instance()->sendRoomList(m_User->getId());
 }
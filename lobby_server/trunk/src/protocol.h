@@ -23,8 +23,10 @@
 #define PROTOCOL_H
 
 #include "packet.h"
+#include "profilecache.h"
 #include "room.h"
 
+class Connection;
 class User;
 
 class Protocol {
@@ -35,9 +37,14 @@ class Protocol {
 	public:
 		/**
 		 * Default constructor.
-		 * @param socket Socket to associate with this protocol.
+		 * @param conn Connection to associate with this protocol.
 		 */
-		Protocol(int socket);
+		Protocol(Connection *conn);
+
+		/**
+		 * Releases this protocol's reference to its connection.
+		 */
+		~Protocol();
 
 		/**
 		 * Sets the user associated with this protocol.
@@ -47,9 +54,10 @@ class Protocol {
 		void setUser(User *user) { m_User=user; }
 
 		/**
-		 * Begins the communication loop with the client.
+		 * Parses and evaluates a given packet.
+		 * @param p The packet to parse.
 		 */
-		void communicationLoop();
+		void parsePacket(Packet &p);
 
 		/**
 		 * Sends this user's client a packet containing the details of a new user who logged in.
@@ -74,6 +82,20 @@ class Protocol {
 		 */
 		void sendChatMessage(const std::string &user, const std::string &message);
 
+		/**
+		 * Sends this user's client his/her statistics.
+		 *
+		 * @param stats The statistics.
+		 */
+		void sendStatistics(const ProfileCache::Statistics &stats);
+
+		/**
+		 * Sends this user's client his/her profile.
+		 *
+		 * @param profile The profile.
+		 */
+		void sendProfile(const ProfileCache::Profile &profile);
+
 		/**
 		 * Sends this user an update about a game room in the lobby.
 		 *
@@ -100,12 +122,6 @@ class Protocol {
 		void sendRoomList(const std::vector<Room*> &list);
 
 	private:
-		/**
-		 * Parses and evaluates a given packet.
-		 * @param p The packet to parse.
-		 */
-		void parsePacket(Packet &p);
-
 		/**
 		 * Handles a user sending a chat message.
 		 * @param p The packet to parse.
@@ -182,8 +198,8 @@ class Protocol {
 		/// The user associated with this protocol.
 		User *m_User;
 
-		/// Socket for reading/writing data between the server and client.
-		int m_Socket;
+		/// Connection for reading/writing data between the server and client.
+		Connection *m_Connection;
 };
 
 #endif
@@ -58,6 +58,15 @@
 /// Inter-server communication.
 #define IS_OPENROOM			0x00	// create a room on the game server
 #define IS_KILLROOM			0x01	// close a game room
+#define IS_LOADREPORT		0x02	// game server reports its current load
+#define IS_HELLO			0x03	// game server opens its control link
+#define IS_HEARTBEAT		0x04	// keeps the control link alive
+#define IS_RESPONSE			0x05	// game server answers a request
+#define IS_MIGRATEROOM		0x06	// game server hands over a snapshot of a room it wants moved
+#define IS_ADOPTROOM		0x07	// take over a room from its snapshot
+#define IS_MIGRATED			0x08	// tells a game server where its room was moved to
+#define IS_DROPROOM			0x09	// drop a room taken over from a snapshot, since it went elsewhere
+#define IS_KEEPROOM			0x0A	// game server played on with a room the lobby already moved
 
 /****************************************************************************/
 
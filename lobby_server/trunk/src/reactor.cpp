@@ -0,0 +1,234 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// reactor.cpp: implementation of the Reactor class.
+
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "connection.h"
+#include "lobbyserver.h"
+#include "reactor.h"
+
+// maximum amount of events to process per wakeup
+#define REACTOR_MAX_EVENTS	128
+
+// global instance of the reactor
+Reactor *g_Reactor=NULL;
+
+// the reactor thread running on the calling thread, if any
+static __thread void *t_Worker=NULL;
+
+Reactor::Reactor(int threads) {
+	// default to one thread per core
+	if (threads<=0)
+		threads=sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads<=0)
+		threads=1;
+
+	for (int i=0; i<threads; i++) {
+		Worker *worker=new Worker;
+		worker->reactor=this;
+		worker->index=i;
+		worker->epoll=-1;
+		worker->wakeup=-1;
+		pthread_mutex_init(&worker->mutex, NULL);
+		m_Workers.push_back(worker);
+	}
+
+	m_Next=0;
+	m_Connections=0;
+
+	g_Reactor=this;
+}
+
+Reactor* Reactor::instance() {
+	return g_Reactor;
+}
+
+void Reactor::start() throw(Reactor::Exception) {
+	for (int i=0; i<m_Workers.size(); i++) {
+		Worker *worker=m_Workers[i];
+
+		if ((worker->epoll=epoll_create(REACTOR_MAX_EVENTS))<0)
+			throw Reactor::Exception("Unable to create epoll instance: "+std::string(strerror(errno)));
+
+		if ((worker->wakeup=eventfd(0, EFD_NONBLOCK))<0)
+			throw Reactor::Exception("Unable to create wakeup event: "+std::string(strerror(errno)));
+
+		// the wakeup event is told apart from connections by its NULL pointer
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events=EPOLLIN | EPOLLET;
+		ev.data.ptr=NULL;
+
+		if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->wakeup, &ev)<0)
+			throw Reactor::Exception("Unable to register wakeup event: "+std::string(strerror(errno)));
+
+		if (pthread_create(&worker->thread, NULL, &Reactor::workerProcess, worker)!=0)
+			throw Reactor::Exception("Unable to start reactor thread.");
+	}
+}
+
+void Reactor::attach(Connection *conn) throw(Reactor::Exception) {
+	// spread connections evenly across threads
+	Worker *worker=m_Workers[m_Next];
+	m_Next=(m_Next+1) % m_Workers.size();
+
+	conn->setOwner(worker->index);
+	__sync_fetch_and_add(&m_Connections, 1);
+
+	// we only ever hear about state changes, so the handlers must drain the socket
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events=EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr=conn;
+
+	if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, conn->getSocket(), &ev)<0) {
+		__sync_fetch_and_sub(&m_Connections, 1);
+		throw Reactor::Exception("Unable to register connection: "+std::string(strerror(errno)));
+	}
+}
+
+void Reactor::schedule(Connection *conn) {
+	Worker *worker=m_Workers[conn->getOwner()];
+
+	// the pending list keeps the connection alive until it has been flushed
+	conn->ref();
+
+	pthread_mutex_lock(&worker->mutex);
+
+	worker->pending.push_back(conn);
+
+	// a thread is always flushed once it's done with its current events, so it only
+	// needs a nudge if it might be asleep and nobody else has nudged it yet
+	bool wake=(worker->pending.size()==1 && t_Worker!=worker);
+
+	pthread_mutex_unlock(&worker->mutex);
+
+	if (wake) {
+		uint64_t one=1;
+		write(worker->wakeup, &one, sizeof(one));
+	}
+}
+
+void* Reactor::workerProcess(void *arg) {
+	Worker *worker=(Worker*) arg;
+	t_Worker=worker;
+
+	worker->reactor->run(worker);
+
+	pthread_exit(0);
+}
+
+void Reactor::run(Worker *worker) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(1) {
+		int n=epoll_wait(worker->epoll, events, REACTOR_MAX_EVENTS, -1);
+		if (n<0) {
+			if (errno!=EINTR)
+				std::cout << "Reactor thread " << worker->index << ": " << strerror(errno) << std::endl;
+
+			continue;
+		}
+
+		for (int i=0; i<n; i++) {
+			Connection *conn=(Connection*) events[i].data.ptr;
+			uint32_t flags=events[i].events;
+
+			// another thread scheduled one of our connections
+			if (!conn) {
+				uint64_t count;
+				read(worker->wakeup, &count, sizeof(count));
+				continue;
+			}
+			bool drop=((flags & EPOLLERR)!=0);
+
+			// the socket has room again for queued data
+			if (!drop && (flags & EPOLLOUT))
+				drop=!conn->flush();
+
+			// read whatever arrived and handle each complete packet
+			if (!drop && (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+				Packet::Result res;
+				Packet p;
+
+				// keep going until the socket is drained, since we won't be told again
+				do {
+					res=conn->fill();
+					while(conn->next(p))
+						connectionHandler(conn, p);
+
+				} while(res==Packet::NoError && conn->getState()!=Connection::Closing);
+
+				drop=(res==Packet::Disconnected);
+			}
+
+			if (drop || conn->isFinished())
+				closeConnection(worker, conn);
+		}
+
+		// write out everything that was queued while handling these events
+		flushPending(worker);
+	}
+}
+
+void Reactor::flushPending(Worker *worker) {
+	std::vector<Connection*> pending;
+
+	// closing a connection can queue more packets on this thread, such as a logout
+	// broadcast, and nobody nudges us about those, so keep going until none are left
+	while(1) {
+		pthread_mutex_lock(&worker->mutex);
+		pending.swap(worker->pending);
+		pthread_mutex_unlock(&worker->mutex);
+
+		if (pending.empty())
+			break;
+
+		for (int i=0; i<pending.size(); i++) {
+			Connection *conn=pending[i];
+
+			// connections closed since being scheduled have nothing left to send
+			if (!conn->isClosed() && (!conn->flush() || conn->isFinished()))
+				closeConnection(worker, conn);
+
+			conn->unref();
+		}
+
+		pending.clear();
+	}
+}
+
+void Reactor::closeConnection(Worker *worker, Connection *conn) {
+	epoll_ctl(worker->epoll, EPOLL_CTL_DEL, conn->getSocket(), NULL);
+
+	// other threads may still hold the connection, but nothing will be sent on it anymore
+	conn->close();
+
+	// let the server clean up any session tied to this connection
+	disconnectHandler(conn);
+
+	__sync_fetch_and_sub(&m_Connections, 1);
+	conn->unref();
+}
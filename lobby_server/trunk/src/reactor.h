@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// reactor.h: definition of the Reactor class.
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <iostream>
+#include <pthread.h>
+#include <vector>
+
+class Connection;
+
+/**
+ * Event loop that multiplexes client connections over a fixed set of threads.
+ * Instead of dedicating a thread to each client, accepted connections are spread
+ * across a small pool of reactor threads (usually one per core). Each thread waits
+ * on its own edge-triggered epoll instance and services whichever of its connections
+ * have data to read or room to write. Complete packets are handed off to
+ * connectionHandler(), which must never block on socket io.
+ *
+ * Packets sent to a connection are not written right away. Instead, the connection
+ * is scheduled with its reactor thread, which flushes all scheduled connections
+ * once it is done with the events of the current iteration.
+ */
+class Reactor {
+	public:
+		/**
+		 * A general exception for reactor problems.
+		 */
+		class Exception {
+			public:
+				/// Default constructor for reactor exceptions.
+				Exception(const std::string &msg): m_Message(msg) { };
+
+				/**
+				 * Returns the reason for this exception.
+				 * @return Message string
+				 */
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The message for this exception.
+				std::string m_Message;
+		};
+
+	public:
+		/**
+		 * Creates a reactor with the given amount of threads.
+		 *
+		 * @param threads The amount of reactor threads, or 0 for one per online core.
+		 */
+		Reactor(int threads);
+
+		/**
+		 * Returns a pointer to the global reactor.
+		 *
+		 * @return A pointer to a Reactor object.
+		 */
+		static Reactor* instance();
+
+		/**
+		 * Creates the epoll instances and starts the reactor threads.
+		 * @throw A Reactor::Exception if an error occurs.
+		 */
+		void start() throw(Reactor::Exception);
+
+		/**
+		 * Hands off a connection to one of the reactor threads.
+		 * The reactor takes over the caller's reference to the connection, and releases
+		 * it once the peer disconnects.
+		 *
+		 * @param conn The connection to manage.
+		 * @throw A Reactor::Exception if the connection could not be registered.
+		 */
+		void attach(Connection *conn) throw(Reactor::Exception);
+
+		/**
+		 * Asks the owning reactor thread to flush a connection's output buffer.
+		 * This method may be called from any thread.
+		 *
+		 * @param conn The connection with pending output.
+		 */
+		void schedule(Connection *conn);
+
+		/**
+		 * Returns the amount of connections currently managed by the reactor.
+		 *
+		 * @return The number of open connections.
+		 */
+		int getConnectionCount() const { return m_Connections; }
+
+		/**
+		 * Returns the amount of reactor threads.
+		 *
+		 * @return The number of threads.
+		 */
+		int getThreadCount() const { return m_Workers.size(); }
+
+	private:
+		/**
+		 * Data about a single reactor thread.
+		 */
+		class Worker {
+			public:
+				/// The reactor this thread belongs to.
+				Reactor *reactor;
+
+				/// The index of this thread.
+				int index;
+
+				/// The epoll instance for this thread's connections.
+				int epoll;
+
+				/// Event used to wake the thread when a connection is scheduled.
+				int wakeup;
+
+				/// Connections waiting to be flushed.
+				std::vector<Connection*> pending;
+
+				/// Guards the list of pending connections.
+				pthread_mutex_t mutex;
+
+				/// The thread handle.
+				pthread_t thread;
+		};
+
+		/**
+		 * Entry point for reactor threads.
+		 *
+		 * @param arg A pointer to a Worker object.
+		 */
+		static void* workerProcess(void *arg);
+
+		/**
+		 * Runs the event loop for the given reactor thread.
+		 *
+		 * @param worker The thread to run.
+		 */
+		void run(Worker *worker);
+
+		/**
+		 * Flushes all connections scheduled with the given thread.
+		 *
+		 * @param worker The thread whose connections should be flushed.
+		 */
+		void flushPending(Worker *worker);
+
+		/**
+		 * Unregisters a connection, alerts the server and frees it.
+		 *
+		 * @param worker The thread that owns the connection.
+		 * @param conn The connection to close.
+		 */
+		void closeConnection(Worker *worker, Connection *conn);
+
+		/// The reactor threads.
+		std::vector<Worker*> m_Workers;
+
+		/// The thread to receive the next connection.
+		int m_Next;
+
+		/// The amount of open connections.
+		volatile int m_Connections;
+};
+
+#endif
@@ -21,7 +21,7 @@
 
 #include "room.h"
 
-Room::Room(int gid, const std::string &owner, const Type &type, const std::string &password, bool friendsOnly) {
+Room::Room(int gid, UserId owner, const Type &type, const std::string &password, bool friendsOnly) {
 	m_Gid=gid;
 	m_Type=type;
 	m_Password=password;
@@ -40,13 +40,20 @@ void Room::getConnectionInfo(std::string &host, int &port) {
 	port=m_Port;
 }
 
-void Room::removePlayer(const std::string &username) {
-	std::vector<std::string> nlist;
+void Room::removePlayer(UserId id) {
+	for (int i=0; i<m_Players.size(); i++) {
+		if (m_Players[i]==id) {
+			m_Players.erase(m_Players.begin()+i);
+			return;
+		}
+	}
+}
 
+bool Room::hasPlayer(UserId id) const {
 	for (int i=0; i<m_Players.size(); i++) {
-		if (m_Players[i]!=username)
-			nlist.push_back(m_Players[i]);
+		if (m_Players[i]==id)
+			return true;
 	}
 
-	m_Players=nlist;
+	return false;
 }
@@ -25,6 +25,8 @@
 #include <iostream>
 #include <vector>
 
+#include "usertable.h"
+
 class Room {
 	public:
 		/// Types of game rooms.
@@ -111,7 +113,7 @@ class Room {
 		 * @param password The room password, or an empty string if none.
 		 * @param friendsOnly Whether or not only friends of the owner may join.
 		 */
-		Room(int gid, const std::string &owner, const Type &type, const std::string &password, bool friendsOnly);
+		Room(int gid, UserId owner, const Type &type, const std::string &password, bool friendsOnly);
 
 		/**
 		 * Sets the rules for this room.
@@ -153,9 +155,9 @@ class Room {
 		/**
 		 * Returns the room's owner.
 		 *
-		 * @return The username of the room owner.
+		 * @return The id of the room owner.
 		 */
-		std::string getOwner() const { return m_Owner; }
+		UserId getOwner() const { return m_Owner; }
 
 		/**
 		 * Returns the room's type.
@@ -195,23 +197,31 @@ class Room {
 		/**
 		 * Adds a player to the game room.
 		 *
-		 * @param username The user to add.
+		 * @param id The user to add.
 		 */
-		void addPlayer(const std::string &username) { m_Players.push_back(username); }
+		void addPlayer(UserId id) { m_Players.push_back(id); }
 
 		/**
 		 * Removes a player from the game room.
 		 *
-		 * @param username The user to remove.
+		 * @param id The user to remove.
+		 */
+		void removePlayer(UserId id);
+
+		/**
+		 * Determines if a user is playing in this room.
+		 *
+		 * @param id The user in question.
+		 * @return true if the user is a player in this room, false otherwise.
 		 */
-		void removePlayer(const std::string &username);
+		bool hasPlayer(UserId id) const;
 
 		/**
 		 * Returns a list of players in this room.
 		 *
-		 * @return A vector of usernames.
+		 * @return A vector of user ids.
 		 */
-		std::vector<std::string> getPlayers() const { return m_Players; }
+		const std::vector<UserId>& getPlayers() const { return m_Players; }
 
 	private:
 		/// The id number of the room.
@@ -221,7 +231,7 @@ class Room {
 		Type m_Type;
 
 		/// The owner of this room.
-		std::string m_Owner;
+		UserId m_Owner;
 
 		/// The status of the room.
 		Status m_Status;
@@ -242,7 +252,7 @@ class Room {
 		bool m_FriendsOnly;
 
 		/// List of players in the room.
-		std::vector<std::string> m_Players;
+		std::vector<UserId> m_Players;
 };
 
 #endif
@@ -0,0 +1,11 @@
+-- -----------------------------------------------------
+-- Adds a unique index on `users`.`username` to databases
+-- created from an older schema.sql. Logins look users up
+-- by name, which otherwise scans the whole table.
+--
+-- Duplicate usernames must be resolved before running this.
+-- -----------------------------------------------------
+USE `tyranny_lobby` ;
+
+ALTER TABLE `tyranny_lobby`.`users`
+  ADD UNIQUE INDEX `username` (`username` ASC) ;
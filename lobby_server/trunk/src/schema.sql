@@ -20,7 +20,8 @@ CREATE  TABLE IF NOT EXISTS `tyranny_lobby`.`users` (
   `age` INT NULL ,
   `online` TINYINT(1)  NULL ,
   `muted` TINYINT(1)  NULL ,
-  PRIMARY KEY (`uid`) );
+  PRIMARY KEY (`uid`) ,
+  UNIQUE INDEX `username` (`username` ASC) );
 
 
 -- -----------------------------------------------------
@@ -19,36 +19,528 @@
  ***************************************************************************/
 // serverpool.cpp: implementation of the ServerPool class.
 
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+#include "connection.h"
+#include "protspec.h"
 #include "serverpool.h"
 
 // globals
 ServerPool *g_ServerPool=NULL;
 
+double ServerPool::GameServer::getLoad() const {
+	int rooms=(m_ReportedRooms>m_Rooms ? m_ReportedRooms : m_Rooms);
+
+	// a busy CPU makes every room and player on it weigh more
+	return (rooms+m_Players)*(1.0+m_CPU/100.0)/m_Weight;
+}
+
+bool ServerPool::GameServer::isAvailable(time_t now) const {
+	if (!m_Link)
+		return false;
+
+	// a tripped server only gets a single probe once it has cooled down
+	if (m_Failures>=SERVERPOOL_BREAKER_THRESHOLD)
+		return (now>=m_OpenUntil && !m_Probing);
+
+	return true;
+}
+
+bool ServerPool::GameServer::beginRequest() {
+	if (m_Failures<SERVERPOOL_BREAKER_THRESHOLD)
+		return false;
+
+	m_Probing=true;
+	return true;
+}
+
+bool ServerPool::GameServer::noteFailure(time_t now) {
+	bool probing=m_Probing;
+
+	m_Failures++;
+	m_Probing=false;
+
+	if (m_Failures<SERVERPOOL_BREAKER_THRESHOLD)
+		return false;
+
+	// a server already out of rotation only sits out another cooldown if its probe failed
+	if (m_Failures==SERVERPOOL_BREAKER_THRESHOLD || probing) {
+		m_OpenUntil=now+SERVERPOOL_BREAKER_COOLDOWN;
+		return true;
+	}
+
+	return false;
+}
+
 ServerPool::ServerPool() {
+	m_Seed=time(NULL);
+	m_NextRequest=0;
+	pthread_mutex_init(&m_Mutex, NULL);
+
 	g_ServerPool=this;
 }
 
 ServerPool::~ServerPool() {
+	for (std::map<uint32_t, Pending*>::iterator it=m_Requests.begin(); it!=m_Requests.end(); ++it) {
+		delete (*it).second->request;
+		delete (*it).second;
+	}
+
+	for (int i=0; i<m_List.size(); i++) {
+		if (m_List[i]->getLink())
+			m_List[i]->getLink()->unref();
 
+		delete m_List[i];
+	}
+
+	pthread_mutex_destroy(&m_Mutex);
 }
 
 ServerPool* ServerPool::instance() {
 	return g_ServerPool;
 }
 
-void ServerPool::addGameServer(const std::string &id, const std::string &host, int port) {
-	m_Servers[id]=new ServerPool::GameServer(id, host, port);
+void ServerPool::start() throw(ServerPool::Exception) {
+	if (pthread_create(&m_Monitor, NULL, &ServerPool::monitorProcess, this)!=0)
+		throw ServerPool::Exception("Unable to start link monitor thread.");
+}
+
+void ServerPool::addGameServer(const std::string &id, const std::string &host, int port, int weight) {
+	GameServer *server=new ServerPool::GameServer(id, host, port, weight);
+	m_Servers[id]=server;
+	m_List.push_back(server);
+}
+
+bool ServerPool::getGameServer(const std::string &id, std::string &host, int &port) {
+	std::map<std::string, GameServer*>::iterator it=m_Servers.find(id);
+	if (it==m_Servers.end())
+		return false;
+
+	host=(*it).second->getHost();
+	port=(*it).second->getPort();
+
+	return true;
 }
 
-void ServerPool::getGameServer(const std::string &id, std::string &host, int &port) {
-	GameServer *server=m_Servers[id];
-	host=server->getHost();
-	port=server->getPort();
+void ServerPool::openRoom(Request *req) {
+	Pending *pending=new Pending;
+	pending->request=req;
+	pending->action=IS_OPENROOM;
+	pending->server=NULL;
+	pending->deadline=0;
+	pending->expires=0;
+
+	dispatch(pending, "No game server is available.");
 }
 
-void ServerPool::selectGameServer(std::string &host, int &port) {
-	// just grab the first server for now
-	GameServer *server=(*m_Servers.begin()).second;
-	host=server->getHost();
-	port=server->getPort();
+void ServerPool::migrateRoom(Request *req, Connection *from) {
+	Pending *pending=new Pending;
+	pending->request=req;
+	pending->action=IS_ADOPTROOM;
+	pending->server=NULL;
+	pending->deadline=0;
+
+	// the server moving the room only holds the game for so long
+	pending->expires=time(NULL)+SERVERPOOL_MIGRATE_TIMEOUT;
+
+	// the room is moving away from this server, so don't send it back
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *source=findLink(from);
+	if (source)
+		pending->tried.push_back(source);
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	dispatch(pending, "No other game server is available.");
+}
+
+void ServerPool::dropRoom(int gid, const std::string &host, int port) {
+	Connection *link=NULL;
+
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findServer(host, port);
+	if (server) {
+		server->addRooms(-1);
+
+		link=server->getLink();
+		if (link)
+			link->ref();
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	if (link) {
+		Packet p;
+		p.addByte(IS_DROPROOM);
+		p.addUint32(gid);
+		link->send(p);
+
+		link->unref();
+	}
+}
+
+void ServerPool::recallRoom(int gid, const std::string &host, int port, Connection *to) {
+	dropRoom(gid, host, port);
+
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *source=findLink(to);
+	if (source)
+		source->addRooms(1);
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+bool ServerPool::attachLink(const std::string &id, Connection *conn) {
+	std::map<std::string, GameServer*>::iterator it=m_Servers.find(id);
+	if (it==m_Servers.end() || (*it).second->getHost()!=conn->getIP())
+		return false;
+
+	GameServer *server=(*it).second;
+	std::vector<Pending*> failed;
+
+	conn->ref();
+
+	pthread_mutex_lock(&m_Mutex);
+	Connection *old=dropLink(server, failed);
+	server->setLink(conn);
+	pthread_mutex_unlock(&m_Mutex);
+
+	// the server reconnected, so whatever was in flight on the old link is lost
+	if (old) {
+		old->shutdown();
+		old->unref();
+	}
+
+	for (int i=0; i<failed.size(); i++)
+		dispatch(failed[i], "Lost connection to the game server.");
+
+	return true;
+}
+
+void ServerPool::detachLink(Connection *conn) {
+	std::vector<Pending*> failed;
+	Connection *link=NULL;
+
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findLink(conn);
+	if (server) {
+		std::cout << "Lost control link to game server " << server->getID() << std::endl;
+		link=dropLink(server, failed);
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	if (link)
+		link->unref();
+
+	for (int i=0; i<failed.size(); i++)
+		dispatch(failed[i], "Lost connection to the game server.");
+}
+
+bool ServerPool::heard(Connection *conn) {
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findLink(conn);
+	if (server)
+		server->touch();
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return (server!=NULL);
+}
+
+bool ServerPool::getLinkServer(Connection *conn, std::string &host, int &port) {
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findLink(conn);
+	if (server) {
+		host=server->getHost();
+		port=server->getPort();
+	}
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	return (server!=NULL);
+}
+
+void ServerPool::respond(Connection *conn, uint32_t id, bool success, const std::string &error) {
+	pthread_mutex_lock(&m_Mutex);
+
+	// only the server the request was sent to may answer it
+	std::map<uint32_t, Pending*>::iterator it=m_Requests.find(id);
+	if (it==m_Requests.end() || (*it).second->server->getLink()!=conn) {
+		pthread_mutex_unlock(&m_Mutex);
+		return;
+	}
+
+	Pending *pending=(*it).second;
+	m_Requests.erase(it);
+
+	if (success) {
+		pending->server->noteSuccess();
+		pthread_mutex_unlock(&m_Mutex);
+
+		pending->request->complete();
+		delete pending->request;
+		delete pending;
+
+		return;
+	}
+
+	if (pending->server->noteFailure(time(NULL)))
+		std::cout << "Taking game server " << pending->server->getID() << " out of rotation" << std::endl;
+
+	pthread_mutex_unlock(&m_Mutex);
+
+	// try another server
+	dispatch(pending, error);
+}
+
+void ServerPool::releaseRoom(const std::string &host, int port) {
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findServer(host, port);
+	if (server)
+		server->addRooms(-1);
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void ServerPool::reportLoad(Connection *conn, int rooms, int players, int cpu) {
+	pthread_mutex_lock(&m_Mutex);
+
+	GameServer *server=findLink(conn);
+	if (server)
+		server->setLoad(rooms, players, cpu);
+
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void* ServerPool::monitorProcess(void *arg) {
+	ServerPool *pool=(ServerPool*) arg;
+	pool->monitor();
+
+	pthread_exit(0);
+}
+
+void ServerPool::monitor() {
+	while(1) {
+		sleep(1);
+
+		std::vector<Connection*> dead;
+		std::vector<Pending*> failed, expired;
+		time_t now=time(NULL);
+
+		pthread_mutex_lock(&m_Mutex);
+
+		// a server that stopped sending heartbeats is presumed dead
+		for (int i=0; i<m_List.size(); i++) {
+			GameServer *server=m_List[i];
+			if (server->getLink() && now-server->getLastHeard()>SERVERPOOL_LINK_TIMEOUT) {
+				std::cout << "Game server " << server->getID() << " stopped responding" << std::endl;
+				dead.push_back(dropLink(server, failed));
+			}
+		}
+
+		std::map<uint32_t, Pending*>::iterator it=m_Requests.begin();
+		while(it!=m_Requests.end()) {
+			Pending *pending=(*it).second;
+			if (pending->deadline<now) {
+				if (pending->server->noteFailure(now))
+					std::cout << "Taking game server " << pending->server->getID() << " out of rotation" << std::endl;
+
+				expired.push_back(pending);
+				m_Requests.erase(it++);
+			}
+
+			else
+				++it;
+		}
+
+		pthread_mutex_unlock(&m_Mutex);
+
+		for (int i=0; i<dead.size(); i++) {
+			dead[i]->shutdown();
+			dead[i]->unref();
+		}
+
+		for (int i=0; i<failed.size(); i++)
+			dispatch(failed[i], "Lost connection to the game server.");
+
+		for (int i=0; i<expired.size(); i++)
+			dispatch(expired[i], "The game server did not respond in time.");
+	}
+}
+
+void ServerPool::dispatch(Pending *pending, const std::string &error) {
+	Request *req=pending->request;
+
+	// the last server might have carried out the request without its answer reaching us,
+	// so undo it there before the request goes anywhere else
+	if (pending->server) {
+		Packet p;
+		Connection *link=NULL;
+
+		pthread_mutex_lock(&m_Mutex);
+
+		if (pending->server->getLink() && req->withdraw(p)) {
+			link=pending->server->getLink();
+			link->ref();
+		}
+
+		pthread_mutex_unlock(&m_Mutex);
+
+		if (link) {
+			link->send(p);
+			link->unref();
+		}
+	}
+
+	while(1) {
+		pthread_mutex_lock(&m_Mutex);
+
+		// the server a room is moved away from counts as tried, but not as an attempt,
+		// and a request that ran out of time isn't tried anywhere else
+		GameServer *server=NULL;
+		if (pending->tried.size()<SERVERPOOL_REQUEST_ATTEMPTS+(pending->action==IS_ADOPTROOM ? 1 : 0) &&
+		    (!pending->expires || time(NULL)<pending->expires))
+			server=pickServer(pending->tried);
+
+		// out of servers to try, so the request stays failed
+		if (!server) {
+			pthread_mutex_unlock(&m_Mutex);
+
+			req->fail(error);
+			delete req;
+			delete pending;
+
+			return;
+		}
+
+		if (server->beginRequest())
+			std::cout << "Probing game server " << server->getID() << std::endl;
+
+		// count the room right away, so the next pick sees it even before the server reports it,
+		// and stop counting it against the server it is moved away from
+		server->addRooms(1);
+		if (pending->server)
+			pending->server->addRooms(-1);
+
+		pending->server=server;
+		pending->tried.push_back(server);
+
+		uint32_t id=m_NextRequest++;
+		std::string host=server->getHost();
+		int port=server->getPort();
+
+		Connection *link=server->getLink();
+		link->ref();
+
+		pthread_mutex_unlock(&m_Mutex);
+
+		// the request may register the room, which must not happen under our lock
+		Packet p;
+		p.addByte(pending->action);
+		p.addUint32(id);
+		req->assign(host, port, p);
+
+		pthread_mutex_lock(&m_Mutex);
+
+		// the link might have gone down in the meantime, in which case move on to another server
+		if (server->getLink()!=link) {
+			pthread_mutex_unlock(&m_Mutex);
+			link->unref();
+
+			continue;
+		}
+
+		pending->deadline=time(NULL)+SERVERPOOL_REQUEST_TIMEOUT;
+		if (pending->expires && pending->deadline>pending->expires)
+			pending->deadline=pending->expires;
+
+		m_Requests[id]=pending;
+
+		pthread_mutex_unlock(&m_Mutex);
+
+		link->send(p);
+		link->unref();
+
+		return;
+	}
+}
+
+ServerPool::GameServer* ServerPool::pickServer(const std::vector<GameServer*> &exclude) {
+	time_t now=time(NULL);
+
+	std::vector<GameServer*> live;
+	for (int i=0; i<m_List.size(); i++) {
+		if (m_List[i]->isAvailable(now) && std::find(exclude.begin(), exclude.end(), m_List[i])==exclude.end())
+			live.push_back(m_List[i]);
+	}
+
+	if (live.empty())
+		return NULL;
+
+	// pick two different servers at random, and go with the less loaded one
+	GameServer *server=live[rand_r(&m_Seed)%live.size()];
+	if (live.size()>1) {
+		GameServer *other;
+		do {
+			other=live[rand_r(&m_Seed)%live.size()];
+		} while(other==server);
+
+		if (other->getLoad()<server->getLoad())
+			server=other;
+	}
+
+	return server;
+}
+
+ServerPool::GameServer* ServerPool::findLink(Connection *conn) {
+	for (int i=0; i<m_List.size(); i++) {
+		if (m_List[i]->getLink()==conn)
+			return m_List[i];
+	}
+
+	return NULL;
+}
+
+ServerPool::GameServer* ServerPool::findServer(const std::string &host, int port) {
+	for (int i=0; i<m_List.size(); i++) {
+		if (m_List[i]->getHost()==host && m_List[i]->getPort()==port)
+			return m_List[i];
+	}
+
+	return NULL;
+}
+
+Connection* ServerPool::dropLink(GameServer *server, std::vector<Pending*> &failed) {
+	std::map<uint32_t, Pending*>::iterator it=m_Requests.begin();
+	while(it!=m_Requests.end()) {
+		if ((*it).second->server==server) {
+			failed.push_back((*it).second);
+			m_Requests.erase(it++);
+		}
+
+		else
+			++it;
+	}
+
+	Connection *link=server->getLink();
+	if (link) {
+		server->setLink(NULL);
+
+		// losing the link counts against the server just like a failed request
+		if (server->noteFailure(time(NULL)))
+			std::cout << "Taking game server " << server->getID() << " out of rotation" << std::endl;
+	}
+
+	return link;
 }
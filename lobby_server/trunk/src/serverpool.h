@@ -22,10 +22,136 @@
 #ifndef SERVERPOOL_H
 #define SERVERPOOL_H
 
+#include <ctime>
 #include <iostream>
 #include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
 
+#include "packet.h"
+
+class Connection;
+
+/// Seconds a control link may stay silent before its game server is considered dead.
+#define SERVERPOOL_LINK_TIMEOUT		5
+
+/// Seconds a game server has to answer a request.
+#define SERVERPOOL_REQUEST_TIMEOUT	3
+
+/// Servers a request is tried on before giving up.
+#define SERVERPOOL_REQUEST_ATTEMPTS	3
+
+/// Seconds a room may take to move, which must stay well below the game servers' ROOM_MIGRATE_TIMEOUT.
+#define SERVERPOOL_MIGRATE_TIMEOUT	10
+
+/// Consecutive failures after which a server is taken out of rotation.
+#define SERVERPOOL_BREAKER_THRESHOLD	3
+
+/// Seconds a server stays out of rotation before it is given another chance.
+#define SERVERPOOL_BREAKER_COOLDOWN	10
+
+/**
+ * The game servers rooms can be placed on.
+ * Each game server periodically reports how many rooms and players it is hosting and
+ * how busy its CPU is. New rooms go to the less loaded of two servers picked at
+ * random, which spreads rooms nearly as evenly as always picking the least loaded
+ * server, but without every lobby thread piling onto the same one between reports.
+ *
+ * A server's load is its room and player count, scaled up by its CPU usage and
+ * divided by the weight given to it in the configuration file. The lobby also counts
+ * the rooms it places itself, so a burst of rooms created between two reports is
+ * spread out as well.
+ *
+ * Each game server keeps one control link open to the lobby, over which it sends
+ * heartbeats, load reports and closed rooms, and the lobby sends it requests to open
+ * rooms. Requests carry an id the game server echoes in its response, so any number
+ * of them can be outstanding on the same link. Only servers with a live link are
+ * given rooms; a link that stays silent for SERVERPOOL_LINK_TIMEOUT seconds is
+ * dropped, and so are requests left unanswered for SERVERPOOL_REQUEST_TIMEOUT.
+ *
+ * A request that fails, whether the server refused it, did not answer in time or lost
+ * its link, is quietly retried on another server, up to SERVERPOOL_REQUEST_ATTEMPTS
+ * servers in all. Each server also acts as a circuit breaker: after
+ * SERVERPOOL_BREAKER_THRESHOLD failures in a row it is left out of rotation for
+ * SERVERPOOL_BREAKER_COOLDOWN seconds, after which a single request is let through
+ * to probe it. If that one succeeds the server is back in rotation, otherwise it sits
+ * out another cooldown. During a partial outage, rooms therefore keep going to the
+ * healthy servers instead of waiting on the broken ones.
+ *
+ * Game servers may also ask for one of their rooms to be moved elsewhere, for instance
+ * when they are being drained for maintenance. Such a request is placed like a new
+ * room, except that it is never sent back to the server that asked, and all its
+ * attempts together must finish within SERVERPOOL_MIGRATE_TIMEOUT, so the answer
+ * reaches the server that asked while it still holds the game. A server that did not
+ * answer in time might have taken over the room anyway, so before the request moves
+ * on, that server is told to drop its copy again.
+ */
 class ServerPool {
+	public:
+		/**
+		 * A general exception for server pool problems.
+		 */
+		class Exception {
+			public:
+				/// Default constructor for server pool exceptions.
+				Exception(const std::string &msg): m_Message(msg) { };
+
+				/**
+				 * Returns the reason for this exception.
+				 * @return Message string
+				 */
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The message for this exception.
+				std::string m_Message;
+		};
+
+		/**
+		 * A request sent to a game server over its control link.
+		 * Exactly one of complete() or fail() is called, on whichever thread learns the
+		 * outcome, after which the pool deletes the request.
+		 */
+		class Request {
+			public:
+				/// Frees memory associated with this request.
+				virtual ~Request() { };
+
+				/**
+				 * Called once a game server is picked for this request, to add the
+				 * request's arguments to the packet sent to it. If the request is
+				 * retried, this is called again for every server it is moved to.
+				 *
+				 * @param host The hostname or IP address of the server.
+				 * @param port The port number of the server.
+				 * @param p The packet, already holding the action and request id.
+				 */
+				virtual void assign(const std::string &host, int port, Packet &p)=0;
+
+				/**
+				 * Called when the game server carried out the request.
+				 */
+				virtual void complete()=0;
+
+				/**
+				 * Called when the request could not be carried out on any server.
+				 *
+				 * @param error A description of the problem.
+				 */
+				virtual void fail(const std::string &error)=0;
+
+				/**
+				 * Called when the request is moved away from a server, or given up on,
+				 * since the server might have carried it out after all. Adds whatever
+				 * undoes the request to a packet sent to that server.
+				 *
+				 * @param p The packet.
+				 * @return true if the packet should be sent, false if there is nothing to undo.
+				 */
+				virtual bool withdraw(Packet &p) { return false; }
+		};
+
 	public:
 		/// Default constructor.
 		ServerPool();
@@ -40,14 +166,21 @@ class ServerPool {
 		 */
 		static ServerPool* instance();
 
+		/**
+		 * Starts the thread watching over control links and outstanding requests.
+		 * @throw A ServerPool::Exception if an error occurs.
+		 */
+		void start() throw(ServerPool::Exception);
+
 		/**
 		 * Adds a game server to the pool.
 		 *
 		 * @param id The identifier for the server.
 		 * @param host The hostname or IP address of the server.
 		 * @param port The port number of the server.
+		 * @param weight The relative capacity of the server.
 		 */
-		void addGameServer(const std::string &id, const std::string &host, int port);
+		void addGameServer(const std::string &id, const std::string &host, int port, int weight=1);
 
 		/**
 		 * Gets the connection information for a given server.
@@ -55,16 +188,116 @@ class ServerPool {
 		 * @param id The identifier of the game server.
 		 * @param host Sets this value to the host or IP address of the server.
 		 * @param port Sets this value to the port number of the server.
+		 * @return true if the server exists, false otherwise.
+		 */
+		bool getGameServer(const std::string &id, std::string &host, int &port);
+
+		/**
+		 * Sends a request to open a room to the most suitable server, and counts the
+		 * room against it. The request is retried on other servers if it fails. The
+		 * pool takes ownership of the request.
+		 *
+		 * @param req The request.
+		 */
+		void openRoom(Request *req);
+
+		/**
+		 * Sends a request to take over a room to the most suitable server other than
+		 * the one it is moved away from, and counts the room against it. The request
+		 * is retried on other servers if it fails. The pool takes ownership of the
+		 * request.
+		 *
+		 * @param req The request.
+		 * @param from The control link of the server the room is moved away from.
+		 */
+		void migrateRoom(Request *req, Connection *from);
+
+		/**
+		 * Tells a server to drop a room it took over that is no longer wanted, and
+		 * stops counting the room against it.
+		 *
+		 * @param gid The room's id.
+		 * @param host The host or IP address of the server.
+		 * @param port The port number of the server.
 		 */
-		void getGameServer(const std::string &id, std::string &host, int &port);
+		void dropRoom(int gid, const std::string &host, int port);
 
 		/**
-		 * Finds the most suitable server for a new client connection.
+		 * Takes back a room that was moved to another server while the server it was
+		 * moved away from kept playing it. The server the room was moved to is told to
+		 * drop its copy, and the room counts against the server it stayed on again.
 		 *
+		 * @param gid The room's id.
+		 * @param host The host or IP address of the server the room was moved to.
+		 * @param port The port number of the server the room was moved to.
+		 * @param to The control link of the server the room stayed on.
+		 */
+		void recallRoom(int gid, const std::string &host, int port, Connection *to);
+
+		/**
+		 * Adopts a connection from a game server as that server's control link,
+		 * replacing any previous one.
+		 *
+		 * @param id The identifier the game server gave.
+		 * @param conn The connection.
+		 * @return true if the link was adopted, false if the id is unknown or the
+		 * connection does not come from the server's address.
+		 */
+		bool attachLink(const std::string &id, Connection *conn);
+
+		/**
+		 * Forgets a control link that was closed, failing requests still waiting on it.
+		 * Connections that are not control links are ignored.
+		 *
+		 * @param conn The connection.
+		 */
+		void detachLink(Connection *conn);
+
+		/**
+		 * Notes that a packet arrived on a control link, which keeps the link alive.
+		 *
+		 * @param conn The connection.
+		 * @return true if the connection is a current control link, false otherwise.
+		 */
+		bool heard(Connection *conn);
+
+		/**
+		 * Gets the connection information of the server a control link belongs to.
+		 *
+		 * @param conn The connection.
 		 * @param host Sets this value to the host or IP address of the server.
 		 * @param port Sets this value to the port number of the server.
+		 * @return true if the connection is a current control link, false otherwise.
+		 */
+		bool getLinkServer(Connection *conn, std::string &host, int &port);
+
+		/**
+		 * Finishes an outstanding request with the game server's response.
+		 *
+		 * @param conn The control link the response arrived on.
+		 * @param id The request's id.
+		 * @param success Whether the game server carried out the request.
+		 * @param error A description of the problem, if any.
+		 */
+		void respond(Connection *conn, uint32_t id, bool success, const std::string &error);
+
+		/**
+		 * Stops counting a closed room against the server it was placed on.
+		 *
+		 * @param host The host or IP address of the server.
+		 * @param port The port number of the server.
 		 */
-		void selectGameServer(std::string &host, int &port);
+		void releaseRoom(const std::string &host, int port);
+
+		/**
+		 * Records the load a game server reported.
+		 *
+		 * @param conn The control link of the game server.
+		 * @param rooms The amount of rooms open on the server.
+		 * @param players The amount of players in those rooms.
+		 * @param cpu The CPU usage of the server, in percent.
+		 */
+		void reportLoad(Connection *conn, int rooms, int players, int cpu);
 
 	private:
 		class GameServer {
@@ -75,11 +308,22 @@ class ServerPool {
 				 * @param id The identifier for the server.
 				 * @param host The hostname or IP address of the server.
 				 * @param port The port number of the server.
+				 * @param weight The relative capacity of the server.
 				 */
-				GameServer(const std::string &id, const std::string &host, int port) {
+				GameServer(const std::string &id, const std::string &host, int port, int weight) {
 					m_ID=id;
 					m_Host=host;
 					m_Port=port;
+					m_Weight=weight;
+					m_Rooms=0;
+					m_ReportedRooms=0;
+					m_Players=0;
+					m_CPU=0;
+					m_Link=NULL;
+					m_LastHeard=0;
+					m_Failures=0;
+					m_OpenUntil=0;
+					m_Probing=false;
 				}
 
 				/**
@@ -103,6 +347,89 @@ class ServerPool {
 				 */
 				int getPort() const { return m_Port; }
 
+				/**
+				 * Counts a room placed on this server by the lobby.
+				 *
+				 * @param delta 1 for a new room, -1 for a closed one.
+				 */
+				void addRooms(int delta) { m_Rooms+=delta; }
+
+				/**
+				 * Records the load the server reported.
+				 *
+				 * @param rooms The amount of rooms open on the server.
+				 * @param players The amount of players in those rooms.
+				 * @param cpu The CPU usage of the server, in percent.
+				 */
+				void setLoad(int rooms, int players, int cpu) {
+					m_ReportedRooms=rooms;
+					m_Players=players;
+					m_CPU=cpu;
+				}
+
+				/**
+				 * Returns how loaded this server is, relative to its weight.
+				 *
+				 * @return The server's load.
+				 */
+				double getLoad() const;
+
+				/**
+				 * Sets the control link of this server.
+				 * The server takes over the caller's reference to the connection.
+				 *
+				 * @param link The connection, or NULL if the server has no link.
+				 */
+				void setLink(Connection *link) { m_Link=link; m_LastHeard=time(NULL); }
+
+				/**
+				 * Returns the control link of this server.
+				 *
+				 * @return The connection, or NULL if the server has no link.
+				 */
+				Connection* getLink() const { return m_Link; }
+
+				/**
+				 * Notes that the server was just heard from.
+				 */
+				void touch() { m_LastHeard=time(NULL); }
+
+				/**
+				 * Returns when the server was last heard from.
+				 *
+				 * @return The time of the last packet on the link.
+				 */
+				time_t getLastHeard() const { return m_LastHeard; }
+
+				/**
+				 * Determines if this server may be given a request.
+				 *
+				 * @param now The current time.
+				 * @return true if the server is linked and its breaker lets requests through.
+				 */
+				bool isAvailable(time_t now) const;
+
+				/**
+				 * Notes that a request is about to be sent to this server. If the breaker
+				 * is open, the request becomes the one probing the server.
+				 *
+				 * @return true if the request is a probe, false otherwise.
+				 */
+				bool beginRequest();
+
+				/**
+				 * Notes that the server carried out a request, which closes its breaker.
+				 */
+				void noteSuccess() { m_Failures=0; m_Probing=false; }
+
+				/**
+				 * Notes that the server failed a request or lost its link.
+				 *
+				 * @param now The current time.
+				 * @return true if this failure took the server out of rotation.
+				 */
+				bool noteFailure(time_t now);
+
 			private:
 				/// The server's identifier.
 				std::string m_ID;
@@ -112,10 +439,137 @@ class ServerPool {
 
 				/// The port number.
 				int m_Port;
+
+				/// The relative capacity of the server.
+				int m_Weight;
+
+				/// Rooms the lobby has placed on the server and that are still open.
+				int m_Rooms;
+
+				/// Rooms the server last reported; it may still be winding down rooms the lobby forgot.
+				int m_ReportedRooms;
+
+				/// Players the server last reported.
+				int m_Players;
+
+				/// CPU usage the server last reported, in percent.
+				int m_CPU;
+
+				/// The control link, if the server is connected.
+				Connection *m_Link;
+
+				/// When a packet last arrived on the link.
+				time_t m_LastHeard;
+
+				/// Failures since the server last carried out a request.
+				int m_Failures;
+
+				/// When the server may be probed again, if its breaker is open.
+				time_t m_OpenUntil;
+
+				/// Whether a request probing the server is in flight.
+				bool m_Probing;
+		};
+
+		/// A request waiting for its response.
+		struct Pending {
+			/// The request itself.
+			Request *request;
+
+			/// The action sent to the game server.
+			uint8_t action;
+
+			/// The server the request was last sent to, if any.
+			GameServer *server;
+
+			/// When the request times out.
+			time_t deadline;
+
+			/// When the request must be finished on whatever server, or 0 if there is no limit.
+			time_t expires;
+
+			/// The servers the request was sent to so far.
+			std::vector<GameServer*> tried;
 		};
 
 	private:
+		/**
+		 * Entry point for the link monitor thread.
+		 *
+		 * @param arg Pointer to the server pool.
+		 */
+		static void* monitorProcess(void *arg);
+
+		/**
+		 * Drops silent links and expired requests every second, until the process exits.
+		 */
+		void monitor();
+
+		/**
+		 * Sends a request to the best server it was not yet tried on, or fails it if
+		 * there is none left. The pool must not be locked.
+		 *
+		 * @param pending The request.
+		 * @param error Why the request failed last, if it was tried before.
+		 */
+		void dispatch(Pending *pending, const std::string &error);
+
+		/**
+		 * Picks the less loaded of two random servers that are available.
+		 * The pool must be locked.
+		 *
+		 * @param exclude Servers not to pick.
+		 * @return The server, or NULL if no server is available.
+		 */
+		GameServer* pickServer(const std::vector<GameServer*> &exclude);
+
+		/**
+		 * Finds the server a control link belongs to. The pool must be locked.
+		 *
+		 * @param conn The connection.
+		 * @return The server, or NULL if the connection is not a current link.
+		 */
+		GameServer* findLink(Connection *conn);
+
+		/**
+		 * Finds a server by its address. The pool must be locked.
+		 *
+		 * @param host The host or IP address of the server.
+		 * @param port The port number of the server.
+		 * @return The server, or NULL if there is no such server.
+		 */
+		GameServer* findServer(const std::string &host, int port);
+
+		/**
+		 * Removes a server's control link and takes its outstanding requests.
+		 * The pool must be locked.
+		 *
+		 * @param server The server.
+		 * @param failed Outstanding requests sent to the server are appended here.
+		 * @return The link, whose reference is handed to the caller.
+		 */
+		Connection* dropLink(GameServer *server, std::vector<Pending*> &failed);
+
+		/// The servers, by id.
 		std::map<std::string, GameServer*> m_Servers;
+
+		/// The servers, for picking one at random.
+		std::vector<GameServer*> m_List;
+
+		/// State of the random number generator used to pick servers.
+		unsigned int m_Seed;
+
+		/// Requests waiting for a response, by id.
+		std::map<uint32_t, Pending*> m_Requests;
+
+		/// The id for the next request.
+		uint32_t m_NextRequest;
+
+		/// The link monitor thread.
+		pthread_t m_Monitor;
+
+		/// Guards the servers' load, links and outstanding requests.
+		pthread_mutex_t m_Mutex;
 };
 
 #endif
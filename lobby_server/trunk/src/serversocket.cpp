@@ -54,8 +54,9 @@ void ServerSocket::bind() throw(ServerSocket::Exception) {
 }
 		
 void ServerSocket::listen() throw(ServerSocket::Exception) {
-	// try listening on the socket (backlog of 10)
-	if (::listen(m_Socket, 10)<0)
+	// try listening on the socket (let the kernel queue as many as it allows,
+	// since reconnect storms can bring in thousands of clients at once)
+	if (::listen(m_Socket, SOMAXCONN)<0)
 		throw ServerSocket::Exception("Unable to listen on socket.");
 }
 
@@ -23,24 +23,107 @@
 
 User::User(const std::string &username, const std::string &password) {
 	m_Username=username;
+	m_Id=UserTable::instance()->intern(username);
+	m_Uid=0;
 	m_Password=password;
 	m_Protocol=NULL;
+	m_Muted=false;
+	m_Refs=1;
+	m_Friends=ListView(new List);
+	m_Blocked=ListView(new List);
+
+	pthread_mutex_init(&m_Mutex, NULL);
+}
+
+User::~User() {
+	delete m_Protocol;
+
+	pthread_mutex_destroy(&m_Mutex);
+}
+
+void User::ref() {
+	__sync_add_and_fetch(&m_Refs, 1);
+}
+
+void User::unref() {
+	if (__sync_sub_and_fetch(&m_Refs, 1)==0)
+		delete this;
+}
+
+void User::setFriendList(const std::vector<std::string> &list) {
+	ListView view=makeList(list);
+
+	pthread_mutex_lock(&m_Mutex);
+	m_Friends.swap(view);
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+User::ListView User::getFriendList() const {
+	pthread_mutex_lock(&m_Mutex);
+	ListView view=m_Friends;
+	pthread_mutex_unlock(&m_Mutex);
+
+	return view;
+}
+
+void User::addFriend(UserId id) {
+	addToList(m_Friends, id);
 }
 
-bool User::isFriendsWith(const std::string &username) const {
-	for (int i=0; i<m_Friends.size(); i++) {
-		if (m_Friends[i]==username)
-			return true;
-	}
+void User::setBlockedList(const std::vector<std::string> &list) {
+	ListView view=makeList(list);
+
+	pthread_mutex_lock(&m_Mutex);
+	m_Blocked.swap(view);
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+User::ListView User::getBlockedList() const {
+	pthread_mutex_lock(&m_Mutex);
+	ListView view=m_Blocked;
+	pthread_mutex_unlock(&m_Mutex);
+
+	return view;
+}
+
+void User::addBlocked(UserId id) {
+	addToList(m_Blocked, id);
+}
+
+bool User::isFriendsWith(UserId id) const {
+	pthread_mutex_lock(&m_Mutex);
+	bool found=(m_Friends->find(id)!=m_Friends->end());
+	pthread_mutex_unlock(&m_Mutex);
+
+	return found;
+}
+
+bool User::isBlocking(UserId id) const {
+	pthread_mutex_lock(&m_Mutex);
+	bool found=(m_Blocked->find(id)!=m_Blocked->end());
+	pthread_mutex_unlock(&m_Mutex);
+
+	return found;
+}
+
+void User::addToList(ListView &list, UserId id) {
+	// lists change on database threads, but only in tasks on the user's strand, which
+	// run one at a time; so the copy can be made without holding the lock, and readers
+	// keep seeing the old list until the swap
+	List *copy=new List(*list);
+	copy->insert(id);
+
+	ListView view(copy);
 
-	return false;
+	pthread_mutex_lock(&m_Mutex);
+	list.swap(view);
+	pthread_mutex_unlock(&m_Mutex);
 }
 
-bool User::isBlocking(const std::string &username) const {
-	for (int i=0; i<m_Blocked.size(); i++) {
-		if (m_Blocked[i]==username)
-			return true;
-	}
+User::ListView User::makeList(const std::vector<std::string> &list) {
+	List *ids=new List;
+	for (int i=0; i<list.size(); i++)
+		ids->insert(UserTable::instance()->intern(list[i]));
 
-	return false;
+	return ListView(ids);
 }
@@ -23,9 +23,13 @@
 #define USER_H
 
 #include <iostream>
+#include <pthread.h>
+#include <tr1/memory>
+#include <tr1/unordered_set>
 #include <vector>
 
 #include "protocol.h"
+#include "usertable.h"
 
 /**
  * A model for a connected user.
@@ -33,8 +37,25 @@
  * or her data is then loaded from the database and placed in a User object
  * for use in the lobby server operations. The required parameters are the
  * username (which must be unique) and password.
+ *
+ * Users are reference counted, since other threads may still be sending them
+ * packets after they disconnect. Whoever holds a pointer to a user beyond the
+ * scope of a single packet handler must take a reference with ref(), and give it
+ * up with unref(). The last reference deletes the user along with its protocol.
+ *
+ * The friend and blocked lists are kept as hash sets, since they are consulted for
+ * every recipient of every broadcast. They are never modified in place; updates
+ * swap in a new set, so a list handed out by getFriendList() or getBlockedList()
+ * stays valid and unchanged for as long as the caller holds on to it.
  */
 class User {
+	public:
+		/// A set of interned usernames.
+		typedef std::tr1::unordered_set<UserId> List;
+
+		/// A read-only, shared view of a list of users.
+		typedef std::tr1::shared_ptr<const List> ListView;
+
 	public:
 		/**
 		 * Creates a model for a generic user.
@@ -45,6 +66,16 @@ class User {
 		 */
 		User(const std::string &username, const std::string &password);
 
+		/**
+		 * Takes another reference to this user.
+		 */
+		void ref();
+
+		/**
+		 * Gives up a reference to this user, deleting it if none are left.
+		 */
+		void unref();
+
 		/**
 		 * Sets the email address for this user, if he/she has one.
 		 *
@@ -80,6 +111,27 @@ class User {
 		 */
 		std::string getUsername() const { return m_Username; }
 
+		/**
+		 * Returns the interned id of this user's username.
+		 *
+		 * @return The id identifying this user.
+		 */
+		UserId getId() const { return m_Id; }
+
+		/**
+		 * Sets the database key of this user.
+		 *
+		 * @param uid The user's uid in the database.
+		 */
+		void setUid(int uid) { m_Uid=uid; }
+
+		/**
+		 * Returns the database key of this user, resolved once at login.
+		 *
+		 * @return The user's uid in the database.
+		 */
+		int getUid() const { return m_Uid; }
+
 		/**
 		 * Returns the password for this user.
 		 *
@@ -103,52 +155,104 @@ class User {
 
 		/**
 		 * Sets this user's friend list.
+		 * Every username is interned, so the list should come from the database
+		 * rather than straight from a client.
 		 *
 		 * @param list A list of usernames.
 		 */
-		void setFriendList(const std::vector<std::string> &list) { m_Friends=list; }
+		void setFriendList(const std::vector<std::string> &list);
 
 		/**
 		 * Returns this user's friend list.
 		 *
-		 * @return A list of usernames.
+		 * @return A view of the set of user ids.
 		 */
-		std::vector<std::string> getFriendList() const { return m_Friends; }
+		ListView getFriendList() const;
+
+		/**
+		 * Adds a user to this user's friend list.
+		 *
+		 * @param id The user to add.
+		 */
+		void addFriend(UserId id);
 
 		/**
 		 * Sets this user's blocked user list.
+		 * Every username is interned, so the list should come from the database
+		 * rather than straight from a client.
 		 *
 		 * @param list A list of usernames.
 		 */
-		void setBlockedList(const std::vector<std::string> &list) { m_Blocked=list; }
+		void setBlockedList(const std::vector<std::string> &list);
 
 		/**
 		 * Returns this user's blocked user list.
 		 *
-		 * @return A list of usernames.
+		 * @return A view of the set of user ids.
+		 */
+		ListView getBlockedList() const;
+
+		/**
+		 * Adds a user to this user's blocked user list.
+		 *
+		 * @param id The user to add.
 		 */
-		std::vector<std::string> getBlockedList() const { return m_Blocked; }
+		void addBlocked(UserId id);
 
 		/**
 		 * Convenience method to determine if this user is friends with another.
 		 *
-		 * @param other The user in question.
+		 * @param id The user in question.
 		 * @return True if this user as the other as a friend, false otherwise.
 		 */
-		bool isFriendsWith(const std::string &username) const;
+		bool isFriendsWith(UserId id) const;
 
 		/**
 		 * Convenience method to determine if this user is blocking another.
 		 *
-		 * @param other The user in question.
+		 * @param id The user in question.
 		 * @return True if this user is blocking the other, false otherwise.
 		 */
-		bool isBlocking(const std::string &username) const;
+		bool isBlocking(UserId id) const;
 
 	private:
+		/**
+		 * Destroys the user's protocol. Use unref() instead of deleting users directly.
+		 */
+		~User();
+
+		/**
+		 * Atomically replaces one of the user's lists with a copy that also contains
+		 * the given username.
+		 *
+		 * @param list The list to extend.
+		 * @param id The user to add.
+		 */
+		void addToList(ListView &list, UserId id);
+
+		/**
+		 * Builds a list out of a set of usernames, interning each one.
+		 *
+		 * @param list A list of usernames.
+		 * @return The new list.
+		 */
+		static ListView makeList(const std::vector<std::string> &list);
+
+		/// Number of references held to this user.
+		int m_Refs;
+
+		/// Guards swapping the friend and blocked lists, which are read by other threads.
+		mutable pthread_mutex_t m_Mutex;
+
 		/// The user's username.
 		std::string m_Username;
 
+		/// The interned id of the user's username.
+		UserId m_Id;
+
+		/// The user's key in the database.
+		int m_Uid;
+
 		/// The user's password.
 		std::string m_Password;
 
@@ -162,10 +266,10 @@ class User {
 		Protocol *m_Protocol;
 
 		/// A cache of this user's friend list.
-		std::vector<std::string> m_Friends;
+		ListView m_Friends;
 
 		/// A cache of this user's blocked user list.
-		std::vector<std::string> m_Blocked;
+		ListView m_Blocked;
 };
 
 #endif
@@ -19,171 +19,192 @@
  ***************************************************************************/
 // usermanager.cpp: implementation of the UserManager class.
 
+#include <algorithm>
+#include <unistd.h>
+
+#include "dbexecutor.h"
 #include "dbmysql.h"
+#include "profilecache.h"
+#include "serverpool.h"
 #include "usermanager.h"
 
 // global instance of the user manager
 UserManager *g_Manager=NULL;
 
+// orders rooms by their id numbers
+static bool compareRooms(const Room &a, const Room &b) {
+	return a.getGid()<b.getGid();
+}
+
 UserManager::UserManager() {
-	pthread_mutex_init(&m_Mutex, NULL);
+	for (int i=0; i<USERMANAGER_SHARDS; i++)
+		pthread_mutex_init(&m_Shards[i].mutex, NULL);
+
+	pthread_mutex_init(&m_RoomMutex, NULL);
+	pthread_mutex_init(&m_FlagMutex, NULL);
+	m_NextGid=1;
 
 	g_Manager=this;
 }
 
 UserManager::~UserManager() {
-	pthread_mutex_destroy(&m_Mutex);
+	for (int i=0; i<USERMANAGER_SHARDS; i++)
+		pthread_mutex_destroy(&m_Shards[i].mutex);
+
+	pthread_mutex_destroy(&m_RoomMutex);
+	pthread_mutex_destroy(&m_FlagMutex);
 }
 
 UserManager* UserManager::instance() {
 	return g_Manager;
 }
 
+void UserManager::start() throw(UserManager::Exception) {
+	if (pthread_create(&m_FlagThread, NULL, &UserManager::flagProcess, this)!=0)
+		throw UserManager::Exception("Unable to start online flag thread.");
+}
+
 void UserManager::addUser(User *user) {
-	pthread_mutex_lock(&m_Mutex);
+	Shard *shard=getShard(user->getId());
+
+	// the registry holds its own reference for as long as the user is online
+	user->ref();
+
+	pthread_mutex_lock(&shard->mutex);
 
-	// hash the user by his username
-	m_UserMap[user->getUsername()]=user;
+	// hash the user by his id, replacing a stale login if there is one
+	User *&slot=shard->users[user->getId()];
+	User *stale=slot;
+	slot=user;
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	if (stale)
+		stale->unref();
 
 	// now let all the other users know that this user has logged in
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
+	std::vector<User*> users;
+	snapshot(users);
+
+	for (int i=0; i<users.size(); i++) {
+		User *other=users[i];
 
 		// check if this other user is being blocked by the newly logged in user
-		bool ignore=user->isBlocking(other->getUsername());
+		bool ignore=user->isBlocking(other->getId());
 
 		// ignore the other user is not being blocked, inform him that we just logged in
 		if (!ignore) {
 			Protocol::UserStatus relation=Protocol::UserNone;
-			if (other->isBlocking(user->getUsername())) relation=Protocol::UserBlocked;
-			else if (other->isFriendsWith(user->getUsername())) relation=Protocol::UserFriend;
+			if (other->isBlocking(user->getId())) relation=Protocol::UserBlocked;
+			else if (other->isFriendsWith(user->getId())) relation=Protocol::UserFriend;
 
 			other->getProtocol()->sendUserLoggedIn(user, relation);
 		}
 
 		// now check if the other user is blocking THIS user
-		ignore=false;
-		for (int i=0; i<other->getBlockedList().size(); i++) {
-			if (other->getBlockedList()[i]==user->getUsername())
-				ignore=true;
-		}
+		ignore=other->isBlocking(user->getId());
 
 		// finally if we are not being blocked, inform us that this other user is online
 		if (other!=user && !ignore) {
 			Protocol::UserStatus relation=Protocol::UserNone;
-			if (user->isBlocking(other->getUsername())) relation=Protocol::UserBlocked;
-			else if (user->isFriendsWith(other->getUsername())) relation=Protocol::UserFriend;
+			if (user->isBlocking(other->getId())) relation=Protocol::UserBlocked;
+			else if (user->isFriendsWith(other->getId())) relation=Protocol::UserFriend;
 			user->getProtocol()->sendUserLoggedIn(other, relation);
 		}
 	}
 
-	// flag the user as online
-	try {
-		pDBMySQL db=DBMySQL::synthesize();
-		db->flagUserOnline(user->getUsername(), true);
-		db->disconnect();
-	}
-
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to flag user as online: " << ex.getMessage() << std::endl;
-	}
+	release(users);
 
-	pthread_mutex_unlock(&m_Mutex);
+	// flag the user as online
+	flagUserOnline(user->getUid(), true);
 }
 
 void UserManager::removeUser(User *user) {
-	pthread_mutex_lock(&m_Mutex);
+	Shard *shard=getShard(user->getId());
+	bool found=false;
 
-	// remove the user from the hash map
-	m_UserMap.erase(user->getUsername());
+	pthread_mutex_lock(&shard->mutex);
 
-	// send all other users a message that this user logged out
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
-		other->getProtocol()->sendUserLoggedOut(user);
+	// remove the user from the hash map, unless he has since logged in again
+	std::tr1::unordered_map<UserId, User*>::iterator it=shard->users.find(user->getId());
+	if (it!=shard->users.end() && (*it).second==user) {
+		shard->users.erase(it);
+		found=true;
 	}
 
-	// flag the user as offline
-	try {
-		pDBMySQL db=DBMySQL::synthesize();
-		db->flagUserOnline(user->getUsername(), false);
-		db->disconnect();
-	}
+	pthread_mutex_unlock(&shard->mutex);
 
-	catch (const DBMySQL::Exception &ex) {
-		std::cout << "Unable to flag user as online: " << ex.getMessage() << std::endl;
-	}
+	if (!found)
+		return;
+
+	// send all other users a message that this user logged out
+	std::vector<User*> users;
+	snapshot(users);
+
+	for (int i=0; i<users.size(); i++)
+		users[i]->getProtocol()->sendUserLoggedOut(user);
+
+	release(users);
+
+	// flag the user as offline, and save any profile edits still held in memory
+	flagUserOnline(user->getUid(), false);
+	ProfileCache::instance()->evict(user->getId());
 
-	pthread_mutex_unlock(&m_Mutex);
+	user->unref();
 }
 
-UserManager::UserActivity UserManager::isUserActive(const std::string &username) {
-	pthread_mutex_lock(&m_Mutex);
+UserManager::UserActivity UserManager::isUserActive(UserId id) {
+	UserActivity activity=Idle;
 
-	// first check the open game rooms
-	for (std::map<int, Room*>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it) {
-		// check who's the owner
-		Room *room=(*it).second;
-		if (room->getOwner()==username) {
-			pthread_mutex_unlock(&m_Mutex);
-			return RoomOwner;
-		}
+	pthread_mutex_lock(&m_RoomMutex);
 
-		// now check if the user is a participant
-		for (int i=0; i<room->getPlayers().size(); i++) {
-			if (room->getPlayers()[i]==username) {
-				pthread_mutex_unlock(&m_Mutex);
-				return Participant;
-			}
-		}
-	}
+	// owners also play in their own rooms, so check ownership first
+	if (m_Owners.find(id)!=m_Owners.end())
+		activity=RoomOwner;
 
-	pthread_mutex_unlock(&m_Mutex);
+	else if (m_Participants.find(id)!=m_Participants.end())
+		activity=Participant;
 
-	return Idle;
+	pthread_mutex_unlock(&m_RoomMutex);
+
+	return activity;
 }
 
-void UserManager::broadcastChatMessage(const std::string &user, const std::string &message) {
-	pthread_mutex_lock(&m_Mutex);
+void UserManager::broadcastChatMessage(UserId user, const std::string &message) {
+	User *sender=getOnlineUser(user);
+	if (!sender)
+		return;
 
-	User *sender=m_UserMap[user];
+	std::string name=sender->getUsername();
 
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
+	std::vector<User*> users;
+	snapshot(users);
 
-		// if this user is on the target user's blocked list, don't sent him the chat message
-		bool ignore=false;
-		for (int i=0; i<other->getBlockedList().size(); i++) {
-			// make sure the other user is not blocking the sender
-			if (other->getBlockedList()[i]==user)
-				ignore=true;
-		}
+	for (int i=0; i<users.size(); i++) {
+		User *other=users[i];
 
-		// if the sender is blocking the recipient, don't send him the message either
-		for (int i=0; i<sender->getBlockedList().size(); i++) {
-			if (sender->getBlockedList()[i]==other->getUsername())
-				ignore=true;
-		}
+		// if this user is on the target user's blocked list, don't sent him the chat message;
+		// and if the sender is blocking the recipient, don't send him the message either
+		bool ignore=(other->isBlocking(user) || sender->isBlocking(other->getId()));
 
 		// if all checks out, send the recepient the chat message
 		if (!ignore)
-			other->getProtocol()->sendChatMessage(user, message);
+			other->getProtocol()->sendChatMessage(name, message);
 	}
 
-	pthread_mutex_unlock(&m_Mutex);
+	release(users);
+	sender->unref();
 }
 
-void UserManager::sendUserStatusUpdate(const std::string &user, const std::string &target, bool online) {
-	pthread_mutex_lock(&m_Mutex);
-
+void UserManager::sendUserStatusUpdate(UserId user, UserId target, bool online) {
 	// see if the user is online at this point
-	User *toWhom=m_UserMap[user];
-	User *targetUser=m_UserMap[target];
+	User *toWhom=getOnlineUser(user);
+	User *targetUser=getOnlineUser(target);
 	if (toWhom && targetUser) {
 		if (online) {
 			Protocol::UserStatus relation=Protocol::UserNone;
-			if (toWhom->isBlocking(targetUser->getUsername())) relation=Protocol::UserBlocked;
-			else if (toWhom->isFriendsWith(targetUser->getUsername())) relation=Protocol::UserFriend;
+			if (toWhom->isBlocking(target)) relation=Protocol::UserBlocked;
+			else if (toWhom->isFriendsWith(target)) relation=Protocol::UserFriend;
 			toWhom->getProtocol()->sendUserLoggedIn(targetUser, relation);
 		}
 
@@ -191,175 +212,353 @@ void UserManager::sendUserStatusUpdate(const std::string &user, const std::strin
 			toWhom->getProtocol()->sendUserLoggedOut(targetUser);
 	}
 
-	pthread_mutex_unlock(&m_Mutex);
+	if (toWhom)
+		toWhom->unref();
+	if (targetUser)
+		targetUser->unref();
 }
 
-void UserManager::sendRoomList(const std::string &user) {
-	pthread_mutex_lock(&m_Mutex);
+void UserManager::sendRoomList(UserId user) {
+	User *toWhom=getOnlineUser(user);
+	if (!toWhom)
+		return;
 
-	User *toWhom=m_UserMap[user];
-	if (toWhom) {
-		std::vector<Room*> list;
-		for (std::map<int, Room*>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it)
-			list.push_back((*it).second);
+	// copy the rooms so they can be sent without holding the lock
+	std::vector<Room> rooms;
 
-		toWhom->getProtocol()->sendRoomList(list);
-	}
+	pthread_mutex_lock(&m_RoomMutex);
+	for (std::tr1::unordered_map<int, Room*>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it)
+		rooms.push_back(*(*it).second);
+	pthread_mutex_unlock(&m_RoomMutex);
 
-	pthread_mutex_unlock(&m_Mutex);
-}
+	// rooms are hashed in no particular order, but clients expect them sorted
+	std::sort(rooms.begin(), rooms.end(), compareRooms);
 
-int UserManager::registerGameRoom(const std::string &owner, const std::string &password, bool friendsOnly, const Room::Rules &rules, const std::string &host, int port) {
-	pthread_mutex_lock(&m_Mutex);
+	std::vector<Room*> list;
+	for (int i=0; i<rooms.size(); i++)
+		list.push_back(&rooms[i]);
+
+	toWhom->getProtocol()->sendRoomList(list);
+	toWhom->unref();
+}
 
+int UserManager::registerGameRoom(UserId owner, const std::string &password, bool friendsOnly, const Room::Rules &rules, const std::string &host, int port) {
 	// determine the type of room
 	Room::Type roomType;
 	if (password.empty()) roomType=Room::Public;
 	else roomType=Room::Private;
 
-	// find the lowest possible id number
-	int gid=1;
-	while(1) {
-		bool found=false;
-
-		for (std::map<int, Room*>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it) {
-			if ((*it).second->getGid()==gid)
-				found=true;
-		}
-
-		if (found)
-			gid++;
+	pthread_mutex_lock(&m_RoomMutex);
 
-		else if (!found)
-			break;
+	// reuse the id number of a closed room if there is one
+	int gid;
+	if (!m_FreeGids.empty()) {
+		gid=m_FreeGids.back();
+		m_FreeGids.pop_back();
 	}
 
+	else
+		gid=m_NextGid++;
+
 	Room *room=new Room(gid, owner, roomType, password, friendsOnly);
 	room->setStatus(Room::Open);
 	room->setRules(rules);
 	room->setConnectionInfo(host, port);
 	m_Rooms[gid]=room;
+	m_Owners[owner]=gid;
+
+	// the room may change as soon as we let go of the lock
+	Room update=*room;
+
+	pthread_mutex_unlock(&m_RoomMutex);
 
 	// now alert all clients
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
-		other->getProtocol()->sendRoomUpdate(room);
-	}
+	std::vector<User*> users;
+	snapshot(users);
+
+	for (int i=0; i<users.size(); i++)
+		users[i]->getProtocol()->sendRoomUpdate(&update);
 
-	pthread_mutex_unlock(&m_Mutex);
+	release(users);
 
 	return gid;
 }
 
-void UserManager::unregisterGameRoom(int gid) {
-	pthread_mutex_lock(&m_Mutex);
+bool UserManager::moveGameRoom(int gid, const std::string &host, int port, const std::string &fromHost, int fromPort) {
+	pthread_mutex_lock(&m_RoomMutex);
+
+	std::tr1::unordered_map<int, Room*>::iterator it=m_Rooms.find(gid);
+	if (it==m_Rooms.end()) {
+		pthread_mutex_unlock(&m_RoomMutex);
+		return false;
+	}
+
+	// make sure the room lives where the caller thinks it does
+	if (!fromHost.empty()) {
+		std::string roomHost;
+		int roomPort;
+		(*it).second->getConnectionInfo(roomHost, roomPort);
 
-	if (m_Rooms.find(gid)==m_Rooms.end()) {
-		pthread_mutex_unlock(&m_Mutex);
+		if (roomHost!=fromHost || roomPort!=fromPort) {
+			pthread_mutex_unlock(&m_RoomMutex);
+			return false;
+		}
+	}
+
+	(*it).second->setConnectionInfo(host, port);
+
+	pthread_mutex_unlock(&m_RoomMutex);
+
+	return true;
+}
+
+void UserManager::unregisterGameRoom(int gid, const std::string &host, int port) {
+	pthread_mutex_lock(&m_RoomMutex);
+
+	std::tr1::unordered_map<int, Room*>::iterator it=m_Rooms.find(gid);
+	if (it==m_Rooms.end()) {
+		pthread_mutex_unlock(&m_RoomMutex);
+		return;
+	}
+
+	Room *room=(*it).second;
+
+	std::string roomHost;
+	int roomPort;
+	room->getConnectionInfo(roomHost, roomPort);
+
+	// make sure the room lives where the caller thinks it does
+	if (!host.empty() && (roomHost!=host || roomPort!=port)) {
+		pthread_mutex_unlock(&m_RoomMutex);
 		return;
 	}
 
 	// remove the given room
-	Room *room=m_Rooms[gid];
-	m_Rooms.erase(gid);
+	m_Rooms.erase(it);
+
+	// its owner and players are free to start or join other rooms
+	m_Owners.erase(room->getOwner());
+
+	const std::vector<UserId> &players=room->getPlayers();
+	for (int i=0; i<players.size(); i++) {
+		m_Participants.erase(players[i]);
+
+		// the game is over, so the statistics of those who played have changed
+		ProfileCache::instance()->invalidateStatistics(players[i]);
+	}
+
+	ProfileCache::instance()->invalidateStatistics(room->getOwner());
+
+	m_FreeGids.push_back(gid);
+
+	pthread_mutex_unlock(&m_RoomMutex);
+
+	// the game server it was on has room for another one
+	ServerPool::instance()->releaseRoom(roomHost, roomPort);
 
 	delete room;
 
 	// inform the clients
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
-		other->getProtocol()->sendRoomDelete(gid);
-	}
+	std::vector<User*> users;
+	snapshot(users);
+
+	for (int i=0; i<users.size(); i++)
+		users[i]->getProtocol()->sendRoomDelete(gid);
 
-	pthread_mutex_unlock(&m_Mutex);
+	release(users);
 }
 
-bool UserManager::joinGameRoom(int gid, const std::string &username, const std::string &password,
+bool UserManager::joinGameRoom(int gid, UserId user, const std::string &password,
 							   std::string &host, int &port, std::string &error) {
-	pthread_mutex_lock(&m_Mutex);
+	pthread_mutex_lock(&m_RoomMutex);
 
 	// we must check all conditions... first, does this room even exist?
-	if (m_Rooms.find(gid)==m_Rooms.end()) {
+	std::tr1::unordered_map<int, Room*>::iterator it=m_Rooms.find(gid);
+	if (it==m_Rooms.end()) {
 		error="There is no such room with the given id number.";
-		pthread_mutex_unlock(&m_Mutex);
+		pthread_mutex_unlock(&m_RoomMutex);
 		return false;
 	}
 
-	Room *room=m_Rooms[gid];
+	Room *room=(*it).second;
 
-	// make sure people who are already in the room don't join it again
-	std::vector<std::string> players=room->getPlayers();
-	for (int i=0; i<players.size(); i++) {
-		if (players[i]==username) {
+	// make sure people who are already in the room don't join it again, and that
+	// users don't join multiple rooms either
+	std::tr1::unordered_map<UserId, int>::iterator joined=m_Participants.find(user);
+	if (joined!=m_Participants.end()) {
+		if ((*joined).second==gid)
 			error="You are already part of this game room.";
-			pthread_mutex_unlock(&m_Mutex);
-			return false;
-		}
-	}
-
-	// users cannot join multiple rooms either
-	for (std::map<int, Room*>::iterator it=m_Rooms.begin(); it!=m_Rooms.end(); ++it) {
-		if ((*it).second==room)
-			continue;
+		else
+			error="You cannot join more than one game room.";
 
-		for (int i=0; i<(*it).second->getPlayers().size(); i++) {
-			if ((*it).second->getPlayers()[i]==username) {
-				error="You cannot join more than one game room.";
-				pthread_mutex_unlock(&m_Mutex);
-				return false;
-			}
-		}
+		pthread_mutex_unlock(&m_RoomMutex);
+		return false;
 	}
 
 	// ok, now is this room friends-only?
-	User *owner=getOnlineUser(room->getOwner());
-	if (room->isFriendsOnly() && (owner && owner->getUsername()!=username && !owner->isFriendsWith(username))) {
-		error="Only friends of the room owner may join.";
-		pthread_mutex_unlock(&m_Mutex);
-		return false;
+	if (room->isFriendsOnly()) {
+		User *owner=getOnlineUser(room->getOwner());
+		bool denied=(owner && owner->getId()!=user && !owner->isFriendsWith(user));
+
+		if (owner)
+			owner->unref();
+
+		if (denied) {
+			error="Only friends of the room owner may join.";
+			pthread_mutex_unlock(&m_RoomMutex);
+			return false;
+		}
 	}
 
 	// is the room full already?
 	if (room->getPlayers().size()==4) {
 		error="This room is already full.";
-		pthread_mutex_unlock(&m_Mutex);
+		pthread_mutex_unlock(&m_RoomMutex);
 		return false;
 	}
 
 	// does it have an owner-defined password?
 	if (room->getPassword()!=password) {
 		error="Incorrect room password.";
-		pthread_mutex_unlock(&m_Mutex);
+		pthread_mutex_unlock(&m_RoomMutex);
 		return false;
 	}
 
 	// if we're still here, then that means the user can join the room
-	room->addPlayer(username);
+	room->addPlayer(user);
+	m_Participants[user]=gid;
 	room->getConnectionInfo(host, port);
 
+	Room update=*room;
+
+	pthread_mutex_unlock(&m_RoomMutex);
+
 	// alert all clients of the room update
-	for (std::map<std::string, User*>::iterator it=m_UserMap.begin(); it!=m_UserMap.end(); ++it) {
-		User *other=(*it).second;
-		other->getProtocol()->sendRoomUpdate(room);
-	}
+	std::vector<User*> users;
+	snapshot(users);
+
+	for (int i=0; i<users.size(); i++)
+		users[i]->getProtocol()->sendRoomUpdate(&update);
 
-	pthread_mutex_unlock(&m_Mutex);
+	release(users);
 
 	return true;
 }
 
 
-bool UserManager::joinGameRoom(int gid, const std::string &username, const std::string &password, std::string &error) {
+bool UserManager::joinGameRoom(int gid, UserId user, const std::string &password, std::string &error) {
 	std::string host;
 	int port;
 
-	return joinGameRoom(gid, username, password, host, port, error);
+	return joinGameRoom(gid, user, password, host, port, error);
+}
+
+UserManager::Shard* UserManager::getShard(UserId id) {
+	// ids are handed out sequentially, so they spread evenly on their own
+	return &m_Shards[id % USERMANAGER_SHARDS];
+}
+
+User* UserManager::getOnlineUser(UserId id) {
+	Shard *shard=getShard(id);
+	User *user=NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	std::tr1::unordered_map<UserId, User*>::iterator it=shard->users.find(id);
+	if (it!=shard->users.end()) {
+		user=(*it).second;
+		user->ref();
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return user;
+}
+
+void UserManager::snapshot(std::vector<User*> &list) {
+	// each shard is locked only long enough to copy it
+	for (int i=0; i<USERMANAGER_SHARDS; i++) {
+		Shard *shard=&m_Shards[i];
+
+		pthread_mutex_lock(&shard->mutex);
+
+		for (std::tr1::unordered_map<UserId, User*>::iterator it=shard->users.begin(); it!=shard->users.end(); ++it) {
+			(*it).second->ref();
+			list.push_back((*it).second);
+		}
+
+		pthread_mutex_unlock(&shard->mutex);
+	}
 }
 
-User* UserManager::getOnlineUser(const std::string &username) const {
-	std::map<std::string, User*>::const_iterator it=m_UserMap.find(username);
-	if (it==m_UserMap.end())
-		return NULL;
+void UserManager::release(std::vector<User*> &list) {
+	for (int i=0; i<list.size(); i++)
+		list[i]->unref();
+
+	list.clear();
+}
+
+/**
+ * Records which users came online or went offline in the database.
+ */
+class FlagOnlineTask: public DBExecutor::Task {
+	public:
+		FlagOnlineTask(const void *strand): DBExecutor::Task(strand) { }
+
+		void run(DBMySQL *db) throw(DBMySQL::Exception) {
+			db->flagUsersOnline(m_Online, m_Offline);
+		}
+
+		void fail(const DBMySQL::Exception &ex) {
+			std::cout << "Unable to flag users as online: " << ex.getMessage() << std::endl;
+		}
+
+		void add(int uid, bool online) {
+			(online ? m_Online : m_Offline).push_back(uid);
+		}
 
-	return (*it).second;
+	private:
+		/// Users who are now online.
+		std::vector<int> m_Online;
+
+		/// Users who are now offline.
+		std::vector<int> m_Offline;
+};
+
+void UserManager::flagUserOnline(int uid, bool online) {
+	pthread_mutex_lock(&m_FlagMutex);
+
+	// only the latest transition of each user needs to be written
+	m_Flags[uid]=online;
+
+	pthread_mutex_unlock(&m_FlagMutex);
+}
+
+void* UserManager::flagProcess(void *arg) {
+	UserManager *manager=(UserManager*) arg;
+	manager->flushFlags();
+
+	pthread_exit(0);
+}
+
+void UserManager::flushFlags() {
+	while(1) {
+		sleep(USERMANAGER_FLAG_INTERVAL);
+
+		std::tr1::unordered_map<int, bool> flags;
+
+		pthread_mutex_lock(&m_FlagMutex);
+		m_Flags.swap(flags);
+		pthread_mutex_unlock(&m_FlagMutex);
+
+		if (flags.empty())
+			continue;
+
+		// batches run on a strand of their own, so an older one never lands after a newer one
+		FlagOnlineTask *task=new FlagOnlineTask(&m_Flags);
+		for (std::tr1::unordered_map<int, bool>::iterator it=flags.begin(); it!=flags.end(); ++it)
+			task->add((*it).first, (*it).second);
+
+		DBExecutor::instance()->submit(task);
+	}
 }
@@ -23,17 +23,63 @@
 #define USERMANAGER_H
 
 #include <iostream>
-#include <map>
 #include <pthread.h>
+#include <stdint.h>
+#include <tr1/unordered_map>
+#include <vector>
 
 #include "room.h"
 #include "user.h"
+#include "usertable.h"
 
+/// Number of independently locked partitions of the online user registry.
+#define USERMANAGER_SHARDS	16
+
+/// Seconds between writes of online flags to the database.
+#define USERMANAGER_FLAG_INTERVAL	1
+
+/**
+ * Registry of online users and open game rooms.
+ * Users are spread across several shards by their interned id, each with
+ * its own lock, so logins, logouts and lookups of unrelated users don't contend
+ * with each other. Rooms are kept separately under a lock of their own, along with
+ * an index of which room each user owns or plays in.
+ *
+ * Locks are only ever held while touching the maps themselves. Broadcasts first take
+ * a referenced snapshot of the recipients and then send to them with no lock held,
+ * and database updates are likewise done outside of any lock. If both are needed,
+ * the room lock must be taken before a shard lock.
+ *
+ * Logins and logouts don't touch the database directly. The latest transition of
+ * each user is queued, and a background thread writes all queued transitions as one
+ * batch every second, so a storm of reconnects costs a handful of queries. Flags
+ * still in the queue when the server dies are cleaned up by DBMySQL::prepare() on
+ * the next start, which flags everyone as offline.
+ */
 class UserManager {
 	public:
 		/// Determines a user's activity.
 		enum UserActivity { RoomOwner, Participant, Idle };
 
+		/**
+		 * A general exception for user manager problems.
+		 */
+		class Exception {
+			public:
+				/// Default constructor for user manager exceptions.
+				Exception(const std::string &msg): m_Message(msg) { };
+
+				/**
+				 * Returns the reason for this exception.
+				 * @return Message string
+				 */
+				std::string getMessage() const { return m_Message; }
+
+			private:
+				/// The message for this exception.
+				std::string m_Message;
+		};
+
 	public:
 		/// Default constructor.
 		UserManager();
@@ -51,6 +97,12 @@ class UserManager {
 		 */
 		static UserManager* instance();
 
+		/**
+		 * Starts the thread writing online flags to the database.
+		 * @throw A UserManager::Exception if an error occurs.
+		 */
+		void start() throw(UserManager::Exception);
+
 		/**
 		 * Adds a user to the management pool.
 		 *
@@ -68,10 +120,10 @@ class UserManager {
 		/**
 		 * Determines if a user is the owner of a room, a participant, or idle.
 		 *
-		 * @param username The user to test.
+		 * @param id The user to test.
 		 * @return An activity code.
 		 */
-		UserActivity isUserActive(const std::string &username);
+		UserActivity isUserActive(UserId id);
 
 		/**
 		 * Sends a chat message to all clients from another user.
@@ -79,7 +131,7 @@ class UserManager {
 		 * @param user The user who sent the message.
 		 * @param message The contents of the message.
 		 */
-		void broadcastChatMessage(const std::string &user, const std::string &message);
+		void broadcastChatMessage(UserId user, const std::string &message);
 
 		/**
 		 * Sends the target user a status update about another use.
@@ -88,14 +140,14 @@ class UserManager {
 		 * @param target The user whose status we are concerned about.
 		 * @param online True if the target is online, false otherwise.
 		 */
-		void sendUserStatusUpdate(const std::string &user, const std::string &target, bool online);
+		void sendUserStatusUpdate(UserId user, UserId target, bool online);
 
 		/**
 		 * Sends the target user a list of current rooms.
 		 *
 		 * @param user The user to whom the list should be sent.
 		 */
-		void sendRoomList(const std::string &user);
+		void sendRoomList(UserId user);
 
 		/**
 		 * Opens a new game room with the given parameters, and sends an update to all clients.
@@ -108,15 +160,32 @@ class UserManager {
 		 * @param port The port of the hosting game server.
 		 * @return The assigned id number for this room
 		 */
-		int registerGameRoom(const std::string &owner, const std::string &password, bool friendsOnly,
+		int registerGameRoom(UserId owner, const std::string &password, bool friendsOnly,
 							 const Room::Rules &rules, const std::string &host, int port);
 
+		/**
+		 * Moves a game room to another game server.
+		 * If a current game server is given, the room is only moved if it still lives there.
+		 *
+		 * @param gid The target room's id number.
+		 * @param host The hostname/IP address of the new game server.
+		 * @param port The port of the new game server.
+		 * @param fromHost The hostname/IP address of the room's current game server, if any.
+		 * @param fromPort The port of that game server.
+		 * @return true if the room was moved, false otherwise.
+		 */
+		bool moveGameRoom(int gid, const std::string &host, int port, const std::string &fromHost="", int fromPort=0);
+
 		/**
 		 * Unregisters and removes the game room with the given id.
+		 * If a game server is given, the room is only removed if it lives on that server,
+		 * so a server that gave up on a room which was since moved elsewhere can't close it.
 		 *
 		 * @param gid The target room's id number.
+		 * @param host The hostname/IP address of the game server reporting the room, if any.
+		 * @param port The port of that game server.
 		 */
-		void unregisterGameRoom(int gid);
+		void unregisterGameRoom(int gid, const std::string &host="", int port=0);
 
 		/**
 		 * Attempts to join the given user to the game room with id number gid.
@@ -125,14 +194,14 @@ class UserManager {
 		 * what went wrong. Otherwise, only the host and port arguments will be set on success.
 		 *
 		 * @param gid The room id number.
-		 * @param username The user who wishes to join.
+		 * @param user The user who wishes to join.
 		 * @param password The room password.
 		 * @param host This gets set to the hosting game server's hostname/IP address.
 		 * @param port This gets set to the hosting game server's port.
 		 * @param error This gets set to a description of an error if this method fails.
 		 * @return true if the user joined the room, false otherwise.
 		 */
-		bool joinGameRoom(int gid, const std::string &username, const std::string &password,
+		bool joinGameRoom(int gid, UserId user, const std::string &password,
 						  std::string &host, int &port, std::string &error);
 
 		/**
@@ -140,30 +209,105 @@ class UserManager {
 		 * details about the game server hosting the room.
 		 *
 		 * @param gid The room id number.
-		 * @param username The user who wishes to join.
+		 * @param user The user who wishes to join.
 		 * @param password The room password.
 		 * @param error This gets set to a description of an error if this method fails.
 		 * @return true if the user joined the room, false otherwise.
 		 */
-		bool joinGameRoom(int gid, const std::string &username, const std::string &password, std::string &error);
+		bool joinGameRoom(int gid, UserId user, const std::string &password, std::string &error);
 
 	private:
+		/// A partition of the online users.
+		struct Shard {
+			/// Map of users, hashed according to their ids.
+			std::tr1::unordered_map<UserId, User*> users;
+
+			/// Guards the map of users.
+			pthread_mutex_t mutex;
+		};
+
+		/**
+		 * Returns the shard a user belongs to.
+		 *
+		 * @param id The user in question.
+		 * @return The shard responsible for this user.
+		 */
+		Shard* getShard(UserId id);
+
 		/**
 		 * Finds the specified user and returns a pointer to his object if he's online.
+		 * The returned user is referenced, and must be released with unref().
 		 *
-		 * @param username The user to find.
+		 * @param id The user to find.
 		 * @return A pointer to a User object, or NULL if the user is not online.
 		 */
-		User* getOnlineUser(const std::string &username) const;
+		User* getOnlineUser(UserId id);
 
-		/// Map of users, hashed according to their usernames.
-		std::map<std::string, User*> m_UserMap;
+		/**
+		 * Takes a referenced snapshot of all online users, to be broadcasted to once all
+		 * locks are released.
+		 *
+		 * @param list The vector to fill with users.
+		 */
+		void snapshot(std::vector<User*> &list);
+
+		/**
+		 * Releases the references taken by snapshot().
+		 *
+		 * @param list The users to release.
+		 */
+		void release(std::vector<User*> &list);
+
+		/**
+		 * Queues a database update to reflect whether or not a user is online.
+		 * Only the latest update queued for a user is written.
+		 *
+		 * @param uid The database key of the user in question.
+		 * @param online True if the user is online, false otherwise.
+		 */
+		void flagUserOnline(int uid, bool online);
+
+		/**
+		 * Entry point for the online flag thread.
+		 *
+		 * @param arg Pointer to the user manager.
+		 */
+		static void* flagProcess(void *arg);
+
+		/**
+		 * Writes queued online flags every second, until the process exits.
+		 */
+		void flushFlags();
+
+		/// The partitions of online users.
+		Shard m_Shards[USERMANAGER_SHARDS];
 
 		/// Map of current rooms, hashed according to their id numbers.
-		std::map<int, Room*> m_Rooms;
+		std::tr1::unordered_map<int, Room*> m_Rooms;
+
+		/// Map of room owners to the id numbers of their rooms.
+		std::tr1::unordered_map<UserId, int> m_Owners;
+
+		/// Map of players to the id numbers of the rooms they joined.
+		std::tr1::unordered_map<UserId, int> m_Participants;
+
+		/// Id numbers of closed rooms, to be handed out again.
+		std::vector<int> m_FreeGids;
+
+		/// The lowest id number that was never handed out.
+		int m_NextGid;
+
+		/// Guards the map of rooms.
+		pthread_mutex_t m_RoomMutex;
+
+		/// Online flags waiting to be written, by uid.
+		std::tr1::unordered_map<int, bool> m_Flags;
+
+		/// Guards the queued online flags.
+		pthread_mutex_t m_FlagMutex;
 
-		/// Synchronization variables.
-		pthread_mutex_t m_Mutex;
+		/// The online flag thread.
+		pthread_t m_FlagThread;
 };
 
 #endif
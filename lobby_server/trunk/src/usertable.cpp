@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// usertable.cpp: implementation of the UserTable class.
+
+#include "usertable.h"
+
+// global instance of the username table
+UserTable *g_UserTable=NULL;
+
+const UserId UserTable::None;
+
+UserTable::UserTable() {
+	pthread_rwlock_init(&m_Lock, NULL);
+
+	// reserve the first slot for None
+	m_Names.push_back(std::string());
+
+	g_UserTable=this;
+}
+
+UserTable::~UserTable() {
+	pthread_rwlock_destroy(&m_Lock);
+}
+
+UserTable* UserTable::instance() {
+	return g_UserTable;
+}
+
+UserId UserTable::intern(const std::string &username) {
+	UserId id=find(username);
+	if (id!=None)
+		return id;
+
+	pthread_rwlock_wrlock(&m_Lock);
+
+	// someone else may have beaten us to it while we weren't holding the lock
+	std::tr1::unordered_map<std::string, UserId>::iterator it=m_Ids.find(username);
+	if (it!=m_Ids.end())
+		id=(*it).second;
+
+	else {
+		id=m_Names.size();
+		m_Names.push_back(username);
+		m_Ids[username]=id;
+	}
+
+	pthread_rwlock_unlock(&m_Lock);
+
+	return id;
+}
+
+UserId UserTable::find(const std::string &username) {
+	UserId id=None;
+
+	pthread_rwlock_rdlock(&m_Lock);
+
+	std::tr1::unordered_map<std::string, UserId>::iterator it=m_Ids.find(username);
+	if (it!=m_Ids.end())
+		id=(*it).second;
+
+	pthread_rwlock_unlock(&m_Lock);
+
+	return id;
+}
+
+const std::string& UserTable::lookup(UserId id) {
+	pthread_rwlock_rdlock(&m_Lock);
+
+	const std::string &username=m_Names[id];
+
+	pthread_rwlock_unlock(&m_Lock);
+
+	return username;
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by the Tyranny Development Team                    *
+ *   http://tyranny.sf.net                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// usertable.h: definition of the UserTable class.
+
+#ifndef USERTABLE_H
+#define USERTABLE_H
+
+#include <deque>
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <tr1/unordered_map>
+
+/// A dense number standing in for a username within this process.
+typedef uint32_t UserId;
+
+/**
+ * Interns usernames as small integers.
+ * The lobby compares, hashes and stores usernames far more often than it prints
+ * them, so every username is assigned a UserId the first time it is seen, and the
+ * id is used in its place from then on. Only when a username has to go out over the
+ * wire is it turned back into a string.
+ *
+ * Ids are never reused or forgotten, which keeps them valid without any reference
+ * counting. The table only grows by the number of distinct usernames the process
+ * ever comes across.
+ */
+class UserTable {
+	public:
+		/// The id that is never assigned to any username.
+		static const UserId None=0;
+
+	public:
+		/// Default constructor.
+		UserTable();
+
+		/// Frees memory associated with this object.
+		~UserTable();
+
+		/**
+		 * Returns the global username table.
+		 *
+		 * @return A pointer to a UserTable object.
+		 */
+		static UserTable* instance();
+
+		/**
+		 * Returns the id of a username, assigning it one if it has none yet.
+		 *
+		 * @param username The username to intern.
+		 * @return The id of the username.
+		 */
+		UserId intern(const std::string &username);
+
+		/**
+		 * Returns the id of a username, without assigning one.
+		 *
+		 * @param username The username to look up.
+		 * @return The id of the username, or None if it was never interned.
+		 */
+		UserId find(const std::string &username);
+
+		/**
+		 * Returns the username an id was assigned to.
+		 * The returned reference stays valid for the lifetime of the table.
+		 *
+		 * @param id An id returned by intern().
+		 * @return The username.
+		 */
+		const std::string& lookup(UserId id);
+
+	private:
+		/// Map of ids, hashed according to their usernames.
+		std::tr1::unordered_map<std::string, UserId> m_Ids;
+
+		/// Usernames indexed by id. A deque never moves its elements as it grows.
+		std::deque<std::string> m_Names;
+
+		/// Lookups vastly outnumber new usernames, so readers share the lock.
+		pthread_rwlock_t m_Lock;
+};
+
+#endif